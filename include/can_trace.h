@@ -0,0 +1,205 @@
+/*
+ * CAN trace record format - encoder and decoder for the trace ring and spill files
+ *
+ * Record: header byte (DLC | TX | EXT | RTR | SAME_ID), LEB128 µs delta from the
+ * previous record, LEB128 ID unless SAME_ID, then the payload. Marker records
+ * (DLC nibble 15) carry one code byte instead of an ID and payload. Each block
+ * restarts the delta/ID chain, so any block decodes on its own.
+ *
+ * Pure code with no Arduino dependencies, so the native test env can build it
+ * on the host: pio test -e native
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+const size_t CAN_TRACE_BLOCK_SIZE       = 4096;
+const size_t CAN_TRACE_MAX_RECORD       = 1 + 5 + 5 + 8;
+const uint32_t CAN_TRACE_NO_ID          = 0xFFFFFFFF;
+const char CAN_TRACE_MAGIC[4]           = {'C', 'T', 'R', 'C'};
+const uint8_t CAN_TRACE_FORMAT_VERSION  = 2;    // v2: results block after the header, bit-rate markers
+const int CAN_TRACE_RESULT_CODES        = 32;
+
+const uint8_t CAN_TRACE_TX       = 0x10;
+const uint8_t CAN_TRACE_EXTENDED = 0x20;
+const uint8_t CAN_TRACE_RTR      = 0x40;
+const uint8_t CAN_TRACE_SAME_ID  = 0x80;  // Same ID as the previous record in this direction
+const uint8_t CAN_TRACE_MARKER   = 0x0F;  // DLC nibble 15 - followed by delta and one code byte
+
+const uint8_t CAN_TRACE_BAUD_MARKER = 0x80;  // Marker code: bit rate switched, low bits index CAN_BAUD_RATES
+const uint8_t CAN_BAUD_UNKNOWN      = 0x7F;  // Bit-rate index before the first marker, or a rate not in the table
+
+const uint8_t CAN_TRACE_ANOMALY_NO_VEHICLE = 0x01;
+const uint8_t CAN_TRACE_ANOMALY_TIMEOUT    = 0x02;
+const uint8_t CAN_TRACE_ANOMALY_BUS_OFF    = 0x04;
+const uint8_t CAN_TRACE_TRUNCATED          = 0x80;  // Header only, not a spill reason: blocks ran out mid-scan
+
+struct CanTraceBlock {
+  uint32_t startUs;      // Timestamp the block's first delta is relative to
+  uint16_t length;       // Bytes used in data[]
+  uint16_t records;
+  uint8_t data[CAN_TRACE_BLOCK_SIZE - 8];
+};
+
+struct CanTraceFileHeader {
+  char magic[4];
+  uint8_t version;
+  uint8_t anomalies;
+  uint16_t blockSize;
+  uint32_t sequence;
+  uint32_t baudRate;
+  uint32_t frames;
+};
+
+// What the recording firmware concluded - replay diffs the current build against it
+struct CanTraceResultCode {
+  uint16_t rawCode;
+  uint16_t ecuId;
+  uint8_t flags;            // bit0 pending, bit1 permanent
+  uint8_t reserved;
+};
+
+struct CanTraceResults {
+  uint32_t scanMs;
+  uint16_t ecuCount;
+  uint8_t detected;
+  uint8_t dtcCount;         // Entries used in codes[] (capped)
+  CanTraceResultCode codes[CAN_TRACE_RESULT_CODES];
+};
+
+// Delta and SAME_ID state shared by every record in one block
+struct CanTraceChain {
+  uint32_t lastUs;
+  uint32_t lastId[2];      // Indexed by direction (1 = TX)
+};
+
+// One decoded record - a frame, or a marker when flags == CAN_TRACE_MARKER
+struct CanTraceRecord {
+  uint32_t timeUs;          // Block start plus every delta so far
+  uint32_t identifier;
+  uint8_t flags;            // CAN_TRACE_TX/EXTENDED/RTR, or CAN_TRACE_MARKER
+  uint8_t dlc;
+  uint8_t code;             // Marker code (anomaly bits or CAN_TRACE_BAUD_MARKER | index)
+  uint8_t data[8];
+};
+
+struct CanTraceReader {
+  const uint8_t* in;
+  const uint8_t* end;
+  uint32_t timeUs;
+  uint32_t lastId[2];
+};
+
+inline uint8_t* canTracePutVarint(uint8_t* out, uint32_t value) {
+  // LEB128 - deltas under 16ms and 11-bit IDs take two bytes
+  while (value >= 0x80) {
+    *out++ = (uint8_t)value | 0x80;
+    value >>= 7;
+  }
+  *out++ = (uint8_t)value;
+  return out;
+}
+
+inline uint32_t canTraceGetVarint(const uint8_t** in, const uint8_t* end) {
+  // Stops at end or after 5 bytes, whichever comes first - never reads past end
+  uint32_t value = 0;
+  for (int shift = 0; *in < end && shift < 35; shift += 7) {
+    uint8_t byte = *(*in)++;
+    value |= (uint32_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) break;
+  }
+  return value;
+}
+
+inline void canTraceStartBlock(CanTraceBlock* block, CanTraceChain* chain, uint32_t nowUs) {
+  block->startUs = nowUs;
+  block->length = 0;
+  block->records = 0;
+  chain->lastUs = nowUs;
+  chain->lastId[0] = CAN_TRACE_NO_ID;
+  chain->lastId[1] = CAN_TRACE_NO_ID;
+}
+
+// Room for the largest record - callers start a new block when this is false
+inline bool canTraceBlockHasRoom(const CanTraceBlock& block) {
+  return block.length <= sizeof(block.data) - CAN_TRACE_MAX_RECORD;
+}
+
+inline void canTraceEncodeFrame(CanTraceBlock* block, CanTraceChain* chain, uint32_t nowUs, uint32_t identifier,
+                                bool transmitted, bool extended, bool rtr, uint8_t dlc, const uint8_t* data) {
+  if (dlc > 8) dlc = 8;
+  bool sameId = identifier == chain->lastId[transmitted];
+  uint8_t header = dlc | (transmitted ? CAN_TRACE_TX : 0) | (extended ? CAN_TRACE_EXTENDED : 0) |
+                   (rtr ? CAN_TRACE_RTR : 0) | (sameId ? CAN_TRACE_SAME_ID : 0);
+  
+  uint8_t* out = block->data + block->length;
+  *out++ = header;
+  out = canTracePutVarint(out, nowUs - chain->lastUs);
+  if (!sameId) out = canTracePutVarint(out, identifier);
+  if (!rtr) {
+    memcpy(out, data, dlc);
+    out += dlc;
+  }
+  
+  block->length = out - block->data;
+  block->records++;
+  chain->lastUs = nowUs;
+  chain->lastId[transmitted] = identifier;
+}
+
+inline void canTraceEncodeMarker(CanTraceBlock* block, CanTraceChain* chain, uint32_t nowUs, uint8_t code) {
+  uint8_t* out = block->data + block->length;
+  *out++ = CAN_TRACE_MARKER;
+  out = canTracePutVarint(out, nowUs - chain->lastUs);
+  *out++ = code;
+  block->length = out - block->data;
+  block->records++;
+  chain->lastUs = nowUs;
+}
+
+inline void canTraceReaderInit(CanTraceReader* reader, const CanTraceBlock& block, uint32_t baseUs) {
+  // baseUs is where the block's own startUs lands on the caller's timeline
+  reader->in = block.data;
+  reader->end = block.data + (block.length <= sizeof(block.data) ? block.length : sizeof(block.data));
+  reader->timeUs = baseUs;
+  reader->lastId[0] = CAN_TRACE_NO_ID;
+  reader->lastId[1] = CAN_TRACE_NO_ID;
+}
+
+inline bool canTraceReadRecord(CanTraceReader* reader, CanTraceRecord* record) {
+  // False at the end of the block or on a record that runs past it
+  if (reader->in >= reader->end) return false;
+  uint8_t header = *reader->in++;
+  reader->timeUs += canTraceGetVarint(&reader->in, reader->end);
+  memset(record, 0, sizeof(*record));
+  record->timeUs = reader->timeUs;
+  
+  if ((header & 0x0F) == CAN_TRACE_MARKER) {
+    if (reader->in >= reader->end) return false;
+    record->flags = CAN_TRACE_MARKER;
+    record->code = *reader->in++;
+    return true;
+  }
+  
+  bool transmitted = header & CAN_TRACE_TX;
+  record->flags = header & (CAN_TRACE_TX | CAN_TRACE_EXTENDED | CAN_TRACE_RTR);
+  record->dlc = header & 0x0F;
+  if (record->dlc > 8) return false;
+  if (header & CAN_TRACE_SAME_ID) {
+    if (reader->lastId[transmitted] == CAN_TRACE_NO_ID) return false;  // SAME_ID as the block's first record
+    record->identifier = reader->lastId[transmitted];
+  } else {
+    if (reader->in >= reader->end) return false;
+    record->identifier = canTraceGetVarint(&reader->in, reader->end);
+  }
+  reader->lastId[transmitted] = record->identifier;
+  
+  if (!(header & CAN_TRACE_RTR)) {
+    if (record->dlc > reader->end - reader->in) return false;
+    memcpy(record->data, reader->in, record->dlc);
+    reader->in += record->dlc;
+  }
+  return true;
+}
@@ -0,0 +1,100 @@
+/*
+ * Minimal CBOR (RFC 8949) encoder into a caller-supplied buffer
+ *
+ * Definite-length unsigned ints, text, bytes, bools, arrays and maps - all the
+ * results and metrics blobs use. No Arduino dependencies, so the native test
+ * env can build it on the host: pio test -e native
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+struct CborWriter {
+  uint8_t* buffer;
+  size_t capacity;
+  size_t length;
+  bool overflow;             // Sticky - once set nothing more is written
+};
+
+inline void cborInit(CborWriter* writer, uint8_t* buffer, size_t capacity) {
+  writer->buffer = buffer;
+  writer->capacity = capacity;
+  writer->length = 0;
+  writer->overflow = false;
+}
+
+inline bool cborReserve(CborWriter* writer, size_t bytes) {
+  // A later, smaller item must not land after a dropped one - that would be valid-looking garbage
+  if (writer->overflow || bytes > writer->capacity - writer->length) {
+    writer->overflow = true;
+    return false;
+  }
+  return true;
+}
+
+inline void cborWriteHead(CborWriter* writer, uint8_t majorType, uint32_t value) {
+  uint8_t head[5];
+  size_t headLength;
+  
+  if (value < 24) {
+    head[0] = (majorType << 5) | value;
+    headLength = 1;
+  } else if (value <= 0xFF) {
+    head[0] = (majorType << 5) | 24;
+    head[1] = value;
+    headLength = 2;
+  } else if (value <= 0xFFFF) {
+    head[0] = (majorType << 5) | 25;
+    head[1] = value >> 8;
+    head[2] = value;
+    headLength = 3;
+  } else {
+    head[0] = (majorType << 5) | 26;
+    head[1] = value >> 24;
+    head[2] = value >> 16;
+    head[3] = value >> 8;
+    head[4] = value;
+    headLength = 5;
+  }
+  
+  if (!cborReserve(writer, headLength)) return;
+  memcpy(writer->buffer + writer->length, head, headLength);
+  writer->length += headLength;
+}
+
+inline void cborWriteUInt(CborWriter* writer, uint32_t value) {
+  cborWriteHead(writer, 0, value);
+}
+
+inline void cborWriteBytes(CborWriter* writer, const uint8_t* data, size_t length) {
+  cborWriteHead(writer, 2, length);
+  
+  if (!cborReserve(writer, length)) return;
+  memcpy(writer->buffer + writer->length, data, length);
+  writer->length += length;
+}
+
+inline void cborWriteText(CborWriter* writer, const char* text) {
+  size_t textLength = strlen(text);
+  cborWriteHead(writer, 3, textLength);
+  
+  if (!cborReserve(writer, textLength)) return;
+  memcpy(writer->buffer + writer->length, text, textLength);
+  writer->length += textLength;
+}
+
+inline void cborWriteBool(CborWriter* writer, bool value) {
+  // Simple values 20/21 (major type 7)
+  if (!cborReserve(writer, 1)) return;
+  writer->buffer[writer->length++] = value ? 0xF5 : 0xF4;
+}
+
+inline void cborBeginArray(CborWriter* writer, uint32_t count) {
+  cborWriteHead(writer, 4, count);
+}
+
+inline void cborBeginMap(CborWriter* writer, uint32_t count) {
+  cborWriteHead(writer, 5, count);
+}
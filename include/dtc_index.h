@@ -0,0 +1,93 @@
+/*
+ * Session DTC list and its dedup index
+ *
+ * Open-addressing index over the session's FaultCode list keyed by (raw DTC, ECU,
+ * mode, UDS failure type). Pure code with no Arduino dependencies, so the native
+ * test env can build it on the host: pio test -e native
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+struct FaultCode {
+  char code[8];         // "P0420" - fixed size so results never touch the heap
+  const char* system;   // Points at a static description string
+  bool isPending;
+  bool isPermanent;     // Reported by Mode 0A - cannot be cleared by a scan tool
+  uint16_t ecuId;
+  uint16_t rawCode;     // (byte1 << 8) | byte2 as sent by the ECU
+  uint8_t status;       // UDS DTC status byte (0 for legacy OBD modes)
+  uint8_t failureType;  // UDS failure type byte (0 for legacy OBD modes)
+  uint8_t mode;         // Service that reported it: 0x03/0x07/0x0A, or 0x19 for UDS
+  uint8_t passes;       // Reports that named it - above 1 when a response repeated the code
+};
+
+// Fixed-capacity list for session storage - push_back refuses overflow
+// instead of growing onto the heap
+template <typename T, int Capacity>
+struct FixedList {
+  T items[Capacity];
+  int count;
+  
+  bool push_back(const T& item) {
+    if (count >= Capacity) return false;
+    items[count++] = item;
+    return true;
+  }
+  int size() const { return count; }
+  bool full() const { return count >= Capacity; }
+  void clear() { count = 0; }
+  T& operator[](int index) { return items[index]; }
+  const T& operator[](int index) const { return items[index]; }
+  T* begin() { return items; }
+  T* end() { return items + count; }
+  const T* begin() const { return items; }
+  const T* end() const { return items + count; }
+};
+
+const int MAX_SESSION_DTCS = 64;
+
+// A repeat report of a code already in the list - a retried request, a response
+// heard twice, or an ECU that lists a code twice - merges into the first entry.
+// Slots hold list index + 1 (0 = empty); the list itself keeps insertion order
+const int DTC_INDEX_SLOTS = 128;  // Power of two, 2x MAX_SESSION_DTCS keeps probes short
+const uint8_t UDS_DTC_MODE = 0x19;
+
+typedef FixedList<FaultCode, MAX_SESSION_DTCS> DtcList;
+
+inline uint32_t dtcKeyHash(const FaultCode& code) {
+  // Multiplicative mix - ECU IDs and DTCs both cluster in narrow ranges
+  uint32_t hash = (((uint32_t)code.ecuId << 16) | code.rawCode) * 0x9E3779B1u;
+  hash ^= (((uint32_t)code.mode << 8) | code.failureType) * 0x85EBCA77u;
+  return hash ^ (hash >> 16);
+}
+
+inline bool sameDtcKey(const FaultCode& a, const FaultCode& b) {
+  // UDS failure types are part of the code (P0420-00 vs P0420-1C are different faults)
+  return a.rawCode == b.rawCode && a.ecuId == b.ecuId && a.mode == b.mode && a.failureType == b.failureType;
+}
+
+// Returns the entry the code now lives in - new, or the earlier report it merged
+// into - or NULL when the list is full. The index is twice the list size, so a
+// probe always reaches an empty slot
+inline FaultCode* dtcIndexAdd(DtcList* codes, uint8_t* slots, const FaultCode& fault) {
+  int slot = dtcKeyHash(fault) & (DTC_INDEX_SLOTS - 1);
+  
+  while (slots[slot] != 0) {
+    FaultCode& existing = (*codes)[slots[slot] - 1];
+    if (sameDtcKey(existing, fault)) {
+      if (existing.passes < 255) existing.passes++;
+      existing.status |= fault.status;  // UDS: union of what each report saw
+      return &existing;
+    }
+    slot = (slot + 1) & (DTC_INDEX_SLOTS - 1);
+  }
+  
+  if (!codes->push_back(fault)) return NULL;
+  FaultCode* stored = &(*codes)[codes->size() - 1];
+  stored->passes = 1;
+  slots[slot] = codes->size();
+  return stored;
+}
@@ -0,0 +1,42 @@
+/*
+ * ELM327/STN response line parser - headers on, spaces off
+ *
+ * Turns one adapter output line into a CAN frame. Pure code with no Arduino
+ * dependencies, so the native test env can build it on the host: pio test -e native
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+// Frame is anything with identifier, extd, data_length_code and data[8] - a
+// twai_message_t on the device, a plain struct on the host.
+// "7E8064100BE3FA813" or "18DAF110064100BE3FA813": an odd digit count is an
+// 11-bit ID, an even one 29-bit; NO DATA, SEARCHING... and other status text
+// never parse, nor does an ID too wide for its length (a headers-off line)
+template <typename Frame>
+bool elmParseLine(const char* line, int length, Frame* frame) {
+  int idDigits = (length & 1) ? 3 : 8;
+  if (length < idDigits + 2 || length > idDigits + 16) return false;
+  for (int j = 0; j < length; j++) {
+    if (!isxdigit((unsigned char)line[j])) return false;
+  }
+  
+  memset(frame, 0, sizeof(*frame));
+  char text[9];
+  memcpy(text, line, idDigits);
+  text[idDigits] = '\0';
+  frame->identifier = strtoul(text, NULL, 16);
+  if (frame->identifier > (idDigits == 8 ? 0x1FFFFFFFUL : 0x7FFUL)) return false;
+  frame->extd = idDigits == 8 ? 1 : 0;
+  frame->data_length_code = (length - idDigits) / 2;
+  for (int j = 0; j < frame->data_length_code; j++) {
+    text[0] = line[idDigits + j * 2];
+    text[1] = line[idDigits + j * 2 + 1];
+    text[2] = '\0';
+    frame->data[j] = strtoul(text, NULL, 16);
+  }
+  return true;
+}
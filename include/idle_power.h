@@ -0,0 +1,35 @@
+/*
+ * Idle power policy - when the kiosk may force light sleep between customers
+ *
+ * Pure decision logic with no Arduino dependencies, so the native test env can
+ * drive it under virtual time to model duty cycle and wake latency on the host:
+ * pio test -e native. The firmware fills IdleInputs and does the GPIO/WiFi work
+ */
+#pragma once
+
+#include <stdint.h>
+
+// Forced light sleep powers the radio down and ESP-IDF does not keep the
+// association through it. A sleep longer than the STA beacon-loss timeout drops
+// the AP anyway, so WiFi is stopped cleanly before sleeping and rejoined on wake.
+// The QR screen polls payments every few seconds and so stays on modem sleep
+const unsigned long IDLE_SLEEP_AFTER_MS    = 30000;  // No input/transition for this long before sleeping
+const unsigned long IDLE_MAX_SLEEP_MS      = 10000;  // Never sleep past this (READY_SCREEN retry cadence)
+const unsigned long IDLE_REJOIN_TIMEOUT_MS = 15000;  // Give up waiting for the AP and sleep again
+
+struct IdleInputs {
+  bool readyScreen;               // Between customers with no session - nothing needs the radio
+  bool busy;                      // Scan, HTTP request, OTA or queued network job in flight
+  bool rejoinPending;             // WiFi still coming back from the last sleep
+  unsigned long sinceActivityMs;  // Since the last input or state transition
+  unsigned long sinceRejoinMs;    // Since the rejoin started
+};
+
+// How long to force light sleep for, or 0 to stay awake and block on the UI queue
+inline unsigned long idleSleepMs(const IdleInputs& in) {
+  if (!in.readyScreen || in.busy) return 0;
+  if (in.sinceActivityMs < IDLE_SLEEP_AFTER_MS) return 0;
+  // Let the rejoin finish so the wake-up's session retry can run - unless the AP is gone
+  if (in.rejoinPending && in.sinceRejoinMs < IDLE_REJOIN_TIMEOUT_MS) return 0;
+  return IDLE_MAX_SLEEP_MS;
+}
@@ -0,0 +1,104 @@
+/*
+ * ISO-TP (ISO 15765-2) reassembly
+ *
+ * Pure receive-side state machine with no Arduino or TWAI dependencies, so the
+ * native test env can build it on the host: pio test -e native. The firmware
+ * wraps isoTpAccept() and sends the flow control frame when asked to
+ */
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+// One receiver per responding ECU so multi-frame replies from several modules
+// can be collected concurrently
+const int ISOTP_MAX_PAYLOAD = 256;
+
+struct IsoTpReceiver {
+  uint32_t flowControlId;     // Where our flow control frames go (the ECU's request ID)
+  bool extended;
+  uint8_t buffer[ISOTP_MAX_PAYLOAD];
+  uint16_t expectedLength;
+  uint16_t receivedLength;
+  uint8_t nextSequence;
+  bool complete;
+};
+
+enum IsoTpResult : uint8_t {
+  ISOTP_IGNORED,         // Not a frame this receiver can use (flow control, runt, stray CF)
+  ISOTP_IN_PROGRESS,     // Consecutive frame accepted, more to come
+  ISOTP_SEND_FLOW,       // First frame accepted - caller must send flow control now
+  ISOTP_COMPLETE,        // buffer/receivedLength hold the whole message
+  ISOTP_SEQUENCE_ERROR   // Consecutive frame out of order - transfer dropped
+};
+
+inline void isoTpReset(IsoTpReceiver* rx, uint32_t flowControlId, bool extended) {
+  rx->flowControlId  = flowControlId;
+  rx->extended       = extended;
+  rx->expectedLength = 0;
+  rx->receivedLength = 0;
+  rx->nextSequence   = 0;
+  rx->complete       = false;
+}
+
+inline IsoTpResult isoTpAccept(IsoTpReceiver* rx, const uint8_t* data, uint8_t length) {
+  if (length < 2 || rx->complete) return ISOTP_IGNORED;
+  
+  switch (data[0] >> 4) {
+    case 0x0: {  // Single frame
+      uint8_t payloadLength = data[0] & 0x0F;
+      if (payloadLength == 0 || payloadLength > length - 1) return ISOTP_IGNORED;
+      memcpy(rx->buffer, &data[1], payloadLength);
+      rx->expectedLength = payloadLength;
+      rx->receivedLength = payloadLength;
+      rx->complete = true;
+      return ISOTP_COMPLETE;
+    }
+    
+    case 0x1: {  // First frame - anything that would have fit a single frame is malformed
+      uint16_t total = ((data[0] & 0x0F) << 8) | data[1];
+      if (total < 8 || length < 8) return ISOTP_IGNORED;
+      rx->expectedLength = total;
+      rx->receivedLength = 6;
+      rx->nextSequence   = 1;
+      memcpy(rx->buffer, &data[2], 6);
+      return ISOTP_SEND_FLOW;
+    }
+    
+    case 0x2: {  // Consecutive frame
+      if (rx->expectedLength == 0) return ISOTP_IGNORED;  // No first frame seen
+      
+      if ((data[0] & 0x0F) != rx->nextSequence) {
+        isoTpReset(rx, rx->flowControlId, rx->extended);
+        return ISOTP_SEQUENCE_ERROR;
+      }
+      rx->nextSequence = (rx->nextSequence + 1) & 0x0F;
+      
+      int chunk = rx->expectedLength - rx->receivedLength;
+      if (chunk > 7) chunk = 7;
+      if (chunk > length - 1) chunk = length - 1;
+      for (int j = 0; j < chunk; j++) {
+        // Payloads larger than the buffer are consumed but truncated
+        if (rx->receivedLength + j < ISOTP_MAX_PAYLOAD) {
+          rx->buffer[rx->receivedLength + j] = data[1 + j];
+        }
+      }
+      rx->receivedLength += chunk;
+      
+      if (rx->receivedLength >= rx->expectedLength) {
+        rx->receivedLength = rx->expectedLength < ISOTP_MAX_PAYLOAD ? rx->expectedLength : ISOTP_MAX_PAYLOAD;
+        rx->complete = true;
+        return ISOTP_COMPLETE;
+      }
+      return ISOTP_IN_PROGRESS;
+    }
+    
+    default:  // Flow control from the ECU - we only send single-frame requests
+      return ISOTP_IGNORED;
+  }
+}
+
+// 7F <service> 78 - the ECU will answer properly within P2*
+inline bool isoTpResponsePending(const IsoTpReceiver& rx) {
+  return rx.complete && rx.receivedLength >= 3 && rx.buffer[0] == 0x7F && rx.buffer[2] == 0x78;
+}
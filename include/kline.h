@@ -0,0 +1,64 @@
+/*
+ * K-line response framing - ISO 9141-2 and KWP2000 (ISO 14230-2)
+ *
+ * ISO 9141-2: 48 6B <ecu> <data> <checksum>. KWP2000: format byte (address mode
+ * | data length), target and source unless the address mode is 0, a length byte
+ * when the format byte's length is 0, then data and checksum. Pure code with no
+ * Arduino dependencies, so the native test env can build it on the host:
+ * pio test -e native
+ */
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+const int K_LINE_MAX_DATA    = 63;                   // KWP format-byte length limit
+const int K_LINE_MAX_MESSAGE = K_LINE_MAX_DATA + 5;  // Format, target, source, length, checksum
+
+struct KLineMessage {
+  uint8_t source;            // ECU address
+  uint8_t length;
+  uint8_t data[K_LINE_MAX_DATA];  // Service byte first - header and checksum stripped
+};
+
+// Header bytes before the data, once the format byte (and length byte) are in
+inline int klineHeaderLength(const uint8_t* raw, bool kwp) {
+  if (!kwp) return 3;
+  int header = (raw[0] & 0xC0) ? 3 : 1;
+  if ((raw[0] & 0x3F) == 0) header++;
+  return header;
+}
+
+// Whole message length from the bytes received so far, or 0 while it is not known
+// yet. ISO 9141-2 has no length - P1 silence ends it
+inline int klineExpectedLength(const uint8_t* raw, int length, bool kwp) {
+  if (!kwp || length < 1) return 0;
+  int header = klineHeaderLength(raw, kwp);
+  int dataLength = raw[0] & 0x3F;
+  if (dataLength == 0) {
+    if (length < header) return 0;  // Length byte not in yet
+    dataLength = raw[header - 1];
+  }
+  return header + dataLength + 1;
+}
+
+// False on a bad checksum, a message too short to hold a header and a service
+// byte, or a KWP message whose length does not match its format/length byte
+inline bool klineDecode(const uint8_t* raw, int length, bool kwp, KLineMessage* message) {
+  if (length < 3) return false;
+  uint8_t checksum = 0;
+  for (int j = 0; j < length - 1; j++) {
+    checksum += raw[j];
+  }
+  if (checksum != raw[length - 1]) return false;
+  
+  int header = klineHeaderLength(raw, kwp);
+  if (length < header + 2) return false;
+  if (kwp && length != klineExpectedLength(raw, length, kwp)) return false;
+  
+  int dataLength = length - header - 1;
+  message->source = header >= 3 ? raw[2] : 0;
+  message->length = dataLength < K_LINE_MAX_DATA ? dataLength : K_LINE_MAX_DATA;
+  memcpy(message->data, raw + header, message->length);
+  return true;
+}
@@ -0,0 +1,162 @@
+/*
+ * Delta OTA patch format and the bsdiff-record applier
+ *
+ * Patch = OtaDeltaHeader, then a zlib stream of records: [diffLen, extraLen, seek]
+ * (little-endian u32, u32, s32) + diffLen bytes added to the base image + extraLen
+ * literal bytes, after which the base cursor moves by seek. The applier is fed the
+ * inflated stream in pieces of any size and never reads the base image outside
+ * [0, baseSize) or writes past targetSize. Flash access goes through an Io type, so
+ * the native tests can run it against memory on the host: pio test -e native
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+const uint32_t OTA_DELTA_MAGIC        = 0x544C444B;  // "KDLT"
+const uint8_t OTA_DELTA_VERSION       = 2;           // v2: ECDSA signature appended to the header
+const size_t OTA_BASE_CHUNK           = 1024;        // Base image bytes per flash read
+const size_t OTA_OUTPUT_CHUNK         = 4096;        // One flash sector per esp_ota_write
+const size_t OTA_DELTA_CONTROL_SIZE   = 12;
+
+struct __attribute__((packed)) OtaDeltaHeader {
+  uint32_t magic;
+  uint8_t version;
+  uint8_t reserved[3];
+  uint32_t baseSize;         // Bytes of the running image the patch reads
+  uint8_t baseSha256[32];    // ... and their hash - we check it before erasing anything
+  uint32_t targetSize;
+  uint8_t targetSha256[32];  // Hash of the rebuilt image, checked before switching
+  uint8_t signatureLength;
+  uint8_t signature[72];     // DER ECDSA signature over every field above
+};
+
+enum OtaDeltaStage {
+  OTA_DELTA_CONTROL,
+  OTA_DELTA_DIFF,
+  OTA_DELTA_EXTRA
+};
+
+struct OtaDeltaApplier {
+  uint32_t baseSize;
+  uint32_t targetSize;
+  OtaDeltaStage stage;
+  uint8_t control[OTA_DELTA_CONTROL_SIZE];
+  uint8_t controlLength;
+  uint32_t remaining;        // Bytes left in the current diff/extra run
+  uint32_t extraLength;      // Extra run queued behind the current diff run
+  int32_t seek;
+  uint32_t basePos;
+  uint32_t written;
+  uint8_t* baseBuffer;       // OTA_BASE_CHUNK
+  uint8_t* output;           // OTA_OUTPUT_CHUNK
+  size_t outputLength;
+};
+
+inline void otaDeltaInit(OtaDeltaApplier* applier, uint32_t baseSize, uint32_t targetSize,
+                         uint8_t* baseBuffer, uint8_t* output) {
+  memset(applier, 0, sizeof(*applier));
+  applier->baseSize = baseSize;
+  applier->targetSize = targetSize;
+  applier->stage = OTA_DELTA_CONTROL;
+  applier->baseBuffer = baseBuffer;
+  applier->output = output;
+}
+
+// Io needs bool readBase(uint32_t offset, uint8_t* buffer, size_t length) and
+// bool write(const uint8_t* data, size_t length) - flash on the device, memory on the host
+template <typename Io>
+bool otaDeltaFlush(OtaDeltaApplier* applier, Io& io) {
+  if (applier->outputLength == 0) return true;
+  if (!io.write(applier->output, applier->outputLength)) return false;
+  applier->written += applier->outputLength;
+  applier->outputLength = 0;
+  return true;
+}
+
+template <typename Io>
+bool otaDeltaEmit(OtaDeltaApplier* applier, Io& io, const uint8_t* data, size_t length) {
+  while (length > 0) {
+    size_t take = OTA_OUTPUT_CHUNK - applier->outputLength;
+    if (take > length) take = length;
+    memcpy(applier->output + applier->outputLength, data, take);
+    applier->outputLength += take;
+    data += take;
+    length -= take;
+    if (applier->outputLength == OTA_OUTPUT_CHUNK && !otaDeltaFlush(applier, io)) return false;
+  }
+  return true;
+}
+
+inline bool otaDeltaAdvance(OtaDeltaApplier* applier) {
+  // Step past finished (or empty) runs: diff -> extra -> seek -> next control record
+  while (applier->stage != OTA_DELTA_CONTROL && applier->remaining == 0) {
+    if (applier->stage == OTA_DELTA_DIFF) {
+      applier->stage = OTA_DELTA_EXTRA;
+      applier->remaining = applier->extraLength;
+    } else {
+      int64_t basePos = (int64_t)applier->basePos + applier->seek;
+      if (basePos < 0 || basePos > applier->baseSize) return false;
+      applier->basePos = basePos;
+      applier->stage = OTA_DELTA_CONTROL;
+    }
+  }
+  return true;
+}
+
+// False on a record that would read outside the base image or build more than
+// targetSize bytes, or when Io fails - the caller abandons the update
+template <typename Io>
+bool otaDeltaConsume(OtaDeltaApplier* applier, Io& io, const uint8_t* data, size_t length) {
+  while (length > 0) {
+    size_t take;
+    if (applier->stage == OTA_DELTA_CONTROL) {
+      take = OTA_DELTA_CONTROL_SIZE - applier->controlLength;
+      if (take > length) take = length;
+      memcpy(applier->control + applier->controlLength, data, take);
+      applier->controlLength += take;
+      if (applier->controlLength == OTA_DELTA_CONTROL_SIZE) {
+        uint32_t diffLength;
+        memcpy(&diffLength, applier->control, 4);
+        memcpy(&applier->extraLength, applier->control + 4, 4);
+        memcpy(&applier->seek, applier->control + 8, 4);
+        applier->controlLength = 0;
+        if ((uint64_t)applier->written + applier->outputLength + diffLength + applier->extraLength >
+            applier->targetSize) {
+          return false;
+        }
+        applier->stage = OTA_DELTA_DIFF;
+        applier->remaining = diffLength;
+      }
+    } else if (applier->stage == OTA_DELTA_DIFF) {
+      // New byte = base byte + diff byte - mostly zeros, which is what compresses
+      take = length < applier->remaining ? length : applier->remaining;
+      if (take > OTA_BASE_CHUNK) take = OTA_BASE_CHUNK;
+      if ((uint64_t)applier->basePos + take > applier->baseSize) return false;
+      if (!io.readBase(applier->basePos, applier->baseBuffer, take)) return false;
+      for (size_t i = 0; i < take; i++) {
+        applier->baseBuffer[i] += data[i];
+      }
+      if (!otaDeltaEmit(applier, io, applier->baseBuffer, take)) return false;
+      applier->basePos += take;
+      applier->remaining -= take;
+    } else {
+      take = length < applier->remaining ? length : applier->remaining;
+      if (!otaDeltaEmit(applier, io, data, take)) return false;
+      applier->remaining -= take;
+    }
+    
+    data += take;
+    length -= take;
+    if (!otaDeltaAdvance(applier)) return false;
+  }
+  return true;
+}
+
+// After the stream ends and the last partial sector is flushed: the whole image was
+// built and the patch did not stop inside a record
+inline bool otaDeltaComplete(const OtaDeltaApplier& applier) {
+  return applier.written == applier.targetSize && applier.outputLength == 0 &&
+         applier.stage == OTA_DELTA_CONTROL && applier.controlLength == 0;
+}
@@ -0,0 +1,128 @@
+/*
+ * Readiness monitor decoding (Mode 01 PID 01 / PID 41)
+ *
+ * Pure decoder with no Arduino dependencies, so the native test env can
+ * build it on the host: pio test -e native
+ */
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+// Readiness monitors (Mode 01 PID 01 since DTCs cleared, PID 41 this drive cycle).
+// Table-driven: each entry names the byte/bit in the B/C/D status bytes and the
+// ignition type it applies to; bit N of the report masks is READINESS_MONITORS[N].
+enum MonitorIgnition : uint8_t {
+  MONITOR_ANY_IGNITION,
+  MONITOR_SPARK,
+  MONITOR_COMPRESSION
+};
+
+struct ReadinessMonitorDef {
+  const char* name;
+  uint8_t statusByte;       // 1 = B (continuous monitors), 2 = C/D (non-continuous)
+  uint8_t bit;
+  MonitorIgnition ignition;
+};
+
+const ReadinessMonitorDef READINESS_MONITORS[] = {
+  {"Misfire",            1, 0, MONITOR_ANY_IGNITION},
+  {"Fuel System",        1, 1, MONITOR_ANY_IGNITION},
+  {"Components",         1, 2, MONITOR_ANY_IGNITION},
+  {"Catalyst",           2, 0, MONITOR_SPARK},
+  {"Heated Catalyst",    2, 1, MONITOR_SPARK},
+  {"EVAP System",        2, 2, MONITOR_SPARK},
+  {"Secondary Air",      2, 3, MONITOR_SPARK},
+  {"A/C Refrigerant",    2, 4, MONITOR_SPARK},
+  {"O2 Sensor",          2, 5, MONITOR_SPARK},
+  {"O2 Sensor Heater",   2, 6, MONITOR_SPARK},
+  {"EGR/VVT",            2, 7, MONITOR_SPARK},
+  {"NMHC Catalyst",      2, 0, MONITOR_COMPRESSION},
+  {"NOx/SCR",            2, 1, MONITOR_COMPRESSION},
+  {"Boost Pressure",     2, 3, MONITOR_COMPRESSION},
+  {"Exhaust Gas Sensor", 2, 5, MONITOR_COMPRESSION},
+  {"PM Filter",          2, 6, MONITOR_COMPRESSION},
+  {"EGR/VVT",            2, 7, MONITOR_COMPRESSION}
+};
+const int NUM_READINESS_MONITORS = sizeof(READINESS_MONITORS) / sizeof(READINESS_MONITORS[0]);
+
+struct ReadinessReport {
+  uint32_t supported;              // Monitor exists on this vehicle (PID 01)
+  uint32_t complete;               // Completed since DTCs were cleared (PID 01)
+  uint32_t cycleEnabled;           // Enabled this drive cycle (PID 41)
+  uint32_t cycleComplete;          // Completed this drive cycle (PID 41)
+  uint8_t dtcCount : 7;            // Emission DTCs the ECU says it has stored
+  uint8_t milOn : 1;
+  uint8_t compressionIgnition : 1;
+  uint8_t hasStatus : 1;           // PID 01 decoded
+  uint8_t hasCycleStatus : 1;      // PID 41 decoded
+};
+
+inline void clearReadiness(ReadinessReport* report) {
+  memset(report, 0, sizeof(*report));
+}
+
+inline bool decodeReadiness(const uint8_t* payload, int len, ReadinessReport* report) {
+  // payload: 41 <pid> A B C D - PID 01 (since clear) or PID 41 (this drive cycle).
+  // Returns false and leaves the report untouched for anything that isn't one
+  if (len < 6 || payload[0] != 0x41 || (payload[1] != 0x01 && payload[1] != 0x41)) return false;
+  
+  bool thisCycle = (payload[1] == 0x41);
+  uint8_t a = payload[2];
+  uint8_t b = payload[3];
+  uint8_t c = payload[4];
+  uint8_t d = payload[5];
+  
+  // Byte B bit 7 is reserved, and so is all of byte A in PID 41 - set means this
+  // isn't a readiness record (or is corrupt), and bit 3 below can't be trusted
+  if (b & 0x80) return false;
+  if (thisCycle && a != 0) return false;
+  
+  // Byte B bit 3 selects the spark vs compression layout of bytes C/D. PID 41 must
+  // agree with PID 01 - mixing layouts would name the wrong monitors
+  bool compression = (b & 0x08) != 0;
+  if (thisCycle && report->hasStatus && compression != (bool)report->compressionIgnition) return false;
+  
+  uint32_t supported = 0;
+  uint32_t complete = 0;
+  
+  for (int i = 0; i < NUM_READINESS_MONITORS; i++) {
+    const ReadinessMonitorDef& monitor = READINESS_MONITORS[i];
+    if (monitor.ignition == MONITOR_SPARK && compression) continue;
+    if (monitor.ignition == MONITOR_COMPRESSION && !compression) continue;
+    
+    bool isSupported, isIncomplete;
+    if (monitor.statusByte == 1) {
+      // Byte B: supported in bits 0-2, incomplete in bits 4-6
+      isSupported  = b & (1 << monitor.bit);
+      isIncomplete = b & (1 << (monitor.bit + 4));
+    } else {
+      isSupported  = c & (1 << monitor.bit);
+      isIncomplete = d & (1 << monitor.bit);
+    }
+    
+    // An incomplete bit on an unsupported monitor means nothing
+    if (isSupported) {
+      supported |= (1UL << i);
+      if (!isIncomplete) complete |= (1UL << i);
+    }
+  }
+  
+  if (thisCycle) {
+    report->cycleEnabled = supported;
+    report->cycleComplete = complete;
+    report->hasCycleStatus = 1;
+  } else {
+    report->supported = supported;
+    report->complete = complete;
+    report->milOn = (a & 0x80) ? 1 : 0;
+    report->dtcCount = a & 0x7F;
+    report->compressionIgnition = compression ? 1 : 0;
+    report->hasStatus = 1;
+  }
+  return true;
+}
+
+inline int countIncompleteMonitors(const ReadinessReport& report) {
+  return __builtin_popcount(report.supported & ~report.complete);
+}
@@ -0,0 +1,218 @@
+/*
+ * Trace replay engine - answers a scan's requests from a recorded CAN trace
+ * under virtual time
+ *
+ * Each transmit is matched to a recorded request (same ID, then identical payload
+ * or same service) and the frames the recording received after it are queued at
+ * their recorded offsets. Pure code with no Arduino or TWAI dependencies: the
+ * firmware routes canTransmit()/canReceive() through it, and the native tests run
+ * it against the sample traces in data/replay/ on the host: pio test -e native
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "can_trace.h"
+
+const int REPLAY_MAX_PENDING = 64;
+
+struct ReplayFrame {
+  uint32_t timeUs;          // From the start of the recording
+  uint32_t identifier;
+  uint8_t flags;            // CAN_TRACE_TX/EXTENDED/RTR, or CAN_TRACE_MARKER for a bit-rate switch
+  uint8_t dlc;
+  uint8_t baudIndex;
+  bool consumed;
+  uint8_t data[8];
+};
+
+struct ReplayPending {
+  uint64_t dueUs;
+  int frame;
+};
+
+struct ReplayEngine {
+  bool active;
+  ReplayFrame* frames;
+  int frameCapacity;
+  int frameCount;
+  CanTraceBlock* block;     // Read buffer while loading
+  int cursor;               // Frame after the last match
+  uint64_t virtualUs;
+  uint8_t baudIndex;        // Rate the scan engine believes the controller is at
+  ReplayPending pending[REPLAY_MAX_PENDING];  // Ordered by dueUs
+  int pendingCount;
+  uint32_t matchedRequests;
+  uint32_t unmatchedRequests;
+  bool truncated;           // Loaded trace stops before the scan did
+};
+
+// Fresh virtual clock and matching state for every trace - runs are independent
+inline void replayReset(ReplayEngine* replay) {
+  replay->virtualUs = 0;
+  replay->cursor = 0;
+  replay->pendingCount = 0;
+  replay->baudIndex = CAN_BAUD_UNKNOWN;
+  replay->matchedRequests = 0;
+  replay->unmatchedRequests = 0;
+  for (int i = 0; i < replay->frameCount; i++) {
+    replay->frames[i].consumed = false;
+  }
+}
+
+// Source is anything with size_t read(uint8_t*, size_t) - an Arduino File on the
+// device, a stdio wrapper on the host
+template <typename Source>
+bool replayLoad(ReplayEngine* replay, Source& source, CanTraceResults* expected) {
+  CanTraceFileHeader header;
+  if (source.read((uint8_t*)&header, sizeof(header)) != sizeof(header) ||
+      memcmp(header.magic, CAN_TRACE_MAGIC, 4) != 0 || header.version != CAN_TRACE_FORMAT_VERSION ||
+      source.read((uint8_t*)expected, sizeof(*expected)) != sizeof(*expected)) {
+    return false;
+  }
+  replay->truncated = (header.anomalies & CAN_TRACE_TRUNCATED) != 0;
+  
+  // Decode every block into one flat, absolute-time frame table
+  replay->frameCount = 0;
+  uint32_t firstBlockUs = 0;
+  bool firstBlock = true;
+  uint8_t baudIndex = CAN_BAUD_UNKNOWN;
+  CanTraceBlock* block = replay->block;
+  const size_t blockHeader = offsetof(CanTraceBlock, data);
+  
+  while (source.read((uint8_t*)block, blockHeader) == blockHeader) {
+    if (block->length > sizeof(block->data) || source.read(block->data, block->length) != block->length) break;
+    if (firstBlock) {
+      firstBlockUs = block->startUs;
+      firstBlock = false;
+    }
+    
+    CanTraceReader reader;
+    CanTraceRecord record;
+    canTraceReaderInit(&reader, *block, block->startUs - firstBlockUs);
+    
+    while (replay->frameCount < replay->frameCapacity && canTraceReadRecord(&reader, &record)) {
+      ReplayFrame& frame = replay->frames[replay->frameCount];
+      memset(&frame, 0, sizeof(frame));
+      frame.timeUs = record.timeUs;
+      
+      if (record.flags == CAN_TRACE_MARKER) {
+        if (!(record.code & CAN_TRACE_BAUD_MARKER)) continue;  // Anomaly markers are informational
+        baudIndex = record.code & ~CAN_TRACE_BAUD_MARKER;
+        frame.flags = CAN_TRACE_MARKER;
+        frame.baudIndex = baudIndex;
+        replay->frameCount++;
+        continue;
+      }
+      
+      frame.flags = record.flags;
+      frame.baudIndex = baudIndex;
+      frame.dlc = record.dlc;
+      frame.identifier = record.identifier;
+      memcpy(frame.data, record.data, sizeof(frame.data));
+      replay->frameCount++;
+    }
+  }
+  
+  return replay->frameCount > 0;
+}
+
+inline void replaySchedule(ReplayEngine* replay, int index) {
+  // Everything received between this frame and the next transmit or bit-rate change,
+  // at the same offsets it had in the recording
+  uint32_t anchorUs = replay->frames[index].timeUs;
+  for (int i = index + 1; i < replay->frameCount; i++) {
+    const ReplayFrame& frame = replay->frames[i];
+    if ((frame.flags & CAN_TRACE_TX) || frame.flags == CAN_TRACE_MARKER) break;
+    if (replay->pendingCount >= REPLAY_MAX_PENDING) break;
+    
+    // Insertion keeps the queue ordered by due time - it is only a few entries deep
+    uint64_t dueUs = replay->virtualUs + (frame.timeUs - anchorUs);
+    int slot = replay->pendingCount;
+    while (slot > 0 && replay->pending[slot - 1].dueUs > dueUs) {
+      replay->pending[slot] = replay->pending[slot - 1];
+      slot--;
+    }
+    replay->pending[slot] = {dueUs, i};
+    replay->pendingCount++;
+  }
+}
+
+inline int replayFindRequest(const ReplayEngine& replay, uint32_t identifier, bool extended,
+                             const uint8_t* data, uint8_t dlc) {
+  // Prefer the identical request, then the same service - searched forward from the
+  // last match first so repeated requests pair up in recording order
+  uint8_t pciType = data[0] & 0xF0;
+  int exactLength = pciType == 0x00 ? 1 + (data[0] & 0x0F) : pciType == 0x30 ? 1 : dlc;
+  if (exactLength > dlc) exactLength = dlc;
+  int serviceLength = pciType == 0x00 ? (dlc < 2 ? dlc : 2) : exactLength;
+  
+  for (int keyLength : {exactLength, serviceLength}) {
+    for (int pass = 0; pass < 2; pass++) {
+      int from = pass == 0 ? replay.cursor : 0;
+      int to = pass == 0 ? replay.frameCount : replay.cursor;
+      for (int i = from; i < to; i++) {
+        const ReplayFrame& frame = replay.frames[i];
+        if (!(frame.flags & CAN_TRACE_TX) || frame.consumed) continue;
+        if (frame.identifier != identifier || ((frame.flags & CAN_TRACE_EXTENDED) != 0) != extended) continue;
+        if (frame.baudIndex != replay.baudIndex && frame.baudIndex != CAN_BAUD_UNKNOWN) continue;
+        if (memcmp(frame.data, data, keyLength) == 0) return i;
+      }
+    }
+  }
+  return -1;
+}
+
+// Nothing reaches a bus - the request selects which recorded responses come next.
+// False when the recording never saw it: the ECU stays silent
+inline bool replayMatchRequest(ReplayEngine* replay, uint32_t identifier, bool extended,
+                               const uint8_t* data, uint8_t dlc) {
+  int index = replayFindRequest(*replay, identifier, extended, data, dlc);
+  if (index < 0) {
+    replay->unmatchedRequests++;
+    return false;
+  }
+  
+  replay->frames[index].consumed = true;
+  replay->cursor = index + 1;
+  replay->matchedRequests++;
+  replaySchedule(replay, index);
+  return true;
+}
+
+// The next queued frame due within waitUs, advancing the virtual clock to it - or
+// NULL with the whole wait passed instantly
+inline const ReplayFrame* replayNextFrame(ReplayEngine* replay, uint64_t waitUs) {
+  uint64_t deadlineUs = replay->virtualUs + waitUs;
+  if (replay->pendingCount == 0 || replay->pending[0].dueUs > deadlineUs) {
+    replay->virtualUs = deadlineUs;
+    return NULL;
+  }
+  
+  ReplayPending next = replay->pending[0];
+  replay->pendingCount--;
+  memmove(&replay->pending[0], &replay->pending[1], replay->pendingCount * sizeof(ReplayPending));
+  if (next.dueUs > replay->virtualUs) replay->virtualUs = next.dueUs;
+  return &replay->frames[next.frame];
+}
+
+inline void replaySelectBaud(ReplayEngine* replay, uint8_t baudIndex) {
+  replay->baudIndex = baudIndex;
+  replay->pendingCount = 0;  // Anything queued was "heard" at the old rate
+  
+  // Play back the passive traffic the recording heard after switching to this rate
+  for (int pass = 0; pass < 2; pass++) {
+    int from = pass == 0 ? replay->cursor : 0;
+    int to = pass == 0 ? replay->frameCount : replay->cursor;
+    for (int i = from; i < to; i++) {
+      ReplayFrame& frame = replay->frames[i];
+      if (frame.flags == CAN_TRACE_MARKER && !frame.consumed && frame.baudIndex == replay->baudIndex) {
+        frame.consumed = true;
+        replay->cursor = i + 1;
+        replaySchedule(replay, i);
+        return;
+      }
+    }
+  }
+}
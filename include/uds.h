@@ -0,0 +1,73 @@
+/*
+ * UDS (ISO 14229) ReadDTCInformation decoding - reportDTCByStatusMask (0x19/0x02)
+ *
+ * Pure decoder with no Arduino dependencies, so the native test env can
+ * build it on the host: pio test -e native
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// DTC status byte (ISO 14229-1 D.2)
+const uint8_t UDS_STATUS_TEST_FAILED         = 0x01;
+const uint8_t UDS_STATUS_PENDING             = 0x04;
+const uint8_t UDS_STATUS_CONFIRMED           = 0x08;
+const uint8_t UDS_STATUS_WARNING_INDICATOR   = 0x80;
+
+struct UdsDtcRecord {
+  uint8_t high;          // First two bytes are the SAE J2012 code (P/C/B/U + 4 hex digits)
+  uint8_t mid;
+  uint8_t failureType;   // Third byte - the failure type byte of a 3-byte DTC
+  uint8_t status;
+};
+
+enum UdsReportResult : int8_t {
+  UDS_REPORT_MALFORMED = -2,  // Not a 59 02 reply, or truncated before the mask
+  UDS_REPORT_REJECTED  = -1   // 7F 19 <NRC> - see udsNegativeCode()
+};
+
+inline uint8_t udsNegativeCode(const uint8_t* payload, int len) {
+  return (len >= 3 && payload[0] == 0x7F) ? payload[2] : 0;
+}
+
+inline int decodeUdsDtcReport(const uint8_t* payload, int len, uint8_t statusMask,
+                              UdsDtcRecord* out, int maxRecords) {
+  // payload: 59 02 <availability mask> then 4-byte records: DTC high, DTC mid, failure type, status.
+  // Returns the records whose status matches statusMask (a trailing partial record is dropped),
+  // or a negative UdsReportResult
+  if (len >= 3 && payload[0] == 0x7F && payload[1] == 0x19) return UDS_REPORT_REJECTED;
+  if (len < 3 || payload[0] != 0x59 || payload[1] != 0x02) return UDS_REPORT_MALFORMED;
+  
+  int count = 0;
+  for (int j = 3; j + 3 < len && count < maxRecords; j += 4) {
+    uint8_t status = payload[j + 3];
+    if ((status & statusMask) == 0) continue;
+    out[count].high = payload[j];
+    out[count].mid = payload[j + 1];
+    out[count].failureType = payload[j + 2];
+    out[count].status = status;
+    count++;
+  }
+  return count;
+}
+
+// Pending but not yet confirmed - matches how Mode 07 codes are shown
+inline bool udsStatusIsPending(uint8_t status) {
+  return (status & UDS_STATUS_PENDING) && !(status & UDS_STATUS_CONFIRMED);
+}
+
+inline void formatDTCStatus(uint8_t status, char* out, size_t outSize) {
+  static const char* STATUS_BIT_NAMES[] = {
+    "testFailed", "failedThisCycle", "pending", "confirmed",
+    "notCompletedSinceClear", "failedSinceClear", "notCompletedThisCycle", "MIL"
+  };
+  
+  size_t used = 0;
+  out[0] = '\0';
+  for (int bit = 0; bit < 8 && used < outSize; bit++) {
+    if (!(status & (1 << bit))) continue;
+    used += snprintf(out + used, outSize - used, "%s%s", used > 0 ? "," : "", STATUS_BIT_NAMES[bit]);
+  }
+}
@@ -15,13 +15,37 @@
 
 #include <Arduino.h>
 #include <driver/twai.h>
+#include <hal/twai_ll.h>
 #include <TFT_eSPI.h>
 #include <qrcode.h>
-#include <vector>
 #include <WiFi.h>
 #include <HTTPClient.h>
+#include <WiFiClientSecure.h>
 #include <ArduinoJson.h>
 #include <ELMduino.h>
+#include <atomic>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <esp_sleep.h>
+#include <driver/gpio.h>
+#include <LittleFS.h>
+#include <Preferences.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include <mbedtls/sha256.h>
+#include <mbedtls/pk.h>
+#include <esp32s3/rom/miniz.h>
+#include "readiness.h"    // Readiness monitor table and decoder - host-testable
+#include "isotp.h"        // ISO-TP reassembly - host-testable
+#include "uds.h"          // UDS 0x19/0x02 report decoding - host-testable
+#include "cbor.h"         // Minimal CBOR encoder for results and metrics - host-testable
+#include "idle_power.h"   // When to force light sleep between customers - host-testable
+#include "can_trace.h"    // CAN trace record codec and spill file layout - host-testable
+#include "replay.h"       // Trace replay matching and virtual-time scheduler - host-testable
+#include "ota_delta.h"    // Delta OTA patch format and record applier - host-testable
+#include "dtc_index.h"    // Session DTC list and dedup index - host-testable
+#include "elm_line.h"     // ELM327/STN response line parser - host-testable
+#include "kline.h"        // K-line response framing and checksum - host-testable
 
 // ========== NEW BOARD PINOUTS ==========
 #define CAN_TX_PIN    GPIO_NUM_4    // CAN TX (wired to pin 4)
@@ -56,12 +80,10 @@ const byte SW_DOCK     = 42; // Dock Sensor
 const byte IR_LATCH    = 45; // IR Brightness Shift Register
 const byte I2C_SDA     = 47; // I2C
 const byte I2C_SCL     = 48; // I2C
-
-// Unused pins that need to be configured
-const byte UNUSED_35   = 35;
-const byte UNUSED_36   = 36;
-const byte UNUSED_37   = 37;
-const byte UNUSED_46   = 46;
+const byte ELM_RX      = 35; // ELM327/STN adapter UART RX (fallback transport)
+const byte ELM_TX      = 36; // ELM327/STN adapter UART TX
+const byte K_LINE_TX   = 37; // K-line transceiver TXD (UART2, bit-banged for init)
+const byte K_LINE_RX   = 46; // K-line transceiver RXD
 
 // ========== DISPLAY CONFIGURATION ==========
 // 2.2" LCD: 240x320 pixels - adapted from original 320x480
@@ -69,6 +91,44 @@ TFT_eSPI tft = TFT_eSPI();
 const int SCREEN_WIDTH  = 240;
 const int SCREEN_HEIGHT = 320;
 
+// Text rendering - the GLCD font is rasterised once into a packed 1-bit atlas and
+// strings are expanded from it into RGB565 runs pushed as one address window each,
+// instead of TFT_eSPI opening windows glyph by glyph. Static labels keep their run
+// in PSRAM, keyed by the string literal's address
+const bool TEXT_CACHE_ENABLED = true;   // false = original tft.print path, for A/B timing
+const int TEXT_GLYPH_WIDTH    = 6;      // GLCD cell, 5x7 glyph plus spacing
+const int TEXT_GLYPH_HEIGHT   = 8;
+const char TEXT_FIRST_GLYPH   = ' ';
+const int TEXT_GLYPH_COUNT    = 95;     // Printable ASCII
+const int TEXT_MAX_SIZE       = 3;
+const int TEXT_CACHE_SLOTS    = 96;     // Every label on every screen fits with room to spare
+const int TEXT_LINE_PIXELS    = SCREEN_WIDTH * TEXT_GLYPH_HEIGHT * TEXT_MAX_SIZE;
+
+struct TextRun {
+  const char* text;          // Label literal - its address is the key
+  uint16_t fg;
+  uint16_t bg;
+  uint8_t size;
+  int16_t x;                 // Clip at the panel edge depends on the start column
+  int16_t width;
+  uint16_t* pixels;          // width x 8*size, panel byte order
+};
+
+struct TextRenderer {
+  bool ready;                // Atlas built and scratch run allocated
+  bool cacheRuns;            // PSRAM present
+  uint8_t atlas[TEXT_GLYPH_COUNT][TEXT_GLYPH_HEIGHT];  // Glyph rows, bit 5 = leftmost column
+  uint16_t* line;            // Scratch run for dynamic strings
+  TextRun runs[TEXT_CACHE_SLOTS];
+  int runCount;
+  uint32_t cacheBytes;
+  int64_t screenStartUs;     // Per-screen benchmark
+  uint32_t screenWindows;
+  uint32_t screenGlyphs;
+};
+
+TextRenderer textRenderer;
+
 // ========== KIOSK STATES ==========
 enum KioskState {
   READY_SCREEN,    
@@ -86,7 +146,7 @@ enum KioskState {
   TROUBLESHOOTING  
 };
 
-KioskState currentState = DISPLAY_QR; // Boot directly to QR code
+KioskState currentState = READY_SCREEN; // Interactive at once - switches to QR when the session arrives
 
 // ========== GLOBAL VARIABLES ==========
 String transactionId           = "";
@@ -104,9 +164,24 @@ bool forceRedraw = false; // Global flag to force all displays to redraw
 
 // Session configuration
 const unsigned long SESSION_TIMEOUT_MS    = 5 * 60 * 1000; // 5 minutes
+const unsigned long SESSION_RECHECK_MS    = 5000;  // Timeout deferred by a running scan - look again
 const unsigned long PAYMENT_POLL_INTERVAL = 3000; // 3 seconds
 
-// Diagnostic scan timeouts - Extended for comprehensive scanning
+// State timeouts - each one arms a one-shot timer when the state is entered
+const unsigned long PREPARE_VEHICLE_MS    = 15000; // 15 seconds to prepare
+const unsigned long RESULTS_DISPLAY_MS    = 3000;  // Show results for 3 seconds
+const unsigned long NO_VEHICLE_DISPLAY_MS = 5000;  // Show "no vehicle" for 5 seconds before a retry
+const unsigned long SCAN_COMPLETE_MS      = 15000; // 15 seconds to read and disconnect
+const unsigned long ERROR_RECOVERY_MS     = 5000;
+const unsigned long BUTTON_DEBOUNCE_MS    = 20;    // Pin must still be low this long after the edge
+
+// Idle power mode - sleep policy and timings are in idle_power.h
+const byte IDLE_WAKE_PINS[] = { SW_TRIG, SCAN_BUTTON, SW_DOCK, IR_IN, TINY_RX };
+const int NUM_IDLE_WAKE_PINS = sizeof(IDLE_WAKE_PINS) / sizeof(IDLE_WAKE_PINS[0]);
+
+// Diagnostic scan timeouts - Extended for comprehensive scanning. These and the
+// other scan timings below are only the compiled defaults: the scan reads the
+// active TimingProfile, which the API can retune per kiosk
 const unsigned long TOTAL_SCAN_TIMEOUT_MS     = 90 * 1000; // 90 seconds max scan time
 const unsigned long BAUD_DETECT_TIMEOUT_MS    = 3000;     // 3 seconds per baud rate
 const unsigned long TRAFFIC_LISTEN_TIMEOUT_MS = 8000;  // 8 seconds listening
@@ -122,17 +197,121 @@ const char* API_BASE_URL  = "https://obd2ai-server-1afd74c5766a.herokuapp.com";
 const char* WEBAPP_URL    = "https://obd2ai-webapp-805f8e39122c.herokuapp.com";
 const char* KIOSK_ID      = "DEMO_KIOSK";
 
-// OBD2 data structures
-struct FaultCode {
-  String code;
-  String system;
-  bool isPending;
+// Fleet telemetry - point METRICS_URL at a local HTTP sink to inspect the CBOR blobs
+const char* METRICS_URL                       = "https://obd2ai-server-1afd74c5766a.herokuapp.com/api/obd2/kiosk/metrics";
+const unsigned long METRICS_FLUSH_INTERVAL_MS = 5 * 60 * 1000; // 5 minutes
+const uint8_t METRICS_FORMAT_VERSION          = 2;
+
+// Results wire format - CBOR unless the server answers 415, then JSON for the rest of uptime
+const uint8_t RESULTS_FORMAT_VERSION = 3;
+bool resultsCborRejected             = false;
+
+const int MAX_SESSION_ECUS = 16;
+
+// ECU registry - one record per responding ECU, keyed by its normalised response
+// ID through the same kind of open-addressing index as the DTCs. Every scan path
+// reports responses here, so a chatty ECU is one record with a response count
+const int ECU_INDEX_SLOTS = 32;  // Power of two, 2x MAX_SESSION_ECUS
+
+struct EcuRecord {
+  uint32_t responseId;
+  uint32_t requestId;        // Physical request ID that pairs with responseId
+  bool extended;             // 29-bit identifiers
+  uint32_t firstSeenMs;      // Since scan start
+  uint16_t responses;        // Single/first frames received (not consecutive frames)
+  uint16_t latencyMinMs;     // Request sent -> response frame
+  uint16_t latencyMaxMs;
+  uint32_t latencySumMs;
+  uint8_t nrcCount;          // Negative responses of any kind...
+  uint8_t pendingCount;      // ...of which 0x78 "response pending"
+  uint8_t lastNrc;
+  uint32_t services;         // ecuServiceBit() of each service answered positively
+};
+
+struct EcuRegistry {
+  EcuRecord records[MAX_SESSION_ECUS];
+  int count;
+  uint8_t slots[ECU_INDEX_SLOTS];  // Record index + 1, 0 = empty
+  unsigned long scanStartMs;
+  
+  int size() const { return count; }
+  const EcuRecord* begin() const { return records; }
+  const EcuRecord* end() const { return records + count; }
+};
+
+// Mode 09 vehicle information - calibration IDs, CVNs and ECU names per ECU.
+// Calibrations only change with a reflash, so they are cached on LittleFS by
+// VIN and a repeat visit skips the multi-frame transfers
+const int MODE09_MAX_ECUS             = 8;
+const int MODE09_MAX_CALIDS           = 4;     // Most ECUs report one or two
+const int MODE09_CALID_LENGTH         = 16;
+const int MODE09_ECU_NAME_LENGTH      = 20;
+const unsigned long MODE09_WINDOW_MS  = 1000;  // Per InfoType, shared by every ECU asked
+const unsigned long MODE09_BUDGET_MS  = 4000;  // Whole collection on top of the DTC scan
+const uint8_t MODE09_SUPPORTED        = 0x00;  // InfoTypes 01-20 bitmap
+const uint8_t MODE09_VIN              = 0x02;
+const uint8_t MODE09_CALID            = 0x04;
+const uint8_t MODE09_CVN              = 0x06;
+const uint8_t MODE09_ECU_NAME         = 0x0A;
+const char* VIN_CACHE_DIR             = "/vin";
+const int VIN_CACHE_MAX_FILES         = 32;    // Oldest-listed entry is dropped past this
+const char VIN_CACHE_MAGIC[4]         = {'V', 'I', 'N', 'C'};
+const uint8_t VIN_CACHE_VERSION       = 1;     // Bump when VehicleInfoRecord changes
+
+struct VehicleInfoRecord {
+  uint32_t responseId;
+  uint32_t supported;        // 09 00 bitmap - bit 31 is InfoType 01
+  uint8_t calIdCount;
+  uint8_t cvnCount;
+  char calIds[MODE09_MAX_CALIDS][MODE09_CALID_LENGTH + 1];
+  uint32_t cvns[MODE09_MAX_CALIDS];
+  char ecuName[MODE09_ECU_NAME_LENGTH + 1];
+};
+
+struct VinCacheHeader {
+  char magic[4];
+  uint8_t version;
+  uint8_t count;             // VehicleInfoRecords that follow
+  char vin[18];
+};
+
+// Mode 02 freeze frames - one compact record per stored DTC that has a frame
+const int MAX_FREEZE_FRAMES                = 4;
+const int FREEZE_FRAME_MAX_PIDS            = 12;
+const unsigned long EXTENDED_DTC_BUDGET_MS = 3000; // Mode 07/0A + freeze frames on top of Mode 03
+
+struct FreezeFrameRecord {
+  uint16_t rawCode;      // DTC that stored the frame
   uint16_t ecuId;
+  uint8_t frameNumber;
+  uint8_t pidCount;
+  uint8_t pids[FREEZE_FRAME_MAX_PIDS];
+  uint8_t values[FREEZE_FRAME_MAX_PIDS][2];  // Raw A/B bytes - decoded server-side
+};
+
+
+// Freeze-frame PIDs we capture, with their response data lengths
+struct FreezeFramePid {
+  uint8_t pid;
+  uint8_t length;
 };
 
-std::vector<FaultCode> detectedCodes;
-std::vector<uint16_t>  activeECUs;
-bool vehicleDetected = false; // Track if vehicle was detected during scan
+const FreezeFramePid FREEZE_FRAME_PIDS[] = {
+  {0x03, 2},  // Fuel system status
+  {0x04, 1},  // Calculated engine load
+  {0x05, 1},  // Coolant temperature
+  {0x06, 1},  // Short term fuel trim bank 1
+  {0x07, 1},  // Long term fuel trim bank 1
+  {0x0B, 1},  // Intake manifold pressure
+  {0x0C, 2},  // Engine RPM
+  {0x0D, 1},  // Vehicle speed
+  {0x0E, 1},  // Timing advance
+  {0x0F, 1},  // Intake air temperature
+  {0x11, 1},  // Throttle position
+  {0x1F, 2}   // Run time since engine start
+};
+const int NUM_FREEZE_FRAME_PIDS = sizeof(FREEZE_FRAME_PIDS) / sizeof(FREEZE_FRAME_PIDS[0]);
+const int FREEZE_FRAME_PIDS_PER_REQUEST = 3;  // 3 PID/frame pairs fill a single-frame request
 int scanRetryCount = 0; // Track scan retry attempts
 twai_message_t message;
 ELM327 myELM327;
@@ -144,6 +323,672 @@ const uint16_t OBD2_ADDRESSES[] = {
 };
 const int NUM_ECUS = sizeof(OBD2_ADDRESSES) / sizeof(OBD2_ADDRESSES[0]);
 
+// Response collection - close each receive window as soon as every expected ECU
+// has answered (or sent a negative response) instead of waiting out the timeout
+const int MAX_EXPECTED_RESPONDERS              = 16;
+const unsigned long RESPONSE_IDLE_GAP_MS       = 150;   // Silence that ends a window once something was heard
+const unsigned long RESPONSE_POLL_MS           = 10;    // twai_receive poll inside a window
+const unsigned long DTC_RESPONSE_TIMEOUT_MS    = 2000;  // Mode 03/07/0A window on the ECM
+const unsigned long PID_RESPONSE_TIMEOUT_MS    = 1000;  // Readiness and freeze-frame requests
+const unsigned long DTC_SILENT_ECU_WINDOW_MS   = 500;   // Mode 07/0A window once the ECM ignored Mode 03
+
+struct ResponseCollector {
+  unsigned long startTime;
+  unsigned long timeoutMs;
+  unsigned long lastUsefulTime;                 // Last frame that counted toward a responder
+  uint32_t expected[MAX_EXPECTED_RESPONDERS];   // Responders we are waiting for (empty = unknown)
+  int expectedCount;
+  uint16_t answeredMask;                        // Bit per expected[] entry that has finished
+  unsigned long idleGapMs;                      // Discovery only (no expected[]) - 0 = off
+  bool heardAny;
+  bool responsePending;                         // A 0x78 was seen - the gap no longer applies
+  unsigned long keepAliveMs;                    // UDS TesterPresent period while waiting - 0 = off
+  unsigned long lastKeepAliveTime;
+};
+
+uint32_t discoveredResponders[MAX_EXPECTED_RESPONDERS]; // ECUs that answered the discovery handshake
+int discoveredResponderCount = 0;
+unsigned long scanDeadTimeMs = 0;    // Window time spent after the last useful frame (per scan)
+int scanWindowCount          = 0;    // Receive windows opened during the scan
+int scanEarlyExitCount       = 0;    // Windows closed because all expected ECUs answered
+
+// CAN bus health - TWAI alerts and status counters are sampled from canTransmit()/
+// canReceive(), so the monitor runs at bus-call rate on the scan task and never
+// races reinitializeCAN() for the driver
+const uint32_t CAN_HEALTH_ALERTS = TWAI_ALERT_BUS_OFF | TWAI_ALERT_BUS_RECOVERED | TWAI_ALERT_ERR_PASS |
+                                   TWAI_ALERT_ARB_LOST | TWAI_ALERT_BUS_ERROR | TWAI_ALERT_RX_QUEUE_FULL;
+const unsigned long CAN_HEALTH_SAMPLE_US    = 5000;    // twai_get_status_info cadence while the bus is in use
+const unsigned long CAN_LOAD_WINDOW_US      = 100000;  // Bus load is averaged over 100ms windows
+const unsigned long CAN_RECOVERY_TIMEOUT_MS = 100;     // 128 x 11 recessive bits is ~3ms at 500k
+const uint32_t CAN_WRONG_BAUD_ERRORS        = 8;       // Bus errors with no clean frame = wrong bit rate
+const uint8_t CAN_PACING_BUSY_LOAD          = 50;      // % bus load that doubles request spacing
+const uint8_t CAN_PACING_SATURATED_LOAD     = 80;      // % bus load (or error passive) that triples it
+const int MAX_REJECTED_BAUD_RATES           = 4;
+
+struct CanBusSummary {
+  uint8_t loadAvgPercent;
+  uint8_t loadPeakPercent;
+  uint32_t rxFrames;
+  uint32_t txFrames;
+  uint32_t busErrors;
+  uint32_t arbitrationLost;
+  uint32_t rxMissed;           // Dropped because the driver RX queue was full
+  uint32_t rxOverruns;         // Dropped by the controller's hardware FIFO
+  uint16_t errorPassiveEvents;
+  uint16_t busOffEvents;
+  uint16_t recoveries;         // Bus-off events recovered in place (no driver reinstall)
+  uint8_t peakTxErrors;        // Highest TEC/REC seen - 128+ is error passive
+  uint8_t peakRxErrors;
+};
+
+struct CanBusHealth {
+  CanBusSummary totals;        // Per scan - copied into the session when the scan ends
+  uint32_t baudRate;
+  twai_state_t state;
+  bool recovering;
+  uint64_t lastSampleUs;
+  uint64_t windowStartUs;
+  uint32_t windowBits;         // Estimated bits on the wire in the current load window
+  uint64_t scanBits;
+  uint64_t scanCapacityBits;   // Bits the bus could have carried over the same windows
+  uint8_t loadPercent;         // Last completed window
+  uint32_t lastBusErrors;      // Driver status counters at the previous sample -
+  uint32_t lastArbitrationLost; // they restart from zero on every driver install
+  uint32_t lastRxMissed;
+  uint32_t lastRxOverruns;
+  uint32_t arbitrationLostAtPace;
+  uint32_t rejectedBaudRates[MAX_REJECTED_BAUD_RATES]; // Bit rates the current detection proved wrong
+  int rejectedBaudCount;
+};
+
+CanBusHealth canHealth;
+
+// CAN controller - the driver is installed once and stays resident. A bit-rate
+// change stops the controller, rewrites its timing registers while it sits in
+// reset mode and starts it again; uninstall/install is only the fallback
+struct CanController {
+  bool installed;
+  uint32_t baudRate;
+  uint32_t lastSwitchUs;
+  uint32_t fastSwitches;
+  uint32_t reinstalls;
+};
+
+CanController canController;
+
+// CAN trace recorder - every frame the scan sends or receives goes into a ring of
+// fixed blocks, in the record format of can_trace.h. Anomalous sessions (no vehicle,
+// timeout, bus-off) are spilled to LittleFS whole. Recording stops when the blocks
+// run out, so a spilled trace always starts at the beginning of the scan - replay
+// needs the bit-rate marker and the first requests
+const size_t CAN_TRACE_PSRAM_BLOCKS     = 16;   // 64 KB per session - also the largest spill file
+const size_t CAN_TRACE_INTERNAL_BLOCKS  = 4;    // 16 KB fallback without PSRAM
+const int CAN_TRACE_SPILL_FILES         = 4;    // /cantrace0..3.bin, reused oldest first
+const bool CAN_TRACE_SPILL_ALL          = false; // Keep every session (replay corpus collection), not just anomalies
+const char* KIOSK_FS_PARTITION          = "littlefs";  // Data partition in partitions_kiosk.csv
+
+const uint32_t CAN_BAUD_RATES[]     = {1000000, 500000, 250000, 125000};
+const int NUM_CAN_BAUD_RATES        = sizeof(CAN_BAUD_RATES) / sizeof(CAN_BAUD_RATES[0]);
+
+struct CanTraceRecorder {
+  CanTraceBlock* blocks;
+  int blockCount;
+  int head;                // Block being written
+  int used;                // Blocks holding this session's data
+  CanTraceChain chain;     // Delta/ID state of the head block
+  uint32_t frames;
+  bool truncated;          // Out of blocks - nothing after this point was recorded
+  uint32_t recordCycles;   // CPU cycles spent in canTraceRecord() this session
+  uint32_t spillSequence;
+  uint8_t anomalies;
+  bool fsReady;
+};
+
+CanTraceRecorder canTrace;
+
+// Trace replay - re-runs performDiagnosticScan() against recorded traces with
+// canTransmit()/canReceive() answered by replay.h under virtual time.
+// Corpus: /replay/*.bin (uploadfs from data/replay) plus /cantrace*.bin.
+const bool REPLAY_ON_BOOT                      = false;  // Bench setting - runs the suite once before the first scan
+const char* REPLAY_CORPUS_DIR                  = "/replay";
+const int REPLAY_MAX_FRAMES                    = 16384;  // 320 KB of PSRAM while the suite runs
+const int REPLAY_MAX_FRAMES_INTERNAL           = 1024;
+const unsigned long REPLAY_MAX_WAIT_MS         = 1000;   // Cap on one receive's wait - portMAX_DELAY would add 49 days
+const uint32_t REPLAY_TIMING_REGRESSION_PERCENT = 10;    // Slower than the recording by more than this = regression
+
+struct ReplaySummary {
+  int traces;
+  int passed;
+  int resultDiffs;
+  int timingRegressions;
+  int skipped;
+  uint32_t virtualMs;
+};
+
+ReplayEngine replay;
+
+// ELM327/STN fallback transport - a UART adapter stands in for the TWAI
+// controller when the driver or transceiver is dead. canTransmit()/canReceive()
+// are answered from the adapter's headers-on output, so the scan engine runs
+// unchanged on top of it. The adapter does ISO-TP segmentation and flow control
+const bool ELM_ENABLED                     = false;  // Hardware config: adapter wired to ELM_RX/ELM_TX - else they are pulled down
+const uint32_t ELM_UART_BAUD               = 38400;  // ELM327 power-on default
+const char ELM_BOOT_PROTOCOL               = '6';    // Fixed CAN 11/500 at boot - skips ELMduino's 0100 search
+const unsigned long ELM_COMMAND_TIMEOUT_MS = 1000;
+const unsigned long ELM_REQUEST_TIMEOUT_MS = 5000;   // Previous request still printing when the next goes out
+const unsigned long ELM_SEARCH_TIMEOUT_MS  = 15000;  // ATSP0 tries every protocol, K-line ones are slow
+const int ELM_RX_QUEUE                     = 64;
+const int ELM_LINE_LENGTH                  = 48;     // 8-digit ID + 8 data bytes, spaces off
+const uint32_t ELM_NO_HEADER               = 0xFFFFFFFF;
+
+struct ElmBackend {
+  bool present;              // Adapter answered at boot
+  bool active;               // canTransmit()/canReceive() go to the adapter
+  bool stn;                  // STN11xx/21xx rather than an ELM327 (or clone)
+  bool busy;                 // A request is out and the '>' prompt has not come back
+  uint32_t header;           // Last ATSH, so repeat requests to one ECU skip it
+  twai_message_t queue[ELM_RX_QUEUE];
+  int queueHead;
+  int queueCount;
+  char line[ELM_LINE_LENGTH];
+  int lineLength;
+  unsigned long requestStartMs;
+  uint32_t requests;
+  uint32_t countedRequests;  // Sent with a response-count suffix
+  uint32_t frames;
+  uint32_t promptMsSum;      // Request written -> prompt back, for the TWAI comparison
+  uint32_t overflows;
+};
+
+ElmBackend elm;
+
+// K-line (ISO 9141-2 / ISO 14230-4 KWP2000) for pre-CAN vehicles - an L9637-style
+// transceiver on UART2. Fast init is tried before the 2.5 s 5-baud init. Request
+// bytes are clocked out by an esp_timer alarm so P4 holds whatever the scheduler
+// is doing; P1-P3 are checked against esp_timer_get_time(). ISO 9141-2 / 14230-2 values
+const bool K_LINE_ENABLED                = false;  // Hardware config: transceiver fitted on K_LINE_TX/RX - else pulled down
+const uint32_t K_LINE_BAUD               = 10400;
+const uint8_t K_LINE_INIT_ADDRESS        = 0x33;   // OBD functional address
+const uint8_t K_LINE_TESTER_ADDRESS      = 0xF1;
+const unsigned long K_LINE_IDLE_MS       = 300;    // W5 - bus idle before either init
+const uint32_t K_LINE_FAST_INIT_LOW_US   = 25000;  // TiniL, then as long high (TWuP 50 ms)
+const unsigned long K_LINE_5BAUD_BIT_MS  = 200;
+const unsigned long K_LINE_W1_MAX_MS     = 300;    // Address sent -> 0x55 sync
+const unsigned long K_LINE_W2_MAX_MS     = 20;     // Sync -> key byte 1
+const unsigned long K_LINE_W3_MAX_MS     = 20;     // Key byte 1 -> key byte 2
+const unsigned long K_LINE_W4_MS         = 30;     // Key byte 2 -> its inverse from us (25-50)
+const unsigned long K_LINE_W4_MAX_MS     = 50;
+const unsigned long K_LINE_P1_MAX_MS     = 20;     // ECU inter-byte gap - longer ends the message
+const unsigned long K_LINE_P2_MAX_MS     = 50;     // Request (or previous response) -> response
+const unsigned long K_LINE_P2_PENDING_MS = 5000;   // P2* after a KWP "response pending"
+const unsigned long K_LINE_P3_MIN_MS     = 55;     // Last response byte -> next request
+const unsigned long K_LINE_P3_MAX_MS     = 5000;   // ECUs drop the session after this much silence
+const uint64_t K_LINE_TX_BYTE_US         = 6000;   // Byte start to byte start: P4 5 ms + ~1 ms on the wire
+const int K_LINE_MAX_RESPONSES           = 8;
+
+struct KLineBackend {
+  bool active;               // Init succeeded this scan
+  bool kwp;                  // KWP2000 framing (format/length byte), else ISO 9141-2
+  bool fastInit;
+  uint8_t keyBytes[2];
+  int64_t lastByteUs;        // Last byte on the wire in either direction, for P3
+  esp_timer_handle_t txTimer;
+  uint8_t tx[K_LINE_MAX_MESSAGE];
+  volatile int txLength;
+  volatile int txIndex;
+  TaskHandle_t txWaiter;
+  uint32_t requests;
+  uint32_t responses;
+  uint32_t checksumErrors;
+  uint32_t echoErrors;       // Our own bytes heard back wrong - a collision or a dead transceiver
+};
+
+KLineBackend kline;
+
+enum ScanLink : uint8_t {
+  SCAN_LINK_TWAI,
+  SCAN_LINK_ELM327,
+  SCAN_LINK_STN,
+  SCAN_LINK_KLINE
+};
+const char* SCAN_LINK_NAMES[] = {"twai", "elm327", "stn", "kline"};
+
+// Session arena - every scan result lives in this one static block, so a scan
+// session allocates nothing and resetScanSession() between customers is O(1)
+struct ScanSession {
+  DtcList codes;
+  EcuRegistry ecus;
+  FreezeFrameRecord freezeFrames[MAX_FREEZE_FRAMES];
+  int freezeFrameCount;
+  ReadinessReport readiness;
+  bool vehicleDetected;             // Track if vehicle was detected during scan
+  unsigned long extendedDTCTimeMs;  // Time spent on Mode 07/0A and freeze frames
+  unsigned long scanDurationMs;     // Whole performDiagnosticScan() run
+  CanBusSummary bus;
+  uint8_t codeSlots[DTC_INDEX_SLOTS];  // Dedup index over codes, see addSessionCode()
+  uint8_t link;                     // ScanLink the scan ran over
+  char vin[18];
+  VehicleInfoRecord vehicleInfo[MODE09_MAX_ECUS];
+  int vehicleInfoCount;
+  bool vehicleInfoCached;           // Calibration data came from the VIN cache
+  unsigned long vehicleInfoTimeMs;  // Time spent on Mode 09
+};
+
+ScanSession session;
+
+IsoTpReceiver mode09Receivers[MODE09_MAX_ECUS];  // One per ECU so Mode 09 transfers overlap
+
+// UDS (ISO 14229) modules outside the emissions range - edit to match the fleet
+struct UDSModule {
+  const char* name;
+  uint32_t requestId;
+  uint32_t responseId;
+};
+
+const UDSModule UDS_MODULES[] = {
+  {"ABS/ESC",              0x760, 0x768},
+  {"Airbag (SRS)",         0x737, 0x73F},
+  {"Body Control (BCM)",   0x726, 0x72E},
+  {"Instrument Cluster",   0x720, 0x728},
+  {"Gateway",              0x716, 0x71E},
+  {"HVAC",                 0x733, 0x73B},
+  {"Power Steering (EPS)", 0x730, 0x738}
+};
+const int NUM_UDS_MODULES = sizeof(UDS_MODULES) / sizeof(UDS_MODULES[0]);
+
+struct UDSModuleState {
+  IsoTpReceiver rx;
+  bool present;          // Answered DiagnosticSessionControl (positively or not)
+  bool extendedSession;  // Accepted the extended session - must be returned to default
+};
+
+UDSModuleState udsModuleStates[NUM_UDS_MODULES];
+
+// Off by default. Session control and 0x19 go to guessed module IDs on every 11-bit vehicle,
+// and on Hondas traffic to anything but 0x7E0 has set U0100/U0029/U0155 communication DTCs
+// (see scanHondaSpecificDTCs). Enable only for a fleet whose modules answer at these IDs
+const bool UDS_SCAN_ENABLED                 = false;
+const uint8_t UDS_DTC_STATUS_MASK           = 0x8D;  // testFailed | pending | confirmed | warningIndicator
+const unsigned long UDS_RESPONSE_TIMEOUT_MS = 1000;  // P2 client timeout per pipelined request
+const unsigned long UDS_PENDING_TIMEOUT_MS  = 5000;  // P2* after a "response pending" NRC
+const unsigned long UDS_TESTER_PRESENT_MS   = 2000;  // Keep-alive well inside the 5s S3 server timer
+const unsigned long UDS_REQUEST_SPACING_MS  = 10;    // Gap between pipelined requests on the bus
+
+// Scan timing profiles - every tunable scan timing in one versioned blob. The
+// active profile is loaded from NVS at boot, refreshed from the API between
+// customers and only swapped at a session boundary, never mid-scan. The arm
+// name tags metrics and results so experiments can be compared server-side
+const uint8_t TIMING_PROFILE_VERSION      = 2;     // Bump when the TimingProfile layout changes
+const int TIMING_ARM_LENGTH               = 12;
+const unsigned long OBD_QUERY_SPACING_MS  = 350;   // ~3 queries/sec max - Honda pacing
+const unsigned long PROTOCOL_LISTEN_MS    = 2000;  // Passive listen per candidate bit rate
+const unsigned long HANDSHAKE_TIMEOUT_MS  = 1000;  // Mode 01 PID 00 discovery window
+const char* TIMING_NVS_NAMESPACE          = "timing";
+const char* TIMING_NVS_KEY                = "profile";
+
+struct TimingProfile {
+  uint8_t version;                  // TIMING_PROFILE_VERSION - blobs from another layout are ignored
+  uint32_t revision;                // Server revision, 0 = compiled defaults
+  char arm[TIMING_ARM_LENGTH];      // Experiment arm ("" = not enrolled)
+  uint32_t prepareVehicleMs;
+  uint32_t totalScanTimeoutMs;
+  uint32_t baudDetectTimeoutMs;
+  uint32_t protocolListenMs;
+  uint32_t handshakeTimeoutMs;
+  uint32_t dtcScanTimeoutMs;
+  uint32_t extendedDtcBudgetMs;
+  uint32_t responseIdleGapMs;
+  uint32_t querySpacingMs;
+  uint32_t udsRequestSpacingMs;
+  uint32_t dtcResponseTimeoutMs;
+  uint32_t pidResponseTimeoutMs;
+  uint32_t silentEcuWindowMs;
+};
+
+const TimingProfile DEFAULT_TIMING = {
+  TIMING_PROFILE_VERSION, 0, "",
+  PREPARE_VEHICLE_MS, TOTAL_SCAN_TIMEOUT_MS, BAUD_DETECT_TIMEOUT_MS, PROTOCOL_LISTEN_MS,
+  HANDSHAKE_TIMEOUT_MS, DTC_SCAN_TIMEOUT_MS, EXTENDED_DTC_BUDGET_MS, RESPONSE_IDLE_GAP_MS,
+  OBD_QUERY_SPACING_MS, UDS_REQUEST_SPACING_MS, DTC_RESPONSE_TIMEOUT_MS, PID_RESPONSE_TIMEOUT_MS,
+  DTC_SILENT_ECU_WINDOW_MS
+};
+
+// Written on the UI task, under timingLock, only while no scan is running - so the
+// scan and UI tasks read fields directly. The network task runs concurrently with
+// the write and must read through timingIdentity(). Fetches stage in pendingTiming
+struct TimingIdentity {
+  uint32_t revision;
+  char arm[TIMING_ARM_LENGTH];
+};
+
+TimingProfile timing = DEFAULT_TIMING;
+TimingProfile pendingTiming;
+std::atomic<bool> pendingTimingReady(false);
+portMUX_TYPE timingLock = portMUX_INITIALIZER_UNLOCKED;
+TimingIdentity metricsTiming;  // Profile the counters since the last flush ran under - net task only
+
+// Delta OTA - the server diffs the image we run against the release and the
+// kiosk rebuilds the release straight into the inactive app slot, so only the
+// patch crosses the kiosk's WiFi. Patch format and applier are in ota_delta.h.
+// The download is plain HTTP - trust comes from the release key's signature over
+// the header, whose target hash the rebuilt image must match before it can boot
+const unsigned long OTA_CHECK_INTERVAL_MS  = 6UL * 60 * 60 * 1000;  // 6 hours
+const unsigned long OTA_IDLE_MS            = 10 * 60 * 1000;  // Untouched this long before checking or rebooting
+const unsigned long OTA_HEALTH_TIMEOUT_MS  = 120000;  // A new image must pass its local boot checks within this
+const unsigned long OTA_STREAM_TIMEOUT_MS  = 15000;   // Stalled download gives up
+const size_t OTA_INPUT_CHUNK               = 1024;    // Compressed bytes per socket read
+const char* OTA_NVS_NAMESPACE              = "ota";
+const char* OTA_NVS_STAGED_KEY             = "staged";  // SHA-256 of the image we last switched to
+
+// Public half of the release signing key (ECDSA P-256). The release pipeline
+// writes include/ota_release_key.h (git-ignored) and signs each patch header with
+// the private half - see OTA_RELEASE_SIGNING.md. A build without the file has no
+// key and never downloads a patch
+#if __has_include("ota_release_key.h")
+#include "ota_release_key.h"
+#else
+#warning "include/ota_release_key.h missing - this build cannot verify firmware updates"
+#define OTA_RELEASE_PUBLIC_KEY_PEM ""
+#endif
+const char OTA_SIGNING_PUBLIC_KEY[] = OTA_RELEASE_PUBLIC_KEY_PEM;
+
+// Flash side of the patch applier - reads the running image, hashes and writes the new one
+struct OtaFlashIo {
+  const esp_partition_t* base;
+  esp_ota_handle_t handle;
+  mbedtls_sha256_context sha;
+  
+  bool readBase(uint32_t offset, uint8_t* buffer, size_t length) {
+    return esp_partition_read(base, offset, buffer, length) == ESP_OK;
+  }
+  bool write(const uint8_t* data, size_t length) {
+    mbedtls_sha256_update_ret(&sha, data, length);
+    if (esp_ota_write(handle, data, length) != ESP_OK) {
+      Serial.println("❌ esp_ota_write failed");
+      return false;
+    }
+    return true;
+  }
+};
+
+bool otaInFlight      = false;  // UI task only
+bool otaHoldSessions  = false;  // UI task only - no new sessions until the firmware check/reboot is done
+bool otaRebootPending = false;  // New image staged - reboot at the next quiet moment
+bool otaPendingVerify = false;  // Running a new image that hasn't passed its boot checks yet
+unsigned long lastOtaCheck = 0;
+uint8_t otaRejectedSha[32];     // Image we rolled back from - never stage it again
+bool otaHasRejected = false;
+
+// Metrics registry - fixed counters and histograms updated with relaxed atomics
+// so recording from scan loops costs a few instructions and never blocks
+enum MetricCounter {
+  METRIC_SCANS_STARTED,
+  METRIC_SCANS_WITH_VEHICLE,
+  METRIC_FRAMES_DROPPED,
+  METRIC_HTTP_REQUESTS,
+  METRIC_HTTP_FAILURES,
+  METRIC_UI_WAKEUPS,
+  METRIC_IDLE_SLEEPS,
+  METRIC_CAN_BUS_OFF,
+  METRIC_OTA_UPDATES,
+  METRIC_OTA_ROLLBACKS,
+  METRIC_ELM_SCANS,
+  METRIC_COUNTER_COUNT
+};
+
+enum MetricHistogram {
+  METRIC_SCAN_DURATION_MS,
+  METRIC_PROTOCOL_DETECT_MS,
+  METRIC_HTTP_LATENCY_MS,
+  METRIC_LOOP_LATENCY_MS,
+  METRIC_INPUT_LATENCY_MS,
+  METRIC_WAKE_LATENCY_MS,
+  METRIC_CAN_BUS_LOAD,
+  METRIC_CAN_SWITCH_US,
+  METRIC_TRACE_RECORD_NS,
+  METRIC_OTA_APPLY_MS,
+  METRIC_MODE09_MS,
+  METRIC_SCREEN_DRAW_US,
+  METRIC_HISTOGRAM_COUNT
+};
+
+const int METRIC_BUCKETS = 8;  // Last bucket catches everything above the final bound
+
+struct HistogramDef {
+  const char* name;
+  uint32_t upperBounds[METRIC_BUCKETS - 1];
+};
+
+const char* METRIC_COUNTER_NAMES[METRIC_COUNTER_COUNT] = {
+  "scans", "scansWithVehicle", "framesDropped", "httpRequests", "httpFailures", "uiWakeups", "idleSleeps", "canBusOff",
+  "otaUpdates", "otaRollbacks", "elmScans"
+};
+
+const HistogramDef METRIC_HISTOGRAMS[METRIC_HISTOGRAM_COUNT] = {
+  {"scanMs",     {5000, 10000, 20000, 30000, 45000, 60000, 90000}},
+  {"detectMs",   {100, 250, 500, 1000, 2000, 4000, 8000}},
+  {"httpMs",     {100, 250, 500, 1000, 2000, 5000, 10000}},
+  {"loopMs",     {1, 2, 5, 10, 50, 250, 1000}},
+  {"inputMs",    {21, 25, 30, 40, 60, 100, 250}},  // Button edge to handler, includes debounce
+  {"wakeMs",     {5, 25, 100, 250, 1000, 2500, 5000}},  // Light-sleep exit to screen settled and WiFi rejoined
+  {"busLoad",    {5, 10, 20, 30, 50, 70, 90}},     // Average % CAN bus load per scan
+  {"baudSwitchUs", {50, 100, 250, 500, 1000, 5000, 20000}},  // reinitializeCAN(), in microseconds
+  {"traceNs",    {100, 200, 300, 500, 1000, 2000, 5000}},  // Mean canTraceRecord() cost per scan
+  {"otaApplyMs", {10000, 20000, 30000, 60000, 120000, 300000, 600000}},  // Delta download + apply
+  {"mode09Ms",   {100, 250, 500, 1000, 2000, 3000, 4000}},  // Vehicle info collection per scan
+  {"screenUs",   {2000, 5000, 10000, 20000, 40000, 80000, 160000}}  // Full screen redraw
+};
+
+struct HistogramData {
+  std::atomic<uint32_t> buckets[METRIC_BUCKETS];
+  std::atomic<uint32_t> count;
+  std::atomic<uint32_t> sum;
+  std::atomic<uint32_t> max;
+};
+
+std::atomic<uint32_t> metricCounters[METRIC_COUNTER_COUNT];
+HistogramData metricHistograms[METRIC_HISTOGRAM_COUNT];
+unsigned long lastMetricsFlush = 0;
+
+// Results upload - streamed with chunked transfer encoding so memory stays flat
+const size_t RESULTS_CHUNK_SIZE              = 512;
+const unsigned long RESULTS_HTTP_TIMEOUT_MS  = 10000; // 10 second timeout for results submission
+
+struct ChunkedBodyWriter : public Print {
+  WiFiClient* client;
+  uint8_t buffer[RESULTS_CHUNK_SIZE];
+  size_t used;
+  size_t totalBytes;
+  int chunkCount;
+  uint32_t lowestFreeHeap;  // Heap low-water observed while streaming
+  bool failed;
+  
+  size_t write(uint8_t b) override;
+  size_t write(const uint8_t* data, size_t len) override;
+};
+
+// ========== TASK ARCHITECTURE ==========
+// The scan engine has core 1 to itself so CAN timing never competes with WiFi/TLS.
+// The UI state machine and the network worker share core 0 with the WiFi stack.
+// The tasks only talk through queues: the UI owns currentState and the display,
+// the scan task owns `session` from SCAN request until SCAN_DONE, and network
+// requests carry their own copy of the transaction ID.
+const BaseType_t SCAN_TASK_CORE            = 1;
+const BaseType_t UI_TASK_CORE              = 0;
+const BaseType_t NET_TASK_CORE             = 0;
+const uint32_t SCAN_TASK_STACK             = 8192;
+const uint32_t UI_TASK_STACK               = 6144;
+const uint32_t NET_TASK_STACK              = 12288;  // TLS handshake is stack hungry
+const UBaseType_t SCAN_TASK_PRIORITY       = 3;
+const UBaseType_t UI_TASK_PRIORITY         = 2;
+const UBaseType_t NET_TASK_PRIORITY        = 1;
+const UBaseType_t UI_QUEUE_LENGTH          = 16;
+const UBaseType_t NET_QUEUE_LENGTH         = 4;
+const UBaseType_t SCAN_QUEUE_LENGTH        = 1;
+const unsigned long UI_TICK_MS             = 1000;       // Countdown/poll tick, only in states that need it
+const unsigned long TASK_STATS_INTERVAL_MS = 60 * 1000;  // CPU/queue report period
+
+enum UiEventType {
+  UI_EVENT_SCAN_PROGRESS,      // text + value = percent
+  UI_EVENT_SCAN_TRAFFIC,       // value = frames, value2 = unique IDs
+  UI_EVENT_SCAN_DONE,          // results = finished session, ownership back to the UI
+  UI_EVENT_SESSION_CREATED,    // text = session ID ("" on failure), value = offline fallback
+  UI_EVENT_PAYMENT_STATUS,     // text = session ID, value = paid
+  UI_EVENT_RESULTS_SUBMITTED,  // value = success
+  UI_EVENT_BUTTON,             // timestampUs = edge that started the debounce
+  UI_EVENT_STATE_TIMEOUT,      // value = state generation the timer was armed for
+  UI_EVENT_SESSION_TIMEOUT,
+  UI_EVENT_TICK,               // Wake-up only - countdowns and polls recheck millis()
+  UI_EVENT_WIFI_CONNECTED,     // Got an IP - fetch a session if we still need one
+  UI_EVENT_TIMING_STAGED,      // A new timing profile is waiting for a session boundary
+  UI_EVENT_OTA_DONE            // value = new image staged for the next boot
+};
+
+struct UiEvent {
+  UiEventType type;
+  int value;
+  int value2;
+  uint32_t timestampUs;
+  const ScanSession* results;
+  char text[64];
+};
+
+enum NetRequestType {
+  NET_CREATE_SESSION,
+  NET_CHECK_PAYMENT,
+  NET_SUBMIT_RESULTS,
+  NET_FLUSH_METRICS,
+  NET_EXPORT_TRACE,
+  NET_FETCH_TIMING,
+  NET_CHECK_OTA
+};
+
+struct NetRequest {
+  NetRequestType type;
+  bool offlineFallback;        // NET_CREATE_SESSION from the button - fall back to offline mode
+  char transactionId[64];
+};
+
+struct ScanRequest {
+  ScanSession* session;        // Arena the scan task fills - the UI must not touch it until SCAN_DONE
+  bool replay;                 // Run the trace replay suite instead of a live scan (no SCAN_DONE)
+};
+
+// Where the SCANNING state is in its scan -> upload hand-off
+enum ScanPhase {
+  SCAN_PHASE_IDLE,
+  SCAN_PHASE_RUNNING,
+  SCAN_PHASE_UPLOADING
+};
+
+enum TaskId { TASK_SCAN, TASK_UI, TASK_NET, NUM_TASKS };
+
+struct TaskStats {
+  const char* name;
+  TaskHandle_t handle;                   // Labels this task's row in trace exports
+  QueueHandle_t queue;
+  UBaseType_t queueLength;
+  std::atomic<uint32_t> busyUs;          // Time spent working (not blocked on the queue)
+  std::atomic<uint32_t> queueHighWater;
+};
+
+TaskStats taskStats[NUM_TASKS];
+QueueHandle_t uiQueue   = NULL;
+QueueHandle_t netQueue  = NULL;
+QueueHandle_t scanQueue = NULL;
+ScanPhase scanPhase          = SCAN_PHASE_IDLE;
+unsigned long scanDispatchTime = 0;
+bool sessionRequestInFlight  = false;
+bool paymentCheckInFlight    = false;
+std::atomic<int> netJobsOutstanding(0);  // Queued or running on the net task - no light sleep while > 0
+
+// Event sources for the UI task - it blocks on uiQueue and wakes only for these
+esp_timer_handle_t stateTimer    = NULL;
+esp_timer_handle_t sessionTimer  = NULL;
+esp_timer_handle_t uiTickTimer   = NULL;
+esp_timer_handle_t debounceTimer = NULL;
+volatile uint32_t buttonEdgeUs   = 0;
+uint32_t stateGeneration         = 0;   // Bumped per transition so stale timeouts are ignored
+bool stateTimeoutPending         = false;
+
+// Idle power mode bookkeeping (UI task only)
+unsigned long lastActivityTime = 0;     // Last input or state transition
+int64_t pendingWakeUs          = 0;     // Set on light-sleep exit until the screen has settled and WiFi rejoined
+uint64_t idleSleptUs           = 0;     // Total time spent in light sleep, for duty cycle
+bool wifiPowerSave             = false;
+std::atomic<bool> wifiRejoinPending(false);  // WiFi stopped for sleep and not back yet - cleared on got-IP
+unsigned long wifiRejoinStartMs = 0;
+
+// Boot timeline - each stage is stamped with millis() since reset
+enum BootStage {
+  BOOT_STAGE_SETUP,        // setup() entered
+  BOOT_STAGE_DISPLAY,      // Panel initialised, splash drawn
+  BOOT_STAGE_TASKS,        // Pinned tasks running
+  BOOT_STAGE_FIRST_FRAME,  // First interactive screen drawn by the UI task
+  BOOT_STAGE_CAN,          // TWAI driver installed (runs on core 1 in parallel)
+  BOOT_STAGE_WIFI,         // Got an IP (association runs in the WiFi driver in parallel)
+  BOOT_STAGE_SESSION,      // Payment session created
+  NUM_BOOT_STAGES
+};
+
+const char* BOOT_STAGE_NAMES[NUM_BOOT_STAGES] = {
+  "setup", "display", "tasks", "firstFrame", "can", "wifi", "session"
+};
+const unsigned long BOOT_FIRST_FRAME_TARGET_MS = 1500;
+
+std::atomic<uint32_t> bootStageMs[NUM_BOOT_STAGES];  // 0 = not reached yet
+std::atomic<bool> bootReportPrinted(false);
+
+// ========== TRACING ==========
+// Begin/end/instant events with microsecond timestamps in a fixed RAM ring,
+// exported as Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev).
+// Built with -DTRACE_ENABLED=0 every macro compiles to nothing.
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED 1
+#endif
+
+#if TRACE_ENABLED
+const uint32_t TRACE_BUFFER_EVENTS = 1024;  // 16 bytes each - newest events win when it wraps
+const bool TRACE_SERIAL_EXPORT     = false; // Dump each session's trace to Serial (~77 KB - debug only)
+const bool TRACE_UPLOAD            = false; // Also POST each session's trace to the API
+
+struct TraceEvent {
+  const char* name;       // Must be a string literal or other static string
+  uint32_t timestampUs;
+  uint32_t tid;           // Recording task's handle - one timeline row per task
+  char phase;             // 'B' begin, 'E' end, 'i' instant
+};
+
+TraceEvent traceBuffer[TRACE_BUFFER_EVENTS];
+std::atomic<uint32_t> traceHead(0);
+
+void traceRecord(const char* name, char phase);
+
+struct TraceScope {
+  const char* name;
+  TraceScope(const char* scopeName) : name(scopeName) { traceRecord(name, 'B'); }
+  ~TraceScope() { traceRecord(name, 'E'); }
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_BEGIN(name)   traceRecord(name, 'B')
+#define TRACE_END(name)     traceRecord(name, 'E')
+#define TRACE_INSTANT(name) traceRecord(name, 'i')
+#define TRACE_SCOPE(name)   TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#else
+#define TRACE_BEGIN(name)
+#define TRACE_END(name)
+#define TRACE_INSTANT(name)
+#define TRACE_SCOPE(name)
+#endif
+
+const char* KIOSK_STATE_NAMES[] = {
+  "READY_SCREEN", "DISPLAY_QR", "PAYMENT_LOADING", "WAITING_PAYMENT", "READY_TO_SCAN",
+  "PREPARE_VEHICLE", "SCANNING", "DISPLAY_RESULTS", "SCAN_COMPLETE", "ERROR_STATE",
+  "VEHICLE_SETUP", "VEHICLE_DETECTING", "TROUBLESHOOTING"
+};
+
 // ========== FUNCTION DECLARATIONS ==========
 // Initialization
 void initializeDisplay();
@@ -156,8 +1001,16 @@ void disableCANTransceiver();
 void updateKioskState();
 void handleSessionTimeout();
 String createNewSession();
-bool checkPaymentStatus();
-bool submitDiagnosticResults();
+bool checkPaymentStatus(const char* sessionId, bool* answered = NULL);
+bool submitDiagnosticResults(const char* sessionId);
+int submitResultsCbor(const char* path);
+int submitResultsJson(const char* path);
+size_t encodeResultsCbor(uint8_t* buffer, size_t capacity);
+bool beginChunkedPost(WiFiClientSecure& client, const char* path, const char* contentType);
+int readHttpStatus(WiFiClient& client, unsigned long timeoutMs);
+void chunkedInit(ChunkedBodyWriter* writer, WiFiClient* client);
+void chunkedFlush(ChunkedBodyWriter* writer);
+void chunkedFinish(ChunkedBodyWriter* writer);
 
 // Enhanced OBD2 Protocol Detection
 typedef enum {
@@ -175,7 +1028,7 @@ struct OBD2ProtocolInfo {
   uint32_t baudRate;
   bool extendedId;
   uint32_t broadcastId;
-  String name;
+  const char* name;
 };
 
 obd2_protocol_t detectOBD2Protocol();
@@ -195,11 +1048,23 @@ void displayPrepareVehicle();
 void displayScanning(bool fullRedraw = false);
 void displayScanResults();
 void displayScanComplete();
-void displayError(String message);
-void drawQRCode(String data, int x, int y, int scale);
+void displayError(const char* message);
+void drawQRCode(const char* data, int x, int y, int scale);
+
+// Text rendering
+void textInit();
+void drawLabel(const char* label, int x, int y, uint8_t size, uint16_t fg, uint16_t bg);
+void drawTextf(int x, int y, uint8_t size, uint16_t fg, uint16_t bg, const char* format, ...);
+int textFit(const char* str, int x, uint8_t size);
+int textExpand(const char* str, int x, uint8_t size, uint16_t fg, uint16_t bg, uint16_t* out);
+void textPush(int x, int y, int width, uint8_t size, const uint16_t* pixels);
+void textLegacy(const char* str, int x, int y, uint8_t size, uint16_t fg);
+void screenDrawBegin();
+void screenDrawEnd();
 
 // Real CAN Bus Scanning
 void performDiagnosticScan();
+void finishDiagnosticScan(unsigned long scanStartTime);
 uint32_t autoDetectCANBaudRate();
 void listenForCANTraffic(uint32_t duration_ms);
 void probeOBD2ECUs();
@@ -208,20 +1073,200 @@ void scanAllDTCs();
 bool testECUCommunication(uint16_t ecuId);
 void scanForDTCs(uint16_t ecuId);
 void parseAndStoreDTC(uint8_t* data, int len, uint16_t ecuId);
+void storeDTCPayload(const uint8_t* payload, int len, uint16_t ecuId);
+FaultCode decodeFaultCode(uint8_t byte1, uint8_t byte2, uint16_t ecuId);
+FaultCode* addSessionCode(const FaultCode& fault);
+bool obdPhysicalRequest(uint32_t requestId, uint32_t responseId, const uint8_t* request, uint8_t len,
+                        IsoTpReceiver* rx, unsigned long timeoutMs, unsigned long maxWindowMs = UINT32_MAX);
+int queryDTCMode(uint32_t requestId, uint32_t responseId, uint8_t mode, unsigned long budgetMs = UINT32_MAX);
+void captureFreezeFrames(uint32_t requestId, uint32_t responseId, unsigned long budgetMs);
+int freezeFramePidLength(uint8_t pid);
+
+// Readiness monitors
+void printReadiness(const ReadinessReport& report);
+void queryReadiness(uint32_t requestId, uint32_t responseId);
 bool reinitializeCAN(uint32_t baudRate);
-void updateScanProgress(String message, int percentage);
+bool canTimingFor(uint32_t baudRate, twai_timing_config_t* timing);
+bool canSwitchInPlace(uint32_t baudRate, const twai_timing_config_t& timing);
+bool canInstallDriver(uint32_t baudRate, const twai_timing_config_t& timing);
+void updateScanProgress(const char* message, int percentage);
+
+// Response collection
+void openResponseWindow(ResponseCollector* collector, unsigned long timeoutMs,
+                        const uint32_t* expected, int expectedCount);
+bool receiveInWindow(ResponseCollector* collector, twai_message_t* response);
+void markResponder(ResponseCollector* collector, uint32_t responderId, bool finished);
+void closeResponseWindow(ResponseCollector* collector);
+bool isFinalResponse(const twai_message_t& response, uint8_t service);
+void addDiscoveredResponder(uint32_t responderId);
+
+// ECU registry
+EcuRecord* ecuObserve(const twai_message_t& response, unsigned long requestMs);
+EcuRecord* ecuFind(uint32_t responseId, bool extended);
+uint32_t ecuKey(uint32_t responseId, bool extended);
+uint32_t ecuRequestIdFor(uint32_t responseId, bool extended);
+uint32_t ecuServiceBit(uint8_t service);
+uint16_t ecuLatencyAvgMs(const EcuRecord& ecu);
+void printEcuRegistry();
+
+// CAN bus health
+esp_err_t canTransmit(const twai_message_t* msg, TickType_t ticksToWait);
+esp_err_t canReceive(twai_message_t* msg, TickType_t ticksToWait);
+void canHealthPoll();
+void canHealthSample(uint64_t nowUs);
+void canHealthCloseWindow(uint64_t nowUs);
+bool canAwaitRecovery(unsigned long timeoutMs);
+void canHealthDriverStarted(uint32_t baudRate, bool countersReset);
+void canHealthReset();
+void canHealthReport();
+uint32_t canFrameBits(const twai_message_t& msg);
+uint32_t canBusErrors();
+void canRejectBaudRate(uint32_t baudRate);
+bool canBaudRateRejected(uint32_t baudRate);
+void canPace(unsigned long baseMs);
+
+// CAN trace recorder
+void canTraceInit();
+void canTraceBegin();
+void canTraceRecord(const twai_message_t& msg, bool transmitted);
+void canTraceAnomaly(uint8_t anomaly);
+void canTraceEnd();
+bool canTraceSpill();
+void canTraceMarker(uint8_t code);
+CanTraceBlock* canTraceNextBlock(uint32_t nowUs);
+uint8_t canTraceCodeFlags(const FaultCode& code);
+uint8_t canBaudIndex(uint32_t baudRate);
+
+// Trace replay
+unsigned long scanMillis();
+void scanDelay(unsigned long ms);
+void runReplaySuite();
+void replayTraceFile(File& file, ReplaySummary* summary);
+esp_err_t replayTransmit(const twai_message_t& msg);
+esp_err_t replayReceive(twai_message_t* msg, TickType_t ticksToWait);
+void replaySwitchBaud(uint32_t baudRate);
+bool replayCompareResults(const CanTraceResults& expected);
+
+// Mode 09 vehicle information
+void collectVehicleInfo();
+int mode09Targets(uint8_t infoType, int* targets);
+int mode09Request(uint8_t infoType, const int* targets, int targetCount, unsigned long maxWindowMs = UINT32_MAX);
+void decodeVehicleInfo(VehicleInfoRecord* record, const uint8_t* payload, int len);
+bool mode09Supported(const VehicleInfoRecord& record, uint8_t infoType);
+void copyPrintable(char* out, const uint8_t* in, int len);
+bool vinCacheLoad(const char* vin);
+void vinCacheStore();
+
+// ELM327/STN adapter backend
+void elmInit();
+void elmSelect(bool active);
+obd2_protocol_t elmDetectProtocol();
+bool elmConfigure(bool extended);
+bool elmCommand(const char* command);
+bool elmSetHeader(uint32_t identifier, bool extended);
+esp_err_t elmTransmit(const twai_message_t& msg);
+esp_err_t elmReceive(twai_message_t* msg, TickType_t ticksToWait);
+void elmPoll(unsigned long waitMs);
+bool elmDrain(unsigned long timeoutMs);
+void elmEndLine();
+void elmReport();
+
+// K-line backend
+void klineInit();
+obd2_protocol_t klineConnect();
+bool klineFastInit();
+bool klineSlowInit();
+void klineReleaseUart();
+void klineOpenUart();
+void klineScan();
+int klineRequest(const uint8_t* request, int length, KLineMessage* responses, int maxResponses);
+bool klineSend(const uint8_t* data, int length);
+int klineReceive(KLineMessage* messages, int maxMessages);
+void klineTxTick(void* arg);
+bool klineReadByte(uint8_t* out, unsigned long timeoutMs);
+
+// ISO-TP transport
+bool isoTpFeed(IsoTpReceiver* rx, const twai_message_t& frame);
+bool isoTpSendSingleFrame(uint32_t id, bool extended, const uint8_t* payload, uint8_t len);
+
+// UDS module scanning
+void scanUDSModules();
+int udsPipelinedRequest(const uint8_t* request, uint8_t len, bool presentOnly);
+void sendUDSTesterPresent();
+
+// Fleet telemetry
+inline void metricIncrement(MetricCounter counter, uint32_t amount = 1);
+void metricRecord(MetricHistogram histogram, uint32_t value);
+size_t encodeMetrics(uint8_t* buffer, size_t capacity);
+bool flushMetrics();
+void loadTimingProfile();
+bool fetchTimingProfile();
+bool validTimingProfile(const TimingProfile& profile);
+void applyPendingTiming();
+TimingIdentity timingIdentity();
+
+// Delta OTA
+void otaBootCheck();
+void otaCheckBootHealth();
+bool otaCheckForUpdate();
+bool otaApplyDelta(HTTPClient& http, const OtaDeltaHeader& header, OtaFlashIo* io);
+bool otaReadExact(WiFiClient* stream, uint8_t* buffer, size_t length);
+bool otaHashPartition(const esp_partition_t* partition, uint32_t length, uint8_t* sha);
+bool otaVerifySignature(const OtaDeltaHeader& header);
+void otaPoll();
+void otaReboot();
+
+// Task architecture
+void createTaskQueues();
+void startTasks();
+void scanTask(void* param);
+void uiTask(void* param);
+void networkTask(void* param);
+void handleUiEvent(const UiEvent& event);
+bool postUiEvent(const UiEvent& event, TickType_t wait);
+bool postNetRequest(NetRequestType type, bool offlineFallback = false);
+void noteQueueDepth(TaskId task);
+void reportTaskStats();
+void drawScanProgress(const char* message, int percentage);
+void drawTrafficCounter(int frameCount, int uniqueCount);
+void initializeEventSources();
+void enterState(KioskState next);
+unsigned long stateTimeoutMs(KioskState state);
+bool stateNeedsTick(KioskState state);
+bool consumeStateTimeout();
+void startSessionClock();
+void IRAM_ATTR onButtonEdge();
+void onButtonDebounced(void* arg);
+void onStateTimer(void* arg);
+void onSessionTimer(void* arg);
+void onUiTick(void* arg);
+bool canEnterIdleSleep(unsigned long* sleepMs);
+void enterIdleSleep(unsigned long sleepMs);
+void setWiFiPowerSave(bool enabled);
+void drawBootSplash();
+void canBootTask(void* param);
+void onWiFiGotIP(WiFiEvent_t event);
+void markBootStage(BootStage stage);
+void printBootReport();
+void traceExportChrome(Print& out);
+bool uploadTrace();
 
 // Utility Functions
 void handleButtonPress();
 void resetToReady();
+void resetScanSession();
+uint8_t heapFragmentationPercent();
+void logHeapStats();
 void resetDisplayFlags();
 
 // ========== SETUP ==========
 void setup() {
+  TRACE_SCOPE("setup");
   Serial.begin(115200);
+  markBootStage(BOOT_STAGE_SETUP);
   
-  delay(1000);
-  
+  // No settle delay for the serial monitor - the boot report is printed again
+  // once every stage has completed, so nothing important is lost
   Serial.println("=== OBD2 AI KIOSK - CLEAN VERSION ===");
   Serial.println("Board: New ESP32 with 2.2\" LCD");
   Serial.println("Features: Full functionality, cleaner code");
@@ -233,20 +1278,27 @@ void setup() {
   digitalWrite(CAN_RS_PIN, HIGH);  // Start in standby mode (Honda-safe)
   Serial.println("🛡️ SN65HVD230 initialized in standby mode (Honda-safe)");
   
-  // Initialize all systems
+  // Staged boot: panel first, then WiFi association and CAN install in parallel.
+  // Nothing below waits on the network - the session arrives as an event
   initializeDisplay();
+  markBootStage(BOOT_STAGE_DISPLAY);
+  createTaskQueues();
   initializeWiFi();
-  initializeCAN();
+  xTaskCreatePinnedToCore(canBootTask, "canBoot", 4096, NULL, SCAN_TASK_PRIORITY, NULL, SCAN_TASK_CORE);
   
   // Setup button (keeping for potential manual override)
   pinMode(SCAN_BUTTON, INPUT_PULLUP);
   
   // Configure all unused pins to prevent floating and spurious LED activation
   Serial.println("🔧 Configuring unused pins to prevent floating...");
-  pinMode(UNUSED_35, INPUT_PULLDOWN);  // UNUSED pin 35
-  pinMode(UNUSED_36, INPUT_PULLDOWN);  // UNUSED pin 36  
-  pinMode(UNUSED_37, INPUT_PULLDOWN);  // UNUSED pin 37
-  pinMode(UNUSED_46, INPUT_PULLDOWN);  // UNUSED pin 46
+  if (!ELM_ENABLED) {
+    pinMode(ELM_RX, INPUT_PULLDOWN);  // Pin 35 - no adapter fitted
+    pinMode(ELM_TX, INPUT_PULLDOWN);  // Pin 36
+  }
+  if (!K_LINE_ENABLED) {
+    pinMode(K_LINE_TX, INPUT_PULLDOWN);  // Pin 37 - no K-line transceiver fitted
+    pinMode(K_LINE_RX, INPUT_PULLDOWN);  // Pin 46 - strapping pin, never driven here
+  }
   
   // Configure used pins that need specific states
   pinMode(RGB_OUT, OUTPUT);     // Pin 21 - RGB LED control
@@ -274,102 +1326,93 @@ void setup() {
     currentState = READY_TO_SCAN;
     sessionStartTime = millis();
     Serial.println("✓ TEST mode initialized, ready to scan immediately");
+    markBootStage(BOOT_STAGE_SESSION);  // No server session in test mode
   } else {
-    // Normal kiosk mode - Create session immediately on boot with retry logic
-    Serial.println("🚀 Boot-to-scan mode: Creating session automatically...");
-    
-    // Try to create session with retries
-    int retryCount = 0;
-    while (retryCount < 3 && transactionId.length() == 0) {
-      if (retryCount > 0) {
-        Serial.printf("🔄 Retry %d/3: Attempting to create session...\n", retryCount);
-        delay(2000); // Wait 2 seconds between retries
-      }
-      
-      transactionId = createNewSession();
-      retryCount++;
-    }
-    
-    if (transactionId.length() > 0) {
-      currentState = DISPLAY_QR;
-      sessionStartTime = millis();
-      lastPaymentCheck = millis(); // Initialize payment polling
-      Serial.println("✓ Session created on boot: " + transactionId);
-      Serial.println("✓ QR code will be displayed immediately");
-    } else {
-      Serial.println("❌ Failed to create session after 3 attempts");
-      Serial.println("❌ WiFi: " + String(WiFi.status() == WL_CONNECTED ? "Connected" : "Disconnected"));
-      Serial.println("⏰ Will retry session creation in main loop...");
-      currentState = READY_SCREEN; // Fallback, but will retry in loop
-    }
+    // Normal kiosk mode - the ready screen shows at once and switches to the QR
+    // code when the session created on WiFi connect comes back
+    Serial.println("🚀 Boot-to-scan mode: session will be created as soon as WiFi is up");
+    currentState = READY_SCREEN;
   }
   
   stateStartTime = millis();
+  loadTimingProfile();
+  metricsTiming = timingIdentity();  // Counters since boot belong to the profile we booted with
+  otaBootCheck();
+  startTasks();
+  markBootStage(BOOT_STAGE_TASKS);
+  
+  if (REPLAY_ON_BOOT) {
+    // Queued ahead of any customer scan, so the scan task runs it first
+    ScanRequest request = { &session, true };
+    xQueueSend(scanQueue, &request, 0);
+  }
   Serial.println("✓ Kiosk initialized in boot-to-scan mode");
 }
 
 // ========== MAIN LOOP ==========
 void loop() {
-  // Button still available for manual override/debugging
-  handleButtonPress();
-  updateKioskState();
-  handleSessionTimeout();
-  delay(50);
+  // All work lives in the pinned tasks started by setup() - retire the Arduino loop task
+  vTaskDelete(NULL);
 }
 
 // ========== INITIALIZATION FUNCTIONS ==========
 void initializeDisplay() {
+  TRACE_SCOPE("initializeDisplay");
   // Set up backlight pin (TFT_BL = 15)
   pinMode(15, OUTPUT);
   digitalWrite(15, HIGH); // Turn on backlight
   
   tft.init();
   tft.setRotation(1); // 90 degrees rotation for proper orientation (320x240)
-  tft.fillScreen(TFT_BLACK);
-  tft.setTextColor(TFT_WHITE, TFT_BLACK);
-  
-  // Test display with a simple message
-  tft.setTextSize(2);
-  tft.setCursor(10, 10);
-  tft.println("KIOSK");
-  tft.setCursor(10, 40);
-  tft.println("STARTING...");
-  delay(2000);
-  tft.fillScreen(TFT_BLACK); // Clear test message
+  textInit();
+  drawBootSplash();
   
   Serial.println("✓ Display initialized (240x320) with backlight");
 }
 
+void drawBootSplash() {
+  // Same header as the ready screen, so the hand-over to it doesn't flash
+  tft.fillScreen(TFT_BLACK);
+  tft.fillRect(0, 0, SCREEN_WIDTH, 40, TFT_DARKGREEN);
+  drawLabel("OBD2 KIOSK", 20, 8, 2, TFT_WHITE, TFT_DARKGREEN);
+  drawLabel("Vehicle Diagnostic Scanner", 30, 25, 1, TFT_WHITE, TFT_DARKGREEN);
+  drawLabel("Starting...", 20, 160, 1, TFT_WHITE, TFT_BLACK);
+}
+
 void initializeWiFi() {
+  // Association runs in the WiFi driver task - onWiFiGotIP() reports back
+  WiFi.onEvent(onWiFiGotIP, ARDUINO_EVENT_WIFI_STA_GOT_IP);
   WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
-  
-  Serial.print("Connecting to WiFi");
-  while (WiFi.status() != WL_CONNECTED && millis() < 10000) {
-    delay(500);
-    Serial.print(".");
-  }
-  
-  if (WiFi.status() == WL_CONNECTED) {
-    Serial.println("\n✓ WiFi connected: " + WiFi.localIP().toString());
-  } else {
-    Serial.println("\n❌ WiFi connection failed");
-  }
+  Serial.println("Connecting to WiFi in the background");
+}
+
+void onWiFiGotIP(WiFiEvent_t event) {
+  Serial.println("✓ WiFi connected: " + WiFi.localIP().toString());
+  TRACE_INSTANT("wifiGotIP");
+  markBootStage(BOOT_STAGE_WIFI);
+  wifiRejoinPending = false;  // Back from idle sleep - the UI task records the full wake time
+  
+  UiEvent uiEvent = {};
+  uiEvent.type = UI_EVENT_WIFI_CONNECTED;
+  postUiEvent(uiEvent, 0);
+}
+
+void canBootTask(void* param) {
+  // Driver install runs on the scan core while the UI comes up on core 0
+  canTraceInit();
+  initializeCAN();
+  if (K_LINE_ENABLED) klineInit();
+  markBootStage(BOOT_STAGE_CAN);
+  if (ELM_ENABLED) elmInit();  // After the stage mark - a missing adapter costs ELMduino's command timeouts
+  vTaskDelete(NULL);
 }
 
 void initializeCAN() {
-  twai_general_config_t g_config = TWAI_GENERAL_CONFIG_DEFAULT(CAN_TX_PIN, CAN_RX_PIN, TWAI_MODE_NORMAL);
-  twai_timing_config_t t_config  = TWAI_TIMING_CONFIG_500KBITS();
-  twai_filter_config_t f_config  = TWAI_FILTER_CONFIG_ACCEPT_ALL();
-  
-  if (twai_driver_install(&g_config, &t_config, &f_config) == ESP_OK) {
-    Serial.println("✓ CAN driver installed");
-  } else {
-    Serial.println("❌ Failed to install CAN driver");
-    return;
-  }
+  TRACE_SCOPE("initializeCAN");
+  twai_timing_config_t t_config = TWAI_TIMING_CONFIG_500KBITS();
   
-  if (twai_start() == ESP_OK) {
-    Serial.println("✓ CAN driver started");
+  if (canInstallDriver(500000, t_config)) {
+    Serial.println("✓ CAN driver installed and started");
     // Enable transceiver for vehicle detection
     enableCANTransceiver();
   } else {
@@ -398,19 +1441,12 @@ void updateKioskState() {
       displayReadyScreen();
       
       // If we're in ready screen but should be in QR mode, try to create session
-      if (transactionId.length() == 0 && WiFi.status() == WL_CONNECTED) {
+      if (transactionId.length() == 0 && WiFi.status() == WL_CONNECTED && !sessionRequestInFlight &&
+          !otaHoldSessions) {
         static unsigned long lastRetryAttempt = 0;
-        if (millis() - lastRetryAttempt > 10000) { // Try every 10 seconds
+        if (millis() - lastRetryAttempt >= 10000) { // Try every 10 seconds
           Serial.println("🔄 Attempting to create session from ready screen...");
-          transactionId = createNewSession();
-          
-          if (transactionId.length() > 0) {
-            Serial.println("✅ Session created successfully, switching to QR mode");
-            currentState = DISPLAY_QR;
-            sessionStartTime = millis();
-            stateStartTime = millis();
-            lastPaymentCheck = millis(); // Initialize payment polling
-          }
+          postNetRequest(NET_CREATE_SESSION);
           lastRetryAttempt = millis();
         }
       }
@@ -419,35 +1455,24 @@ void updateKioskState() {
     case DISPLAY_QR:
       displayQRCode();
       // Check payment status while showing QR code - no automatic transition
-      if (millis() - lastPaymentCheck > PAYMENT_POLL_INTERVAL) {
+      if (millis() - lastPaymentCheck >= PAYMENT_POLL_INTERVAL && !paymentCheckInFlight) {
         lastPaymentCheck = millis();
-        if (checkPaymentStatus()) {
-          Serial.println("✅ Payment confirmed! Preparing for vehicle scan...");
-          currentState = PREPARE_VEHICLE;  // Give user time to prepare vehicle
-          sessionStartTime = millis();
-          stateStartTime = millis();
-        }
+        paymentCheckInFlight = postNetRequest(NET_CHECK_PAYMENT);
       }
       break;
       
     case PAYMENT_LOADING:
       displayPaymentLoading();
-      currentState = WAITING_PAYMENT;
-      stateStartTime = millis();
+      enterState(WAITING_PAYMENT);
       break;
       
     case WAITING_PAYMENT:
       displayWaitingPayment();
       
       // Check payment status periodically
-      if (millis() - lastPaymentCheck > PAYMENT_POLL_INTERVAL) {
+      if (millis() - lastPaymentCheck >= PAYMENT_POLL_INTERVAL && !paymentCheckInFlight) {
         lastPaymentCheck = millis();
-        if (checkPaymentStatus()) {
-          Serial.println("✅ Payment confirmed! Preparing for vehicle scan...");
-          currentState = PREPARE_VEHICLE;  // Give user time to prepare vehicle
-          sessionStartTime = millis();
-          stateStartTime = millis();
-        }
+        paymentCheckInFlight = postNetRequest(NET_CHECK_PAYMENT);
       }
       break;
       
@@ -459,9 +1484,8 @@ void updateKioskState() {
       {
         displayPrepareVehicle();
         // Give user time to turn on ignition and prepare
-        if (millis() - stateStartTime > 15000) { // 15 seconds to prepare
-          currentState = SCANNING;
-          stateStartTime = millis();
+        if (consumeStateTimeout()) {
+          enterState(SCANNING);
           Serial.println("🔍 Starting diagnostic scan after preparation time...");
         }
       }
@@ -469,43 +1493,39 @@ void updateKioskState() {
       
     case SCANNING:
       displayScanning();
-      // Ensure transceiver is enabled for scanning (especially important for retries)
-      enableCANTransceiver();
-      performDiagnosticScan();
-      
-      // Submit diagnostic results to database for AI analysis and email
-      Serial.println("📤 Submitting diagnostic results to server...");
-      if (submitDiagnosticResults()) {
-        Serial.println("✅ Diagnostic results submitted successfully");
-      } else {
-        Serial.println("❌ Failed to submit diagnostic results");
+      if (scanPhase == SCAN_PHASE_IDLE) {
+        // Ensure transceiver is enabled for scanning (especially important for retries)
+        enableCANTransceiver();
+        metricIncrement(METRIC_SCANS_STARTED);
+        
+        // Hand the session arena to the scan engine on core 1 - SCAN_DONE hands it back
+        ScanRequest request = { &session, false };
+        scanPhase = SCAN_PHASE_RUNNING;
+        scanDispatchTime = millis();
+        xQueueSend(scanQueue, &request, portMAX_DELAY);
+        noteQueueDepth(TASK_SCAN);
       }
-      
-      currentState = DISPLAY_RESULTS;
-      stateStartTime = millis();
+      // SCAN_DONE and RESULTS_SUBMITTED events move on to DISPLAY_RESULTS
       break;
       
     case DISPLAY_RESULTS:
       {
         displayScanResults();
         
+        // Display time is up - stateTimeoutMs() picked 5 s for "no vehicle", 3 s otherwise
+        if (!consumeStateTimeout()) break;
+        
         // Check if we should retry (no vehicle detected and retries available)
-        if (!vehicleDetected && scanRetryCount < 2) { // Allow up to 2 retries
-          if (millis() - stateStartTime > 5000) { // Show "no vehicle" for 5 seconds
-            scanRetryCount++;
-            Serial.printf("🔄 Retry attempt %d/2 - returning to preparation...\n", scanRetryCount);
-            currentState = PREPARE_VEHICLE;
-            stateStartTime = millis();
-          }
+        if (!session.vehicleDetected && scanRetryCount < 2) { // Allow up to 2 retries
+          scanRetryCount++;
+          Serial.printf("🔄 Retry attempt %d/2 - returning to preparation...\n", scanRetryCount);
+          enterState(PREPARE_VEHICLE);
         } else {
           // Vehicle detected OR max retries reached - proceed to completion
-          if (millis() - stateStartTime > 3000) { // Show results for 3 seconds
-            currentState = SCAN_COMPLETE;
-            stateStartTime = millis();
-            Serial.println("➡️ Transitioning to scan completion screen");
-            Serial.println("🔍 DEBUG: vehicleDetected=" + String(vehicleDetected ? "true" : "false"));
-            Serial.println("🔍 DEBUG: detectedCodes.size()=" + String(detectedCodes.size()));
-          }
+          enterState(SCAN_COMPLETE);
+          Serial.println("➡️ Transitioning to scan completion screen");
+          Serial.printf("🔍 DEBUG: vehicleDetected=%s\n", session.vehicleDetected ? "true" : "false");
+          Serial.printf("🔍 DEBUG: detectedCodes=%d\n", session.codes.size());
         }
       }
       break;
@@ -514,7 +1534,7 @@ void updateKioskState() {
       {
         displayScanComplete();
         // Auto-return to ready after showing completion message
-        if (millis() - stateStartTime > 15000) { // 15 seconds to read and disconnect
+        if (consumeStateTimeout()) {
           Serial.println("🔄 Auto-reset timeout reached, returning to ready state");
           resetToReady();
         }
@@ -523,7 +1543,7 @@ void updateKioskState() {
       
     case ERROR_STATE:
       // Auto-recover from error state
-      if (millis() - stateStartTime > 5000) {
+      if (consumeStateTimeout()) {
         resetToReady();
       }
       break;
@@ -535,62 +1555,62 @@ void handleSessionTimeout() {
   if ((currentState == WAITING_PAYMENT || currentState == READY_TO_SCAN || 
        currentState == SCANNING) && sessionStartTime > 0) {
     
-    if (millis() - sessionStartTime > SESSION_TIMEOUT_MS) {
-      displayError("Session timeout - returning to home");
-      delay(2000);
-      resetToReady();
+    unsigned long elapsed = millis() - sessionStartTime;
+    if (elapsed < SESSION_TIMEOUT_MS) {
+      // Fired early (clock restarted meanwhile) - wait out the rest
+      esp_timer_start_once(sessionTimer, (SESSION_TIMEOUT_MS - elapsed) * 1000ULL);
+      return;
+    }
+    
+    // A running scan/upload owns the session and ends on its own timeouts -
+    // check again once it has had the chance to move the kiosk on
+    if (scanPhase != SCAN_PHASE_IDLE) {
+      esp_timer_start_once(sessionTimer, SESSION_RECHECK_MS * 1000ULL);
+      return;
     }
+    
+    displayError("Session timeout - returning to home");
+    delay(2000);
+    resetToReady();
   }
 }
 
 // ========== BUTTON HANDLING ==========
 void handleButtonPress() {
+  // Called for each debounced UI_EVENT_BUTTON - edges come from onButtonEdge()
   static unsigned long lastPress = 0;
-  static bool buttonPressed = false;
-  
-  bool currentButtonState = !digitalRead(SCAN_BUTTON);
   
-  if (currentButtonState && !buttonPressed && (millis() - lastPress > 300)) {
-    buttonPressed = true;
+  if (lastPress == 0 || millis() - lastPress > 300) {
     lastPress = millis();
     
-    Serial.println("🔘 Button pressed in state: " + String(currentState));
+    Serial.printf("🔘 Button pressed in state: %d\n", currentState);
     
     switch (currentState) {
       case READY_SCREEN:
         // Try session creation first, fallback to test mode if it fails
-        Serial.println("🔗 Attempting session creation...");
-        transactionId = createNewSession();
-        if (transactionId.length() > 0) {
-          Serial.println("✅ Session created successfully: " + transactionId);
-          currentState = DISPLAY_QR;
-          stateStartTime = millis();
-          lastPaymentCheck = millis(); // Initialize payment polling
-        } else {
-          Serial.println("❌ Session creation failed, using offline test mode");
-          transactionId = "OFFLINE_" + String(millis());
-          currentState = READY_TO_SCAN;  // Skip QR/payment, go directly to scan
-          stateStartTime = millis();
+        // Result arrives as UI_EVENT_SESSION_CREATED, falling back to offline test mode
+        otaHoldSessions = false;  // A customer outranks the firmware update
+        if (!sessionRequestInFlight) {
+          Serial.println("🔗 Attempting session creation...");
+          postNetRequest(NET_CREATE_SESSION, true);
         }
         break;
         
       case READY_TO_SCAN:
         // Start diagnostic scan
-        currentState = SCANNING;
-        stateStartTime = millis();
+        enterState(SCANNING);
         break;
         
       default:
         // Button press in other states - could be used for cancellation
         break;
     }
-  } else if (!currentButtonState) {
-    buttonPressed = false;
   }
 }
 
 // ========== SESSION MANAGEMENT ==========
 String createNewSession() {
+  TRACE_SCOPE("http:createSession");
   if (WiFi.status() != WL_CONNECTED) {
     Serial.println("❌ No WiFi connection for session creation");
     return "";
@@ -603,7 +1623,7 @@ String createNewSession() {
   http.begin(String(API_BASE_URL) + "/kiosk/create-session");
   http.addHeader("Content-Type", "application/json");
   
-  DynamicJsonDocument doc(200);
+  StaticJsonDocument<200> doc;
   doc["kioskId"]  = KIOSK_ID;
   doc["deviceId"] = WiFi.macAddress();
   
@@ -612,15 +1632,19 @@ String createNewSession() {
   
   Serial.println("📤 Sending request: " + requestBody);
   
+  unsigned long httpStart = millis();
   int httpCode = http.POST(requestBody);
   String response = http.getString();
   http.end();
+  metricIncrement(METRIC_HTTP_REQUESTS);
+  metricRecord(METRIC_HTTP_LATENCY_MS, millis() - httpStart);
+  if (httpCode != 200) metricIncrement(METRIC_HTTP_FAILURES);
   
   Serial.println("📥 Response code: " + String(httpCode));
   Serial.println("📥 Response body: " + response);
   
   if (httpCode == 200) {
-    DynamicJsonDocument responseDoc(500);
+    StaticJsonDocument<500> responseDoc;
     deserializeJson(responseDoc, response);
     String sessionId = responseDoc["sessionId"];
     
@@ -633,19 +1657,28 @@ String createNewSession() {
   }
 }
 
-bool checkPaymentStatus() {
-  if (transactionId.length() == 0) return false;
+bool checkPaymentStatus(const char* sessionId, bool* answered) {
+  TRACE_SCOPE("http:checkPayment");
+  if (answered != NULL) *answered = false;
+  if (sessionId[0] == '\0') return false;
   
+  char url[192];
+  snprintf(url, sizeof(url), "%s/kiosk/check-payment/%s", API_BASE_URL, sessionId);
   HTTPClient http;
-  http.begin(String(API_BASE_URL) + "/kiosk/check-payment/" + transactionId);
+  http.begin(url);
   
+  unsigned long httpStart = millis();
   int httpCode = http.GET();
   String response = http.getString();
   http.end();
+  metricIncrement(METRIC_HTTP_REQUESTS);
+  metricRecord(METRIC_HTTP_LATENCY_MS, millis() - httpStart);
+  if (httpCode != 200) metricIncrement(METRIC_HTTP_FAILURES);
   
   if (httpCode == 200) {
-    DynamicJsonDocument doc(500);
-    deserializeJson(doc, response);
+    StaticJsonDocument<500> doc;
+    bool parsed = !deserializeJson(doc, response);
+    if (answered != NULL) *answered = parsed;
     bool paid = doc["paid"];
     
     if (paid) {
@@ -657,69 +1690,43 @@ bool checkPaymentStatus() {
   return false;
 }
 
-bool submitDiagnosticResults() {
+bool submitDiagnosticResults(const char* sessionId) {
+  TRACE_SCOPE("submit");
   if (WiFi.status() != WL_CONNECTED) {
     Serial.println("❌ No WiFi connection for results submission");
     return false;
   }
   
-  if (transactionId.length() == 0) {
+  if (sessionId[0] == '\0') {
     Serial.println("❌ No transaction ID for results submission");
     return false;
   }
   
   Serial.println("📡 Submitting diagnostic results to API...");
   
-  HTTPClient http;
-  http.setTimeout(10000);  // 10 second timeout for results submission
-  String endpoint = String(API_BASE_URL) + "/api/obd2/kiosk/" + KIOSK_ID + "/session/" + transactionId + "/results";
-  http.begin(endpoint);
-  http.addHeader("Content-Type", "application/json");
-  
-  // Create JSON payload with diagnostic results
-  DynamicJsonDocument doc(2048);  // Larger buffer for diagnostic data
+  char path[160];
+  snprintf(path, sizeof(path), "/api/obd2/kiosk/%s/session/%s/results", KIOSK_ID, sessionId);
   
-  // Add fault codes array
-  JsonArray faultCodesArray = doc.createNestedArray("faultCodes");
-  for (const auto& code : detectedCodes) {
-    JsonObject faultObj = faultCodesArray.createNestedObject();
-    faultObj["code"] = code.code;
-    faultObj["system"] = code.system;
+  Serial.println("📤 Sending diagnostic results:");
+  Serial.printf("   Fault codes: %d\n", session.codes.size());
+  Serial.printf("   Active ECUs: %d\n", session.ecus.size());
+  Serial.printf("   Vehicle detected: %s\n", session.vehicleDetected ? "Yes" : "No");
+  
+  int httpCode = -1;
+  if (!resultsCborRejected) {
+    httpCode = submitResultsCbor(path);
+    if (httpCode == 415) {
+      // Server doesn't speak CBOR yet - remember that and resend as JSON
+      Serial.println("ℹ️ Server rejected CBOR results, falling back to JSON");
+      resultsCborRejected = true;
+    }
   }
-  
-  // Add vehicle info (this will be merged with payment data on server)
-  JsonObject vehicleInfo = doc.createNestedObject("vehicleInfo");
-  vehicleInfo["ecuCount"] = activeECUs.size();
-  vehicleInfo["vehicleDetected"] = vehicleDetected;
-  vehicleInfo["scanTimestamp"] = millis();
-  
-  // Add basic AI analysis summary (server will do full AI processing)
-  String basicAnalysis;
-  if (detectedCodes.size() > 0) {
-    basicAnalysis = "ESP32 scan detected " + String(detectedCodes.size()) + " fault code(s). ";
-  } else if (vehicleDetected) {
-    basicAnalysis = "ESP32 scan completed successfully. No fault codes detected. Vehicle systems appear healthy. ";
-  } else {
-    basicAnalysis = "ESP32 scan could not detect vehicle. Please ensure OBD2 cable is connected and ignition is on. ";
+  if (resultsCborRejected) {
+    httpCode = submitResultsJson(path);
   }
-  basicAnalysis += "Full AI analysis and professional report will be generated server-side.";
-  doc["aiAnalysis"] = basicAnalysis;
   
-  String requestBody;
-  serializeJson(doc, requestBody);
-  
-  Serial.println("📤 Sending diagnostic results:");
-  Serial.println("   Fault codes: " + String(detectedCodes.size()));
-  Serial.println("   Active ECUs: " + String(activeECUs.size()));
-  Serial.println("   Vehicle detected: " + String(vehicleDetected ? "Yes" : "No"));
-  
-  int httpCode = http.POST(requestBody);
-  String response = http.getString();
-  http.end();
-  
-  Serial.println("📥 Results response code: " + String(httpCode));
+  Serial.printf("📥 Results response code: %d\n", httpCode);
   if (httpCode != 201 && httpCode != 200) {
-    Serial.println("📥 Error response: " + response);
     return false;
   }
   
@@ -727,52 +1734,460 @@ bool submitDiagnosticResults() {
   return true;
 }
 
-// ========== DISPLAY FUNCTIONS (Adapted for 240x320) ==========
-void displayReadyScreen() {
-  static bool displayed = false;
+int submitResultsCbor(const char* path) {
+  TRACE_SCOPE("http:resultsCbor");
+  static uint8_t blob[3072];
+  unsigned long encodeStart = micros();
+  size_t blobLength = encodeResultsCbor(blob, sizeof(blob));
+  unsigned long encodeTime = micros() - encodeStart;
+  if (blobLength == 0) {
+    Serial.println("❌ Results CBOR overflowed its buffer, sending JSON instead");
+    return submitResultsJson(path);
+  }
+  Serial.printf("📦 CBOR results: %d bytes, encoded in %lu us\n", (int)blobLength, encodeTime);
   
-  // Redraw if forced or not displayed
-  if (displayed && !forceRedraw) return;
-  displayed = true;
-  forceRedraw = false; // Clear the force redraw flag
+  char url[224];
+  snprintf(url, sizeof(url), "%s%s", API_BASE_URL, path);
   
-  tft.fillScreen(TFT_BLACK);
+  HTTPClient http;
+  http.setTimeout(RESULTS_HTTP_TIMEOUT_MS);
+  http.begin(url);
+  http.addHeader("Content-Type", "application/cbor");
+  http.addHeader("Accept", "application/json");
   
-  // Header (adapted for smaller screen)
-  tft.fillRect(0, 0, SCREEN_WIDTH, 40, TFT_DARKGREEN);
-  tft.setTextSize(2);
-  tft.setTextColor(TFT_WHITE);
-  tft.setCursor(20, 8);
-  tft.println("OBD2 KIOSK");
-  tft.setTextSize(1);
-  tft.setCursor(30, 25);
-  tft.println("Vehicle Diagnostic Scanner");
+  unsigned long httpStart = millis();
+  int httpCode = http.POST(blob, blobLength);
+  http.end();
+  metricIncrement(METRIC_HTTP_REQUESTS);
+  metricRecord(METRIC_HTTP_LATENCY_MS, millis() - httpStart);
+  if (httpCode != 201 && httpCode != 200 && httpCode != 415) metricIncrement(METRIC_HTTP_FAILURES);
+  return httpCode;
+}
+
+size_t encodeResultsCbor(uint8_t* buffer, size_t capacity) {
+  // Compact session encoding: raw 16-bit DTCs and ECU IDs, no prose - the server
+  // renders descriptions and the analysis text itself
+  CborWriter writer;
+  cborInit(&writer, buffer, capacity);
+  bool hasReadiness = session.readiness.hasStatus;
+  cborBeginMap(&writer, hasReadiness ? 12 : 11);
+  
+  cborWriteText(&writer, "v");
+  cborWriteUInt(&writer, RESULTS_FORMAT_VERSION);
+  
+  cborWriteText(&writer, "detected");
+  cborWriteBool(&writer, session.vehicleDetected);
+  
+  // ScanLink: 0 TWAI, 1 ELM327, 2 STN, 3 K-line - latencies are only comparable within one link
+  cborWriteText(&writer, "link");
+  cborWriteUInt(&writer, session.link);
+  
+  // [rawCode, ecu, flags, status, failureType, passes] - flags: bit0 pending, bit1 permanent
+  cborWriteText(&writer, "dtcs");
+  cborBeginArray(&writer, session.codes.size());
+  for (const auto& code : session.codes) {
+    cborBeginArray(&writer, 6);
+    cborWriteUInt(&writer, code.rawCode);
+    cborWriteUInt(&writer, code.ecuId);
+    cborWriteUInt(&writer, (code.isPending ? 0x01 : 0) | (code.isPermanent ? 0x02 : 0));
+    cborWriteUInt(&writer, code.status);
+    cborWriteUInt(&writer, code.failureType);
+    cborWriteUInt(&writer, code.passes);
+  }
   
-  // Main content
-  tft.setTextSize(3);
-  tft.setTextColor(TFT_DARKGREEN);
-  tft.setCursor(70, 100);
-  tft.println("READY");
+  // [responseId, requestId, responses, minMs, avgMs, maxMs, nrcs, services]
+  cborWriteText(&writer, "ecus");
+  cborBeginArray(&writer, session.ecus.size());
+  for (const EcuRecord& ecu : session.ecus) {
+    cborBeginArray(&writer, 8);
+    cborWriteUInt(&writer, ecu.responseId);
+    cborWriteUInt(&writer, ecu.requestId);
+    cborWriteUInt(&writer, ecu.responses);
+    cborWriteUInt(&writer, ecu.latencyMinMs);
+    cborWriteUInt(&writer, ecuLatencyAvgMs(ecu));
+    cborWriteUInt(&writer, ecu.latencyMaxMs);
+    cborWriteUInt(&writer, ecu.nrcCount);
+    cborWriteUInt(&writer, ecu.services);
+  }
   
-  // Instructions
-  tft.setTextSize(1);
-  tft.setTextColor(TFT_WHITE);
-  tft.setCursor(20, 160);
-  tft.println("Press button to start");
-  tft.setCursor(20, 175);
-  tft.println("professional vehicle");
-  tft.setCursor(20, 190);
-  tft.println("diagnostic scan");
+  // VIN ("" when no ECU reported one), then [responseId, name, [calIds], [cvns]] per ECU
+  cborWriteText(&writer, "vin");
+  cborWriteText(&writer, session.vin);
+  cborWriteText(&writer, "vinfo");
+  cborBeginArray(&writer, session.vehicleInfoCount);
+  for (int i = 0; i < session.vehicleInfoCount; i++) {
+    const VehicleInfoRecord& record = session.vehicleInfo[i];
+    cborBeginArray(&writer, 4);
+    cborWriteUInt(&writer, record.responseId);
+    cborWriteText(&writer, record.ecuName);
+    cborBeginArray(&writer, record.calIdCount);
+    for (int c = 0; c < record.calIdCount; c++) {
+      cborWriteText(&writer, record.calIds[c]);
+    }
+    cborBeginArray(&writer, record.cvnCount);
+    for (int c = 0; c < record.cvnCount; c++) {
+      cborWriteUInt(&writer, record.cvns[c]);
+    }
+  }
   
-  // Status bar
+  // [rawCode, ecu, frame, pid/A/B bytes] - B is only present for two-byte PIDs
+  cborWriteText(&writer, "freeze");
+  cborBeginArray(&writer, session.freezeFrameCount);
+  for (int i = 0; i < session.freezeFrameCount; i++) {
+    const FreezeFrameRecord& record = session.freezeFrames[i];
+    uint8_t pidBytes[FREEZE_FRAME_MAX_PIDS * 3];
+    size_t pidLength = 0;
+    for (int p = 0; p < record.pidCount; p++) {
+      pidBytes[pidLength++] = record.pids[p];
+      pidBytes[pidLength++] = record.values[p][0];
+      if (freezeFramePidLength(record.pids[p]) > 1) pidBytes[pidLength++] = record.values[p][1];
+    }
+    cborBeginArray(&writer, 4);
+    cborWriteUInt(&writer, record.rawCode);
+    cborWriteUInt(&writer, record.ecuId);
+    cborWriteUInt(&writer, record.frameNumber);
+    cborWriteBytes(&writer, pidBytes, pidLength);
+  }
+  
+  // [supported, complete, cycleEnabled, cycleComplete, flags, dtcCount] as monitor bitmasks
+  if (hasReadiness) {
+    const ReadinessReport& readiness = session.readiness;
+    cborWriteText(&writer, "ready");
+    cborBeginArray(&writer, 6);
+    cborWriteUInt(&writer, readiness.supported);
+    cborWriteUInt(&writer, readiness.complete);
+    cborWriteUInt(&writer, readiness.hasCycleStatus ? readiness.cycleEnabled : 0);
+    cborWriteUInt(&writer, readiness.hasCycleStatus ? readiness.cycleComplete : 0);
+    cborWriteUInt(&writer, (readiness.milOn ? 0x01 : 0) | (readiness.compressionIgnition ? 0x02 : 0) |
+                           (readiness.hasCycleStatus ? 0x04 : 0));
+    cborWriteUInt(&writer, readiness.dtcCount);
+  }
+  
+  // [scanMs, extendedDtcMs, deadTimeMs, uptimeMs, mode09Ms]
+  cborWriteText(&writer, "t");
+  cborBeginArray(&writer, 5);
+  cborWriteUInt(&writer, session.scanDurationMs);
+  cborWriteUInt(&writer, session.extendedDTCTimeMs);
+  cborWriteUInt(&writer, scanDeadTimeMs);
+  cborWriteUInt(&writer, millis());
+  cborWriteUInt(&writer, session.vehicleInfoTimeMs);
+  
+  // [loadAvg%, loadPeak%, busErrors, arbLost, rxMissed, rxOverruns, busOffs, peakTec, peakRec]
+  const CanBusSummary& bus = session.bus;
+  cborWriteText(&writer, "bus");
+  cborBeginArray(&writer, 9);
+  cborWriteUInt(&writer, bus.loadAvgPercent);
+  cborWriteUInt(&writer, bus.loadPeakPercent);
+  cborWriteUInt(&writer, bus.busErrors);
+  cborWriteUInt(&writer, bus.arbitrationLost);
+  cborWriteUInt(&writer, bus.rxMissed);
+  cborWriteUInt(&writer, bus.rxOverruns);
+  cborWriteUInt(&writer, bus.busOffEvents);
+  cborWriteUInt(&writer, bus.peakTxErrors);
+  cborWriteUInt(&writer, bus.peakRxErrors);
+  
+  // [revision, arm] - profiles only change between sessions, so this is what the scan ran with
+  TimingIdentity profile = timingIdentity();
+  cborWriteText(&writer, "timing");
+  cborBeginArray(&writer, 2);
+  cborWriteUInt(&writer, profile.revision);
+  cborWriteText(&writer, profile.arm);
+  
+  return writer.overflow ? 0 : writer.length;
+}
+
+int submitResultsJson(const char* path) {
+  TRACE_SCOPE("http:resultsJson");
+  unsigned long httpStart = millis();
+  uint32_t heapBefore = ESP.getFreeHeap();
+  WiFiClientSecure client;
+  if (!beginChunkedPost(client, path, "application/json")) {
+    metricIncrement(METRIC_HTTP_REQUESTS);
+    metricIncrement(METRIC_HTTP_FAILURES);
+    return -1;
+  }
+  
+  // The body is written element by element straight into the socket - only one
+  // DTC/freeze frame/section is ever held in a JSON document, whatever the DTC count
+  static ChunkedBodyWriter writer;
+  static StaticJsonDocument<1536> part;
+  chunkedInit(&writer, &client);
+  
+  // Add fault codes array
+  writer.print("{\"faultCodes\":[");
+  for (int i = 0; i < session.codes.size(); i++) {
+    const FaultCode& code = session.codes[i];
+    part.clear();
+    part["code"] = code.code;
+    part["system"] = code.system;
+    part["pending"] = code.isPending;
+    part["permanent"] = code.isPermanent;
+    part["passes"] = code.passes;
+    if (code.status != 0) {
+      // UDS codes carry the ISO 14229 status byte and failure type
+      part["ecu"] = code.ecuId;
+      part["status"] = code.status;
+      part["failureType"] = code.failureType;
+    }
+    if (i > 0) writer.print(",");
+    serializeJson(part, writer);
+  }
+  
+  // Freeze frames: raw PID bytes per DTC, decoded server-side
+  writer.print("],\"freezeFrames\":[");
+  for (int i = 0; i < session.freezeFrameCount; i++) {
+    const FreezeFrameRecord& record = session.freezeFrames[i];
+    FaultCode owner = decodeFaultCode(record.rawCode >> 8, record.rawCode & 0xFF, record.ecuId);
+    part.clear();
+    part["code"] = owner.code;
+    part["ecu"] = record.ecuId;
+    part["frame"] = record.frameNumber;
+    JsonArray pidsArray = part.createNestedArray("pids");
+    for (int p = 0; p < record.pidCount; p++) {
+      JsonArray pidEntry = pidsArray.createNestedArray();
+      pidEntry.add(record.pids[p]);
+      pidEntry.add(record.values[p][0]);
+      if (freezeFramePidLength(record.pids[p]) > 1) pidEntry.add(record.values[p][1]);
+    }
+    if (i > 0) writer.print(",");
+    serializeJson(part, writer);
+  }
+  
+  // Responding ECUs with their response timing
+  writer.print("],\"ecus\":[");
+  for (int i = 0; i < session.ecus.size(); i++) {
+    const EcuRecord& ecu = session.ecus.records[i];
+    part.clear();
+    part["responseId"] = ecu.responseId;
+    part["requestId"] = ecu.requestId;
+    part["responses"] = ecu.responses;
+    part["firstSeenMs"] = ecu.firstSeenMs;
+    part["latencyMinMs"] = ecu.latencyMinMs;
+    part["latencyAvgMs"] = ecuLatencyAvgMs(ecu);
+    part["latencyMaxMs"] = ecu.latencyMaxMs;
+    part["nrcs"] = ecu.nrcCount;
+    part["services"] = ecu.services;
+    if (i > 0) writer.print(",");
+    serializeJson(part, writer);
+  }
+  
+  // Mode 09 module identity - lets the server match TSBs and label DTC sources
+  writer.print("],\"moduleInfo\":[");
+  for (int i = 0; i < session.vehicleInfoCount; i++) {
+    const VehicleInfoRecord& record = session.vehicleInfo[i];
+    part.clear();
+    part["responseId"] = record.responseId;
+    part["name"] = record.ecuName;
+    JsonArray calIdArray = part.createNestedArray("calibrationIds");
+    for (int c = 0; c < record.calIdCount; c++) {
+      calIdArray.add(record.calIds[c]);
+    }
+    JsonArray cvnArray = part.createNestedArray("cvns");
+    for (int c = 0; c < record.cvnCount; c++) {
+      cvnArray.add(record.cvns[c]);
+    }
+    if (i > 0) writer.print(",");
+    serializeJson(part, writer);
+  }
+  writer.print("]");
+  
+  // Readiness monitors for the smog-check question
+  if (session.readiness.hasStatus) {
+    part.clear();
+    part["mil"] = (bool)session.readiness.milOn;
+    part["dtcCount"] = session.readiness.dtcCount;
+    part["ignition"] = session.readiness.compressionIgnition ? "compression" : "spark";
+    part["incomplete"] = countIncompleteMonitors(session.readiness);
+    JsonArray monitorsArray = part.createNestedArray("monitors");
+    for (int i = 0; i < NUM_READINESS_MONITORS; i++) {
+      if (!(session.readiness.supported & (1UL << i))) continue;
+      JsonObject monitorObj = monitorsArray.createNestedObject();
+      monitorObj["name"] = READINESS_MONITORS[i].name;
+      monitorObj["complete"] = (session.readiness.complete & (1UL << i)) != 0;
+      if (session.readiness.hasCycleStatus && (session.readiness.cycleEnabled & (1UL << i))) {
+        monitorObj["completeThisCycle"] = (session.readiness.cycleComplete & (1UL << i)) != 0;
+      }
+    }
+    writer.print(",\"readiness\":");
+    serializeJson(part, writer);
+  }
+  
+  // Add vehicle info (this will be merged with payment data on server)
+  part.clear();
+  part["ecuCount"] = session.ecus.size();
+  part["vehicleDetected"] = session.vehicleDetected;
+  part["scanTimestamp"] = millis();
+  part["extendedDtcTimeMs"] = session.extendedDTCTimeMs;
+  part["vin"] = session.vin;
+  part["mode09TimeMs"] = session.vehicleInfoTimeMs;
+  part["mode09Cached"] = session.vehicleInfoCached;
+  JsonObject busObj = part.createNestedObject("bus");
+  busObj["loadAvg"] = session.bus.loadAvgPercent;
+  busObj["loadPeak"] = session.bus.loadPeakPercent;
+  busObj["busErrors"] = session.bus.busErrors;
+  busObj["arbitrationLost"] = session.bus.arbitrationLost;
+  busObj["rxMissed"] = session.bus.rxMissed + session.bus.rxOverruns;
+  busObj["busOff"] = session.bus.busOffEvents;
+  TimingIdentity profile = timingIdentity();
+  part["timingRevision"] = profile.revision;
+  part["timingArm"] = (const char*)profile.arm;
+  part["link"] = SCAN_LINK_NAMES[session.link];
+  writer.print(",\"vehicleInfo\":");
+  serializeJson(part, writer);
+  
+  // Add basic AI analysis summary (server will do full AI processing)
+  char basicAnalysis[200];
+  if (session.codes.size() > 0) {
+    snprintf(basicAnalysis, sizeof(basicAnalysis), "ESP32 scan detected %d fault code(s). ", session.codes.size());
+  } else if (session.vehicleDetected) {
+    snprintf(basicAnalysis, sizeof(basicAnalysis), "ESP32 scan completed successfully. No fault codes detected. Vehicle systems appear healthy. ");
+  } else {
+    snprintf(basicAnalysis, sizeof(basicAnalysis), "ESP32 scan could not detect vehicle. Please ensure OBD2 cable is connected and ignition is on. ");
+  }
+  strncat(basicAnalysis, "Full AI analysis and professional report will be generated server-side.",
+          sizeof(basicAnalysis) - strlen(basicAnalysis) - 1);
+  part.clear();
+  part.set((const char*)basicAnalysis);
+  writer.print(",\"aiAnalysis\":");
+  serializeJson(part, writer);
+  writer.print("}");
+  chunkedFinish(&writer);
+  
+  int httpCode = writer.failed ? -1 : readHttpStatus(client, RESULTS_HTTP_TIMEOUT_MS);
+  client.stop();
+  metricIncrement(METRIC_HTTP_REQUESTS);
+  metricRecord(METRIC_HTTP_LATENCY_MS, millis() - httpStart);
+  if (httpCode != 201 && httpCode != 200) metricIncrement(METRIC_HTTP_FAILURES);
+  
+  Serial.printf("📤 Streamed %u bytes in %d chunks, heap %u -> low %u\n",
+                (unsigned)writer.totalBytes, writer.chunkCount, heapBefore, writer.lowestFreeHeap);
+  return httpCode;
+}
+
+bool beginChunkedPost(WiFiClientSecure& client, const char* path, const char* contentType) {
+  // API_BASE_URL is "https://host" - the socket wants the bare host name
+  const char* host = strstr(API_BASE_URL, "://");
+  host = host ? host + 3 : API_BASE_URL;
+  
+  client.setInsecure();  // Same trust model as the HTTPClient calls - no CA pinned
+  client.setTimeout(RESULTS_HTTP_TIMEOUT_MS / 1000);
+  if (!client.connect(host, 443)) {
+    Serial.printf("❌ Could not connect to %s\n", host);
+    return false;
+  }
+  
+  client.printf("POST %s HTTP/1.1\r\n", path);
+  client.printf("Host: %s\r\n", host);
+  client.printf("Content-Type: %s\r\n", contentType);
+  client.print("Transfer-Encoding: chunked\r\n");
+  client.print("Connection: close\r\n\r\n");
+  return true;
+}
+
+int readHttpStatus(WiFiClient& client, unsigned long timeoutMs) {
+  // Only the status line matters - "HTTP/1.1 201 Created"
+  unsigned long start = millis();
+  char line[48];
+  int length = 0;
+  while (millis() - start < timeoutMs && client.connected()) {
+    if (!client.available()) {
+      delay(10);
+      continue;
+    }
+    char c = client.read();
+    if (c == '\n') break;
+    if (c != '\r' && length < (int)sizeof(line) - 1) line[length++] = c;
+  }
+  line[length] = '\0';
+  
+  int httpCode = -1;
+  if (sscanf(line, "HTTP/%*s %d", &httpCode) != 1) {
+    Serial.printf("❌ Bad HTTP status line: '%s'\n", line);
+    return -1;
+  }
+  return httpCode;
+}
+
+void chunkedInit(ChunkedBodyWriter* writer, WiFiClient* client) {
+  writer->client = client;
+  writer->used = 0;
+  writer->totalBytes = 0;
+  writer->chunkCount = 0;
+  writer->lowestFreeHeap = ESP.getFreeHeap();
+  writer->failed = false;
+}
+
+size_t ChunkedBodyWriter::write(uint8_t b) {
+  return write(&b, 1);
+}
+
+size_t ChunkedBodyWriter::write(const uint8_t* data, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    if (used == RESULTS_CHUNK_SIZE) chunkedFlush(this);
+    buffer[used++] = data[i];
+  }
+  return len;
+}
+
+void chunkedFlush(ChunkedBodyWriter* writer) {
+  if (writer->used == 0 || writer->failed) {
+    writer->used = 0;
+    return;
+  }
+  
+  // One HTTP/1.1 chunk: hex length, CRLF, data, CRLF
+  writer->client->printf("%X\r\n", (unsigned)writer->used);
+  size_t sent = writer->client->write(writer->buffer, writer->used);
+  writer->client->print("\r\n");
+  if (sent != writer->used) {
+    Serial.println("❌ Results stream write failed");
+    writer->failed = true;
+  }
+  
+  writer->totalBytes += writer->used;
+  writer->chunkCount++;
+  writer->used = 0;
+  uint32_t freeHeap = ESP.getFreeHeap();
+  if (freeHeap < writer->lowestFreeHeap) writer->lowestFreeHeap = freeHeap;
+}
+
+void chunkedFinish(ChunkedBodyWriter* writer) {
+  chunkedFlush(writer);
+  if (!writer->failed) writer->client->print("0\r\n\r\n");
+}
+
+// ========== DISPLAY FUNCTIONS (Adapted for 240x320) ==========
+void displayReadyScreen() {
+  static bool displayed = false;
+  
+  // Redraw if forced or not displayed
+  if (displayed && !forceRedraw) return;
+  displayed = true;
+  forceRedraw = false; // Clear the force redraw flag
+  screenDrawBegin();
+  
+  tft.fillScreen(TFT_BLACK);
+  
+  // Header (adapted for smaller screen)
+  tft.fillRect(0, 0, SCREEN_WIDTH, 40, TFT_DARKGREEN);
+  drawLabel("OBD2 KIOSK", 20, 8, 2, TFT_WHITE, TFT_DARKGREEN);
+  drawLabel("Vehicle Diagnostic Scanner", 30, 25, 1, TFT_WHITE, TFT_DARKGREEN);
+  
+  // Main content
+  drawLabel("READY", 70, 100, 3, TFT_DARKGREEN, TFT_BLACK);
+  
+  // Instructions
+  drawLabel("Press button to start", 20, 160, 1, TFT_WHITE, TFT_BLACK);
+  drawLabel("professional vehicle", 20, 175, 1, TFT_WHITE, TFT_BLACK);
+  drawLabel("diagnostic scan", 20, 190, 1, TFT_WHITE, TFT_BLACK);
+  
+  // Status bar
   tft.fillRect(0, SCREEN_HEIGHT-30, SCREEN_WIDTH, 30, TFT_DARKGREY);
-  tft.setTextColor(TFT_LIGHTGREY);
-  tft.setCursor(10, SCREEN_HEIGHT-20);
-  String wifiStatus = "WiFi: ";
-  wifiStatus += (WiFi.status() == WL_CONNECTED ? "Connected" : "Disconnected");
-  tft.println(wifiStatus);
+  drawLabel(WiFi.status() == WL_CONNECTED ? "WiFi: Connected" : "WiFi: Disconnected", 10, SCREEN_HEIGHT-20, 1,
+            TFT_LIGHTGREY, TFT_DARKGREY);
   
   Serial.println("📺 Ready screen displayed");
+  screenDrawEnd();
 }
 
 void displayQRCode() {
@@ -782,31 +2197,26 @@ void displayQRCode() {
   // Only redraw the static parts once
   if (!displayed) {
     displayed = true;
+    screenDrawBegin();
     
     tft.fillScreen(TFT_WHITE);
     
     // Header
     tft.fillRect(0, 0, SCREEN_WIDTH, 40, TFT_BLUE);
-    tft.setTextSize(1);
-    tft.setTextColor(TFT_WHITE);
-    tft.setCursor(60, 15);
-    tft.println("SCAN QR CODE");
+    drawLabel("SCAN QR CODE", 60, 15, 1, TFT_WHITE, TFT_BLUE);
     
     // QR Code (use short URL to trigger router redirect with token)
-    String qrData = String(WEBAPP_URL) + "/" + transactionId;
+    char qrData[160];
+    snprintf(qrData, sizeof(qrData), "%s/%s", WEBAPP_URL, transactionId.c_str());
     drawQRCode(qrData, 30, 70, 3); // Version 6 QR codes are larger, use smaller scale
     
     // Instructions 
-    tft.setTextSize(1);
-    tft.setTextColor(TFT_BLACK);
-    tft.setCursor(20, 220);
-    tft.println("1. Scan QR with phone");
-    tft.setCursor(20, 235);
-    tft.println("2. Complete payment");
-    tft.setCursor(20, 250);
-    tft.println("3. Return to kiosk");
+    drawLabel("1. Scan QR with phone", 20, 220, 1, TFT_BLACK, TFT_WHITE);
+    drawLabel("2. Complete payment", 20, 235, 1, TFT_BLACK, TFT_WHITE);
+    drawLabel("3. Return to kiosk", 20, 250, 1, TFT_BLACK, TFT_WHITE);
     
-    Serial.println("📺 QR code displayed: " + qrData);
+    Serial.printf("📺 QR code displayed: %s\n", qrData);
+    screenDrawEnd();
   }
   
   // Update payment status indicator every 2 seconds
@@ -817,124 +2227,88 @@ void displayQRCode() {
     tft.fillRect(0, 270, SCREEN_WIDTH, 50, TFT_WHITE);
     
     // Show payment status
-    tft.setTextSize(1);
-    tft.setTextColor(TFT_ORANGE);
-    tft.setCursor(20, 275);
-    tft.println("Waiting for payment...");
+    drawLabel("Waiting for payment...", 20, 275, 1, TFT_ORANGE, TFT_WHITE);
     
     // Show elapsed time
     unsigned long elapsed = (millis() - stateStartTime) / 1000;
-    tft.setTextColor(TFT_DARKGREY);
-    tft.setCursor(20, 290);
-    tft.printf("Time: %02d:%02d", (int)(elapsed / 60), (int)(elapsed % 60));
+    drawTextf(20, 290, 1, TFT_DARKGREY, TFT_WHITE, "Time: %02d:%02d", (int)(elapsed / 60), (int)(elapsed % 60));
     
     // Add animated dots
     static int dots = 0;
-    tft.setCursor(20, 305);
-    tft.setTextColor(TFT_BLUE);
-    for (int i = 0; i < (dots % 4); i++) {
-      tft.print(".");
-    }
+    drawTextf(20, 305, 1, TFT_BLUE, TFT_WHITE, "%.*s", dots % 4, "...");
     dots++;
   }
 }
 
 void displayPaymentLoading() {
+  screenDrawBegin();
   tft.fillScreen(TFT_YELLOW);
   
-  tft.setTextSize(2);
-  tft.setTextColor(TFT_BLACK);
-  tft.setCursor(40, 120);
-  tft.println("PROCESSING");
-  tft.setCursor(60, 150);
-  tft.println("PAYMENT");
+  drawLabel("PROCESSING", 40, 120, 2, TFT_BLACK, TFT_YELLOW);
+  drawLabel("PAYMENT", 60, 150, 2, TFT_BLACK, TFT_YELLOW);
   
   // Loading animation
   static int dots = 0;
-  tft.setCursor(80, 180);
-  for (int i = 0; i < dots % 4; i++) {
-    tft.print(".");
-  }
+  drawTextf(80, 180, 2, TFT_BLACK, TFT_YELLOW, "%.*s", dots % 4, "...");
   dots++;
   
   Serial.println("📺 Payment loading displayed");
+  screenDrawEnd();
 }
 
 void displayWaitingPayment() {
   static bool displayed = false;
   if (displayed) return;
   displayed = true;
+  screenDrawBegin();
   
   tft.fillScreen(TFT_ORANGE);
   
-  tft.setTextSize(2);
-  tft.setTextColor(TFT_WHITE);
-  tft.setCursor(30, 100);
-  tft.println("WAITING FOR");
-  tft.setCursor(50, 130);
-  tft.println("PAYMENT");
-  
-  tft.setTextSize(1);
-  tft.setCursor(20, 180);
-  tft.println("Complete payment on");
-  tft.setCursor(20, 195);
-  tft.println("your phone, then");
-  tft.setCursor(20, 210);
-  tft.println("return to kiosk");
+  drawLabel("WAITING FOR", 30, 100, 2, TFT_WHITE, TFT_ORANGE);
+  drawLabel("PAYMENT", 50, 130, 2, TFT_WHITE, TFT_ORANGE);
+  
+  drawLabel("Complete payment on", 20, 180, 1, TFT_WHITE, TFT_ORANGE);
+  drawLabel("your phone, then", 20, 195, 1, TFT_WHITE, TFT_ORANGE);
+  drawLabel("return to kiosk", 20, 210, 1, TFT_WHITE, TFT_ORANGE);
   
   Serial.println("📺 Waiting for payment displayed");
+  screenDrawEnd();
 }
 
 void displayReadyToScan(bool fullRedraw) {
   static bool displayed = false;
   if (displayed && !fullRedraw) return;
   displayed = true;
+  screenDrawBegin();
   
   if (TEST_MODE) {
     // TEST MODE display
     tft.fillScreen(TFT_ORANGE);
     
-    tft.setTextSize(2);
-    tft.setTextColor(TFT_BLACK);
-    tft.setCursor(40, 80);
-    tft.println("TEST MODE");
-    
-    tft.setTextSize(1);
-    tft.setCursor(20, 120);
-    tft.println("Development/Testing Mode");
-    tft.setCursor(20, 140);
-    tft.println("Bypassing payment process");
-    
-    tft.setTextSize(1);
-    tft.setCursor(20, 180);
-    tft.println("Connect OBD2 cable to");
-    tft.setCursor(20, 195);
-    tft.println("your vehicle's port");
-    tft.setCursor(20, 210);
-    tft.println("Press button to scan");
+    drawLabel("TEST MODE", 40, 80, 2, TFT_BLACK, TFT_ORANGE);
+    
+    drawLabel("Development/Testing Mode", 20, 120, 1, TFT_BLACK, TFT_ORANGE);
+    drawLabel("Bypassing payment process", 20, 140, 1, TFT_BLACK, TFT_ORANGE);
+    
+    drawLabel("Connect OBD2 cable to", 20, 180, 1, TFT_BLACK, TFT_ORANGE);
+    drawLabel("your vehicle's port", 20, 195, 1, TFT_BLACK, TFT_ORANGE);
+    drawLabel("Press button to scan", 20, 210, 1, TFT_BLACK, TFT_ORANGE);
     
     Serial.println("📺 TEST MODE ready to scan displayed");
   } else {
     // Normal kiosk mode display
     tft.fillScreen(TFT_GREEN);
     
-    tft.setTextSize(2);
-    tft.setTextColor(TFT_WHITE);
-    tft.setCursor(40, 100);
-    tft.println("PAYMENT");
-    tft.setCursor(50, 130);
-    tft.println("SUCCESS");
-    
-    tft.setTextSize(1);
-    tft.setCursor(20, 180);
-    tft.println("Connect OBD2 cable to");
-    tft.setCursor(20, 195);
-    tft.println("your vehicle's port");
-    tft.setCursor(20, 210);
-    tft.println("Press button to scan");
+    drawLabel("PAYMENT", 40, 100, 2, TFT_WHITE, TFT_GREEN);
+    drawLabel("SUCCESS", 50, 130, 2, TFT_WHITE, TFT_GREEN);
+    
+    drawLabel("Connect OBD2 cable to", 20, 180, 1, TFT_WHITE, TFT_GREEN);
+    drawLabel("your vehicle's port", 20, 195, 1, TFT_WHITE, TFT_GREEN);
+    drawLabel("Press button to scan", 20, 210, 1, TFT_WHITE, TFT_GREEN);
     
     Serial.println("📺 Ready to scan displayed");
   }
+  screenDrawEnd();
 }
 
 void displayPrepareVehicle() {
@@ -945,43 +2319,31 @@ void displayPrepareVehicle() {
   if (!displayed || forceRedraw) {
     displayed = true;
     if (forceRedraw) forceRedraw = false; // Clear the force redraw flag
+    screenDrawBegin();
     
     tft.fillScreen(TFT_ORANGE);
     
     // Header
     tft.fillRect(0, 0, SCREEN_WIDTH, 40, TFT_DARKCYAN);
-    tft.setTextSize(1);
-    tft.setTextColor(TFT_WHITE);
-    tft.setCursor(40, 15);
-    tft.println("PREPARE VEHICLE");
+    drawLabel("PREPARE VEHICLE", 40, 15, 1, TFT_WHITE, TFT_DARKCYAN);
     
     // Main instructions
-    tft.setTextSize(2);
-    tft.setTextColor(TFT_WHITE);
-    tft.setCursor(20, 70);
-    tft.println("Please:");
+    drawLabel("Please:", 20, 70, 2, TFT_WHITE, TFT_ORANGE);
     
-    tft.setTextSize(1);
-    tft.setTextColor(TFT_BLACK);
     int y = 110;
-    tft.setCursor(10, y);
-    tft.println("1. Turn on vehicle ignition");
+    drawLabel("1. Turn on vehicle ignition", 10, y, 1, TFT_BLACK, TFT_ORANGE);
     y += 20;
-    tft.setCursor(10, y);
-    tft.println("2. Engine can be ON or OFF");
+    drawLabel("2. Engine can be ON or OFF", 10, y, 1, TFT_BLACK, TFT_ORANGE);
     y += 20;
-    tft.setCursor(10, y);
-    tft.println("3. Ensure OBD2 cable is");
+    drawLabel("3. Ensure OBD2 cable is", 10, y, 1, TFT_BLACK, TFT_ORANGE);
     y += 15;
-    tft.setCursor(15, y);
-    tft.println("firmly connected");
+    drawLabel("firmly connected", 15, y, 1, TFT_BLACK, TFT_ORANGE);
     y += 25;
     
-    tft.setTextColor(TFT_DARKGREEN);
-    tft.setCursor(10, y);
-    tft.println("Scan will start automatically");
+    drawLabel("Scan will start automatically", 10, y, 1, TFT_DARKGREEN, TFT_ORANGE);
     
     Serial.println("📺 Prepare vehicle screen displayed");
+    screenDrawEnd();
   }
   
   // Update countdown every second
@@ -990,14 +2352,11 @@ void displayPrepareVehicle() {
     
     // Calculate remaining time
     unsigned long elapsed = millis() - stateStartTime;
-    unsigned long remaining = (15000 > elapsed) ? (15000 - elapsed) / 1000 : 0;
+    unsigned long remaining = (timing.prepareVehicleMs > elapsed) ? (timing.prepareVehicleMs - elapsed) / 1000 : 0;
     
     // Update countdown at bottom
     tft.fillRect(10, SCREEN_HEIGHT - 25, SCREEN_WIDTH - 20, 20, TFT_ORANGE);
-    tft.setTextColor(TFT_WHITE);
-    tft.setTextSize(1);
-    tft.setCursor(10, SCREEN_HEIGHT - 20);
-    tft.printf("Starting scan in %d seconds...", (int)remaining);
+    drawTextf(10, SCREEN_HEIGHT - 20, 1, TFT_WHITE, TFT_ORANGE, "Starting scan in %d seconds...", (int)remaining);
   }
 }
 
@@ -1005,25 +2364,19 @@ void displayScanning(bool fullRedraw) {
   static bool displayed = false;
   if (displayed && !fullRedraw) return;
   displayed = true;
+  screenDrawBegin();
   
   tft.fillScreen(TFT_BLUE);
   
-  tft.setTextSize(2);
-  tft.setTextColor(TFT_WHITE);
-  tft.setCursor(50, 100);
-  tft.println("SCANNING");
-  tft.setCursor(60, 130);
-  tft.println("VEHICLE");
-  
-  tft.setTextSize(1);
-  tft.setCursor(20, 180);
-  tft.println("Please wait while we");
-  tft.setCursor(20, 195);
-  tft.println("scan all vehicle");
-  tft.setCursor(20, 210);
-  tft.println("systems...");
+  drawLabel("SCANNING", 50, 100, 2, TFT_WHITE, TFT_BLUE);
+  drawLabel("VEHICLE", 60, 130, 2, TFT_WHITE, TFT_BLUE);
+  
+  drawLabel("Please wait while we", 20, 180, 1, TFT_WHITE, TFT_BLUE);
+  drawLabel("scan all vehicle", 20, 195, 1, TFT_WHITE, TFT_BLUE);
+  drawLabel("systems...", 20, 210, 1, TFT_WHITE, TFT_BLUE);
   
   Serial.println("📺 Scanning displayed");
+  screenDrawEnd();
 }
 
 void displayScanResults() {
@@ -1032,80 +2385,80 @@ void displayScanResults() {
   
   if (!displayed) {
     displayed = true;
+    screenDrawBegin();
     
     tft.fillScreen(TFT_WHITE);
     
     // Header
     tft.fillRect(0, 0, SCREEN_WIDTH, 40, TFT_NAVY);
-    tft.setTextSize(1);
-    tft.setTextColor(TFT_WHITE);
-    tft.setCursor(60, 15);
-    tft.println("SCAN COMPLETE");
+    drawLabel("SCAN COMPLETE", 60, 15, 1, TFT_WHITE, TFT_NAVY);
     
     // Results summary
     int y = 60;
-    tft.setTextSize(1);
-    tft.setTextColor(TFT_BLACK);
-    
-    tft.setCursor(10, y);
-    tft.println("Active ECUs: " + String(activeECUs.size()) + "/" + String(NUM_ECUS));
+    drawTextf(10, y, 1, TFT_BLACK, TFT_WHITE, "Active ECUs: %d/%d", session.ecus.size(), NUM_ECUS);
     y += 20;
     
-    tft.setCursor(10, y);
-    tft.println("Fault Codes: " + String(detectedCodes.size()));
+    drawTextf(10, y, 1, TFT_BLACK, TFT_WHITE, "Fault Codes: %d", session.codes.size());
+    y += 15;
+    
+    // Smog-check readiness summary
+    if (session.readiness.hasStatus) {
+      int supportedCount = __builtin_popcount(session.readiness.supported);
+      int incomplete = countIncompleteMonitors(session.readiness);
+      uint16_t readinessColor = incomplete == 0 ? TFT_DARKGREEN : TFT_ORANGE;
+      drawTextf(10, y, 1, readinessColor, TFT_WHITE, "Readiness: %d/%d ready  MIL %s", supportedCount - incomplete,
+                supportedCount, session.readiness.milOn ? "ON" : "OFF");
+      
+      if (incomplete > 0) {
+        char notReady[64] = "Not ready:";
+        int shown = 0;
+        for (int i = 0; i < NUM_READINESS_MONITORS && shown < 3; i++) {
+          if (!(session.readiness.supported & (1UL << i)) || (session.readiness.complete & (1UL << i))) continue;
+          size_t used = strlen(notReady);
+          snprintf(notReady + used, sizeof(notReady) - used, "%s%s", shown == 0 ? " " : ", ", READINESS_MONITORS[i].name);
+          shown++;
+        }
+        drawTextf(10, y + 12, 1, readinessColor, TFT_WHITE, "%s", notReady);
+      }
+    }
     y += 30;
     
     // Display fault codes if any
-    if (detectedCodes.size() > 0) {
-      tft.setTextColor(TFT_RED);
-      tft.setCursor(10, y);
-      tft.println("ISSUES FOUND:");
+    if (session.codes.size() > 0) {
+      drawLabel("ISSUES FOUND:", 10, y, 1, TFT_RED, TFT_WHITE);
       y += 15;
       
-      for (int i = 0; i < min(5, (int)detectedCodes.size()); i++) {
-        tft.setCursor(10, y);
-        tft.println(detectedCodes[i].code + " - " + detectedCodes[i].system);
+      for (int i = 0; i < min(5, (int)session.codes.size()); i++) {
+        drawTextf(10, y, 1, TFT_RED, TFT_WHITE, "%s - %s", session.codes[i].code, session.codes[i].system);
         y += 12;
       }
       
       // Instructions for issues found
-      tft.setTextColor(TFT_BLACK);
-      tft.setCursor(10, SCREEN_HEIGHT - 30);
-      tft.println("Detailed report sent via email");
+      drawLabel("Detailed report sent via email", 10, SCREEN_HEIGHT - 30, 1, TFT_BLACK, TFT_WHITE);
       
-    } else if (!vehicleDetected) {
+    } else if (!session.vehicleDetected) {
       // No vehicle detected case
-      tft.setTextColor(TFT_ORANGE);
-      tft.setCursor(10, y);
-      tft.println("NO VEHICLE DETECTED");
-      tft.setCursor(10, y + 20);
-      tft.println("Please ensure:");
-      tft.setCursor(10, y + 35);
-      tft.println("- OBD2 cable is connected");
-      tft.setCursor(10, y + 50);
-      tft.println("- Vehicle is turned ON");
-      tft.setCursor(10, y + 65);
-      tft.println("- Engine is running");
+      drawLabel("NO VEHICLE DETECTED", 10, y, 1, TFT_ORANGE, TFT_WHITE);
+      drawLabel("Please ensure:", 10, y + 20, 1, TFT_ORANGE, TFT_WHITE);
+      drawLabel("- OBD2 cable is connected", 10, y + 35, 1, TFT_ORANGE, TFT_WHITE);
+      drawLabel("- Vehicle is turned ON", 10, y + 50, 1, TFT_ORANGE, TFT_WHITE);
+      drawLabel("- Engine is running", 10, y + 65, 1, TFT_ORANGE, TFT_WHITE);
       
     } else {
       // Vehicle found but no codes - THIS IS YOUR CASE!
-      tft.setTextColor(TFT_GREEN);
-      tft.setCursor(10, y);
-      tft.println("ALL SYSTEMS OK!");
-      tft.setCursor(10, y + 15);
-      tft.println("No issues detected");
+      drawLabel("ALL SYSTEMS OK!", 10, y, 1, TFT_GREEN, TFT_WHITE);
+      drawLabel("No issues detected", 10, y + 15, 1, TFT_GREEN, TFT_WHITE);
       
       // Instructions for good results
-      tft.setTextColor(TFT_BLACK);
-      tft.setCursor(10, SCREEN_HEIGHT - 30);
-      tft.println("Health report sent via email");
+      drawLabel("Health report sent via email", 10, SCREEN_HEIGHT - 30, 1, TFT_BLACK, TFT_WHITE);
     }
     
     Serial.println("📺 Scan results displayed");
+    screenDrawEnd();
   }
   
   // Update countdown every second for "no vehicle" case
-  if (!vehicleDetected && millis() - lastUpdate > 1000) {
+  if (!session.vehicleDetected && millis() - lastUpdate > 1000) {
     lastUpdate = millis();
     
     // Calculate remaining time
@@ -1114,9 +2467,7 @@ void displayScanResults() {
     
     // Update countdown
     tft.fillRect(10, SCREEN_HEIGHT - 30, SCREEN_WIDTH - 20, 20, TFT_WHITE);
-    tft.setTextColor(TFT_DARKGREY);
-    tft.setCursor(10, SCREEN_HEIGHT - 25);
-    tft.printf("Returning to menu in %d seconds", (int)remaining);
+    drawTextf(10, SCREEN_HEIGHT - 25, 1, TFT_DARKGREY, TFT_WHITE, "Returning to menu in %d seconds", (int)remaining);
   }
 }
 
@@ -1128,82 +2479,59 @@ void displayScanComplete() {
   if (!displayed || forceRedraw) {
     displayed = true;
     if (forceRedraw) forceRedraw = false; // Clear the force redraw flag
+    screenDrawBegin();
     
     tft.fillScreen(TFT_WHITE);
     
     // Header
     tft.fillRect(0, 0, SCREEN_WIDTH, 40, TFT_DARKGREEN);
-    tft.setTextSize(1);
-    tft.setTextColor(TFT_WHITE);
-    tft.setCursor(40, 15);
-    tft.println("SCAN COMPLETE!");
+    drawLabel("SCAN COMPLETE!", 40, 15, 1, TFT_WHITE, TFT_DARKGREEN);
     
     int y = 50;
-    tft.setTextSize(2);
-    tft.setTextColor(TFT_DARKGREEN);
-    tft.setCursor(70, y);
-    tft.println("DONE!");
+    drawLabel("DONE!", 70, y, 2, TFT_DARKGREEN, TFT_WHITE);
     
     y += 35;
-    tft.setTextSize(1);
-    tft.setTextColor(TFT_BLACK);
     
     // Different messages based on results
-    if (detectedCodes.size() > 0) {
+    if (session.codes.size() > 0) {
       // Issues found
-      tft.setCursor(10, y);
-      tft.println("Report with " + String(detectedCodes.size()) + " issue(s)");
+      drawTextf(10, y, 1, TFT_BLACK, TFT_WHITE, "Report with %d issue(s)", session.codes.size());
       y += 15;
-      tft.setCursor(10, y);
-      tft.println("being sent to your email.");
+      drawLabel("being sent to your email.", 10, y, 1, TFT_BLACK, TFT_WHITE);
       y += 30;
       
-      tft.setTextColor(TFT_ORANGE);
-      tft.setCursor(10, y);
-      tft.println("Please review the detailed");
+      drawLabel("Please review the detailed", 10, y, 1, TFT_ORANGE, TFT_WHITE);
       y += 15;
-      tft.setCursor(10, y);
-      tft.println("analysis and recommendations.");
+      drawLabel("analysis and recommendations.", 10, y, 1, TFT_ORANGE, TFT_WHITE);
       
-    } else if (vehicleDetected) {
+    } else if (session.vehicleDetected) {
       // Vehicle healthy
-      tft.setCursor(10, y);
-      tft.println("Vehicle health report");
+      drawLabel("Vehicle health report", 10, y, 1, TFT_BLACK, TFT_WHITE);
       y += 15;
-      tft.setCursor(10, y);
-      tft.println("being sent to your email.");
+      drawLabel("being sent to your email.", 10, y, 1, TFT_BLACK, TFT_WHITE);
       y += 30;
       
-      tft.setTextColor(TFT_DARKGREEN);
-      tft.setCursor(10, y);
-      tft.println("Your vehicle is running");
+      drawLabel("Your vehicle is running", 10, y, 1, TFT_DARKGREEN, TFT_WHITE);
       y += 15;
-      tft.setCursor(10, y);
-      tft.println("in excellent condition!");
+      drawLabel("in excellent condition!", 10, y, 1, TFT_DARKGREEN, TFT_WHITE);
       
     } else {
       // No vehicle detected
-      tft.setCursor(10, y);
-      tft.println("Please ensure OBD2 cable");
+      drawLabel("Please ensure OBD2 cable", 10, y, 1, TFT_BLACK, TFT_WHITE);
       y += 15;
-      tft.setCursor(10, y);
-      tft.println("is properly connected.");
+      drawLabel("is properly connected.", 10, y, 1, TFT_BLACK, TFT_WHITE);
     }
     
     // Disconnection instructions - ensure they're visible and don't conflict with countdown
     y += 15; // Add space after previous content
-    tft.setTextColor(TFT_NAVY);
-    tft.setTextSize(1);
-    tft.setCursor(10, y);
-    tft.println("Please disconnect OBD2 cable");
+    drawLabel("Please disconnect OBD2 cable", 10, y, 1, TFT_NAVY, TFT_WHITE);
     y += 12;
-    tft.setCursor(10, y);
-    tft.println("from your vehicle.");
+    drawLabel("from your vehicle.", 10, y, 1, TFT_NAVY, TFT_WHITE);
     y += 15;
-    tft.setCursor(10, y);
-    tft.println("Thank you for using OBD2Ai!");
+    drawLabel("Thank you for using OBD2Ai!", 10, y, 1, TFT_NAVY, TFT_WHITE);
     
     Serial.println("📺 Scan completion screen displayed");
+    screenDrawEnd();
   }
   
   // Update countdown every second
@@ -1212,40 +2540,184 @@ void displayScanComplete() {
     
     // Calculate remaining time
     unsigned long elapsed = millis() - stateStartTime;
-    unsigned long remaining = (15000 > elapsed) ? (15000 - elapsed) / 1000 : 0;
+    unsigned long remaining = (SCAN_COMPLETE_MS > elapsed) ? (SCAN_COMPLETE_MS - elapsed) / 1000 : 0;
     
     // Update countdown at bottom - only clear the countdown area
     tft.fillRect(10, SCREEN_HEIGHT - 20, SCREEN_WIDTH - 20, 20, TFT_WHITE);
-    tft.setTextColor(TFT_DARKGREY);
-    tft.setTextSize(1);
-    tft.setCursor(10, SCREEN_HEIGHT - 15);
-    tft.printf("Next customer ready in %ds", (int)remaining);
+    drawTextf(10, SCREEN_HEIGHT - 15, 1, TFT_DARKGREY, TFT_WHITE, "Next customer ready in %ds", (int)remaining);
   }
 }
 
-void displayError(String message) {
+void displayError(const char* message) {
+  screenDrawBegin();
   tft.fillScreen(TFT_RED);
   
-  tft.setTextSize(2);
-  tft.setTextColor(TFT_WHITE);
-  tft.setCursor(70, 100);
-  tft.println("ERROR");
+  drawLabel("ERROR", 70, 100, 2, TFT_WHITE, TFT_RED);
   
-  tft.setTextSize(1);
-  tft.setCursor(20, 140);
-  tft.println(message);
+  // Not cached and may run past one line or drawTextf's 64-byte buffer - tft.print wraps it
+  textLegacy(message, 20, 140, 1, TFT_WHITE);
   
-  currentState = ERROR_STATE;
-  stateStartTime = millis();
+  enterState(ERROR_STATE);
+  
+  Serial.printf("❌ Error displayed: %s\n", message);
+  screenDrawEnd();
+}
+
+// ========== TEXT RENDERING ==========
+void textInit() {
+  // Rasterise the GLCD font once through a sprite into the 1-bit atlas
+  TFT_eSprite glyph = TFT_eSprite(&tft);
+  glyph.setColorDepth(8);
+  if (glyph.createSprite(TEXT_GLYPH_WIDTH, TEXT_GLYPH_HEIGHT) == nullptr) {
+    Serial.println("❌ Text atlas sprite allocation failed - using tft.print");
+    return;
+  }
+  glyph.setTextFont(1);
+  glyph.setTextSize(1);
+  glyph.setTextColor(TFT_WHITE, TFT_BLACK);
+  for (int g = 0; g < TEXT_GLYPH_COUNT; g++) {
+    glyph.fillSprite(TFT_BLACK);
+    glyph.drawChar(TEXT_FIRST_GLYPH + g, 0, 0);
+    for (int row = 0; row < TEXT_GLYPH_HEIGHT; row++) {
+      uint8_t bits = 0;
+      for (int col = 0; col < TEXT_GLYPH_WIDTH; col++) {
+        if (glyph.readPixel(col, row) != TFT_BLACK) bits |= 0x20 >> col;
+      }
+      textRenderer.atlas[g][row] = bits;
+    }
+  }
+  glyph.deleteSprite();
+  
+  uint32_t caps = psramFound() ? MALLOC_CAP_SPIRAM : (MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  textRenderer.line = (uint16_t*)heap_caps_malloc(TEXT_LINE_PIXELS * sizeof(uint16_t), caps);
+  textRenderer.cacheRuns = psramFound();  // Without PSRAM every label is expanded per draw
+  textRenderer.ready = TEXT_CACHE_ENABLED && textRenderer.line != nullptr;
+  Serial.printf("🔤 Text renderer: %s, label cache %s\n", textRenderer.ready ? "glyph atlas" : "tft.print",
+                textRenderer.ready && textRenderer.cacheRuns ? "in PSRAM" : "off");
+}
+
+void drawLabel(const char* label, int x, int y, uint8_t size, uint16_t fg, uint16_t bg) {
+  // Static labels - the literal's address plus x, size and colours is the cache key
+  if (!textRenderer.ready) {
+    textLegacy(label, x, y, size, fg);
+    return;
+  }
+  
+  for (int i = 0; i < textRenderer.runCount; i++) {
+    TextRun& run = textRenderer.runs[i];
+    if (run.text == label && run.x == x && run.size == size && run.fg == fg && run.bg == bg) {
+      textPush(x, y, run.width, size, run.pixels);
+      return;
+    }
+  }
+  
+  int width = textFit(label, x, size) * TEXT_GLYPH_WIDTH * size;
+  uint16_t* pixels = nullptr;
+  if (textRenderer.cacheRuns && textRenderer.runCount < TEXT_CACHE_SLOTS && width > 0) {
+    size_t bytes = width * TEXT_GLYPH_HEIGHT * size * sizeof(uint16_t);
+    pixels = (uint16_t*)heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM);
+    if (pixels != nullptr) {
+      textRenderer.runs[textRenderer.runCount++] = {label, fg, bg, size, (int16_t)x, (int16_t)width, pixels};
+      textRenderer.cacheBytes += bytes;
+    }
+  }
+  if (pixels == nullptr) pixels = textRenderer.line;  // Cache full - expand per draw
   
-  Serial.println("❌ Error displayed: " + message);
+  textExpand(label, x, size, fg, bg, pixels);
+  textPush(x, y, width, size, pixels);
+}
+
+void drawTextf(int x, int y, uint8_t size, uint16_t fg, uint16_t bg, const char* format, ...) {
+  // Dynamic single-line text (countdowns, DTC lines) - expanded from the atlas into
+  // the scratch run. Truncates at 63 chars and never wraps; multi-line messages use textLegacy
+  char buffer[64];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  
+  if (!textRenderer.ready) {
+    textLegacy(buffer, x, y, size, fg);
+    return;
+  }
+  int width = textExpand(buffer, x, size, fg, bg, textRenderer.line);
+  textPush(x, y, width, size, textRenderer.line);
+}
+
+int textFit(const char* str, int x, uint8_t size) {
+  // Glyphs that fit between x and the panel edge, capped by the scratch run (SCREEN_WIDTH wide)
+  int glyphWidth = TEXT_GLYPH_WIDTH * size;
+  int room = min(tft.width() - x, SCREEN_WIDTH);
+  if (room < glyphWidth) return 0;
+  return min((int)strlen(str), room / glyphWidth);
+}
+
+int textExpand(const char* str, int x, uint8_t size, uint16_t fg, uint16_t bg, uint16_t* out) {
+  // One RGB565 run, width x 8*size, byte-swapped for the panel like a sprite buffer.
+  // Clipped at the panel edge from x - a run never wraps
+  int glyphWidth = TEXT_GLYPH_WIDTH * size;
+  int length = textFit(str, x, size);
+  int width = length * glyphWidth;
+  uint16_t fgSwapped = (fg >> 8) | (fg << 8);
+  uint16_t bgSwapped = (bg >> 8) | (bg << 8);
+  
+  for (int row = 0; row < TEXT_GLYPH_HEIGHT * size; row++) {
+    uint16_t* pixel = out + row * width;
+    for (int i = 0; i < length; i++) {
+      int g = (uint8_t)str[i] - TEXT_FIRST_GLYPH;
+      if (g < 0 || g >= TEXT_GLYPH_COUNT) g = 0;  // Outside printable ASCII draws as a space
+      uint8_t bits = textRenderer.atlas[g][row / size];
+      for (int col = 0; col < glyphWidth; col++) {
+        *pixel++ = (bits & (0x20 >> (col / size))) ? fgSwapped : bgSwapped;
+      }
+    }
+  }
+  textRenderer.screenGlyphs += length;
+  return width;
+}
+
+void textPush(int x, int y, int width, uint8_t size, const uint16_t* pixels) {
+  // One address window and one pixel burst for the whole run
+  if (width <= 0) return;
+  bool swapBytes = tft.getSwapBytes();
+  tft.setSwapBytes(false);
+  tft.pushImage(x, y, width, TEXT_GLYPH_HEIGHT * size, pixels);
+  tft.setSwapBytes(swapBytes);
+  textRenderer.screenWindows++;
+}
+
+void textLegacy(const char* str, int x, int y, uint8_t size, uint16_t fg) {
+  // The original transparent tft.print path, kept for A/B timing. At least one
+  // address window per glyph - transparent glyphs open one per pixel run
+  tft.setTextSize(size);
+  tft.setTextColor(fg);
+  tft.setCursor(x, y);
+  tft.print(str);
+  int length = strlen(str);
+  textRenderer.screenGlyphs += length;
+  textRenderer.screenWindows += length;
+}
+
+void screenDrawBegin() {
+  textRenderer.screenStartUs = esp_timer_get_time();
+  textRenderer.screenWindows = 0;
+  textRenderer.screenGlyphs = 0;
+}
+
+void screenDrawEnd() {
+  uint32_t elapsedUs = esp_timer_get_time() - textRenderer.screenStartUs;
+  metricRecord(METRIC_SCREEN_DRAW_US, elapsedUs);
+  Serial.printf("   ⏱️ Drawn in %.1fms - %u glyphs in %u text windows (%s, %u labels / %u KB cached)\n",
+                elapsedUs / 1000.0f, textRenderer.screenGlyphs, textRenderer.screenWindows,
+                textRenderer.ready ? "atlas" : "tft.print", textRenderer.runCount,
+                (unsigned)(textRenderer.cacheBytes / 1024));
 }
 
 // ========== QR CODE GENERATION ==========
-void drawQRCode(String data, int x, int y, int scale) {
+void drawQRCode(const char* data, int x, int y, int scale) {
   QRCode qrcode;
   uint8_t qrcodeData[qrcode_getBufferSize(6)]; // Higher version for longer URLs
-  qrcode_initText(&qrcode, qrcodeData, 6, 0, data.c_str());
+  qrcode_initText(&qrcode, qrcodeData, 6, 0, data);
   
   // Draw QR code
   for (uint8_t y0 = 0; y0 < qrcode.size; y0++) {
@@ -1256,35 +2728,311 @@ void drawQRCode(String data, int x, int y, int scale) {
   }
 }
 
+// ========== RESPONSE COLLECTION ==========
+void openResponseWindow(ResponseCollector* collector, unsigned long timeoutMs,
+                        const uint32_t* expected, int expectedCount) {
+  collector->startTime         = scanMillis();
+  collector->timeoutMs         = timeoutMs;
+  collector->lastUsefulTime    = collector->startTime;
+  collector->expectedCount     = min(expectedCount, MAX_EXPECTED_RESPONDERS);
+  collector->answeredMask      = 0;
+  collector->idleGapMs         = timing.responseIdleGapMs;
+  collector->heardAny          = false;
+  collector->responsePending   = false;
+  collector->keepAliveMs       = 0;
+  collector->lastKeepAliveTime = collector->startTime;
+  
+  for (int i = 0; i < collector->expectedCount; i++) {
+    collector->expected[i] = expected[i];
+  }
+  
+  scanWindowCount++;
+}
+
+bool receiveInWindow(ResponseCollector* collector, twai_message_t* response) {
+  uint16_t allAnswered = (1 << collector->expectedCount) - 1;
+  
+  while (true) {
+    unsigned long now = scanMillis();
+    
+    // Every expected ECU has given its final answer - no reason to keep listening
+    if (collector->expectedCount > 0 && collector->answeredMask == allAnswered) {
+      scanEarlyExitCount++;
+      return false;
+    }
+    
+    if (now - collector->startTime >= collector->timeoutMs) {
+      return false;
+    }
+    
+    // Keep non-default sessions alive on elapsed time - a silent module sends nothing to wait for
+    if (collector->keepAliveMs > 0 && now - collector->lastKeepAliveTime >= collector->keepAliveMs) {
+      sendUDSTesterPresent();
+      collector->lastKeepAliveTime = now;
+    }
+    
+    // Unknown responder set: a short silence after the last useful frame means
+    // everyone who is going to answer already has. Never applied while a known
+    // ECU is still outstanding or after a 0x78 - slow ECUs answer late
+    if (collector->idleGapMs > 0 && collector->expectedCount == 0 && !collector->responsePending &&
+        collector->heardAny && now - collector->lastUsefulTime >= collector->idleGapMs) {
+      return false;
+    }
+    
+    if (canReceive(response, pdMS_TO_TICKS(RESPONSE_POLL_MS)) == ESP_OK) {
+      if (response->data_length_code >= 4 && response->data[1] == 0x7F && response->data[3] == 0x78) {
+        collector->responsePending = true;
+      }
+      return true;
+    }
+  }
+}
+
+void markResponder(ResponseCollector* collector, uint32_t responderId, bool finished) {
+  collector->heardAny = true;
+  collector->lastUsefulTime = scanMillis();
+  
+  if (!finished) return;
+  
+  for (int i = 0; i < collector->expectedCount; i++) {
+    if (collector->expected[i] == responderId) {
+      collector->answeredMask |= (1 << i);
+      break;
+    }
+  }
+}
+
+void closeResponseWindow(ResponseCollector* collector) {
+  // Whole window is dead time if nobody answered, otherwise only the tail
+  unsigned long deadTime = scanMillis() - collector->lastUsefulTime;
+  scanDeadTimeMs += deadTime;
+}
+
+bool isFinalResponse(const twai_message_t& response, uint8_t service) {
+  if (response.data_length_code < 3) return false;
+  
+  // Negative response (0x7F) ends the exchange unless it is "response pending" (0x78)
+  if (response.data[1] == 0x7F) {
+    return response.data[2] == service &&
+           !(response.data_length_code >= 4 && response.data[3] == 0x78);
+  }
+  
+  // Positive single-frame response; first frames of multi-frame replies are not final
+  return (response.data[0] & 0xF0) == 0x00 && response.data[1] == (uint8_t)(service + 0x40);
+}
+
+void addDiscoveredResponder(uint32_t responderId) {
+  for (int i = 0; i < discoveredResponderCount; i++) {
+    if (discoveredResponders[i] == responderId) return;
+  }
+  if (discoveredResponderCount < MAX_EXPECTED_RESPONDERS) {
+    discoveredResponders[discoveredResponderCount++] = responderId;
+  }
+}
+
+// ========== ECU REGISTRY ==========
+EcuRecord* ecuObserve(const twai_message_t& response, unsigned long requestMs) {
+  // Records (or finds) the sender and folds this frame into its statistics.
+  // requestMs is when the request went out, on the scanMillis() clock
+  uint32_t key = ecuKey(response.identifier, response.extd);
+  int slot = (key * 0x9E3779B1u) >> 27;  // Top 5 bits -> 0..31
+  
+  EcuRecord* ecu = NULL;
+  while (session.ecus.slots[slot] != 0) {
+    EcuRecord& candidate = session.ecus.records[session.ecus.slots[slot] - 1];
+    if (ecuKey(candidate.responseId, candidate.extended) == key) {
+      ecu = &candidate;
+      break;
+    }
+    slot = (slot + 1) & (ECU_INDEX_SLOTS - 1);
+  }
+  
+  unsigned long now = scanMillis();
+  if (ecu == NULL) {
+    if (session.ecus.count >= MAX_SESSION_ECUS) return NULL;
+    ecu = &session.ecus.records[session.ecus.count++];
+    session.ecus.slots[slot] = session.ecus.count;
+    *ecu = {};
+    ecu->responseId = response.identifier;
+    ecu->extended = response.extd;
+    ecu->requestId = ecuRequestIdFor(response.identifier, response.extd);
+    ecu->firstSeenMs = now - session.ecus.scanStartMs;
+    ecu->latencyMinMs = UINT16_MAX;
+  }
+  
+  // Only single and first frames start a response - consecutive and flow
+  // control frames belong to one already counted
+  uint8_t pciType = response.data[0] >> 4;
+  if (response.data_length_code < 2 || pciType > 1) return ecu;
+  uint8_t service = pciType == 0 ? response.data[1] : response.data[2];
+  
+  uint16_t latency = min(now - requestMs, (unsigned long)UINT16_MAX);
+  if (ecu->responses < UINT16_MAX) ecu->responses++;
+  ecu->latencySumMs += latency;
+  if (latency < ecu->latencyMinMs) ecu->latencyMinMs = latency;
+  if (latency > ecu->latencyMaxMs) ecu->latencyMaxMs = latency;
+  
+  if (service == 0x7F && pciType == 0 && response.data_length_code >= 4) {
+    if (ecu->nrcCount < UINT8_MAX) ecu->nrcCount++;
+    if (response.data[3] == 0x78 && ecu->pendingCount < UINT8_MAX) ecu->pendingCount++;
+    ecu->lastNrc = response.data[3];
+  } else if (service >= 0x40) {
+    ecu->services |= ecuServiceBit(service - 0x40);
+  }
+  return ecu;
+}
+
+EcuRecord* ecuFind(uint32_t responseId, bool extended) {
+  uint32_t key = ecuKey(responseId, extended);
+  int slot = (key * 0x9E3779B1u) >> 27;
+  while (session.ecus.slots[slot] != 0) {
+    EcuRecord& candidate = session.ecus.records[session.ecus.slots[slot] - 1];
+    if (ecuKey(candidate.responseId, candidate.extended) == key) return &candidate;
+    slot = (slot + 1) & (ECU_INDEX_SLOTS - 1);
+  }
+  return NULL;
+}
+
+uint32_t ecuKey(uint32_t responseId, bool extended) {
+  // 11-bit and 29-bit IDs live in separate spaces; bit 31 keeps them apart
+  return extended ? (responseId & 0x1FFFFFFF) | 0x80000000 : (responseId & 0x7FF);
+}
+
+uint32_t ecuRequestIdFor(uint32_t responseId, bool extended) {
+  // 11-bit: 0x7E8-0x7EF answer 0x7E0-0x7E7. 29-bit: 0x18DAF1xx answers 0x18DAxxF1
+  if (!extended) return responseId >= 0x7E8 && responseId <= 0x7EF ? responseId - 8 : 0;
+  if ((responseId & 0xFFFF0000) != 0x18DA0000) return 0;
+  return 0x18DA0000 | ((responseId & 0xFF) << 8) | ((responseId >> 8) & 0xFF);
+}
+
+uint32_t ecuServiceBit(uint8_t service) {
+  // OBD modes 0x01-0x0A map to bits 1-10, the UDS services we use to bits 16+
+  if (service >= 0x01 && service <= 0x0A) return 1UL << service;
+  switch (service) {
+    case 0x10: return 1UL << 16;  // DiagnosticSessionControl
+    case 0x19: return 1UL << 17;  // ReadDTCInformation
+    case 0x22: return 1UL << 18;  // ReadDataByIdentifier
+    case 0x3E: return 1UL << 19;  // TesterPresent
+    default:   return 0;
+  }
+}
+
+uint16_t ecuLatencyAvgMs(const EcuRecord& ecu) {
+  return ecu.responses > 0 ? ecu.latencySumMs / ecu.responses : 0;
+}
+
+void printEcuRegistry() {
+  for (const EcuRecord& ecu : session.ecus) {
+    Serial.printf("   🖥️ ECU 0x%03X -> 0x%03X: %u responses, %u/%u/%u ms min/avg/max, %u NRCs, services 0x%05X\n",
+                  ecu.requestId, ecu.responseId, ecu.responses,
+                  ecu.responses > 0 ? ecu.latencyMinMs : 0, ecuLatencyAvgMs(ecu), ecu.latencyMaxMs,
+                  ecu.nrcCount, ecu.services);
+  }
+}
+
+// ========== ISO-TP TRANSPORT ==========
+bool isoTpFeed(IsoTpReceiver* rx, const twai_message_t& frame) {
+  // Reassembly lives in isotp.h - this side sends the flow control it asks for
+  switch (isoTpAccept(rx, frame.data, frame.data_length_code)) {
+    case ISOTP_COMPLETE:
+      return true;
+    
+    case ISOTP_SEND_FLOW: {  // Ask for the rest with no block limit or separation time
+      twai_message_t flowControl;
+      flowControl.identifier = rx->flowControlId;
+      flowControl.extd = rx->extended ? 1 : 0;
+      flowControl.rtr = 0;
+      flowControl.data_length_code = 8;
+      flowControl.data[0] = 0x30;  // Continue to send
+      flowControl.data[1] = 0x00;  // Block size: send everything
+      flowControl.data[2] = 0x00;  // STmin: as fast as the ECU likes
+      for (int j = 3; j < 8; j++) {
+        flowControl.data[j] = 0x00;
+      }
+      canTransmit(&flowControl, pdMS_TO_TICKS(50));
+      return false;
+    }
+    
+    case ISOTP_SEQUENCE_ERROR:
+      Serial.printf("   ⚠️ ISO-TP sequence error from 0x%03X, dropping transfer\n", frame.identifier);
+      metricIncrement(METRIC_FRAMES_DROPPED);
+      return false;
+    
+    default:
+      return false;
+  }
+}
+
+bool isoTpSendSingleFrame(uint32_t id, bool extended, const uint8_t* payload, uint8_t len) {
+  if (len == 0 || len > 7) return false;
+  
+  twai_message_t msg;
+  msg.identifier = id;
+  msg.extd = extended ? 1 : 0;
+  msg.rtr = 0;
+  msg.data_length_code = 8;
+  msg.data[0] = len;
+  for (int j = 0; j < 7; j++) {
+    msg.data[1 + j] = (j < len) ? payload[j] : 0x00;
+  }
+  
+  return canTransmit(&msg, pdMS_TO_TICKS(100)) == ESP_OK;
+}
+
 // ========== REAL CAN BUS SCANNING ==========
 void performDiagnosticScan() {
+  TRACE_SCOPE("scan");
   Serial.println("🔍 PROFESSIONAL OBD2 DIAGNOSTIC SCAN");
   Serial.println("   Implementing commercial scan tool methodology...");
-  unsigned long scanStartTime = millis();
-  
-  detectedCodes.clear();
-  activeECUs.clear();
-  vehicleDetected = false; // Reset vehicle detection flag
+  unsigned long scanStartTime = scanMillis();
+  
+  resetScanSession();
+  session.ecus.scanStartMs = scanStartTime;
+  canHealthReset();
+  canTraceBegin();
+  elmSelect(elm.present && !canController.installed);  // TWAI unless its driver never came up
+  kline.active = false;
+  scanDeadTimeMs = 0;
+  scanWindowCount = 0;
+  scanEarlyExitCount = 0;
   
   // Update display with progress
   updateScanProgress("Detecting protocol...", 0);
   
   // Step 1: Professional Protocol Detection (transceiver already enabled)
+  unsigned long detectStart = scanMillis();
+  TRACE_BEGIN("detect");
   obd2_protocol_t detectedProtocol = detectOBD2Protocol();
+  if (detectedProtocol == OBD2_PROTOCOL_NONE && !elm.active && elm.present && !replay.active) {
+    // A dead transceiver looks exactly like a silent bus - ask the adapter before giving up
+    Serial.println("🔌 Nothing over TWAI - retrying through the ELM327/STN adapter");
+    elmSelect(true);
+    detectedProtocol = detectOBD2Protocol();
+  }
+  TRACE_END("detect");
+  metricRecord(METRIC_PROTOCOL_DETECT_MS, scanMillis() - detectStart);
   if (detectedProtocol == OBD2_PROTOCOL_NONE) {
     Serial.println("❌ No OBD2 protocol detected");
+    session.scanDurationMs = scanMillis() - scanStartTime;
+    canTraceAnomaly(CAN_TRACE_ANOMALY_NO_VEHICLE);
+    canHealthReport();
+    canTraceEnd();
     updateScanProgress("No vehicle detected", 100);
     disableCANTransceiver();  // Return to standby mode
-    delay(3000); // Show message for 3 seconds
+    scanDelay(3000); // Show message for 3 seconds
     return;
   }
   
   // Check overall timeout
-  if (millis() - scanStartTime > TOTAL_SCAN_TIMEOUT_MS) {
+  if (scanMillis() - scanStartTime > timing.totalScanTimeoutMs) {
     Serial.println("⏰ Scan timeout reached");
+    session.scanDurationMs = scanMillis() - scanStartTime;
+    canTraceAnomaly(CAN_TRACE_ANOMALY_TIMEOUT);
+    canHealthReport();
+    canTraceEnd();
     updateScanProgress("Scan timeout", 100);
     disableCANTransceiver();  // Return to standby mode
-    delay(2000);
+    scanDelay(2000);
     return;
   }
   
@@ -1303,20 +3051,39 @@ void performDiagnosticScan() {
     case OBD2_PROTOCOL_CAN_29BIT_250K:
       detectedProtocolInfo = {OBD2_PROTOCOL_CAN_29BIT_250K, 250000, true, 0x18DB33F1, "CAN 29-bit 250kbps"};
       break;
+    case OBD2_PROTOCOL_ISO9141:
+      detectedProtocolInfo = {OBD2_PROTOCOL_ISO9141, K_LINE_BAUD, false, K_LINE_INIT_ADDRESS, "ISO 9141-2 K-line"};
+      break;
+    case OBD2_PROTOCOL_KWP2000:
+      detectedProtocolInfo = {OBD2_PROTOCOL_KWP2000, K_LINE_BAUD, false, K_LINE_INIT_ADDRESS, "KWP2000 K-line"};
+      break;
     default:
       Serial.println("❌ Unsupported protocol detected");
+      canHealthReport();
+      canTraceEnd();
       return;
   }
   
-  Serial.printf("✅ Protocol confirmed: %s\n", detectedProtocolInfo.name.c_str());
-  vehicleDetected = true; // Vehicle was successfully detected!
+  Serial.printf("✅ Protocol confirmed: %s\n", detectedProtocolInfo.name);
+  session.vehicleDetected = true; // Vehicle was successfully detected!
   updateScanProgress("Vehicle found! Analyzing...", 25);
   
   // Check timeout
-  if (millis() - scanStartTime > TOTAL_SCAN_TIMEOUT_MS) {
+  if (scanMillis() - scanStartTime > timing.totalScanTimeoutMs) {
     Serial.println("⏰ Scan timeout reached during protocol detection");
+    session.scanDurationMs = scanMillis() - scanStartTime;
+    canTraceAnomaly(CAN_TRACE_ANOMALY_TIMEOUT);
+    canHealthReport();
+    canTraceEnd();
     updateScanProgress("Scan timeout", 100);
-    delay(2000);
+    scanDelay(2000);
+    return;
+  }
+  
+  // K-line vehicles: readiness and Mode 03/07 over the K-line session, same results
+  if (kline.active) {
+    klineScan();
+    finishDiagnosticScan(scanStartTime);
     return;
   }
   
@@ -1330,49 +3097,71 @@ void performDiagnosticScan() {
   
   updateScanProgress("Professional DTC query...", 50);
   
-  twai_message_t msg;
-  msg.identifier = targetAddress;
-  msg.extd = 0;
-  msg.rtr = 0;
-  msg.data_length_code = 8;
-  msg.data[0] = 0x01;  // Length
-  msg.data[1] = 0x03;  // Mode 03 - Stored DTCs
-  msg.data[2] = 0x00;
-  msg.data[3] = 0x00;
-  msg.data[4] = 0x00;
-  msg.data[5] = 0x00;
-  msg.data[6] = 0x00;
-  msg.data[7] = 0x00;
-  
   Serial.printf("📡 Professional query to ECM 0x%03X (like real scanners)...\n", targetAddress);
   
-  // Respect Honda timing - max 3 queries per second
-  delay(350);  // 350ms spacing = ~3 queries/sec max
+  // Respect Honda timing - max 3 queries per second, slower on a busy bus
+  canPace(timing.querySpacingMs);  // ~3 queries/sec max by default
   
-  if (twai_transmit(&msg, pdMS_TO_TICKS(200)) == ESP_OK) {
-    unsigned long start = millis();
-    bool foundResponse = false;
-    
-    while (millis() - start < 2000 && !foundResponse) {  // 2 second timeout
-      twai_message_t response;
-      if (twai_receive(&response, pdMS_TO_TICKS(100)) == ESP_OK) {
-        // Only process expected ECM response
-        if (response.identifier == expectedResponse && 
-            response.data_length_code >= 3 && response.data[1] == 0x43) {
-          Serial.printf("✅ Professional ECM response from 0x%03X\n", response.identifier);
-          parseAndStoreDTC(response.data, response.data_length_code, response.identifier);
-          foundResponse = true;
-        }
-      }
-    }
-    
-    if (!foundResponse) {
-      Serial.println("ℹ️ No DTCs found - vehicle appears healthy");
-    }
+  TRACE_BEGIN("dtc");
+  int storedCount = queryDTCMode(targetAddress, expectedResponse, 0x03);
+  if (storedCount == 0) {
+    Serial.println("ℹ️ No DTCs found - vehicle appears healthy");
+  }
+  TRACE_END("dtc");
+  
+  // Smog-check readiness (PID 01 since clear, PID 41 this drive cycle)
+  TRACE_BEGIN("readiness");
+  queryReadiness(targetAddress, expectedResponse);
+  TRACE_END("readiness");
+  
+  // Pending (07) and permanent (0A) codes, then freeze frames for stored codes,
+  // all inside a fixed time budget so a slow ECM can't stretch the scan
+  unsigned long extendedStart = scanMillis();
+  TRACE_BEGIN("dtcExtended");
+  // An ECM that ignored Mode 03 rarely answers 07/0A - give those a short window
+  uint8_t extendedModes[] = {0x07, 0x0A};
+  for (int m = 0; m < 2; m++) {
+    if (scanMillis() - extendedStart >= timing.extendedDtcBudgetMs) break;
+    canPace(timing.querySpacingMs);
+    if (scanMillis() - extendedStart >= timing.extendedDtcBudgetMs) break;
+    unsigned long windowMs = timing.extendedDtcBudgetMs - (scanMillis() - extendedStart);
+    if (storedCount < 0) windowMs = min(windowMs, (unsigned long)timing.silentEcuWindowMs);
+    queryDTCMode(targetAddress, expectedResponse, extendedModes[m], windowMs);
+  }
+  
+  if (storedCount > 0 && scanMillis() - extendedStart < timing.extendedDtcBudgetMs) {
+    updateScanProgress("Reading freeze frames...", 55);
+    captureFreezeFrames(targetAddress, expectedResponse,
+                        timing.extendedDtcBudgetMs - (scanMillis() - extendedStart));
+  }
+  
+  session.extendedDTCTimeMs = scanMillis() - extendedStart;
+  TRACE_END("dtcExtended");
+  Serial.printf("⏱️ Pending/permanent/freeze-frame capture: %lums (budget %lums)\n",
+                session.extendedDTCTimeMs, timing.extendedDtcBudgetMs);
+  
+  // Step 3: Mode 09 calibration IDs, CVNs and ECU names from every OBD ECU
+  if (!detectedProtocolInfo.extendedId) {
+    updateScanProgress("Reading vehicle info...", 58);
+    TRACE_BEGIN("mode09");
+    collectVehicleInfo();
+    TRACE_END("mode09");
   }
   
+  // Step 4: UDS ReadDTCInformation for ABS, SRS, body and network modules
+  if (UDS_SCAN_ENABLED && !detectedProtocolInfo.extendedId) {
+    updateScanProgress("Scanning other modules...", 60);
+    TRACE_BEGIN("discover");
+    scanUDSModules();
+    TRACE_END("discover");
+  }
+  
+  finishDiagnosticScan(scanStartTime);
+}
+
+void finishDiagnosticScan(unsigned long scanStartTime) {
   updateScanProgress("Complete!", 75);
-  delay(1000);  // Professional scanner spacing
+  scanDelay(1000);  // Professional scanner spacing
   
   updateScanProgress("Scan complete!", 100);
   
@@ -1380,9 +3169,21 @@ void performDiagnosticScan() {
   Serial.println("🛡️ Returning SN65HVD230 to standby mode (Honda-safe)");
   disableCANTransceiver();
   
-  unsigned long scanDuration = millis() - scanStartTime;
+  unsigned long scanDuration = scanMillis() - scanStartTime;
+  session.scanDurationMs = scanDuration;
   Serial.printf("✓ Scan complete: %d active ECUs, %d fault codes (%.1fs)\n", 
-                activeECUs.size(), detectedCodes.size(), scanDuration / 1000.0);
+                session.ecus.size(), session.codes.size(), scanDuration / 1000.0);
+  Serial.printf("⏱️ Response windows: %d opened, %d closed early, %lu ms dead time\n",
+                scanWindowCount, scanEarlyExitCount, scanDeadTimeMs);
+  printEcuRegistry();
+  elmReport();
+  canHealthReport();
+  canTraceEnd();
+  
+  if (kline.active) {
+    Serial2.end();  // The ECU drops the session itself after P3max
+    kline.active = false;
+  }
 }
 
 bool testECUCommunication(uint16_t ecuId) {
@@ -1398,12 +3199,12 @@ bool testECUCommunication(uint16_t ecuId) {
   msg.data[6] = 0x00;
   msg.data[7] = 0x00;
   
-  if (twai_transmit(&msg, pdMS_TO_TICKS(100)) != ESP_OK) {
+  if (canTransmit(&msg, pdMS_TO_TICKS(100)) != ESP_OK) {
     return false;
   }
   
   twai_message_t response;
-  if (twai_receive(&response, pdMS_TO_TICKS(500)) == ESP_OK) {
+  if (canReceive(&response, pdMS_TO_TICKS(500)) == ESP_OK) {
     return (response.identifier == (ecuId + 8));
   }
   
@@ -1423,12 +3224,12 @@ void scanForDTCs(uint16_t ecuId) {
   msg.data[6] = 0x00;
   msg.data[7] = 0x00;
   
-  if (twai_transmit(&msg, pdMS_TO_TICKS(100)) != ESP_OK) {
+  if (canTransmit(&msg, pdMS_TO_TICKS(100)) != ESP_OK) {
     return;
   }
   
   twai_message_t response;
-  if (twai_receive(&response, pdMS_TO_TICKS(500)) == ESP_OK) {
+  if (canReceive(&response, pdMS_TO_TICKS(500)) == ESP_OK) {
     if (response.data_length_code > 2) {
       parseAndStoreDTC(response.data, response.data_length_code, ecuId);
     }
@@ -1436,72 +3237,264 @@ void scanForDTCs(uint16_t ecuId) {
 }
 
 void parseAndStoreDTC(uint8_t* data, int len, uint16_t ecuId) {
-  for (int i = 2; i < len - 1; i += 2) {
-    uint8_t byte1 = data[i];
-    uint8_t byte2 = data[i + 1];
-    
-    if (byte1 == 0 && byte2 == 0) continue;
+  // Single CAN frame: PCI length, then the Mode 03/07/0A payload
+  int payloadLen = min((int)(data[0] & 0x0F), len - 1);
+  storeDTCPayload(&data[1], payloadLen, ecuId);
+}
+
+void storeDTCPayload(const uint8_t* payload, int len, uint16_t ecuId) {
+  if (len < 2) return;
+  
+  // payload[0] is the response mode (0x43 stored, 0x47 pending, 0x4A permanent),
+  // payload[1] the DTC count on CAN, followed by 2-byte DTCs
+  uint8_t responseMode = payload[0];
+  
+  for (int i = 2; i < len - 1; i += 2) {
+    uint8_t byte1 = payload[i];
+    uint8_t byte2 = payload[i + 1];
     
-    // Determine DTC type
-    char category = 'P';
-    if ((byte1 & 0xC0) == 0x40) category = 'C';
-    else if ((byte1 & 0xC0) == 0x80) category = 'B';
-    else if ((byte1 & 0xC0) == 0xC0) category = 'U';
-    
-    int codeNumber = ((byte1 & 0x3F) << 8) | byte2;
-    String dtcCode = String(category) + String(codeNumber, HEX);
-    dtcCode.toUpperCase();
-    
-    // Pad with zeros if needed
-    while (dtcCode.length() < 5) {
-      dtcCode = dtcCode.substring(0, 1) + "0" + dtcCode.substring(1);
-    }
-    
-    FaultCode fault;
-    fault.code = dtcCode;
-    fault.ecuId = ecuId;
-    fault.isPending = false;
-    
-    // Add better system description based on DTC code
-    if (dtcCode.startsWith("P0")) {
-      fault.system = "Engine/Powertrain";
-    } else if (dtcCode.startsWith("P1")) {
-      fault.system = "Fuel and Air Metering";
-    } else if (dtcCode.startsWith("P2")) {
-      fault.system = "Fuel and Air Metering (Injector Circuit)";
-    } else if (dtcCode.startsWith("P3")) {
-      fault.system = "Ignition System or Misfire";
-    } else if (dtcCode.startsWith("B")) {
-      fault.system = "Body Control";
-    } else if (dtcCode.startsWith("C")) {
-      fault.system = "Chassis";
-    } else if (dtcCode.startsWith("U")) {
-      fault.system = "Network/Communication";
-    } else {
-      fault.system = "Unknown System";
+    if (byte1 == 0 && byte2 == 0) continue;
+    
+    FaultCode fault = decodeFaultCode(byte1, byte2, ecuId);
+    fault.isPending   = (responseMode == 0x47);
+    fault.isPermanent = (responseMode == 0x4A);
+    fault.mode        = responseMode & 0x3F;
+    FaultCode* stored = addSessionCode(fault);
+    if (stored == NULL) {
+      Serial.printf("  ⚠️ DTC list full (%d), dropping %s\n", MAX_SESSION_DTCS, fault.code);
+      continue;
+    }
+    if (stored->passes > 1) {
+      Serial.printf("  ↺ DTC %s from ECU 0x%03X seen again (%d reports)\n", fault.code, ecuId, stored->passes);
+      continue;
+    }
+    
+    Serial.printf("  🚨 DTC found: %s from ECU 0x%03X%s\n", fault.code, ecuId,
+                  fault.isPending ? " (pending)" : fault.isPermanent ? " (permanent)" : "");
+  }
+}
+
+FaultCode* addSessionCode(const FaultCode& fault) {
+  return dtcIndexAdd(&session.codes, session.codeSlots, fault);
+}
+
+FaultCode decodeFaultCode(uint8_t byte1, uint8_t byte2, uint16_t ecuId) {
+  // Determine DTC type
+  char category = 'P';
+  if ((byte1 & 0xC0) == 0x40) category = 'C';
+  else if ((byte1 & 0xC0) == 0x80) category = 'B';
+  else if ((byte1 & 0xC0) == 0xC0) category = 'U';
+  
+  FaultCode fault;
+  int codeNumber = ((byte1 & 0x3F) << 8) | byte2;
+  snprintf(fault.code, sizeof(fault.code), "%c%04X", category, codeNumber);
+  fault.ecuId = ecuId;
+  fault.rawCode = (byte1 << 8) | byte2;
+  fault.isPending = false;
+  fault.isPermanent = false;
+  fault.status = 0;
+  fault.failureType = 0;
+  fault.mode = 0;
+  fault.passes = 0;
+  
+  // Add better system description based on DTC code
+  if (category == 'P' && fault.code[1] == '0') {
+    fault.system = "Engine/Powertrain";
+  } else if (category == 'P' && fault.code[1] == '1') {
+    fault.system = "Fuel and Air Metering";
+  } else if (category == 'P' && fault.code[1] == '2') {
+    fault.system = "Fuel and Air Metering (Injector Circuit)";
+  } else if (category == 'P' && fault.code[1] == '3') {
+    fault.system = "Ignition System or Misfire";
+  } else if (category == 'B') {
+    fault.system = "Body Control";
+  } else if (category == 'C') {
+    fault.system = "Chassis";
+  } else if (category == 'U') {
+    fault.system = "Network/Communication";
+  } else {
+    fault.system = "Unknown System";
+  }
+  
+  // Add specific descriptions for common codes
+  if (fault.rawCode == 0x0354) {
+    fault.system = "Ignition Coil D Primary/Secondary Circuit";
+  } else if (fault.rawCode == 0x0301) {
+    fault.system = "Engine - Cylinder 1 Misfire Detected";
+  } else if (fault.rawCode == 0x0420) {
+    fault.system = "Catalyst System Efficiency Below Threshold";
+  }
+  
+  return fault;
+}
+
+bool obdPhysicalRequest(uint32_t requestId, uint32_t responseId, const uint8_t* request, uint8_t len,
+                        IsoTpReceiver* rx, unsigned long timeoutMs, unsigned long maxWindowMs) {
+  // maxWindowMs caps the window even after a 0x78 stretches it - callers with a time budget pass what is left
+  isoTpReset(rx, requestId, false);
+  if (!isoTpSendSingleFrame(requestId, false, request, len)) return false;
+  unsigned long sentMs = scanMillis();
+  
+  ResponseCollector collector;
+  openResponseWindow(&collector, min(timeoutMs, maxWindowMs), &responseId, 1);
+  collector.idleGapMs = 0;  // Multi-frame replies can pause between frames
+  
+  twai_message_t response;
+  while (receiveInWindow(&collector, &response)) {
+    if (response.extd || response.identifier != responseId) continue;
+    ecuObserve(response, sentMs);
+    
+    if (!isoTpFeed(rx, response)) {
+      markResponder(&collector, responseId, false);
+      continue;
+    }
+    
+    // Response pending - the ECU will answer properly within P2*
+    if (isoTpResponsePending(*rx)) {
+      isoTpReset(rx, requestId, false);
+      collector.timeoutMs = min((scanMillis() - collector.startTime) + UDS_PENDING_TIMEOUT_MS, maxWindowMs);
+      markResponder(&collector, responseId, false);
+      continue;
+    }
+    
+    markResponder(&collector, responseId, true);
+  }
+  closeResponseWindow(&collector);
+  
+  return rx->complete && rx->buffer[0] == (uint8_t)(request[0] + 0x40);
+}
+
+int queryDTCMode(uint32_t requestId, uint32_t responseId, uint8_t mode, unsigned long budgetMs) {
+  static IsoTpReceiver rx;  // Static - too large for the loop task stack
+  uint8_t request[] = {mode};
+  
+  if (!obdPhysicalRequest(requestId, responseId, request, sizeof(request), &rx, timing.dtcResponseTimeoutMs,
+                          budgetMs)) {
+    Serial.printf("   ⚠️ No Mode %02X response from 0x%03X\n", mode, responseId);
+    return -1;
+  }
+  
+  Serial.printf("✅ Mode %02X response from 0x%03X (%d bytes)\n", mode, responseId, rx.receivedLength);
+  int before = session.codes.size();
+  storeDTCPayload(rx.buffer, rx.receivedLength, responseId);
+  return session.codes.size() - before;
+}
+
+void captureFreezeFrames(uint32_t requestId, uint32_t responseId, unsigned long budgetMs) {
+  static IsoTpReceiver rx;
+  unsigned long start = scanMillis();
+  
+  for (uint8_t frame = 0; frame < MAX_FREEZE_FRAMES && session.freezeFrameCount < MAX_FREEZE_FRAMES; frame++) {
+    if (scanMillis() - start >= budgetMs) {
+      Serial.println("   ⏰ Freeze-frame budget exhausted");
+      break;
     }
     
-    // Add specific descriptions for common codes
-    if (dtcCode == "P0354") {
-      fault.system = "Ignition Coil D Primary/Secondary Circuit";
-    } else if (dtcCode == "P0301") {
-      fault.system = "Engine - Cylinder 1 Misfire Detected";
-    } else if (dtcCode == "P0420") {
-      fault.system = "Catalyst System Efficiency Below Threshold";
+    // PID 02 names the DTC that stored this frame - 0000 means no frame
+    uint8_t dtcRequest[] = {0x02, 0x02, frame};
+    if (!obdPhysicalRequest(requestId, responseId, dtcRequest, sizeof(dtcRequest), &rx, timing.pidResponseTimeoutMs,
+                            budgetMs - (scanMillis() - start)) ||
+        rx.receivedLength < 5 || (rx.buffer[3] == 0 && rx.buffer[4] == 0)) {
+      break;
     }
     
-    detectedCodes.push_back(fault);
+    FreezeFrameRecord& record = session.freezeFrames[session.freezeFrameCount];
+    record.rawCode = (rx.buffer[3] << 8) | rx.buffer[4];
+    record.ecuId = responseId;
+    record.frameNumber = frame;
+    record.pidCount = 0;
+    
+    // Batch PIDs three per request: 02 <pid> <frame> <pid> <frame> <pid> <frame>
+    for (int p = 0; p < NUM_FREEZE_FRAME_PIDS; p += FREEZE_FRAME_PIDS_PER_REQUEST) {
+      if (scanMillis() - start >= budgetMs) break;
+      
+      uint8_t request[1 + 2 * FREEZE_FRAME_PIDS_PER_REQUEST];
+      uint8_t requestLen = 1;
+      request[0] = 0x02;
+      for (int k = p; k < min(p + FREEZE_FRAME_PIDS_PER_REQUEST, NUM_FREEZE_FRAME_PIDS); k++) {
+        request[requestLen++] = FREEZE_FRAME_PIDS[k].pid;
+        request[requestLen++] = frame;
+      }
+      
+      if (!obdPhysicalRequest(requestId, responseId, request, requestLen, &rx, timing.pidResponseTimeoutMs,
+                              budgetMs - (scanMillis() - start))) {
+        continue;
+      }
+      
+      // 42 <pid> <frame> <data...> repeated for each PID the ECU supports
+      int pos = 1;
+      while (pos + 2 < rx.receivedLength && record.pidCount < FREEZE_FRAME_MAX_PIDS) {
+        uint8_t pid = rx.buffer[pos];
+        int length = freezeFramePidLength(pid);
+        if (length == 0 || pos + 2 + length > rx.receivedLength) break;
+        
+        record.pids[record.pidCount] = pid;
+        record.values[record.pidCount][0] = rx.buffer[pos + 2];
+        record.values[record.pidCount][1] = (length > 1) ? rx.buffer[pos + 3] : 0;
+        record.pidCount++;
+        pos += 2 + length;
+      }
+    }
     
-    Serial.printf("  🚨 DTC found: %s from ECU 0x%03X\n", dtcCode.c_str(), ecuId);
+    // rx now holds the last PID batch - the owner comes from the record
+    FaultCode owner = decodeFaultCode(record.rawCode >> 8, record.rawCode & 0xFF, responseId);
+    Serial.printf("   🧊 Freeze frame %d for %s: %d PIDs\n", frame, owner.code, record.pidCount);
+    session.freezeFrameCount++;
+  }
+}
+
+int freezeFramePidLength(uint8_t pid) {
+  for (int i = 0; i < NUM_FREEZE_FRAME_PIDS; i++) {
+    if (FREEZE_FRAME_PIDS[i].pid == pid) return FREEZE_FRAME_PIDS[i].length;
+  }
+  return 0;
+}
+
+// ========== READINESS MONITORS ==========
+void printReadiness(const ReadinessReport& report) {
+  if (!report.hasStatus) {
+    Serial.println("   ℹ️ Readiness: not reported");
+    return;
+  }
+  
+  Serial.printf("📋 Readiness: MIL %s, %d emission DTC(s), %s ignition, %d incomplete\n",
+                report.milOn ? "ON" : "OFF", report.dtcCount,
+                report.compressionIgnition ? "compression" : "spark", countIncompleteMonitors(report));
+  
+  for (int i = 0; i < NUM_READINESS_MONITORS; i++) {
+    if (!(report.supported & (1UL << i))) continue;
+    Serial.printf("   %s %s", (report.complete & (1UL << i)) ? "✅" : "⏳", READINESS_MONITORS[i].name);
+    if (report.hasCycleStatus && (report.cycleEnabled & (1UL << i))) {
+      Serial.printf(" (this cycle: %s)", (report.cycleComplete & (1UL << i)) ? "complete" : "running");
+    }
+    Serial.println();
+  }
+}
+
+void queryReadiness(uint32_t requestId, uint32_t responseId) {
+  static IsoTpReceiver rx;
+  uint8_t pids[] = {0x01, 0x41};
+  
+  for (int i = 0; i < 2; i++) {
+    uint8_t request[] = {0x01, pids[i]};
+    if (obdPhysicalRequest(requestId, responseId, request, sizeof(request), &rx, timing.pidResponseTimeoutMs)) {
+      decodeReadiness(rx.buffer, rx.receivedLength, &session.readiness);
+    }
+    canPace(timing.querySpacingMs);  // Honda pacing
   }
+  
+  printReadiness(session.readiness);
 }
 
 // ========== ENHANCED OBD2 PROTOCOL DETECTION ==========
 obd2_protocol_t detectOBD2Protocol() {
+  if (elm.active) return elmDetectProtocol();
+  
   Serial.println("🔍 PROFESSIONAL OBD2 PROTOCOL DETECTION");
   Serial.println("   Using commercial scan tool methodology...");
   
   // Define supported OBD2 protocols in order of prevalence
+  bool klineTried = false;
   OBD2ProtocolInfo protocols[] = {
     {OBD2_PROTOCOL_CAN_11BIT_500K, 500000, false, 0x7DF, "CAN 11-bit 500kbps"},
     {OBD2_PROTOCOL_CAN_11BIT_250K, 250000, false, 0x7DF, "CAN 11-bit 250kbps"},
@@ -1512,14 +3505,27 @@ obd2_protocol_t detectOBD2Protocol() {
   int numProtocols = sizeof(protocols) / sizeof(protocols[0]);
   
   for (int i = 0; i < numProtocols; i++) {
-    Serial.printf("📡 Testing Protocol: %s\n", protocols[i].name.c_str());
+    Serial.printf("📡 Testing Protocol: %s\n", protocols[i].name);
     
     if (testProtocol(&protocols[i])) {
-      Serial.printf("✅ PROTOCOL DETECTED: %s\n", protocols[i].name.c_str());
+      Serial.printf("✅ PROTOCOL DETECTED: %s\n", protocols[i].name);
       Serial.printf("   Broadcast ID: 0x%08X\n", protocols[i].broadcastId);
       Serial.printf("   Extended ID: %s\n", protocols[i].extendedId ? "Yes" : "No");
       return protocols[i].protocol;
     }
+    
+    // Dead silence at 11-bit 500k is the pre-CAN signature - try the K-line
+    // before sitting through the remaining CAN listens
+    if (i == 0 && K_LINE_ENABLED && !replay.active && canHealth.totals.rxFrames == 0 && canBusErrors() == 0) {
+      klineTried = true;
+      obd2_protocol_t klineProtocol = klineConnect();
+      if (klineProtocol != OBD2_PROTOCOL_NONE) return klineProtocol;
+    }
+  }
+  
+  if (K_LINE_ENABLED && !klineTried && !replay.active) {
+    obd2_protocol_t klineProtocol = klineConnect();
+    if (klineProtocol != OBD2_PROTOCOL_NONE) return klineProtocol;
   }
   
   Serial.println("❌ No OBD2 protocol detected");
@@ -1527,6 +3533,12 @@ obd2_protocol_t detectOBD2Protocol() {
 }
 
 bool testProtocol(OBD2ProtocolInfo* protocolInfo) {
+  // An earlier variant already drew error frames at this bit rate - don't listen again
+  if (canBaudRateRejected(protocolInfo->baudRate)) {
+    Serial.printf("   ⏭️ Skipping - %d bps already rejected (bus errors)\n", protocolInfo->baudRate);
+    return false;
+  }
+  
   // Initialize CAN with protocol specifications
   if (!reinitializeCAN(protocolInfo->baudRate)) {
     Serial.printf("   ❌ Failed to initialize CAN at %d bps\n", protocolInfo->baudRate);
@@ -1538,12 +3550,22 @@ bool testProtocol(OBD2ProtocolInfo* protocolInfo) {
   
   // Step 1: Listen for existing traffic
   Serial.println("   👂 Listening for existing CAN traffic...");
-  unsigned long startTime = millis();
+  unsigned long startTime = scanMillis();
   int frameCount = 0;
-  
-  while (millis() - startTime < 2000) { // 2 second listen
+  uint32_t errorsAtStart = canBusErrors();
+  
+  while (scanMillis() - startTime < timing.protocolListenMs) {
+    // A wrong bit rate on a busy bus shows up as error frames, not silence -
+    // stop listening and never transmit onto that bus at this rate
+    if (frameCount == 0 && canBusErrors() - errorsAtStart >= CAN_WRONG_BAUD_ERRORS) {
+      Serial.printf("   ⚡ %u bus errors and no clean frame - wrong bit rate\n",
+                    canBusErrors() - errorsAtStart);
+      canRejectBaudRate(protocolInfo->baudRate);
+      return false;
+    }
+    
     twai_message_t message;
-    if (twai_receive(&message, pdMS_TO_TICKS(50)) == ESP_OK) {
+    if (canReceive(&message, pdMS_TO_TICKS(50)) == ESP_OK) {
       frameCount++;
       
       // Check if frame matches expected ID format
@@ -1595,41 +3617,46 @@ bool sendOBD2Handshake(uint32_t address, bool extended) {
   msg.data[7] = 0x00;
   
   // Send handshake
-  if (twai_transmit(&msg, pdMS_TO_TICKS(100)) != ESP_OK) {
+  if (canTransmit(&msg, pdMS_TO_TICKS(100)) != ESP_OK) {
     Serial.println("   ❌ Failed to send handshake");
     return false;
   }
   
-  // Wait for any ECU to respond
-  unsigned long startTime = millis();
-  while (millis() - startTime < 1000) { // 1 second timeout
-    twai_message_t response;
-    if (twai_receive(&response, pdMS_TO_TICKS(50)) == ESP_OK) {
-      
-      // Check if this looks like an OBD2 response
-      bool validResponse = false;
-      
-      if (!extended && !response.extd) {
-        // 11-bit: Response should be 0x7E8-0x7EF
-        validResponse = (response.identifier >= 0x7E8 && response.identifier <= 0x7EF);
-      } else if (extended && response.extd) {
-        // 29-bit: Response should follow ISO-TP format
-        validResponse = ((response.identifier & 0xFFFF0000) == 0x18DA0000);
-      }
-      
-      if (validResponse && response.data_length_code >= 3) {
-        // Check if response is Mode 01 PID 00 response (0x41 0x00 ...)
-        if (response.data[1] == 0x41 && response.data[2] == 0x00) {
-          Serial.printf("   ✅ Valid Mode 01 PID 00 response from 0x%08X\n", response.identifier);
-          Serial.printf("   📋 Supported PIDs: %02X %02X %02X %02X\n", 
-                        response.data[3], response.data[4], response.data[5], response.data[6]);
-          return true;
-        }
+  // Wait for every ECU to respond - the responders become the expected set for later queries
+  discoveredResponderCount = 0;
+  
+  ResponseCollector collector;
+  openResponseWindow(&collector, timing.handshakeTimeoutMs, NULL, 0); // Idle gap once anyone answers
+  
+  twai_message_t response;
+  while (receiveInWindow(&collector, &response)) {
+    
+    // Check if this looks like an OBD2 response
+    bool validResponse = false;
+    
+    if (!extended && !response.extd) {
+      // 11-bit: Response should be 0x7E8-0x7EF
+      validResponse = (response.identifier >= 0x7E8 && response.identifier <= 0x7EF);
+    } else if (extended && response.extd) {
+      // 29-bit: Response should follow ISO-TP format
+      validResponse = ((response.identifier & 0xFFFF0000) == 0x18DA0000);
+    }
+    
+    if (validResponse && response.data_length_code >= 3) {
+      // Check if response is Mode 01 PID 00 response (0x41 0x00 ...)
+      if (response.data[1] == 0x41 && response.data[2] == 0x00) {
+        Serial.printf("   ✅ Valid Mode 01 PID 00 response from 0x%08X\n", response.identifier);
+        Serial.printf("   📋 Supported PIDs: %02X %02X %02X %02X\n", 
+                      response.data[3], response.data[4], response.data[5], response.data[6]);
+        addDiscoveredResponder(response.identifier);
+        ecuObserve(response, collector.startTime);
+        markResponder(&collector, response.identifier, true);
       }
     }
   }
+  closeResponseWindow(&collector);
   
-  return false;
+  return discoveredResponderCount > 0;
 }
 
 void scanWithBroadcastAddress(uint32_t broadcastId, bool extended) {
@@ -1646,6 +3673,7 @@ void scanWithBroadcastAddress(uint32_t broadcastId, bool extended) {
     {0x01, 0x00, "Supported PIDs 01-20", 500},        // Handshake first
     {0x03, 0x00, "Stored emission DTCs", 1000},       // Priority #1 - stored DTCs  
     {0x07, 0x00, "Pending emission DTCs", 1000},      // Priority #2 - pending DTCs
+    {0x0A, 0x00, "Permanent emission DTCs", 1000},    // Priority #3 - permanent DTCs
     {0x01, 0x01, "Monitor status since DTCs cleared", 750},
     {0x01, 0x03, "Fuel system status", 500},
     {0x09, 0x00, "Vehicle information supported", 500},
@@ -1684,70 +3712,70 @@ void scanWithBroadcastAddress(uint32_t broadcastId, bool extended) {
     
     // Send broadcast query with Honda-compatible approach
     Serial.printf("   📡 Sending query (waiting %dms after)...\n", standardQueries[i].delayMs);
-    if (twai_transmit(&msg, pdMS_TO_TICKS(200)) == ESP_OK) {
+    if (canTransmit(&msg, pdMS_TO_TICKS(200)) == ESP_OK) {
       // Collect responses with longer timeout for Honda
-      unsigned long queryStart = millis();
       int responseCount = 0;
       
-      // Honda ECUs may need more time to respond, especially for DTC queries
-      int collectionTime = (standardQueries[i].mode == 0x03 || standardQueries[i].mode == 0x07) ? 3000 : 2000;
-      while (millis() - queryStart < collectionTime) {
-        twai_message_t response;
-        if (twai_receive(&response, pdMS_TO_TICKS(50)) == ESP_OK) {
+      // Honda ECUs may need more time to respond, especially for DTC queries.
+      // The window still closes as soon as every ECU from discovery has answered.
+      bool dtcQuery = (standardQueries[i].mode == 0x03 || standardQueries[i].mode == 0x07 ||
+                       standardQueries[i].mode == 0x0A);
+      int collectionTime = dtcQuery ? 3000 : 2000;
+      ResponseCollector collector;
+      openResponseWindow(&collector, collectionTime, discoveredResponders, discoveredResponderCount);
+      
+      twai_message_t response;
+      while (receiveInWindow(&collector, &response)) {
+        
+        // Validate response format
+        bool validResponse = false;
+        if (!extended && !response.extd) {
+          // 11-bit responses from 0x7E8-0x7EF
+          validResponse = (response.identifier >= 0x7E8 && response.identifier <= 0x7EF);
+        } else if (extended && response.extd) {
+          // 29-bit ISO-TP responses
+          validResponse = ((response.identifier & 0xFFFF0000) == 0x18DA0000);
+        }
+        
+        if (validResponse && response.data_length_code >= 2) {
+          responseCount++;
+          session.vehicleDetected = true; // Mark vehicle as detected
+          markResponder(&collector, response.identifier, isFinalResponse(response, standardQueries[i].mode));
+          ecuObserve(response, collector.startTime);
           
-          // Validate response format
-          bool validResponse = false;
-          if (!extended && !response.extd) {
-            // 11-bit responses from 0x7E8-0x7EF
-            validResponse = (response.identifier >= 0x7E8 && response.identifier <= 0x7EF);
-          } else if (extended && response.extd) {
-            // 29-bit ISO-TP responses
-            validResponse = ((response.identifier & 0xFFFF0000) == 0x18DA0000);
+          Serial.printf("   ✅ Response #%d from ECU 0x%08X: ", responseCount, response.identifier);
+          for (int j = 0; j < response.data_length_code; j++) {
+            Serial.printf("%02X ", response.data[j]);
           }
+          Serial.println();
           
-          if (validResponse && response.data_length_code >= 2) {
-            responseCount++;
-            vehicleDetected = true; // Mark vehicle as detected
-            
-            // Track active ECU
-            bool ecuKnown = false;
-            for (uint16_t ecu : activeECUs) {
-              if (ecu == response.identifier) {
-                ecuKnown = true;
-                break;
-              }
-            }
-            if (!ecuKnown) {
-              activeECUs.push_back(response.identifier);
-            }
-            
-            Serial.printf("   ✅ Response #%d from ECU 0x%08X: ", responseCount, response.identifier);
-            for (int j = 0; j < response.data_length_code; j++) {
-              Serial.printf("%02X ", response.data[j]);
-            }
-            Serial.println();
-            
-            // Parse DTC responses (Mode 03/07)
-            if ((standardQueries[i].mode == 0x03 || standardQueries[i].mode == 0x07) && 
-                response.data_length_code > 2) {
-              parseAndStoreDTC(response.data, response.data_length_code, response.identifier);
-            }
+          // Parse DTC responses (Mode 03/07/0A)
+          if (dtcQuery && response.data_length_code > 2 && response.data[1] != 0x7F) {
+            parseAndStoreDTC(response.data, response.data_length_code, response.identifier);
+          }
+          
+          // Monitor status - the ECM's answer wins over other emissions ECUs
+          if (standardQueries[i].mode == 0x01 && standardQueries[i].pid == 0x01 &&
+              (!session.readiness.hasStatus || response.identifier == 0x7E8)) {
+            decodeReadiness(&response.data[1], response.data[0] & 0x0F, &session.readiness);
           }
         }
       }
+      closeResponseWindow(&collector);
       
-      Serial.printf("   📊 Query complete: %d ECU responses collected\n", responseCount);
+      Serial.printf("   📊 Query complete: %d ECU responses collected in %lums\n",
+                    responseCount, scanMillis() - collector.startTime);
     } else {
       Serial.printf("   ❌ Failed to send Mode %02X PID %02X query\n", 
                     standardQueries[i].mode, standardQueries[i].pid);
     }
     
     // Honda-specific delay between queries to prevent dashboard interference
-    delay(standardQueries[i].delayMs);
+    scanDelay(standardQueries[i].delayMs);
   }
   
   Serial.printf("🎯 BROADCAST SCAN COMPLETE: %d active ECUs, %d DTCs\n", 
-                activeECUs.size(), detectedCodes.size());
+                session.ecus.size(), session.codes.size());
 }
 
 void scanHondaSpecificDTCs(bool extended) {
@@ -1755,7 +3783,7 @@ void scanHondaSpecificDTCs(bool extended) {
   Serial.println("   Using conservative timing and targeted ECU queries...");
   
   // Initial delay to let CAN bus settle
-  delay(1000);
+  scanDelay(1000);
   
   // Minimal ECU addresses to prevent CAN bus disruption
   uint16_t hondaECUs[] = {
@@ -1784,51 +3812,43 @@ void scanHondaSpecificDTCs(bool extended) {
     msg.data[6] = 0x00;
     msg.data[7] = 0x00;
     
-    if (twai_transmit(&msg, pdMS_TO_TICKS(200)) == ESP_OK) {
+    if (canTransmit(&msg, pdMS_TO_TICKS(200)) == ESP_OK) {
       // Honda ECUs may take longer to respond to DTC requests
-      unsigned long start = millis();
       bool foundResponse = false;
+      uint32_t responseAddr = ecuAddr + 8;
       
-      while (millis() - start < 3000 && !foundResponse) { // 3 second timeout per ECU
-        twai_message_t response;
-        if (twai_receive(&response, pdMS_TO_TICKS(100)) == ESP_OK) {
+      ResponseCollector collector;
+      openResponseWindow(&collector, 3000, &responseAddr, 1); // 3 second timeout per ECU
+      
+      twai_message_t response;
+      while (!foundResponse && receiveInWindow(&collector, &response)) {
+        
+        // Look for valid Honda response
+        bool validResponse = false;
+        if (!extended && !response.extd) {
+          validResponse = (response.identifier >= 0x7E8 && response.identifier <= 0x7EF);
+        } else if (extended && response.extd) {
+          validResponse = ((response.identifier & 0xFFFF0000) == 0x18DA0000);
+        }
+        
+        if (validResponse) {
+          foundResponse = true;
+          markResponder(&collector, response.identifier, true);
+          ecuObserve(response, collector.startTime);
           
-          // Look for valid Honda response
-          bool validResponse = false;
-          if (!extended && !response.extd) {
-            validResponse = (response.identifier >= 0x7E8 && response.identifier <= 0x7EF);
-          } else if (extended && response.extd) {
-            validResponse = ((response.identifier & 0xFFFF0000) == 0x18DA0000);
+          Serial.printf("   ✅ Honda ECU 0x%03X responded from 0x%03X: ", ecuAddr, response.identifier);
+          for (int j = 0; j < response.data_length_code; j++) {
+            Serial.printf("%02X ", response.data[j]);
           }
+          Serial.println();
           
-          if (validResponse) {
-            foundResponse = true;
-            
-            // Track active ECU
-            bool ecuKnown = false;
-            for (uint16_t ecu : activeECUs) {
-              if (ecu == response.identifier) {
-                ecuKnown = true;
-                break;
-              }
-            }
-            if (!ecuKnown) {
-              activeECUs.push_back(response.identifier);
-            }
-            
-            Serial.printf("   ✅ Honda ECU 0x%03X responded from 0x%03X: ", ecuAddr, response.identifier);
-            for (int j = 0; j < response.data_length_code; j++) {
-              Serial.printf("%02X ", response.data[j]);
-            }
-            Serial.println();
-            
-            // Parse DTC response
-            if (response.data_length_code > 2) {
-              parseAndStoreDTC(response.data, response.data_length_code, response.identifier);
-            }
+          // Parse DTC response
+          if (response.data_length_code > 2 && response.data[1] != 0x7F) {
+            parseAndStoreDTC(response.data, response.data_length_code, response.identifier);
           }
         }
       }
+      closeResponseWindow(&collector);
       
       if (!foundResponse) {
         Serial.printf("   ⚠️ No response from Honda ECU 0x%03X\n", ecuAddr);
@@ -1836,13 +3856,13 @@ void scanHondaSpecificDTCs(bool extended) {
     }
     
     // Honda-specific: Longer delay between ECU queries to prevent interference
-    delay(2000);  // 2000ms between ECU queries to prevent CAN bus disruption
+    scanDelay(2000);  // 2000ms between ECU queries to prevent CAN bus disruption
   }
   
-  Serial.printf("🔧 HONDA SCAN COMPLETE: Found %d DTCs\n", detectedCodes.size());
+  Serial.printf("🔧 HONDA SCAN COMPLETE: Found %d DTCs\n", session.codes.size());
   
   // Final delay to let CAN bus settle before returning to normal vehicle operation
-  delay(2000);
+  scanDelay(2000);
 }
 
 bool isHondaVehicle() {
@@ -1861,11 +3881,11 @@ bool isHondaVehicle() {
   msg.data[6] = 0x00;
   msg.data[7] = 0x00;
   
-  if (twai_transmit(&msg, pdMS_TO_TICKS(200)) == ESP_OK) {
-    unsigned long start = millis();
-    while (millis() - start < 2000) {  // 2 second timeout
+  if (canTransmit(&msg, pdMS_TO_TICKS(200)) == ESP_OK) {
+    unsigned long start = scanMillis();
+    while (scanMillis() - start < 2000) {  // 2 second timeout
       twai_message_t response;
-      if (twai_receive(&response, pdMS_TO_TICKS(100)) == ESP_OK) {
+      if (canReceive(&response, pdMS_TO_TICKS(100)) == ESP_OK) {
         // Look for VIN response
         if (response.data_length_code >= 7 && response.data[0] >= 0x06 && 
             response.data[1] == 0x49 && response.data[2] == 0x02) {
@@ -1889,11 +3909,11 @@ bool isHondaVehicle() {
   msg.data[1] = 0x01;  // Mode 01
   msg.data[2] = 0x00;  // Supported PIDs
   
-  if (twai_transmit(&msg, pdMS_TO_TICKS(200)) == ESP_OK) {
-    unsigned long start = millis();
-    while (millis() - start < 1000) {
+  if (canTransmit(&msg, pdMS_TO_TICKS(200)) == ESP_OK) {
+    unsigned long start = scanMillis();
+    while (scanMillis() - start < 1000) {
       twai_message_t response;
-      if (twai_receive(&response, pdMS_TO_TICKS(100)) == ESP_OK) {
+      if (canReceive(&response, pdMS_TO_TICKS(100)) == ESP_OK) {
         if ((response.identifier == 0x7E8 || response.identifier == 0x7E9) &&
             response.data_length_code >= 3 && response.data[1] == 0x41) {
           Serial.println("🏎️ Honda vehicle detected from ECU response");
@@ -1906,136 +3926,1689 @@ bool isHondaVehicle() {
   return false;  // Not detected as Honda
 }
 
-// ========== REAL CAN BUS FUNCTIONS ==========
-uint32_t autoDetectCANBaudRate() {
-  Serial.println("🔍 Auto-detecting CAN baud rate...");
-  
-  // Common OBD2 baud rates to try
-  uint32_t baudRates[] = {500000, 250000, 125000, 1000000};
-  int numRates = sizeof(baudRates) / sizeof(baudRates[0]);
-  
-  for (int i = 0; i < numRates; i++) {
-    uint32_t baudRate = baudRates[i];
-    Serial.printf("📡 Trying %d bps...\n", baudRate);
-    
-    if (reinitializeCAN(baudRate)) {
-      // Listen for any CAN activity for shorter time per baud rate
-      unsigned long startTime = millis();
-      int frameCount = 0;
-      
-      while (millis() - startTime < BAUD_DETECT_TIMEOUT_MS) {
-        twai_message_t message;
-        if (twai_receive(&message, pdMS_TO_TICKS(100)) == ESP_OK) {
-          frameCount++;
-          if (frameCount >= 3) { // Found activity
-            Serial.printf("✅ CAN activity detected at %d bps (%d frames)\n", baudRate, frameCount);
-            return baudRate;
-          }
-        }
-      }
-      Serial.printf("   No activity at %d bps\n", baudRate);
-    }
+// ========== MODE 09 VEHICLE INFORMATION ==========
+void collectVehicleInfo() {
+  // Supported InfoTypes first, then each InfoType is requested from every ECU
+  // that lists it in one window - the multi-frame CALID/CVN transfers from
+  // several ECUs overlap on the bus instead of running back to back
+  unsigned long start = scanMillis();
+  
+  session.vehicleInfoCount = 0;
+  for (const EcuRecord& ecu : session.ecus) {
+    if (session.vehicleInfoCount >= MODE09_MAX_ECUS) break;
+    if (ecu.extended || ecu.requestId == 0) continue;
+    VehicleInfoRecord& record = session.vehicleInfo[session.vehicleInfoCount++];
+    record = {};
+    record.responseId = ecu.responseId;
+  }
+  if (session.vehicleInfoCount == 0) {
+    Serial.println("ℹ️ Mode 09: no OBD ECUs to ask");
+    return;
   }
   
-  return 0; // No activity detected
-}
-
-bool reinitializeCAN(uint32_t baudRate) {
-  // Stop current driver
-  twai_stop();
-  twai_driver_uninstall();
+  // Every window, 0x78 extensions included, is capped by what is left of the budget
+  int targets[MODE09_MAX_ECUS];
+  int targetCount = mode09Targets(MODE09_SUPPORTED, targets);
+  mode09Request(MODE09_SUPPORTED, targets, targetCount, MODE09_BUDGET_MS);
   
-  // Configure for new baud rate
-  twai_general_config_t g_config = TWAI_GENERAL_CONFIG_DEFAULT(CAN_TX_PIN, CAN_RX_PIN, TWAI_MODE_NORMAL);
-  twai_filter_config_t f_config = TWAI_FILTER_CONFIG_ACCEPT_ALL(); // Accept all messages
+  targetCount = mode09Targets(MODE09_VIN, targets);
+  if (targetCount > 0 && scanMillis() - start < MODE09_BUDGET_MS) {
+    mode09Request(MODE09_VIN, targets, targetCount, MODE09_BUDGET_MS - (scanMillis() - start));
+  }
   
-  twai_timing_config_t t_config;
-  if (baudRate == 1000000) {
-    t_config = TWAI_TIMING_CONFIG_1MBITS();
-  } else if (baudRate == 500000) {
-    t_config = TWAI_TIMING_CONFIG_500KBITS();
-  } else if (baudRate == 250000) {
-    t_config = TWAI_TIMING_CONFIG_250KBITS();
-  } else if (baudRate == 125000) {
-    t_config = TWAI_TIMING_CONFIG_125KBITS();
+  if (session.vin[0] != '\0' && vinCacheLoad(session.vin)) {
+    session.vehicleInfoCached = true;
   } else {
-    return false;
+    const uint8_t infoTypes[] = {MODE09_CALID, MODE09_CVN, MODE09_ECU_NAME};
+    bool complete = true;
+    for (uint8_t infoType : infoTypes) {
+      if (scanMillis() - start >= MODE09_BUDGET_MS) {
+        Serial.printf("   ⏱️ Mode 09 budget spent, skipping InfoType %02X\n", infoType);
+        complete = false;
+        break;
+      }
+      targetCount = mode09Targets(infoType, targets);
+      if (targetCount == 0) continue;
+      int answered = mode09Request(infoType, targets, targetCount, MODE09_BUDGET_MS - (scanMillis() - start));
+      if (answered < targetCount) {
+        Serial.printf("   ⚠️ Mode 09 InfoType %02X: %d of %d ECUs answered\n", infoType, answered, targetCount);
+        complete = false;
+      }
+    }
+    // Only a full read is cached - a partial one would stick for every later visit
+    if (complete && session.vin[0] != '\0') vinCacheStore();
   }
   
-  if (twai_driver_install(&g_config, &t_config, &f_config) != ESP_OK) {
-    return false;
+  session.vehicleInfoTimeMs = scanMillis() - start;
+  metricRecord(METRIC_MODE09_MS, session.vehicleInfoTimeMs);
+  
+  Serial.printf("🪪 Mode 09: VIN %s, %d ECUs, %lums%s\n", session.vin[0] ? session.vin : "(none)",
+                session.vehicleInfoCount, session.vehicleInfoTimeMs, session.vehicleInfoCached ? " (cached)" : "");
+  for (int i = 0; i < session.vehicleInfoCount; i++) {
+    const VehicleInfoRecord& record = session.vehicleInfo[i];
+    Serial.printf("   🪪 0x%03X %-20s CALID %s CVN %08X%s\n", record.responseId,
+                  record.ecuName[0] ? record.ecuName : "(unnamed)",
+                  record.calIdCount > 0 ? record.calIds[0] : "-",
+                  record.cvnCount > 0 ? record.cvns[0] : 0,
+                  record.calIdCount > 1 ? " (+more)" : "");
   }
-  
-  if (twai_start() != ESP_OK) {
-    return false;
+}
+
+int mode09Targets(uint8_t infoType, int* targets) {
+  // Indexes into session.vehicleInfo of the ECUs that advertise infoType
+  int count = 0;
+  for (int i = 0; i < session.vehicleInfoCount; i++) {
+    if (infoType == MODE09_SUPPORTED || mode09Supported(session.vehicleInfo[i], infoType)) {
+      targets[count++] = i;
+    }
   }
-  
-  return true;
+  return count;
 }
 
-void listenForCANTraffic(uint32_t duration_ms) {
-  Serial.println("👂 Listening for raw CAN traffic...");
+int mode09Request(uint8_t infoType, const int* targets, int targetCount, unsigned long maxWindowMs) {
+  uint8_t request[] = {0x09, infoType};
+  uint32_t expected[MODE09_MAX_ECUS];
+  unsigned long sentMs[MODE09_MAX_ECUS];
+  int expectedCount = 0;
+  
+  // Physical request to each ECU back-to-back, then one collection window for all of them
+  for (int i = 0; i < targetCount; i++) {
+    const VehicleInfoRecord& record = session.vehicleInfo[targets[i]];
+    uint32_t requestId = ecuRequestIdFor(record.responseId, false);
+    isoTpReset(&mode09Receivers[targets[i]], requestId, false);
+    sentMs[i] = scanMillis();
+    if (isoTpSendSingleFrame(requestId, false, request, sizeof(request))) {
+      expected[expectedCount++] = record.responseId;
+    }
+    canPace(timing.udsRequestSpacingMs);
+  }
   
-  unsigned long startTime = millis();
-  int frameCount = 0;
-  std::vector<uint32_t> uniqueIDs;
+  if (expectedCount == 0) return 0;
   
-  while (millis() - startTime < duration_ms) {
-    twai_message_t message;
-    if (twai_receive(&message, pdMS_TO_TICKS(50)) == ESP_OK) {
-      frameCount++;
+  ResponseCollector collector;
+  openResponseWindow(&collector, min(MODE09_WINDOW_MS, maxWindowMs), expected, expectedCount);
+  collector.idleGapMs = 0;  // Known ECU set: wait for each one or the timeout
+  
+  int completed = 0;
+  twai_message_t response;
+  while (receiveInWindow(&collector, &response)) {
+    if (response.extd) continue;
+    
+    for (int i = 0; i < targetCount; i++) {
+      VehicleInfoRecord& record = session.vehicleInfo[targets[i]];
+      if (record.responseId != response.identifier) continue;
       
-      // Log raw frame data
-      Serial.printf("📦 CAN Frame #%d: ID=0x%03X DLC=%d Data=", 
-                    frameCount, message.identifier, message.data_length_code);
+      ecuObserve(response, sentMs[i]);
+      IsoTpReceiver& rx = mode09Receivers[targets[i]];
+      if (!isoTpFeed(&rx, response)) {
+        markResponder(&collector, response.identifier, false);
+        break;
+      }
       
-      for (int i = 0; i < message.data_length_code; i++) {
-        Serial.printf("%02X ", message.data[i]);
+      if (isoTpResponsePending(rx)) {
+        isoTpReset(&rx, rx.flowControlId, false);
+        collector.timeoutMs = min((scanMillis() - collector.startTime) + UDS_PENDING_TIMEOUT_MS, maxWindowMs);
+        markResponder(&collector, response.identifier, false);
+        break;
       }
-      Serial.printf(" (Extended=%s)\n", message.extd ? "yes" : "no");
       
-      // Track unique IDs
-      bool found = false;
-      for (uint32_t id : uniqueIDs) {
-        if (id == message.identifier) {
-          found = true;
-          break;
-        }
+      if (rx.receivedLength >= 2 && rx.buffer[0] == 0x49 && rx.buffer[1] == infoType) {
+        decodeVehicleInfo(&record, rx.buffer, rx.receivedLength);
+        completed++;
       }
-      if (!found) {
-        uniqueIDs.push_back(message.identifier);
+      markResponder(&collector, response.identifier, true);
+      break;
+    }
+  }
+  closeResponseWindow(&collector);
+  
+  return completed;
+}
+
+void decodeVehicleInfo(VehicleInfoRecord* record, const uint8_t* payload, int len) {
+  // payload is 49 <InfoType> <data>; on CAN the data starts with the item count
+  const uint8_t* data = payload + 2;
+  int dataLength = len - 2;
+  
+  switch (payload[1]) {
+    case MODE09_SUPPORTED:
+      if (dataLength >= 4) {
+        record->supported = ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | (data[2] << 8) | data[3];
       }
+      break;
       
-      // Update display periodically
-      if (frameCount % 10 == 0) {
-        tft.fillRect(0, 200, SCREEN_WIDTH, 20, TFT_BLACK);
-        tft.setTextColor(TFT_WHITE);
-        tft.setCursor(10, 200);
-        tft.printf("Frames: %d IDs: %d", frameCount, uniqueIDs.size());
+    case MODE09_VIN: {
+      // The VIN is the last 17 bytes - some ECUs pad in front of it
+      if (dataLength < 17 || session.vin[0] != '\0') break;
+      const uint8_t* vin = data + dataLength - 17;
+      for (int j = 0; j < 17; j++) {
+        if (!isalnum(vin[j])) return;  // Blank or garbage VIN - not usable as a cache key
+      }
+      memcpy(session.vin, vin, 17);
+      session.vin[17] = '\0';
+      break;
+    }
+      
+    case MODE09_CALID: {
+      if (dataLength < 1) break;
+      int count = min((int)data[0], min((dataLength - 1) / MODE09_CALID_LENGTH, MODE09_MAX_CALIDS));
+      for (int c = 0; c < count; c++) {
+        copyPrintable(record->calIds[c], data + 1 + c * MODE09_CALID_LENGTH, MODE09_CALID_LENGTH);
+      }
+      record->calIdCount = count;
+      break;
+    }
+      
+    case MODE09_CVN: {
+      if (dataLength < 1) break;
+      int count = min((int)data[0], min((dataLength - 1) / 4, MODE09_MAX_CALIDS));
+      for (int c = 0; c < count; c++) {
+        const uint8_t* cvn = data + 1 + c * 4;
+        record->cvns[c] = ((uint32_t)cvn[0] << 24) | ((uint32_t)cvn[1] << 16) | (cvn[2] << 8) | cvn[3];
       }
+      record->cvnCount = count;
+      break;
     }
+      
+    case MODE09_ECU_NAME:
+      // "ECM" + '-' + "EngineControl", NUL padded to 20 bytes
+      if (dataLength >= 1 + MODE09_ECU_NAME_LENGTH) {
+        copyPrintable(record->ecuName, data + 1, MODE09_ECU_NAME_LENGTH);
+      }
+      break;
   }
+}
+
+bool mode09Supported(const VehicleInfoRecord& record, uint8_t infoType) {
+  if (infoType == 0 || infoType > 0x20) return false;
+  return (record.supported >> (32 - infoType)) & 1;
+}
+
+void copyPrintable(char* out, const uint8_t* in, int len) {
+  // Fixed-width ASCII field -> C string: stops at padding, masks anything unprintable
+  int end = 0;
+  for (int j = 0; j < len && in[j] != 0x00; j++) {
+    out[j] = isprint(in[j]) ? in[j] : '?';
+    if (in[j] != ' ') end = j + 1;
+  }
+  out[end] = '\0';
+}
+
+bool vinCacheLoad(const char* vin) {
+  // Replays must exercise the bus path, so the cache is bypassed for them
+  if (replay.active || !canTrace.fsReady) return false;
+  
+  char path[32];
+  snprintf(path, sizeof(path), "%s/%s.bin", VIN_CACHE_DIR, vin);
+  if (!LittleFS.exists(path)) return false;
+  File file = LittleFS.open(path, FILE_READ);
+  if (!file) return false;
+  
+  VinCacheHeader header;
+  bool valid = file.read((uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+               memcmp(header.magic, VIN_CACHE_MAGIC, 4) == 0 &&
+               header.version == VIN_CACHE_VERSION &&
+               header.count > 0 && header.count <= MODE09_MAX_ECUS &&
+               strncmp(header.vin, vin, sizeof(header.vin)) == 0 &&
+               file.size() == sizeof(header) + header.count * sizeof(VehicleInfoRecord);
+  if (valid) {
+    size_t bytes = header.count * sizeof(VehicleInfoRecord);
+    valid = file.read((uint8_t*)session.vehicleInfo, bytes) == bytes;
+    session.vehicleInfoCount = valid ? header.count : 0;
+  }
+  file.close();
   
-  Serial.printf("📊 Traffic summary: %d frames, %d unique IDs\n", frameCount, uniqueIDs.size());
-  
-  // Log unique IDs found
-  Serial.print("🆔 Unique CAN IDs: ");
-  for (int i = 0; i < uniqueIDs.size() && i < 20; i++) {
-    Serial.printf("0x%03X ", uniqueIDs[i]);
+  if (!valid) {
+    Serial.printf("⚠️ VIN cache entry %s is stale or corrupt, re-reading\n", path);
+    LittleFS.remove(path);
   }
-  Serial.println();
+  return valid;
 }
 
-void probeOBD2ECUs() {
-  Serial.println("🔍 Actively probing for OBD2 ECUs...");
+void vinCacheStore() {
+  if (replay.active || !canTrace.fsReady || session.vehicleInfoCount == 0) return;
+  
+  if (!LittleFS.exists(VIN_CACHE_DIR)) LittleFS.mkdir(VIN_CACHE_DIR);
+  
+  // Bounded cache: past the limit one entry makes room - any will do, repeat
+  // visits are rare enough that recency is not worth tracking
+  File dir = LittleFS.open(VIN_CACHE_DIR);
+  int entries = 0;
+  char victim[40] = "";
+  if (dir && dir.isDirectory()) {
+    for (File entry = dir.openNextFile(); entry; entry = dir.openNextFile()) {
+      if (entries++ == 0) snprintf(victim, sizeof(victim), "%s", entry.path());
+      entry.close();
+    }
+  }
+  dir.close();
+  if (entries >= VIN_CACHE_MAX_FILES && victim[0] != '\0') LittleFS.remove(victim);
+  
+  char path[32];
+  snprintf(path, sizeof(path), "%s/%s.bin", VIN_CACHE_DIR, session.vin);
+  File file = LittleFS.open(path, FILE_WRITE);
+  if (!file) {
+    Serial.printf("⚠️ Could not write VIN cache entry %s\n", path);
+    return;
+  }
   
-  // Enhanced ECU probing with multiple methods
-  Serial.println("📡 Enhanced ECU probing with multiple detection methods...");
+  VinCacheHeader header = {};
+  memcpy(header.magic, VIN_CACHE_MAGIC, 4);
+  header.version = VIN_CACHE_VERSION;
+  header.count = session.vehicleInfoCount;
+  memcpy(header.vin, session.vin, sizeof(header.vin));
+  file.write((const uint8_t*)&header, sizeof(header));
+  file.write((const uint8_t*)session.vehicleInfo, session.vehicleInfoCount * sizeof(VehicleInfoRecord));
+  file.close();
+  Serial.printf("💾 Cached vehicle info for %s (%d ECUs)\n", session.vin, session.vehicleInfoCount);
+}
+
+// ========== UDS (ISO 14229) MODULE SCAN ==========
+void scanUDSModules() {
+  Serial.println("🧩 UDS MODULE SCAN (ReadDTCInformation 0x19/0x02)");
+  Serial.printf("   %d modules in address table, status mask 0x%02X\n", NUM_UDS_MODULES, UDS_DTC_STATUS_MASK);
+  unsigned long udsStart = scanMillis();
+  int initialDTCCount = session.codes.size();
+  
+  for (int i = 0; i < NUM_UDS_MODULES; i++) {
+    udsModuleStates[i].present = false;
+    udsModuleStates[i].extendedSession = false;
+    isoTpReset(&udsModuleStates[i].rx, UDS_MODULES[i].requestId, false);
+  }
   
-  for (int i = 0; i < NUM_ECUS; i++) {
-    uint16_t ecuAddr = OBD2_ADDRESSES[i];
+  // Step 1: DiagnosticSessionControl - extended session, pipelined to every module
+  uint8_t sessionRequest[] = {0x10, 0x03};
+  udsPipelinedRequest(sessionRequest, sizeof(sessionRequest), false);
+  
+  int presentCount = 0;
+  for (int i = 0; i < NUM_UDS_MODULES; i++) {
+    IsoTpReceiver& rx = udsModuleStates[i].rx;
+    if (!rx.complete) continue;
     
-    Serial.printf("📡 Probing ECU 0x%03X (%d/%d) with multiple methods...\n", ecuAddr, i + 1, NUM_ECUS);
+    // A refusal still proves the module exists - 0x19 is allowed in the default session
+    udsModuleStates[i].present = true;
+    udsModuleStates[i].extendedSession = (rx.buffer[0] == 0x50);
+    presentCount++;
+    
+    Serial.printf("   ✅ %s (0x%03X) %s\n", UDS_MODULES[i].name, UDS_MODULES[i].responseId,
+                  udsModuleStates[i].extendedSession ? "in extended session" : "refused session, using default");
+  }
+  
+  if (presentCount == 0) {
+    Serial.println("   ℹ️ No UDS modules answered");
+    return;
+  }
+  
+  // Step 2: ReadDTCInformation - reportDTCByStatusMask
+  uint8_t readDTCRequest[] = {0x19, 0x02, UDS_DTC_STATUS_MASK};
+  udsPipelinedRequest(readDTCRequest, sizeof(readDTCRequest), true);
+  
+  for (int i = 0; i < NUM_UDS_MODULES; i++) {
+    if (!udsModuleStates[i].present) continue;
+    IsoTpReceiver& rx = udsModuleStates[i].rx;
+    
+    if (!rx.complete) {
+      Serial.printf("   ⚠️ %s: no DTC response\n", UDS_MODULES[i].name);
+      continue;
+    }
+    
+    static UdsDtcRecord records[ISOTP_MAX_PAYLOAD / 4];  // Static - too large for the scan task stack
+    int recordCount = decodeUdsDtcReport(rx.buffer, rx.receivedLength, UDS_DTC_STATUS_MASK,
+                                         records, ISOTP_MAX_PAYLOAD / 4);
+    if (recordCount == UDS_REPORT_REJECTED) {
+      Serial.printf("   ⚠️ %s: ReadDTCInformation rejected (NRC %02X)\n", UDS_MODULES[i].name,
+                    udsNegativeCode(rx.buffer, rx.receivedLength));
+      continue;
+    }
+    if (recordCount < 0) continue;
+    
+    int moduleDTCs = 0;
+    for (int j = 0; j < recordCount; j++) {
+      const UdsDtcRecord& record = records[j];
+      uint8_t status = record.status;
+      
+      FaultCode fault = decodeFaultCode(record.high, record.mid, UDS_MODULES[i].responseId);
+      fault.failureType = record.failureType;
+      fault.status = status;
+      fault.isPending = udsStatusIsPending(status);
+      fault.mode = UDS_DTC_MODE;
+      FaultCode* stored = addSessionCode(fault);
+      if (stored == NULL) break;
+      if (stored->passes > 1) continue;
+      moduleDTCs++;
+      
+      char statusText[96];
+      formatDTCStatus(status, statusText, sizeof(statusText));
+      Serial.printf("  🚨 DTC found: %s-%02X from %s [%s]\n", fault.code, fault.failureType,
+                    UDS_MODULES[i].name, statusText);
+    }
+    
+    if (moduleDTCs == 0) {
+      Serial.printf("   ✅ %s: no DTCs\n", UDS_MODULES[i].name);
+    }
+  }
+  
+  // Step 3: Put modules back in the default session rather than waiting for S3 to expire.
+  // Pipelined like the others so the 50 01 replies are consumed here, not by the next window
+  uint8_t defaultSession[] = {0x10, 0x01};
+  udsPipelinedRequest(defaultSession, sizeof(defaultSession), true);
+  
+  Serial.printf("🧩 UDS SCAN COMPLETE: %d modules, %d DTCs (%lums)\n",
+                presentCount, (int)session.codes.size() - initialDTCCount, scanMillis() - udsStart);
+}
+
+int udsPipelinedRequest(const uint8_t* request, uint8_t len, bool presentOnly) {
+  uint8_t service = request[0];
+  uint32_t expected[MAX_EXPECTED_RESPONDERS];
+  unsigned long sentMs[NUM_UDS_MODULES] = {};  // Per module - latency is from its own request
+  int expectedCount = 0;
+  
+  // Fire the request at every module back-to-back, then collect all replies in one window
+  for (int i = 0; i < NUM_UDS_MODULES && expectedCount < MAX_EXPECTED_RESPONDERS; i++) {
+    if (presentOnly && !udsModuleStates[i].present) continue;
+    
+    isoTpReset(&udsModuleStates[i].rx, UDS_MODULES[i].requestId, false);
+    if (isoTpSendSingleFrame(UDS_MODULES[i].requestId, false, request, len)) {
+      expected[expectedCount++] = UDS_MODULES[i].responseId;
+      sentMs[i] = scanMillis();
+    }
+    canPace(timing.udsRequestSpacingMs);
+  }
+  
+  if (expectedCount == 0) return 0;
+  
+  ResponseCollector collector;
+  openResponseWindow(&collector, UDS_RESPONSE_TIMEOUT_MS, expected, expectedCount);
+  collector.idleGapMs = 0;  // Known module set: wait for each one or the timeout
+  collector.keepAliveMs = UDS_TESTER_PRESENT_MS;
+  
+  int completed = 0;
+  
+  twai_message_t response;
+  while (receiveInWindow(&collector, &response)) {
+    if (response.extd) continue;
+    
+    for (int i = 0; i < NUM_UDS_MODULES; i++) {
+      if (UDS_MODULES[i].responseId != response.identifier) continue;
+      if (presentOnly && !udsModuleStates[i].present) break;
+      ecuObserve(response, sentMs[i]);
+      
+      IsoTpReceiver& rx = udsModuleStates[i].rx;
+      if (!isoTpFeed(&rx, response)) {
+        markResponder(&collector, response.identifier, false);
+        break;
+      }
+      
+      // Response pending: the module needs up to P2* - restart its reassembly and stretch the window
+      if (rx.buffer[0] == 0x7F && rx.receivedLength >= 3 && rx.buffer[1] == service && rx.buffer[2] == 0x78) {
+        isoTpReset(&rx, UDS_MODULES[i].requestId, false);
+        collector.timeoutMs = (scanMillis() - collector.startTime) + UDS_PENDING_TIMEOUT_MS;
+        markResponder(&collector, response.identifier, false);
+        break;
+      }
+      
+      completed++;
+      markResponder(&collector, response.identifier, true);
+      break;
+    }
+  }
+  closeResponseWindow(&collector);
+  
+  return completed;
+}
+
+void sendUDSTesterPresent() {
+  // Functional TesterPresent with suppressPosRspMsgIndicationBit - keeps every session alive, no replies
+  uint8_t testerPresent[] = {0x3E, 0x80};
+  isoTpSendSingleFrame(0x7DF, false, testerPresent, sizeof(testerPresent));
+}
+
+// ========== CAN BUS HEALTH ==========
+esp_err_t canTransmit(const twai_message_t* msg, TickType_t ticksToWait) {
+  if (replay.active) return replayTransmit(*msg);
+  if (elm.active) return elmTransmit(*msg);
+  canHealthPoll();
+  if (canHealth.recovering && !canAwaitRecovery(CAN_RECOVERY_TIMEOUT_MS)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  
+  esp_err_t result = twai_transmit(msg, ticksToWait);
+  if (result == ESP_OK) {
+    canHealth.totals.txFrames++;
+    canHealth.windowBits += canFrameBits(*msg);
+    canTraceRecord(*msg, true);
+  }
+  return result;
+}
+
+esp_err_t canReceive(twai_message_t* msg, TickType_t ticksToWait) {
+  if (replay.active) return replayReceive(msg, ticksToWait);
+  if (elm.active) return elmReceive(msg, ticksToWait);
+  canHealthPoll();
+  esp_err_t result = twai_receive(msg, ticksToWait);
+  if (result == ESP_OK) {
+    canHealth.totals.rxFrames++;
+    canHealth.windowBits += canFrameBits(*msg);
+    canTraceRecord(*msg, false);
+  }
+  return result;
+}
+
+void canHealthPoll() {
+  // Alerts latch in the driver, so a non-blocking read here misses nothing
+  uint32_t alerts = 0;
+  if (twai_read_alerts(&alerts, 0) == ESP_OK) {
+    if (alerts & TWAI_ALERT_ERR_PASS) {
+      canHealth.totals.errorPassiveEvents++;
+      Serial.println("⚠️ CAN error passive");
+    }
+    if ((alerts & TWAI_ALERT_BUS_OFF) && !canHealth.recovering) {
+      // Recover in place - the driver keeps its config, no uninstall/install cycle
+      canHealth.totals.busOffEvents++;
+      metricIncrement(METRIC_CAN_BUS_OFF);
+      canTraceAnomaly(CAN_TRACE_ANOMALY_BUS_OFF);
+      Serial.println("🚨 CAN bus-off - initiating recovery");
+      canHealth.recovering = twai_initiate_recovery() == ESP_OK;
+    }
+    if ((alerts & TWAI_ALERT_BUS_RECOVERED) && canHealth.recovering) {
+      canHealth.recovering = false;
+      if (twai_start() == ESP_OK) {
+        canHealth.totals.recoveries++;
+        Serial.println("✓ CAN bus recovered");
+      }
+    }
+  }
+  
+  uint64_t nowUs = esp_timer_get_time();
+  if (nowUs - canHealth.lastSampleUs >= CAN_HEALTH_SAMPLE_US) {
+    canHealthSample(nowUs);
+  }
+}
+
+void canHealthSample(uint64_t nowUs) {
+  if (replay.active) return;  // The controller is idle - a replay has no bus to measure
+  canHealth.lastSampleUs = nowUs;
+  twai_status_info_t status;
+  if (twai_get_status_info(&status) != ESP_OK) return;
+  
+  canHealth.state = status.state;
+  CanBusSummary& totals = canHealth.totals;
+  totals.peakTxErrors = max(totals.peakTxErrors, (uint8_t)min(status.tx_error_counter, (uint32_t)255));
+  totals.peakRxErrors = max(totals.peakRxErrors, (uint8_t)min(status.rx_error_counter, (uint32_t)255));
+  
+  // Driver counters are cumulative since install - fold in the change since the last sample
+  uint32_t newBusErrors = status.bus_error_count - canHealth.lastBusErrors;
+  uint32_t newMissed = status.rx_missed_count - canHealth.lastRxMissed;
+  uint32_t newOverruns = status.rx_overrun_count - canHealth.lastRxOverruns;
+  totals.busErrors += newBusErrors;
+  totals.arbitrationLost += status.arb_lost_count - canHealth.lastArbitrationLost;
+  totals.rxMissed += newMissed;
+  totals.rxOverruns += newOverruns;
+  canHealth.lastBusErrors = status.bus_error_count;
+  canHealth.lastArbitrationLost = status.arb_lost_count;
+  canHealth.lastRxMissed = status.rx_missed_count;
+  canHealth.lastRxOverruns = status.rx_overrun_count;
+  
+  // Frames we never saw still occupied the bus: charge dropped frames as full
+  // 8-byte frames and each error frame as its ~20 bit flag + delimiter
+  canHealth.windowBits += (newMissed + newOverruns) * 122 + newBusErrors * 20;
+  
+  if (nowUs - canHealth.windowStartUs >= CAN_LOAD_WINDOW_US) {
+    canHealthCloseWindow(nowUs);
+  }
+}
+
+void canHealthCloseWindow(uint64_t nowUs) {
+  uint64_t elapsedUs = nowUs - canHealth.windowStartUs;
+  uint64_t capacityBits = (uint64_t)canHealth.baudRate * elapsedUs / 1000000;
+  if (capacityBits > 0) {
+    canHealth.loadPercent = (uint8_t)min((uint64_t)100, (uint64_t)canHealth.windowBits * 100 / capacityBits);
+    canHealth.totals.loadPeakPercent = max(canHealth.totals.loadPeakPercent, canHealth.loadPercent);
+    canHealth.scanBits += canHealth.windowBits;
+    canHealth.scanCapacityBits += capacityBits;
+  }
+  canHealth.windowBits = 0;
+  canHealth.windowStartUs = nowUs;
+}
+
+bool canAwaitRecovery(unsigned long timeoutMs) {
+  unsigned long start = millis();
+  while (canHealth.recovering && millis() - start < timeoutMs) {
+    uint32_t alerts = 0;
+    if (twai_read_alerts(&alerts, pdMS_TO_TICKS(5)) == ESP_OK && (alerts & TWAI_ALERT_BUS_RECOVERED)) {
+      canHealth.recovering = false;
+      if (twai_start() == ESP_OK) {
+        canHealth.totals.recoveries++;
+        Serial.printf("✓ CAN bus recovered in %lums\n", millis() - start);
+      }
+    }
+  }
+  return !canHealth.recovering;
+}
+
+void canHealthDriverStarted(uint32_t baudRate, bool countersReset) {
+  // A fresh install restarts the driver's status counters from zero - an
+  // in-place bit-rate switch keeps them, so only the load window restarts
+  uint64_t nowUs = esp_timer_get_time();
+  if (canHealth.baudRate != 0) canHealthCloseWindow(nowUs);
+  canHealth.baudRate = baudRate;
+  canHealth.state = TWAI_STATE_RUNNING;
+  canHealth.recovering = false;
+  if (countersReset) {
+    canHealth.lastBusErrors = 0;
+    canHealth.lastArbitrationLost = 0;
+    canHealth.lastRxMissed = 0;
+    canHealth.lastRxOverruns = 0;
+  }
+  canHealth.windowBits = 0;
+  canHealth.windowStartUs = nowUs;
+}
+
+void canHealthReset() {
+  // Per-scan totals only - the live driver state carries over
+  canHealthSample(esp_timer_get_time());
+  canHealth.totals = {};
+  canHealth.scanBits = 0;
+  canHealth.scanCapacityBits = 0;
+  canHealth.arbitrationLostAtPace = 0;
+  canHealth.rejectedBaudCount = 0;
+  canHealth.windowBits = 0;
+  canHealth.windowStartUs = esp_timer_get_time();
+}
+
+void canHealthReport() {
+  canHealthSample(esp_timer_get_time());
+  canHealthCloseWindow(esp_timer_get_time());
+  CanBusSummary& totals = canHealth.totals;
+  if (canHealth.scanCapacityBits > 0) {
+    totals.loadAvgPercent = (uint8_t)min((uint64_t)100, canHealth.scanBits * 100 / canHealth.scanCapacityBits);
+  }
+  session.bus = totals;
+  
+  metricRecord(METRIC_CAN_BUS_LOAD, totals.loadAvgPercent);
+  metricIncrement(METRIC_FRAMES_DROPPED, totals.rxMissed + totals.rxOverruns);
+  
+  Serial.printf("🚌 CAN bus: load %u%% avg / %u%% peak, %u rx / %u tx frames\n",
+                totals.loadAvgPercent, totals.loadPeakPercent, totals.rxFrames, totals.txFrames);
+  Serial.printf("   errors %u, arbitration lost %u, missed %u, overruns %u, TEC/REC peak %u/%u\n",
+                totals.busErrors, totals.arbitrationLost, totals.rxMissed, totals.rxOverruns,
+                totals.peakTxErrors, totals.peakRxErrors);
+  if (totals.errorPassiveEvents > 0 || totals.busOffEvents > 0) {
+    Serial.printf("   error passive %u, bus-off %u (%u recovered in place)\n",
+                  totals.errorPassiveEvents, totals.busOffEvents, totals.recoveries);
+  }
+}
+
+uint32_t canFrameBits(const twai_message_t& msg) {
+  // SOF..EOF + interframe space, plus ~10% stuff bits on typical payloads
+  uint32_t bits = (msg.extd ? 67 : 47) + (msg.rtr ? 0 : 8 * msg.data_length_code);
+  return bits + bits / 10;
+}
+
+uint32_t canBusErrors() {
+  canHealthSample(esp_timer_get_time());
+  return canHealth.totals.busErrors;
+}
+
+void canRejectBaudRate(uint32_t baudRate) {
+  if (canBaudRateRejected(baudRate) || canHealth.rejectedBaudCount >= MAX_REJECTED_BAUD_RATES) return;
+  canHealth.rejectedBaudRates[canHealth.rejectedBaudCount++] = baudRate;
+}
+
+bool canBaudRateRejected(uint32_t baudRate) {
+  for (int i = 0; i < canHealth.rejectedBaudCount; i++) {
+    if (canHealth.rejectedBaudRates[i] == baudRate) return true;
+  }
+  return false;
+}
+
+void canPace(unsigned long baseMs) {
+  // Back off when the vehicle's own traffic is heavy or we are losing arbitration/
+  // accumulating errors - our requests are the lowest-priority thing on the bus
+  if (replay.active) {
+    scanDelay(baseMs);  // Recorded timing already includes the vehicle's bus load
+    return;
+  }
+  canHealthSample(esp_timer_get_time());
+  unsigned long factor = 1;
+  if (canHealth.loadPercent >= CAN_PACING_SATURATED_LOAD || canHealth.state == TWAI_STATE_BUS_OFF ||
+      canHealth.totals.peakTxErrors >= 128) {
+    factor = 3;
+  } else if (canHealth.loadPercent >= CAN_PACING_BUSY_LOAD ||
+             canHealth.totals.arbitrationLost > canHealth.arbitrationLostAtPace) {
+    factor = 2;
+  }
+  canHealth.arbitrationLostAtPace = canHealth.totals.arbitrationLost;
+  scanDelay(baseMs * factor);
+}
+
+// ========== CAN TRACE RECORDER ==========
+void canTraceInit() {
+  // PSRAM when the module has it - the internal heap is reserved for TLS
+  size_t blockCount = psramFound() ? CAN_TRACE_PSRAM_BLOCKS : CAN_TRACE_INTERNAL_BLOCKS;
+  uint32_t caps = psramFound() ? MALLOC_CAP_SPIRAM : (MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  canTrace.blocks = (CanTraceBlock*)heap_caps_malloc(blockCount * sizeof(CanTraceBlock), caps);
+  canTrace.blockCount = canTrace.blocks != NULL ? blockCount : 0;
+  Serial.printf("🎞️ CAN trace ring: %u KB in %s\n", (unsigned)(canTrace.blockCount * sizeof(CanTraceBlock) / 1024),
+                psramFound() ? "PSRAM" : "internal RAM");
+  
+  // partitions_kiosk.csv gives LittleFS its own partition in place of tinyuf2's "ffat",
+  // so formatting on the first boot is safe. Traces, replay corpus and the VIN cache live here
+  canTrace.fsReady = LittleFS.begin(true, "/littlefs", 4, KIOSK_FS_PARTITION);
+  if (!canTrace.fsReady) {
+    Serial.println("⚠️ LittleFS unavailable - CAN traces will not be kept");
+    return;
+  }
+  
+  // Continue the spill sequence across reboots so the oldest slot is reused first
+  for (int slot = 0; slot < CAN_TRACE_SPILL_FILES; slot++) {
+    char path[24];
+    snprintf(path, sizeof(path), "/cantrace%d.bin", slot);
+    File file = LittleFS.open(path, FILE_READ);
+    if (!file) continue;
+    CanTraceFileHeader header;
+    if (file.read((uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+        memcmp(header.magic, CAN_TRACE_MAGIC, 4) == 0) {
+      canTrace.spillSequence = max(canTrace.spillSequence, header.sequence);
+    }
+    file.close();
+  }
+}
+
+void canTraceBegin() {
+  if (canTrace.blocks == NULL || replay.active) return;
+  canTrace.head = 0;
+  canTrace.used = 0;
+  canTrace.frames = 0;
+  canTrace.truncated = false;
+  canTrace.anomalies = 0;
+  canTrace.recordCycles = 0;
+  canTraceNextBlock((uint32_t)esp_timer_get_time());
+  canTraceMarker(CAN_TRACE_BAUD_MARKER | canBaudIndex(canController.baudRate));
+}
+
+void canTraceRecord(const twai_message_t& msg, bool transmitted) {
+  if (canTrace.used == 0 || canTrace.truncated) return;  // No session open (or no ring, or full)
+  uint32_t startCycles = ESP.getCycleCount();
+  uint32_t nowUs = (uint32_t)esp_timer_get_time();
+  
+  CanTraceBlock* block = &canTrace.blocks[canTrace.head];
+  if (!canTraceBlockHasRoom(*block)) {
+    block = canTraceNextBlock(nowUs);
+    if (block == NULL) return;
+  }
+  
+  canTraceEncodeFrame(block, &canTrace.chain, nowUs, msg.identifier, transmitted, msg.extd, msg.rtr,
+                      msg.data_length_code, msg.data);
+  canTrace.frames++;
+  canTrace.recordCycles += ESP.getCycleCount() - startCycles;
+}
+
+void canTraceAnomaly(uint8_t anomaly) {
+  if (canTrace.used == 0 || replay.active) return;
+  canTrace.anomalies |= anomaly;
+  canTraceMarker(anomaly);  // Shows where in the trace it happened
+}
+
+void canTraceMarker(uint8_t code) {
+  // Marker record: DLC nibble 0xF, delta, code (anomaly bits or a bit-rate switch)
+  if (canTrace.used == 0 || canTrace.truncated) return;
+  uint32_t nowUs = (uint32_t)esp_timer_get_time();
+  CanTraceBlock* block = &canTrace.blocks[canTrace.head];
+  if (!canTraceBlockHasRoom(*block)) {
+    block = canTraceNextBlock(nowUs);
+    if (block == NULL) return;
+  }
+  canTraceEncodeMarker(block, &canTrace.chain, nowUs, code);
+}
+
+void canTraceEnd() {
+  if (canTrace.used == 0 || replay.active) return;
+  
+  size_t bytes = 0;
+  for (int i = 0; i < canTrace.used; i++) {
+    bytes += canTrace.blocks[i].length;
+  }
+  uint32_t recordNs = canTrace.frames > 0
+    ? (uint32_t)((uint64_t)canTrace.recordCycles * 1000 / getCpuFrequencyMhz() / canTrace.frames) : 0;
+  if (canTrace.frames > 0) metricRecord(METRIC_TRACE_RECORD_NS, recordNs);
+  
+  Serial.printf("🎞️ CAN trace: %u frames in %u bytes (%.1f B/frame), %uns/frame%s\n",
+                canTrace.frames, (unsigned)bytes, canTrace.frames > 0 ? (float)bytes / canTrace.frames : 0.0f,
+                recordNs, canTrace.truncated ? ", TRUNCATED" : "");
+  
+  if (canTrace.anomalies != 0 || CAN_TRACE_SPILL_ALL) {
+    canTraceSpill();
+  }
+  canTrace.used = 0;  // Session closed - canTraceRecord() is a no-op until the next begin
+}
+
+bool canTraceSpill() {
+  if (!canTrace.fsReady || canTrace.used == 0) return false;
+  unsigned long spillStart = millis();
+  
+  CanTraceFileHeader header = {};
+  memcpy(header.magic, CAN_TRACE_MAGIC, 4);
+  header.version = CAN_TRACE_FORMAT_VERSION;
+  header.anomalies = canTrace.anomalies | (canTrace.truncated ? CAN_TRACE_TRUNCATED : 0);
+  header.blockSize = sizeof(CanTraceBlock);
+  header.sequence = ++canTrace.spillSequence;
+  header.baudRate = canController.baudRate;
+  header.frames = canTrace.frames;
+  
+  CanTraceResults results = {};
+  results.scanMs = session.scanDurationMs;
+  results.ecuCount = session.ecus.size();
+  results.detected = session.vehicleDetected;
+  for (const auto& code : session.codes) {
+    if (results.dtcCount >= CAN_TRACE_RESULT_CODES) break;
+    results.codes[results.dtcCount++] = {code.rawCode, code.ecuId, canTraceCodeFlags(code), 0};
+  }
+  
+  char path[24];
+  snprintf(path, sizeof(path), "/cantrace%d.bin", (int)(header.sequence % CAN_TRACE_SPILL_FILES));
+  File file = LittleFS.open(path, FILE_WRITE);
+  if (!file) {
+    Serial.printf("❌ Could not open %s for the CAN trace\n", path);
+    return false;
+  }
+  
+  // Header, results, then every block of the session in order - each block is
+  // its 8-byte header plus `length` bytes
+  bool ok = file.write((const uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+            file.write((const uint8_t*)&results, sizeof(results)) == sizeof(results);
+  size_t bytes = sizeof(header) + sizeof(results);
+  for (int i = 0; i < canTrace.used && ok; i++) {
+    const CanTraceBlock& block = canTrace.blocks[i];
+    size_t length = offsetof(CanTraceBlock, data) + block.length;
+    ok = file.write((const uint8_t*)&block, length) == length;
+    bytes += length;
+  }
+  file.close();
+  
+  Serial.printf("💾 CAN trace #%u -> %s (%u bytes, anomalies 0x%02X) in %lums\n",
+                header.sequence, path, (unsigned)bytes, header.anomalies, millis() - spillStart);
+  return ok;
+}
+
+CanTraceBlock* canTraceNextBlock(uint32_t nowUs) {
+  // Blocks restart the delta/ID chain, so any block decodes on its own. Out of
+  // blocks = stop recording: a trace missing its start cannot be replayed
+  if (canTrace.used == canTrace.blockCount) {
+    if (!canTrace.truncated) Serial.println("⚠️ CAN trace full - recording stopped for this scan");
+    canTrace.truncated = true;
+    return NULL;
+  }
+  if (canTrace.used > 0) canTrace.head++;
+  canTrace.used++;
+  
+  CanTraceBlock* block = &canTrace.blocks[canTrace.head];
+  canTraceStartBlock(block, &canTrace.chain, nowUs);
+  return block;
+}
+
+uint8_t canTraceCodeFlags(const FaultCode& code) {
+  return (code.isPending ? 0x01 : 0) | (code.isPermanent ? 0x02 : 0);
+}
+
+uint8_t canBaudIndex(uint32_t baudRate) {
+  for (int i = 0; i < NUM_CAN_BAUD_RATES; i++) {
+    if (CAN_BAUD_RATES[i] == baudRate) return i;
+  }
+  return CAN_BAUD_UNKNOWN;
+}
+
+// ========== TRACE REPLAY ==========
+unsigned long scanMillis() {
+  return replay.active ? (unsigned long)(replay.virtualUs / 1000) : millis();
+}
+
+void scanDelay(unsigned long ms) {
+  if (replay.active) {
+    replay.virtualUs += (uint64_t)ms * 1000;
+  } else {
+    delay(ms);
+  }
+}
+
+void runReplaySuite() {
+  // canBootTask mounts LittleFS - wait for it rather than racing the mount
+  while (bootStageMs[BOOT_STAGE_CAN] == 0) {
+    vTaskDelay(pdMS_TO_TICKS(10));
+  }
+  if (!canTrace.fsReady) {
+    Serial.println("❌ Replay: LittleFS not mounted");
+    return;
+  }
+  
+  // Only for the length of the suite - PSRAM when present
+  uint32_t caps = psramFound() ? MALLOC_CAP_SPIRAM : (MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  replay.frameCapacity = psramFound() ? REPLAY_MAX_FRAMES : REPLAY_MAX_FRAMES_INTERNAL;
+  replay.frames = (ReplayFrame*)heap_caps_malloc(replay.frameCapacity * sizeof(ReplayFrame), caps);
+  replay.block = (CanTraceBlock*)heap_caps_malloc(sizeof(CanTraceBlock), caps);
+  if (replay.frames == NULL || replay.block == NULL) {
+    Serial.println("❌ Replay: not enough memory for the frame table");
+    heap_caps_free(replay.frames);
+    heap_caps_free(replay.block);
+    replay.frames = NULL;
+    replay.block = NULL;
+    return;
+  }
+  
+  Serial.println("🔁 TRACE REPLAY SUITE");
+  ReplaySummary summary = {};
+  unsigned long suiteStart = millis();
+  
+  File dir = LittleFS.open(REPLAY_CORPUS_DIR);
+  if (dir && dir.isDirectory()) {
+    for (File file = dir.openNextFile(); file; file = dir.openNextFile()) {
+      replayTraceFile(file, &summary);
+      file.close();
+    }
+  }
+  for (int slot = 0; slot < CAN_TRACE_SPILL_FILES; slot++) {
+    char path[24];
+    snprintf(path, sizeof(path), "/cantrace%d.bin", slot);
+    File file = LittleFS.open(path, FILE_READ);
+    if (!file) continue;
+    replayTraceFile(file, &summary);
+    file.close();
+  }
+  
+  unsigned long suiteMs = millis() - suiteStart;
+  Serial.printf("🔁 Replay: %d traces, %d passed, %d result diffs, %d timing regressions, %d skipped\n",
+                summary.traces, summary.passed, summary.resultDiffs, summary.timingRegressions, summary.skipped);
+  Serial.printf("   %.1fs of vehicle time in %lums (%.0fx real time)\n", summary.virtualMs / 1000.0, suiteMs,
+                suiteMs > 0 ? (double)summary.virtualMs / suiteMs : 0.0);
+  
+  heap_caps_free(replay.frames);
+  heap_caps_free(replay.block);
+  replay.frames = NULL;
+  replay.block = NULL;
+}
+
+void replayTraceFile(File& file, ReplaySummary* summary) {
+  CanTraceResults expected;
+  if (!replayLoad(&replay, file, &expected)) {
+    Serial.printf("   ⏭️ %s: not a v%d CAN trace\n", file.path(), CAN_TRACE_FORMAT_VERSION);
+    summary->skipped++;
+    return;
+  }
+  if (replay.truncated) {
+    // The scan would run off the end of the recording - results cannot match
+    Serial.printf("   ⏭️ %s: truncated recording\n", file.path());
+    summary->skipped++;
+    return;
+  }
+  
+  replayReset(&replay);
+  
+  unsigned long realStart = millis();
+  replay.active = true;
+  performDiagnosticScan();
+  replay.active = false;
+  unsigned long realMs = millis() - realStart;
+  
+  bool resultsMatch = replayCompareResults(expected);
+  bool timingRegressed = expected.scanMs > 0 &&
+    session.scanDurationMs > expected.scanMs * (100 + REPLAY_TIMING_REGRESSION_PERCENT) / 100;
+  
+  summary->traces++;
+  summary->virtualMs += session.scanDurationMs;
+  if (!resultsMatch) summary->resultDiffs++;
+  if (timingRegressed) summary->timingRegressions++;
+  if (resultsMatch && !timingRegressed) summary->passed++;
+  
+  Serial.printf("   %s %s: %d DTCs, scan %lums (recorded %ums)%s, %u/%u requests matched, %lums real\n",
+                resultsMatch && !timingRegressed ? "✅" : "❌", file.path(), session.codes.size(),
+                session.scanDurationMs, expected.scanMs, timingRegressed ? " SLOWER" : "",
+                replay.matchedRequests, replay.matchedRequests + replay.unmatchedRequests, realMs);
+  
+  // The next customer must not see replayed results
+  resetScanSession();
+  vTaskDelay(1);
+}
+
+esp_err_t replayTransmit(const twai_message_t& msg) {
+  // Nothing reaches the bus - an unmatched request just goes unanswered
+  replayMatchRequest(&replay, msg.identifier, msg.extd, msg.data, msg.data_length_code);
+  return ESP_OK;
+}
+
+esp_err_t replayReceive(twai_message_t* msg, TickType_t ticksToWait) {
+  uint64_t waitMs = min((uint64_t)ticksToWait * portTICK_PERIOD_MS, (uint64_t)REPLAY_MAX_WAIT_MS);
+  const ReplayFrame* frame = replayNextFrame(&replay, waitMs * 1000);
+  if (frame == NULL) return ESP_ERR_TIMEOUT;
+  
+  memset(msg, 0, sizeof(*msg));
+  msg->identifier = frame->identifier;
+  msg->extd = (frame->flags & CAN_TRACE_EXTENDED) ? 1 : 0;
+  msg->rtr = (frame->flags & CAN_TRACE_RTR) ? 1 : 0;
+  msg->data_length_code = frame->dlc;
+  memcpy(msg->data, frame->data, frame->dlc);
+  return ESP_OK;
+}
+
+void replaySwitchBaud(uint32_t baudRate) {
+  replaySelectBaud(&replay, canBaudIndex(baudRate));
+}
+
+bool replayCompareResults(const CanTraceResults& expected) {
+  bool match = true;
+  if ((bool)expected.detected != session.vehicleDetected) {
+    Serial.printf("      vehicle detected: recorded %d, now %d\n", expected.detected, session.vehicleDetected);
+    match = false;
+  }
+  if (expected.ecuCount != session.ecus.size()) {
+    Serial.printf("      ECUs: recorded %u, now %d\n", expected.ecuCount, session.ecus.size());
+    match = false;
+  }
+  
+  // Codes are compared as a set - order follows the request order, which may change
+  for (int i = 0; i < expected.dtcCount; i++) {
+    const CanTraceResultCode& want = expected.codes[i];
+    bool found = false;
+    for (const auto& code : session.codes) {
+      if (code.rawCode == want.rawCode && code.ecuId == want.ecuId && canTraceCodeFlags(code) == want.flags) {
+        found = true;
+        break;
+      }
+    }
+    if (!found) {
+      FaultCode missing = decodeFaultCode(want.rawCode >> 8, want.rawCode & 0xFF, want.ecuId);
+      Serial.printf("      - %s @%03X (flags %u) no longer reported\n", missing.code, want.ecuId, want.flags);
+      match = false;
+    }
+  }
+  if (expected.dtcCount < CAN_TRACE_RESULT_CODES) {
+    for (const auto& code : session.codes) {
+      bool found = false;
+      for (int i = 0; i < expected.dtcCount && !found; i++) {
+        found = expected.codes[i].rawCode == code.rawCode && expected.codes[i].ecuId == code.ecuId &&
+                expected.codes[i].flags == canTraceCodeFlags(code);
+      }
+      if (!found) {
+        Serial.printf("      + %s @%03X (flags %u) newly reported\n", code.code, code.ecuId, canTraceCodeFlags(code));
+        match = false;
+      }
+    }
+  }
+  return match;
+}
+
+// ========== ELM327 ADAPTER BACKEND ==========
+void elmInit() {
+  // Boot probe only, no protocol search - a kiosk with nothing plugged in still
+  // comes up quickly. ELMduino resets the chip and turns echo and spaces off
+  Serial1.begin(ELM_UART_BAUD, SERIAL_8N1, ELM_RX, ELM_TX);
+  if (!myELM327.begin(Serial1, false, ELM_COMMAND_TIMEOUT_MS, ELM_BOOT_PROTOCOL)) {
+    Serial.println("ℹ️ No ELM327/STN adapter on the fallback UART");
+    return;
+  }
+  
+  // STN chips answer STI, an ELM327 (or clone) answers "?"
+  elm.stn = elmCommand("STI") && strstr(myELM327.payload, "STN") != NULL;
+  elm.present = true;  // Last - a scan may already be running on the other core
+  Serial.printf("🔌 %s adapter on UART (RX %d, TX %d)%s\n", elm.stn ? "STN" : "ELM327", ELM_RX, ELM_TX,
+                canController.installed ? "" : " - TWAI is down, scans will use it");
+}
+
+void elmSelect(bool active) {
+  elm.active = active && !replay.active;
+  elm.busy = false;
+  elm.header = ELM_NO_HEADER;
+  elm.queueHead = 0;
+  elm.queueCount = 0;
+  elm.lineLength = 0;
+  elm.requests = 0;
+  elm.countedRequests = 0;
+  elm.frames = 0;
+  elm.promptMsSum = 0;
+  elm.overflows = 0;
+}
+
+obd2_protocol_t elmDetectProtocol() {
+  Serial.println("🔌 Protocol search through the adapter (ATSP0)...");
+  if (!elmCommand("ATSP0")) return OBD2_PROTOCOL_NONE;
+  
+  // The search runs on the first request - 0100 is answered by every OBD-II ECU
+  Serial1.print("0100\r");
+  elm.busy = true;
+  elm.requestStartMs = millis();
+  elmDrain(ELM_SEARCH_TIMEOUT_MS);
+  elm.queueCount = 0;
+  
+  // "A6" while auto-search remembers its result, "6" once fixed
+  if (!elmCommand("ATDPN")) return OBD2_PROTOCOL_NONE;
+  const char* answer = myELM327.payload;
+  if (*answer == 'A') answer++;
+  
+  obd2_protocol_t protocol;
+  switch (*answer) {
+    case '6': protocol = OBD2_PROTOCOL_CAN_11BIT_500K; break;
+    case '7': protocol = OBD2_PROTOCOL_CAN_29BIT_500K; break;
+    case '8': protocol = OBD2_PROTOCOL_CAN_11BIT_250K; break;
+    case '9': protocol = OBD2_PROTOCOL_CAN_29BIT_250K; break;
+    case '0':
+      Serial.println("❌ Adapter found no vehicle");
+      return OBD2_PROTOCOL_NONE;
+    default:
+      Serial.printf("❌ Adapter found non-CAN protocol %c - not supported over the adapter\n", *answer);
+      return OBD2_PROTOCOL_NONE;
+  }
+  
+  bool extended = protocol == OBD2_PROTOCOL_CAN_29BIT_500K || protocol == OBD2_PROTOCOL_CAN_29BIT_250K;
+  if (!elmConfigure(extended)) return OBD2_PROTOCOL_NONE;
+  
+  // Same handshake as the TWAI path, so the responders land in the ECU registry
+  if (!sendOBD2Handshake(extended ? 0x18DB33F1 : 0x7DF, extended)) return OBD2_PROTOCOL_NONE;
+  
+  session.link = elm.stn ? SCAN_LINK_STN : SCAN_LINK_ELM327;
+  metricIncrement(METRIC_ELM_SCANS);
+  Serial.printf("✅ Adapter protocol %c (%s)\n", *answer, extended ? "29-bit" : "11-bit");
+  return protocol;
+}
+
+bool elmConfigure(bool extended) {
+  // Headers on so every line carries its CAN ID, auto-formatting and flow control
+  // on so the adapter handles ISO-TP, adaptive timing so it returns as soon as
+  // the ECUs go quiet. The filter passes only replies to the tester
+  char timeoutCommand[8];
+  snprintf(timeoutCommand, sizeof(timeoutCommand), "ATST%02X",
+           (unsigned)constrain(timing.responseIdleGapMs / 4, 1, 255));
+  const char* commands[] = {
+    "ATE0", "ATS0", "ATH1", "ATCAF1", "ATCFC1", "ATAL", "ATAT2", timeoutCommand,
+    extended ? "ATCF18DAF100" : "ATCF700",
+    extended ? "ATCM1FFFFF00" : "ATCM700"
+  };
+  for (const char* command : commands) {
+    if (!elmCommand(command)) {
+      Serial.printf("   ❌ Adapter rejected %s\n", command);
+      return false;
+    }
+  }
+  elm.header = ELM_NO_HEADER;
+  return true;
+}
+
+bool elmCommand(const char* command) {
+  // AT/ST commands go through ELMduino; anything but "?" before the prompt is success
+  elmDrain(ELM_REQUEST_TIMEOUT_MS);
+  if (myELM327.sendCommand_Blocking(command) != ELM_SUCCESS) return false;
+  return strchr(myELM327.payload, '?') == NULL;
+}
+
+bool elmSetHeader(uint32_t identifier, bool extended) {
+  if (elm.header == identifier) return true;
+  
+  char command[16];
+  if (extended) {
+    // ATCP takes the top 5 ID bits, ATSH the remaining 24
+    snprintf(command, sizeof(command), "ATCP%02X", (unsigned)((identifier >> 24) & 0x1F));
+    if (!elmCommand(command)) return false;
+    snprintf(command, sizeof(command), "ATSH%06X", (unsigned)(identifier & 0xFFFFFF));
+  } else {
+    snprintf(command, sizeof(command), "ATSH%03X", (unsigned)identifier);
+  }
+  if (!elmCommand(command)) return false;
+  
+  elm.header = identifier;
+  return true;
+}
+
+esp_err_t elmTransmit(const twai_message_t& msg) {
+  // The adapter adds the PCI byte and sends flow control itself, so single-frame
+  // payloads go out bare and our own flow control frames are dropped
+  uint8_t frameType = msg.data[0] >> 4;
+  if (frameType == 0x3) return ESP_OK;
+  uint8_t length = msg.data[0] & 0x0F;
+  if (frameType != 0x0 || length == 0 || length > 7) return ESP_ERR_NOT_SUPPORTED;
+  
+  // One request at a time - typing into a busy adapter aborts the reply it is printing
+  elmDrain(ELM_REQUEST_TIMEOUT_MS);
+  if (!elmSetHeader(msg.identifier, msg.extd)) return ESP_FAIL;
+  
+  char command[24];
+  int used = 0;
+  for (int j = 0; j < length; j++) {
+    used += snprintf(command + used, sizeof(command) - used, "%02X", msg.data[1 + j]);
+  }
+  
+  // Response-count suffix: the adapter returns on the first reply instead of
+  // waiting out ATST. Only where one frame is the whole answer - a physical
+  // single-PID Mode 01/02 request. Mode 03/07/0A and multi-PID replies can span
+  // several frames, and UDS can answer 0x78 "response pending" first
+  bool functional = msg.extd ? (msg.identifier & 0xFFFF0000) == 0x18DB0000 : msg.identifier == 0x7DF;
+  bool singleFrameReply = (msg.data[1] == 0x01 && length == 2) || (msg.data[1] == 0x02 && length == 3);
+  if (!functional && singleFrameReply) {
+    used += snprintf(command + used, sizeof(command) - used, " 1");
+    elm.countedRequests++;
+  }
+  snprintf(command + used, sizeof(command) - used, "\r");
+  
+  Serial1.print(command);
+  elm.busy = true;
+  elm.requestStartMs = millis();
+  elm.requests++;
+  canTraceRecord(msg, true);
+  return ESP_OK;
+}
+
+esp_err_t elmReceive(twai_message_t* msg, TickType_t ticksToWait) {
+  if (elm.queueCount == 0 && elm.busy) elmPoll(ticksToWait * portTICK_PERIOD_MS);
+  if (elm.queueCount == 0) {
+    // Prompt is back with nothing queued: the bus is quiet, block like twai_receive() would
+    if (!elm.busy) vTaskDelay(ticksToWait);
+    return ESP_ERR_TIMEOUT;
+  }
+  
+  *msg = elm.queue[elm.queueHead];
+  elm.queueHead = (elm.queueHead + 1) % ELM_RX_QUEUE;
+  elm.queueCount--;
+  canTraceRecord(*msg, false);
+  return ESP_OK;
+}
+
+void elmPoll(unsigned long waitMs) {
+  // Moves adapter output into the frame queue until a frame lands, the prompt
+  // comes back or waitMs runs out
+  unsigned long start = millis();
+  while (elm.busy) {
+    int queuedBefore = elm.queueCount;
+    while (elm.busy && Serial1.available() > 0) {
+      char c = Serial1.read();
+      if (c == '>') {
+        elmEndLine();
+        elm.busy = false;
+        elm.promptMsSum += millis() - elm.requestStartMs;
+      } else if (c == '\r' || c == '\n') {
+        elmEndLine();
+      } else if (elm.lineLength < ELM_LINE_LENGTH - 1) {
+        elm.line[elm.lineLength++] = c;
+      }
+    }
+    if (elm.queueCount > queuedBefore || millis() - start >= waitMs) return;
+    if (elm.busy) vTaskDelay(1);
+  }
+}
+
+bool elmDrain(unsigned long timeoutMs) {
+  unsigned long start = millis();
+  while (elm.busy && millis() - start < timeoutMs) {
+    elmPoll(timeoutMs - (millis() - start));
+  }
+  return !elm.busy;
+}
+
+void elmEndLine() {
+  if (elm.lineLength == 0) return;
+  elm.line[elm.lineLength] = '\0';
+  
+  twai_message_t frame;
+  if (elmParseLine(elm.line, elm.lineLength, &frame)) {
+    elm.frames++;
+    if (elm.queueCount < ELM_RX_QUEUE) {
+      elm.queue[(elm.queueHead + elm.queueCount) % ELM_RX_QUEUE] = frame;
+      elm.queueCount++;
+    } else {
+      elm.overflows++;
+      metricIncrement(METRIC_FRAMES_DROPPED);
+    }
+  } else if (strstr(elm.line, "BUFFER") != NULL || strstr(elm.line, "ERROR") != NULL) {
+    Serial.printf("   ⚠️ Adapter: %s\n", elm.line);
+  }
+  elm.lineLength = 0;
+}
+
+void elmReport() {
+  if (!elm.active || elm.requests == 0) return;
+  Serial.printf("🔌 %s link: %u requests (%u with a response count), %u frames, %u ms avg to prompt, %u dropped\n",
+                elm.stn ? "STN" : "ELM327", elm.requests, elm.countedRequests, elm.frames,
+                elm.promptMsSum / elm.requests, elm.overflows);
+}
+
+// ========== K-LINE BACKEND ==========
+void klineInit() {
+  esp_timer_create_args_t timerArgs = {};
+  timerArgs.callback = klineTxTick;
+  timerArgs.name = "kline";
+  esp_timer_create(&timerArgs, &kline.txTimer);
+}
+
+obd2_protocol_t klineConnect() {
+  Serial.println("🔌 Trying K-line (fast init, then 5-baud)...");
+  updateScanProgress("Trying older protocols...", 10);
+  unsigned long connectStart = scanMillis();
+  
+  kline.requests = 0;
+  kline.responses = 0;
+  kline.checksumErrors = 0;
+  kline.echoErrors = 0;
+  kline.active = klineFastInit() || klineSlowInit();
+  if (!kline.active) {
+    Serial2.end();
+    Serial.printf("   ❌ No K-line response (%lums)\n", scanMillis() - connectStart);
+    return OBD2_PROTOCOL_NONE;
+  }
+  
+  session.link = SCAN_LINK_KLINE;
+  Serial.printf("✅ K-line %s via %s init in %lums, key bytes %02X %02X\n", kline.kwp ? "KWP2000" : "ISO 9141-2",
+                kline.fastInit ? "fast" : "5-baud", scanMillis() - connectStart, kline.keyBytes[0], kline.keyBytes[1]);
+  return kline.kwp ? OBD2_PROTOCOL_KWP2000 : OBD2_PROTOCOL_ISO9141;
+}
+
+bool klineFastInit() {
+  // ISO 14230-2: W5 idle, 25 ms low / 25 ms high wake-up, StartCommunication straight after
+  klineReleaseUart();
+  vTaskDelay(pdMS_TO_TICKS(K_LINE_IDLE_MS));
+  digitalWrite(K_LINE_TX, LOW);
+  delayMicroseconds(K_LINE_FAST_INIT_LOW_US);  // Busy-wait - TiniL only tolerates +-1 ms
+  digitalWrite(K_LINE_TX, HIGH);
+  delayMicroseconds(K_LINE_FAST_INIT_LOW_US);
+  klineOpenUart();
+  
+  kline.kwp = true;
+  kline.fastInit = true;
+  kline.lastByteUs = 0;
+  uint8_t startCommunication[] = {0x81};
+  KLineMessage reply;
+  if (!klineSend(startCommunication, sizeof(startCommunication)) || klineReceive(&reply, 1) == 0) return false;
+  if (reply.length < 3 || reply.data[0] != 0xC1) return false;
+  
+  kline.keyBytes[0] = reply.data[1];
+  kline.keyBytes[1] = reply.data[2];
+  return true;
+}
+
+bool klineSlowInit() {
+  // ISO 9141-2 / KWP2000 5-baud init: address 0x33 at 5 bit/s (start, 8 data
+  // LSB first, stop), then sync and key bytes from the ECU at 10.4k
+  klineReleaseUart();
+  vTaskDelay(pdMS_TO_TICKS(K_LINE_IDLE_MS));
+  uint16_t bits = (K_LINE_INIT_ADDRESS << 1) | 0x200;  // Start bit 0, stop bit 1
+  for (int b = 0; b < 10; b++) {
+    digitalWrite(K_LINE_TX, (bits >> b) & 1 ? HIGH : LOW);
+    vTaskDelay(pdMS_TO_TICKS(K_LINE_5BAUD_BIT_MS));
+  }
+  klineOpenUart();
+  
+  uint8_t sync, keyByte1, keyByte2;
+  if (!klineReadByte(&sync, K_LINE_W1_MAX_MS) || sync != 0x55) return false;
+  if (!klineReadByte(&keyByte1, K_LINE_W2_MAX_MS) || !klineReadByte(&keyByte2, K_LINE_W3_MAX_MS)) return false;
+  
+  // W4, then key byte 2 inverted; the ECU confirms with the address inverted
+  vTaskDelay(pdMS_TO_TICKS(K_LINE_W4_MS));
+  Serial2.write((uint8_t)~keyByte2);
+  uint8_t echo, confirm;
+  klineReadByte(&echo, K_LINE_P1_MAX_MS);
+  if (!klineReadByte(&confirm, K_LINE_W4_MAX_MS) || confirm != (uint8_t)~K_LINE_INIT_ADDRESS) return false;
+  
+  // 08 08 / 94 94 = ISO 9141-2, xx 8F = KWP2000 with 5-baud init
+  kline.kwp = keyByte2 == 0x8F;
+  kline.fastInit = false;
+  kline.keyBytes[0] = keyByte1;
+  kline.keyBytes[1] = keyByte2;
+  kline.lastByteUs = esp_timer_get_time();
+  return true;
+}
+
+void klineReleaseUart() {
+  // Both inits drive the TX pin directly, so the UART lets go of it first
+  Serial2.end();
+  pinMode(K_LINE_TX, OUTPUT);
+  digitalWrite(K_LINE_TX, HIGH);
+}
+
+void klineOpenUart() {
+  Serial2.begin(K_LINE_BAUD, SERIAL_8N1, K_LINE_RX, K_LINE_TX);
+  Serial2.setRxFIFOFull(1);  // Hand over every byte at once - P1 is measured per byte
+  while (Serial2.available() > 0) Serial2.read();
+}
+
+void klineScan() {
+  // Same result path as CAN: readiness into session.readiness, Mode 03/07 into
+  // storeDTCPayload(). K-line DTC messages have no count byte, so one is added
+  static KLineMessage responses[K_LINE_MAX_RESPONSES];  // Static - too large for the scan task stack
+  
+  updateScanProgress("Reading readiness...", 40);
+  TRACE_BEGIN("readiness");
+  uint8_t readinessRequest[] = {0x01, 0x01};
+  int count = klineRequest(readinessRequest, sizeof(readinessRequest), responses, K_LINE_MAX_RESPONSES);
+  for (int i = 0; i < count; i++) {
+    if (decodeReadiness(responses[i].data, responses[i].length, &session.readiness)) break;
+  }
+  printReadiness(session.readiness);
+  TRACE_END("readiness");
+  
+  updateScanProgress("Professional DTC query...", 50);
+  TRACE_BEGIN("dtc");
+  const uint8_t modes[] = {0x03, 0x07};
+  for (uint8_t mode : modes) {
+    count = klineRequest(&mode, 1, responses, K_LINE_MAX_RESPONSES);
+    for (int i = 0; i < count; i++) {
+      const KLineMessage& message = responses[i];
+      if (message.length < 3 || message.data[0] != mode + 0x40) continue;
+      
+      uint8_t payload[K_LINE_MAX_DATA + 1];
+      payload[0] = message.data[0];
+      payload[1] = (message.length - 1) / 2;
+      memcpy(payload + 2, message.data + 1, message.length - 1);
+      storeDTCPayload(payload, message.length + 1, message.source);
+    }
+  }
+  TRACE_END("dtc");
+  
+  Serial.printf("🔌 K-line: %u requests, %u responses, %u checksum errors, %u echo errors\n",
+                kline.requests, kline.responses, kline.checksumErrors, kline.echoErrors);
+}
+
+int klineRequest(const uint8_t* request, int length, KLineMessage* responses, int maxResponses) {
+  // The ECUs drop the session after P3max of silence - wake them again first
+  if (esp_timer_get_time() - kline.lastByteUs > (int64_t)K_LINE_P3_MAX_MS * 1000) {
+    Serial.println("   🔁 K-line session expired (P3max), initialising again");
+    if (!(kline.fastInit ? klineFastInit() : klineSlowInit())) return 0;
+  }
+  if (!klineSend(request, length)) return 0;
+  return klineReceive(responses, maxResponses);
+}
+
+bool klineSend(const uint8_t* data, int length) {
+  // P3: a request may only start P3min after the last response byte
+  int64_t earliestUs = kline.lastByteUs + (int64_t)K_LINE_P3_MIN_MS * 1000;
+  int64_t now = esp_timer_get_time();
+  if (kline.lastByteUs != 0 && now < earliestUs) {
+    vTaskDelay(pdMS_TO_TICKS((earliestUs - now + 999) / 1000));
+  }
+  
+  // ISO 9141-2: 68 6A F1 <data> <checksum>. KWP2000: (C0 | length) 33 F1 <data> <checksum>
+  int used = 0;
+  if (kline.kwp) {
+    kline.tx[used++] = 0xC0 | length;
+    kline.tx[used++] = K_LINE_INIT_ADDRESS;
+  } else {
+    kline.tx[used++] = 0x68;
+    kline.tx[used++] = 0x6A;
+  }
+  kline.tx[used++] = K_LINE_TESTER_ADDRESS;
+  memcpy(kline.tx + used, data, length);
+  used += length;
+  uint8_t checksum = 0;
+  for (int j = 0; j < used; j++) {
+    checksum += kline.tx[j];
+  }
+  kline.tx[used++] = checksum;
+  
+  while (Serial2.available() > 0) Serial2.read();  // Stale bytes would read as a response
+  
+  // First byte now, the rest from the timer alarm one P4 period apart
+  ulTaskNotifyTake(pdTRUE, 0);  // Drop a give left over from an earlier timed-out send
+  kline.txWaiter = xTaskGetCurrentTaskHandle();
+  kline.txLength = used;
+  kline.txIndex = 1;
+  Serial2.write(kline.tx[0]);
+  esp_timer_start_periodic(kline.txTimer, K_LINE_TX_BYTE_US);
+  if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(used * K_LINE_TX_BYTE_US / 1000 + 50)) == 0) {
+    esp_timer_stop(kline.txTimer);
+    ulTaskNotifyTake(pdTRUE, 0);  // The alarm may have given just before it was stopped
+    return false;
+  }
+  
+  // The transceiver hears its own bytes - consume the echo and check it
+  for (int j = 0; j < used; j++) {
+    uint8_t echo;
+    if (!klineReadByte(&echo, K_LINE_P1_MAX_MS) || echo != kline.tx[j]) {
+      kline.echoErrors++;
+      return false;
+    }
+  }
+  kline.requests++;
+  kline.lastByteUs = esp_timer_get_time();
+  return true;
+}
+
+void klineTxTick(void* arg) {
+  // esp_timer callback: one request byte per period, independent of scan task scheduling
+  if (kline.txIndex < kline.txLength) {
+    Serial2.write(kline.tx[kline.txIndex++]);
+  }
+  if (kline.txIndex >= kline.txLength) {
+    esp_timer_stop(kline.txTimer);
+    xTaskNotifyGive(kline.txWaiter);
+  }
+}
+
+int klineReceive(KLineMessage* messages, int maxMessages) {
+  // Responses start within P2max of the request or of the previous response;
+  // inside one message the bytes are at most P1max apart
+  uint8_t raw[K_LINE_MAX_MESSAGE];
+  unsigned long p2Ms = K_LINE_P2_MAX_MS;
+  int count = 0;
+  
+  while (count < maxMessages && klineReadByte(&raw[0], p2Ms)) {
+    int length = 1;
+    int expected = 0;
+    while (length < K_LINE_MAX_MESSAGE && (expected == 0 || length < expected) &&
+           klineReadByte(&raw[length], K_LINE_P1_MAX_MS)) {
+      length++;
+      if (expected == 0) expected = klineExpectedLength(raw, length, kline.kwp);
+    }
+    kline.lastByteUs = esp_timer_get_time();
+    
+    KLineMessage& message = messages[count];
+    if (!klineDecode(raw, length, kline.kwp, &message)) {
+      kline.checksumErrors++;
+      continue;
+    }
+    kline.responses++;
+    
+    // KWP response pending - the ECU gets P2* for the real answer
+    if (message.length >= 3 && message.data[0] == 0x7F && message.data[2] == 0x78) {
+      p2Ms = K_LINE_P2_PENDING_MS;
+      continue;
+    }
+    p2Ms = K_LINE_P2_MAX_MS;
+    count++;
+  }
+  return count;
+}
+
+bool klineReadByte(uint8_t* out, unsigned long timeoutMs) {
+  int64_t deadlineUs = esp_timer_get_time() + (int64_t)timeoutMs * 1000;
+  while (Serial2.available() == 0) {
+    if (esp_timer_get_time() >= deadlineUs) return false;
+    vTaskDelay(1);
+  }
+  *out = Serial2.read();
+  return true;
+}
+
+// ========== REAL CAN BUS FUNCTIONS ==========
+uint32_t autoDetectCANBaudRate() {
+  Serial.println("🔍 Auto-detecting CAN baud rate...");
+  
+  // Common OBD2 baud rates to try
+  uint32_t baudRates[] = {500000, 250000, 125000, 1000000};
+  int numRates = sizeof(baudRates) / sizeof(baudRates[0]);
+  
+  for (int i = 0; i < numRates; i++) {
+    uint32_t baudRate = baudRates[i];
+    Serial.printf("📡 Trying %d bps...\n", baudRate);
+    
+    if (reinitializeCAN(baudRate)) {
+      // Listen for any CAN activity for shorter time per baud rate
+      unsigned long startTime = scanMillis();
+      int frameCount = 0;
+      
+      while (scanMillis() - startTime < timing.baudDetectTimeoutMs) {
+        twai_message_t message;
+        if (canReceive(&message, pdMS_TO_TICKS(100)) == ESP_OK) {
+          frameCount++;
+          if (frameCount >= 3) { // Found activity
+            Serial.printf("✅ CAN activity detected at %d bps (%d frames)\n", baudRate, frameCount);
+            return baudRate;
+          }
+        }
+      }
+      Serial.printf("   No activity at %d bps\n", baudRate);
+    }
+  }
+  
+  return 0; // No activity detected
+}
+
+bool reinitializeCAN(uint32_t baudRate) {
+  twai_timing_config_t t_config;
+  if (!canTimingFor(baudRate, &t_config)) {
+    return false;
+  }
+  if (replay.active) {
+    replaySwitchBaud(baudRate);
+    return true;
+  }
+  
+  uint64_t switchStart = esp_timer_get_time();
+  bool inPlace = canController.installed && canSwitchInPlace(baudRate, t_config);
+  if (!inPlace && !canInstallDriver(baudRate, t_config)) {
+    return false;
+  }
+  
+  canController.lastSwitchUs = esp_timer_get_time() - switchStart;
+  metricRecord(METRIC_CAN_SWITCH_US, canController.lastSwitchUs);
+  if (inPlace) {
+    canController.fastSwitches++;
+  } else {
+    canController.reinstalls++;
+  }
+  Serial.printf("   🔁 %u bps in %uus (%s)\n", baudRate, canController.lastSwitchUs,
+                inPlace ? "timing rewrite" : "driver reinstall");
+  canTraceMarker(CAN_TRACE_BAUD_MARKER | canBaudIndex(baudRate));
+  return true;
+}
+
+bool canTimingFor(uint32_t baudRate, twai_timing_config_t* timing) {
+  if (baudRate == 1000000) {
+    *timing = TWAI_TIMING_CONFIG_1MBITS();
+  } else if (baudRate == 500000) {
+    *timing = TWAI_TIMING_CONFIG_500KBITS();
+  } else if (baudRate == 250000) {
+    *timing = TWAI_TIMING_CONFIG_250KBITS();
+  } else if (baudRate == 125000) {
+    *timing = TWAI_TIMING_CONFIG_125KBITS();
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool canSwitchInPlace(uint32_t baudRate, const twai_timing_config_t& timing) {
+  // twai_stop() is only legal while running - bus-off falls back to a reinstall
+  if (twai_stop() != ESP_OK) {
+    return false;
+  }
+  
+  // twai_stop() leaves the controller in reset mode, the only mode in which the
+  // bus timing registers are writable, and twai_start() does not touch them
+  twai_ll_set_bus_timing(&TWAI, timing.brp, timing.sjw, timing.tseg_1, timing.tseg_2, timing.triple_sampling);
+  if (twai_start() != ESP_OK) {
+    return false;
+  }
+  
+  twai_clear_receive_queue();  // Anything still queued was decoded at the old rate
+  canController.baudRate = baudRate;
+  canHealthDriverStarted(baudRate, false);
+  return true;
+}
+
+bool canInstallDriver(uint32_t baudRate, const twai_timing_config_t& timing) {
+  if (canController.installed) {
+    twai_stop();
+    twai_driver_uninstall();
+    canController.installed = false;
+  }
+  
+  twai_general_config_t g_config = TWAI_GENERAL_CONFIG_DEFAULT(CAN_TX_PIN, CAN_RX_PIN, TWAI_MODE_NORMAL);
+  twai_filter_config_t f_config = TWAI_FILTER_CONFIG_ACCEPT_ALL(); // Accept all messages
+  g_config.alerts_enabled = CAN_HEALTH_ALERTS;
+  
+  if (twai_driver_install(&g_config, &timing, &f_config) != ESP_OK) {
+    return false;
+  }
+  if (twai_start() != ESP_OK) {
+    twai_driver_uninstall();  // Never leave a stopped driver marked as running
+    return false;
+  }
+  canController.installed = true;
+  canController.baudRate = baudRate;
+  canHealthDriverStarted(baudRate, true);
+  
+  return true;
+}
+
+void listenForCANTraffic(uint32_t duration_ms) {
+  Serial.println("👂 Listening for raw CAN traffic...");
+  
+  unsigned long startTime = scanMillis();
+  int frameCount = 0;
+  uint32_t uniqueIDs[64];
+  int uniqueCount = 0;
+  
+  while (scanMillis() - startTime < duration_ms) {
+    twai_message_t message;
+    if (canReceive(&message, pdMS_TO_TICKS(50)) == ESP_OK) {
+      frameCount++;
+      
+      // Log raw frame data
+      Serial.printf("📦 CAN Frame #%d: ID=0x%03X DLC=%d Data=", 
+                    frameCount, message.identifier, message.data_length_code);
+      
+      for (int i = 0; i < message.data_length_code; i++) {
+        Serial.printf("%02X ", message.data[i]);
+      }
+      Serial.printf(" (Extended=%s)\n", message.extd ? "yes" : "no");
+      
+      // Track unique IDs
+      bool found = false;
+      for (int j = 0; j < uniqueCount; j++) {
+        if (uniqueIDs[j] == message.identifier) {
+          found = true;
+          break;
+        }
+      }
+      if (!found && uniqueCount < 64) {
+        uniqueIDs[uniqueCount++] = message.identifier;
+      }
+      
+      // Update display periodically
+      if (frameCount % 10 == 0) {
+        UiEvent event = {};
+        event.type = UI_EVENT_SCAN_TRAFFIC;
+        event.value = frameCount;
+        event.value2 = uniqueCount;
+        postUiEvent(event, 0);
+      }
+    }
+  }
+  
+  Serial.printf("📊 Traffic summary: %d frames, %d unique IDs\n", frameCount, uniqueCount);
+  
+  // Log unique IDs found
+  Serial.print("🆔 Unique CAN IDs: ");
+  for (int i = 0; i < uniqueCount && i < 20; i++) {
+    Serial.printf("0x%03X ", uniqueIDs[i]);
+  }
+  Serial.println();
+}
+
+void probeOBD2ECUs() {
+  Serial.println("🔍 Actively probing for OBD2 ECUs...");
+  
+  // Enhanced ECU probing with multiple methods
+  Serial.println("📡 Enhanced ECU probing with multiple detection methods...");
+  
+  for (int i = 0; i < NUM_ECUS; i++) {
+    uint16_t ecuAddr = OBD2_ADDRESSES[i];
+    
+    Serial.printf("📡 Probing ECU 0x%03X (%d/%d) with multiple methods...\n", ecuAddr, i + 1, NUM_ECUS);
     
     bool ecuFound = false;
     
@@ -2044,273 +5617,1561 @@ void probeOBD2ECUs() {
       Serial.printf("  Method 1: Mode 01 PID 00...\n");
       
       twai_message_t msg;
-      msg.identifier = ecuAddr;
+      msg.identifier = ecuAddr;
+      msg.flags = TWAI_MSG_FLAG_NONE;
+      msg.data_length_code = 8;
+    msg.data[0] = 0x02;  // Length
+    msg.data[1] = 0x01;  // Mode 01 (Show current data)
+    msg.data[2] = 0x00;  // PID 00 (Supported PIDs 01-20)
+    msg.data[3] = 0x00;
+    msg.data[4] = 0x00;
+    msg.data[5] = 0x00;
+    msg.data[6] = 0x00;
+    msg.data[7] = 0x00;
+    
+    if (canTransmit(&msg, pdMS_TO_TICKS(100)) == ESP_OK) {
+      // Wait for response
+      twai_message_t response;
+      unsigned long start = scanMillis();
+      while (scanMillis() - start < 1000) { // 1 second timeout
+        if (canReceive(&response, pdMS_TO_TICKS(50)) == ESP_OK) {
+          // Check if this is a response to our query
+          if (response.identifier == (ecuAddr + 8) || 
+              (response.identifier >= 0x7E8 && response.identifier <= 0x7EF)) {
+            
+            ecuObserve(response, start);
+            Serial.printf("  ✅ Active ECU found: 0x%03X responded from 0x%03X\n", 
+                         ecuAddr, response.identifier);
+            
+            // Log response data
+            Serial.printf("     Response: ");
+            for (int j = 0; j < response.data_length_code; j++) {
+              Serial.printf("%02X ", response.data[j]);
+            }
+            Serial.println();
+            break;
+          }
+        }
+      }
+    }
+    }  // Close the if (!ecuFound) block
+    
+    scanDelay(100); // Brief pause between requests
+  }
+  
+  Serial.printf("🎯 Found %d active OBD2 ECUs\n", session.ecus.size());
+}
+
+void probeOBD2ECUsWithTimeout(uint32_t timeout_ms) {
+  Serial.println("🔍 Actively probing for OBD2 ECUs with timeout...");
+  unsigned long startTime = scanMillis();
+  
+  // Send standard OBD2 query to detect active ECUs
+  for (int i = 0; i < NUM_ECUS; i++) {
+    // Check timeout
+    if (scanMillis() - startTime > timeout_ms) {
+      Serial.printf("⏰ ECU probing timeout after %d ECUs\n", i);
+      break;
+    }
+    
+    uint16_t ecuAddr = OBD2_ADDRESSES[i];
+    
+    Serial.printf("📡 Probing ECU 0x%03X (%d/%d)...\n", ecuAddr, i + 1, NUM_ECUS);
+    
+    // Update progress on display
+    if (i % 4 == 0) {
+      int progress = 50 + (i * 25 / NUM_ECUS); // 50-75% range
+      char progressText[32];
+      snprintf(progressText, sizeof(progressText), "Checking ECU %d/%d", i + 1, NUM_ECUS);
+      updateScanProgress(progressText, progress);
+    }
+    
+    // Send Mode 01 PID 00 (Supported PIDs) request
+    twai_message_t msg;
+    msg.identifier = ecuAddr;
+    msg.flags = TWAI_MSG_FLAG_NONE;
+    msg.data_length_code = 8;
+    msg.data[0] = 0x02;  // Length
+    msg.data[1] = 0x01;  // Mode 01 (Show current data)
+    msg.data[2] = 0x00;  // PID 00 (Supported PIDs 01-20)
+    msg.data[3] = 0x00;
+    msg.data[4] = 0x00;
+    msg.data[5] = 0x00;
+    msg.data[6] = 0x00;
+    msg.data[7] = 0x00;
+    
+    if (canTransmit(&msg, pdMS_TO_TICKS(100)) == ESP_OK) {
+      // Wait for response with shorter timeout per ECU
+      twai_message_t response;
+      unsigned long ecuStart = scanMillis();
+      while (scanMillis() - ecuStart < 800) { // 800ms per ECU max
+        if (canReceive(&response, pdMS_TO_TICKS(50)) == ESP_OK) {
+          // Check if this is a response to our query
+          if (response.identifier == (ecuAddr + 8) || 
+              (response.identifier >= 0x7E8 && response.identifier <= 0x7EF)) {
+            
+            ecuObserve(response, ecuStart);
+            Serial.printf("  ✅ Active ECU found: 0x%03X responded from 0x%03X\n", 
+                         ecuAddr, response.identifier);
+            
+            // Log response data
+            Serial.printf("     Response: ");
+            for (int j = 0; j < response.data_length_code; j++) {
+              Serial.printf("%02X ", response.data[j]);
+            }
+            Serial.println();
+            break;
+          }
+        }
+      }
+    }
+    
+    scanDelay(50); // Brief pause between requests
+  }
+  
+  Serial.printf("🎯 Found %d active OBD2 ECUs\n", session.ecus.size());
+}
+
+void updateScanProgress(const char* message, int percentage) {
+  // Runs on the scan task - the UI task does the drawing
+  if (replay.active) return;
+  UiEvent event = {};
+  event.type = UI_EVENT_SCAN_PROGRESS;
+  event.value = percentage;
+  strncpy(event.text, message, sizeof(event.text) - 1);
+  postUiEvent(event, 0);
+}
+
+void drawScanProgress(const char* message, int percentage) {
+  // Update the scanning display with progress
+  tft.fillRect(0, 180, SCREEN_WIDTH, 40, TFT_BLUE);
+  
+  // Progress message - copied out of a UI event, so not cacheable
+  drawTextf(20, 185, 1, TFT_WHITE, TFT_BLUE, "%s", message);
+  
+  // Progress bar
+  int barWidth = SCREEN_WIDTH - 40;
+  int barHeight = 8;
+  int barX = 20;
+  int barY = 200;
+  
+  // Progress bar background
+  tft.fillRect(barX, barY, barWidth, barHeight, TFT_DARKGREY);
+  
+  // Progress bar fill
+  int fillWidth = (barWidth * percentage) / 100;
+  tft.fillRect(barX, barY, fillWidth, barHeight, TFT_WHITE);
+  
+  // Percentage text
+  drawTextf(barX + barWidth + 5, barY, 1, TFT_WHITE, TFT_BLUE, "%d%%", percentage);
+}
+
+void drawTrafficCounter(int frameCount, int uniqueCount) {
+  tft.fillRect(0, 200, SCREEN_WIDTH, 20, TFT_BLACK);
+  drawTextf(10, 200, 1, TFT_WHITE, TFT_BLACK, "Frames: %d IDs: %d", frameCount, uniqueCount);
+}
+
+void scanAllDTCs() {
+  Serial.println("🚨 COMPREHENSIVE DTC SCAN - Multiple passes for maximum detection");
+  Serial.printf("   Active ECUs found during probe: %d\n", session.ecus.size());
+  Serial.println("   Performing 2-pass scan of all 16 standard OBD2 addresses...");
+  
+  unsigned long scanStart = scanMillis();
+  int initialDTCCount = session.codes.size();
+  
+  // Perform 2 passes to catch intermittent codes
+  for (int pass = 1; pass <= 2; pass++) {
+    Serial.printf("\n🔄 DTC Scan Pass %d/2:\n", pass);
+    
+    // Scan ALL standard OBD2 addresses for DTCs, not just session.ecus
+    // This ensures we don't miss codes like P0354 from ECUs that didn't respond to probes
+    for (int i = 0; i < NUM_ECUS; i++) {
+    uint16_t requestAddr = OBD2_ADDRESSES[i];
+    uint16_t responseAddr = requestAddr + 8; // Standard OBD2 response offset
+    
+    Serial.printf("🔍 Scanning ECU 0x%03X → 0x%03X for DTCs...\n", requestAddr, responseAddr);
+    
+    // Try both Mode 03 (stored DTCs) and Mode 07 (pending DTCs)
+    uint8_t modes[] = {0x03, 0x07};
+    const char* modeNames[] = {"stored", "pending"};
+    
+    for (int m = 0; m < 2; m++) {
+      Serial.printf("    Trying Mode %02X (%s DTCs)...\n", modes[m], modeNames[m]);
+      
+      twai_message_t msg;
+      msg.identifier = requestAddr;
       msg.flags = TWAI_MSG_FLAG_NONE;
       msg.data_length_code = 8;
-    msg.data[0] = 0x02;  // Length
-    msg.data[1] = 0x01;  // Mode 01 (Show current data)
-    msg.data[2] = 0x00;  // PID 00 (Supported PIDs 01-20)
-    msg.data[3] = 0x00;
-    msg.data[4] = 0x00;
-    msg.data[5] = 0x00;
-    msg.data[6] = 0x00;
-    msg.data[7] = 0x00;
-    
-    if (twai_transmit(&msg, pdMS_TO_TICKS(100)) == ESP_OK) {
-      // Wait for response
-      twai_message_t response;
-      unsigned long start = millis();
-      while (millis() - start < 1000) { // 1 second timeout
-        if (twai_receive(&response, pdMS_TO_TICKS(50)) == ESP_OK) {
-          // Check if this is a response to our query
-          if (response.identifier == (ecuAddr + 8) || 
-              (response.identifier >= 0x7E8 && response.identifier <= 0x7EF)) {
-            
-            activeECUs.push_back(response.identifier);
-            Serial.printf("  ✅ Active ECU found: 0x%03X responded from 0x%03X\n", 
-                         ecuAddr, response.identifier);
-            
-            // Log response data
-            Serial.printf("     Response: ");
-            for (int j = 0; j < response.data_length_code; j++) {
-              Serial.printf("%02X ", response.data[j]);
+      msg.data[0] = 0x01;  // Length
+      msg.data[1] = modes[m];  // Mode 03 or 07
+      msg.data[2] = 0x00;
+      msg.data[3] = 0x00;
+      msg.data[4] = 0x00;
+      msg.data[5] = 0x00;
+      msg.data[6] = 0x00;
+      msg.data[7] = 0x00;
+      
+      if (canTransmit(&msg, pdMS_TO_TICKS(100)) == ESP_OK) {
+        // Wait for DTC response
+        bool foundResponse = false;
+        uint32_t expectedAddr = responseAddr;
+        
+        ResponseCollector collector;
+        // Longer timeout for DTC responses - except on pass 2 for an address that
+        // has not answered anything this scan, which only gets a short retry window
+        bool silentEcu = pass > 1 && ecuFind(responseAddr, false) == NULL;
+        openResponseWindow(&collector, silentEcu ? timing.silentEcuWindowMs : 2000, &expectedAddr, 1);
+        
+        twai_message_t response;
+        while (!foundResponse && receiveInWindow(&collector, &response)) {
+          if (response.identifier == responseAddr) {
+            ecuObserve(response, collector.startTime);
+            Serial.printf("    📋 Mode %02X Response from 0x%03X: ", modes[m], responseAddr);
+            for (int i = 0; i < response.data_length_code; i++) {
+              Serial.printf("%02X ", response.data[i]);
             }
             Serial.println();
-            break;
+            markResponder(&collector, response.identifier, isFinalResponse(response, modes[m]));
+            if (!isFinalResponse(response, modes[m]) && response.data[1] == 0x7F) {
+              continue; // Response pending (NRC 0x78) - keep waiting for the real answer
+            }
+            
+            // Check if this is a positive response (not just "no DTCs")
+            if (response.data[1] == 0x7F) {
+              Serial.printf("    ⚠️ Mode %02X rejected by ECU (NRC %02X)\n", modes[m], response.data[3]);
+            } else if (response.data_length_code > 2 && !(response.data_length_code == 3 && response.data[2] == 0x00)) {
+              parseAndStoreDTC(response.data, response.data_length_code, responseAddr);
+            } else if (response.data_length_code == 3 && response.data[2] == 0x00) {
+              Serial.printf("    ✅ No %s DTCs in this ECU\n", modeNames[m]);
+            }
+            foundResponse = true;
           }
         }
+        closeResponseWindow(&collector);
+        
+        if (!foundResponse) {
+          Serial.printf("    ⚠️ No response to Mode %02X from ECU 0x%03X\n", modes[m], requestAddr);
+        }
+      } else {
+        Serial.printf("    ❌ Failed to send Mode %02X request to ECU 0x%03X\n", modes[m], requestAddr);
       }
+      
+      scanDelay(50); // Small delay between mode requests
     }
-    }  // Close the if (!ecuFound) block
+      
+      scanDelay(100);
+      
+      // Check for timeout
+      if (scanMillis() - scanStart > timing.dtcScanTimeoutMs) {
+        Serial.println("⏰ DTC scan timeout reached, stopping...");
+        break;
+      }
+    }
+    
+    // Brief pause between passes
+    if (pass == 1) {
+      scanDelay(500);
+      Serial.printf("✓ Pass %d complete, found %d new DTCs\n", pass, session.codes.size() - initialDTCCount);
+    }
+  }
+  
+  // Final summary
+  int totalDTCs = session.codes.size();
+  int newDTCs = totalDTCs - initialDTCCount;
+  unsigned long scanDuration = scanMillis() - scanStart;
+  
+  Serial.printf("\n🏁 COMPREHENSIVE DTC SCAN COMPLETE:\n");
+  Serial.printf("   Duration: %.1f seconds\n", scanDuration / 1000.0);
+  Serial.printf("   Total DTCs found: %d\n", totalDTCs);
+  Serial.printf("   New DTCs this scan: %d\n", newDTCs);
+  
+  if (totalDTCs > 0) {
+    Serial.println("   Detected fault codes:");
+    for (const auto& code : session.codes) {
+      Serial.printf("   🚨 %s - %s\n", code.code, code.system);
+    }
+  } else {
+    Serial.println("   ✅ No diagnostic trouble codes detected");
+  }
+}
+
+// ========== TIMING PROFILES ==========
+void loadTimingProfile() {
+  Preferences prefs;
+  if (!prefs.begin(TIMING_NVS_NAMESPACE, true)) {
+    Serial.println("⏱️ No stored timing profile - using compiled defaults");
+    return;
+  }
+  
+  TimingProfile stored;
+  size_t length = prefs.getBytes(TIMING_NVS_KEY, &stored, sizeof(stored));
+  prefs.end();
+  
+  if (length != sizeof(stored) || stored.version != TIMING_PROFILE_VERSION || !validTimingProfile(stored)) {
+    Serial.println("⚠️ Stored timing profile unusable - using compiled defaults");
+    return;
+  }
+  
+  timing = stored;
+  Serial.printf("⏱️ Timing profile rev %u loaded (arm '%s')\n", timing.revision, timing.arm);
+}
+
+bool fetchTimingProfile() {
+  TRACE_SCOPE("http:timing");
+  if (WiFi.status() != WL_CONNECTED) return false;
+  if (pendingTimingReady.load(std::memory_order_acquire)) return false;  // Previous one not live yet
+  
+  uint32_t liveRevision = timingIdentity().revision;
+  char url[192];
+  snprintf(url, sizeof(url), "%s/api/obd2/kiosk/%s/timing?rev=%u&v=%u",
+           API_BASE_URL, KIOSK_ID, liveRevision, TIMING_PROFILE_VERSION);
+  HTTPClient http;
+  http.setTimeout(5000);
+  http.begin(url);
+  
+  unsigned long httpStart = millis();
+  int httpCode = http.GET();
+  String response = httpCode == 200 ? http.getString() : String();
+  http.end();
+  metricIncrement(METRIC_HTTP_REQUESTS);
+  metricRecord(METRIC_HTTP_LATENCY_MS, millis() - httpStart);
+  
+  if (httpCode == 304 || httpCode == 404) return false;  // Unchanged / kiosk not enrolled
+  if (httpCode != 200) {
+    metricIncrement(METRIC_HTTP_FAILURES);
+    Serial.printf("❌ Timing profile fetch failed: HTTP %d\n", httpCode);
+    return false;
+  }
+  
+  StaticJsonDocument<768> doc;
+  if (deserializeJson(doc, response)) {
+    Serial.println("❌ Timing profile is not valid JSON");
+    return false;
+  }
+  
+  // Fields the server leaves out keep their compiled default
+  TimingProfile profile = DEFAULT_TIMING;
+  if ((doc["version"] | 0) != TIMING_PROFILE_VERSION) {
+    Serial.println("⚠️ Timing profile version mismatch - ignored");
+    return false;
+  }
+  profile.revision            = doc["revision"] | 0;
+  strncpy(profile.arm, doc["arm"] | "", sizeof(profile.arm) - 1);
+  profile.prepareVehicleMs    = doc["prepareVehicleMs"] | profile.prepareVehicleMs;
+  profile.totalScanTimeoutMs  = doc["totalScanTimeoutMs"] | profile.totalScanTimeoutMs;
+  profile.baudDetectTimeoutMs = doc["baudDetectTimeoutMs"] | profile.baudDetectTimeoutMs;
+  profile.protocolListenMs    = doc["protocolListenMs"] | profile.protocolListenMs;
+  profile.handshakeTimeoutMs  = doc["handshakeTimeoutMs"] | profile.handshakeTimeoutMs;
+  profile.dtcScanTimeoutMs    = doc["dtcScanTimeoutMs"] | profile.dtcScanTimeoutMs;
+  profile.extendedDtcBudgetMs = doc["extendedDtcBudgetMs"] | profile.extendedDtcBudgetMs;
+  profile.responseIdleGapMs   = doc["responseIdleGapMs"] | profile.responseIdleGapMs;
+  profile.querySpacingMs      = doc["querySpacingMs"] | profile.querySpacingMs;
+  profile.udsRequestSpacingMs = doc["udsRequestSpacingMs"] | profile.udsRequestSpacingMs;
+  profile.dtcResponseTimeoutMs = doc["dtcResponseTimeoutMs"] | profile.dtcResponseTimeoutMs;
+  profile.pidResponseTimeoutMs = doc["pidResponseTimeoutMs"] | profile.pidResponseTimeoutMs;
+  profile.silentEcuWindowMs    = doc["silentEcuWindowMs"] | profile.silentEcuWindowMs;
+  
+  if (profile.revision == liveRevision) return false;
+  if (!validTimingProfile(profile)) {
+    Serial.printf("⚠️ Timing profile rev %u out of bounds - ignored\n", profile.revision);
+    return false;
+  }
+  
+  // Persist first so a reboot before the next session boundary still picks it up
+  Preferences prefs;
+  if (prefs.begin(TIMING_NVS_NAMESPACE, false)) {
+    prefs.putBytes(TIMING_NVS_KEY, &profile, sizeof(profile));
+    prefs.end();
+  }
+  
+  pendingTiming = profile;
+  pendingTimingReady.store(true, std::memory_order_release);
+  Serial.printf("⏱️ Timing profile rev %u staged (arm '%s')\n", profile.revision, profile.arm);
+  return true;
+}
+
+bool validTimingProfile(const TimingProfile& profile) {
+  // Generous bounds - they stop a typo from bricking scans, not from being slow.
+  // The protocol and DTC phases must fit inside the overall scan budget
+  if (profile.prepareVehicleMs < 3000 || profile.prepareVehicleMs > 60000) return false;
+  if (profile.totalScanTimeoutMs < 20000 || profile.totalScanTimeoutMs > 180000) return false;
+  if (profile.baudDetectTimeoutMs < 500 || profile.baudDetectTimeoutMs > 10000) return false;
+  if (profile.protocolListenMs < 200 || profile.protocolListenMs > 5000) return false;
+  if (profile.handshakeTimeoutMs < 200 || profile.handshakeTimeoutMs > 5000) return false;
+  if (profile.dtcScanTimeoutMs < 5000 || profile.dtcScanTimeoutMs > profile.totalScanTimeoutMs) return false;
+  if (profile.extendedDtcBudgetMs > 10000) return false;
+  if (profile.responseIdleGapMs < 50 || profile.responseIdleGapMs > 1000) return false;
+  if (profile.querySpacingMs < 50 || profile.querySpacingMs > 2000) return false;  // Honda dashboards glitch below ~50ms
+  if (profile.udsRequestSpacingMs < 2 || profile.udsRequestSpacingMs > 500) return false;
+  if (profile.dtcResponseTimeoutMs < 200 || profile.dtcResponseTimeoutMs > 5000) return false;
+  if (profile.pidResponseTimeoutMs < 200 || profile.pidResponseTimeoutMs > 5000) return false;
+  if (profile.silentEcuWindowMs < 100 || profile.silentEcuWindowMs > profile.dtcResponseTimeoutMs) return false;
+  return true;
+}
+
+void applyPendingTiming() {
+  // UI task only, and never while the scan task could be reading the profile
+  if (!pendingTimingReady.load(std::memory_order_acquire)) return;
+  if (scanPhase != SCAN_PHASE_IDLE || replay.active) return;
+  
+  // Counters so far belong to the old profile - the flush is queued ahead of
+  // anything the new one can produce, and reports metricsTiming, not `timing`
+  postNetRequest(NET_FLUSH_METRICS);
+  
+  uint32_t previousRevision = timing.revision;
+  portENTER_CRITICAL(&timingLock);
+  timing = pendingTiming;
+  portEXIT_CRITICAL(&timingLock);
+  pendingTimingReady.store(false, std::memory_order_release);
+  Serial.printf("⏱️ Timing profile rev %u -> %u live (arm '%s', scan budget %lus)\n",
+                previousRevision, timing.revision, timing.arm,
+                (unsigned long)timing.totalScanTimeoutMs / 1000);
+}
+
+TimingIdentity timingIdentity() {
+  TimingIdentity identity;
+  portENTER_CRITICAL(&timingLock);
+  identity.revision = timing.revision;
+  memcpy(identity.arm, timing.arm, sizeof(identity.arm));
+  portEXIT_CRITICAL(&timingLock);
+  return identity;
+}
+
+// ========== FLEET TELEMETRY ==========
+inline void metricIncrement(MetricCounter counter, uint32_t amount) {
+  if (replay.active) return;  // Replayed scans are not fleet traffic
+  metricCounters[counter].fetch_add(amount, std::memory_order_relaxed);
+}
+
+void metricRecord(MetricHistogram histogram, uint32_t value) {
+  if (replay.active) return;
+  HistogramData& data = metricHistograms[histogram];
+  const uint32_t* bounds = METRIC_HISTOGRAMS[histogram].upperBounds;
+  
+  int bucket = 0;
+  while (bucket < METRIC_BUCKETS - 1 && value > bounds[bucket]) {
+    bucket++;
+  }
+  
+  data.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+  data.count.fetch_add(1, std::memory_order_relaxed);
+  data.sum.fetch_add(value, std::memory_order_relaxed);
+  
+  // Lock-free max: retry only if another core raced us with a smaller value
+  uint32_t currentMax = data.max.load(std::memory_order_relaxed);
+  while (value > currentMax &&
+         !data.max.compare_exchange_weak(currentMax, value, std::memory_order_relaxed)) {
+  }
+}
+
+size_t encodeMetrics(uint8_t* buffer, size_t capacity) {
+  // Cumulative since boot - the server diffs consecutive blobs, so a failed
+  // flush loses nothing. Counter/histogram order is fixed by METRICS_FORMAT_VERSION.
+  CborWriter writer;
+  cborInit(&writer, buffer, capacity);
+  
+  cborBeginMap(&writer, 8);
+  cborWriteText(&writer, "v");
+  cborWriteUInt(&writer, METRICS_FORMAT_VERSION);
+  cborWriteText(&writer, "kiosk");
+  cborWriteText(&writer, KIOSK_ID);
+  cborWriteText(&writer, "uptime");
+  cborWriteUInt(&writer, millis() / 1000);
+  cborWriteText(&writer, "heapMin");
+  cborWriteUInt(&writer, ESP.getMinFreeHeap());
+  cborWriteText(&writer, "heapFrag");
+  cborWriteUInt(&writer, heapFragmentationPercent());
+  
+  // [revision, arm] the window ran under - the server buckets it by arm
+  cborWriteText(&writer, "timing");
+  cborBeginArray(&writer, 2);
+  cborWriteUInt(&writer, metricsTiming.revision);
+  cborWriteText(&writer, metricsTiming.arm);
+  
+  cborWriteText(&writer, "counters");
+  cborBeginArray(&writer, METRIC_COUNTER_COUNT);
+  for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+    cborWriteUInt(&writer, metricCounters[i].load(std::memory_order_relaxed));
+  }
+  
+  // Each histogram: [count, sum, max, [buckets...]]
+  cborWriteText(&writer, "histograms");
+  cborBeginArray(&writer, METRIC_HISTOGRAM_COUNT);
+  for (int i = 0; i < METRIC_HISTOGRAM_COUNT; i++) {
+    HistogramData& data = metricHistograms[i];
+    cborBeginArray(&writer, 4);
+    cborWriteUInt(&writer, data.count.load(std::memory_order_relaxed));
+    cborWriteUInt(&writer, data.sum.load(std::memory_order_relaxed));
+    cborWriteUInt(&writer, data.max.load(std::memory_order_relaxed));
+    cborBeginArray(&writer, METRIC_BUCKETS);
+    for (int b = 0; b < METRIC_BUCKETS; b++) {
+      cborWriteUInt(&writer, data.buckets[b].load(std::memory_order_relaxed));
+    }
+  }
+  
+  return writer.overflow ? 0 : writer.length;
+}
+
+bool flushMetrics() {
+  TRACE_SCOPE("http:metrics");
+  if (WiFi.status() != WL_CONNECTED) return false;
+  
+  uint8_t blob[1024];
+  size_t blobLength = encodeMetrics(blob, sizeof(blob));
+  if (blobLength == 0) {
+    Serial.println("❌ Metrics blob overflowed its buffer");
+    return false;
+  }
+  
+  HTTPClient http;
+  http.setTimeout(5000);
+  http.begin(METRICS_URL);
+  http.addHeader("Content-Type", "application/cbor");
+  http.addHeader("X-Kiosk-Id", KIOSK_ID);
+  
+  unsigned long httpStart = millis();
+  int httpCode = http.POST(blob, blobLength);
+  http.end();
+  metricIncrement(METRIC_HTTP_REQUESTS);
+  metricRecord(METRIC_HTTP_LATENCY_MS, millis() - httpStart);
+  
+  if (httpCode != 200 && httpCode != 204) {
+    metricIncrement(METRIC_HTTP_FAILURES);
+    Serial.printf("❌ Metrics flush failed: HTTP %d\n", httpCode);
+    return false;
+  }
+  
+  metricsTiming = timingIdentity();  // The next window is the live profile's
+  Serial.printf("📊 Metrics flushed (%d bytes)\n", (int)blobLength);
+  return true;
+}
+
+// ========== DELTA OTA ==========
+// The Arduino core marks a new image valid as soon as it boots unless this says
+// otherwise - we do it ourselves once the kiosk has proven it can work
+bool verifyRollbackLater() {
+  return true;
+}
+
+void otaBootCheck() {
+  const esp_partition_t* running = esp_ota_get_running_partition();
+  esp_ota_img_states_t state;
+  if (esp_ota_get_state_partition(running, &state) == ESP_OK && state == ESP_OTA_IMG_PENDING_VERIFY) {
+    otaPendingVerify = true;
+    Serial.printf("🆕 Running new firmware from %s - verifying before committing\n", running->label);
+  }
+  
+  // Came back from a rollback: remember what we rolled back from so the same
+  // patch isn't applied again on the next check
+  Preferences prefs;
+  if (!prefs.begin(OTA_NVS_NAMESPACE, false)) return;
+  if (!otaPendingVerify && esp_ota_get_last_invalid_partition() != NULL &&
+      prefs.getBytes(OTA_NVS_STAGED_KEY, otaRejectedSha, sizeof(otaRejectedSha)) == sizeof(otaRejectedSha)) {
+    otaHasRejected = true;
+    metricIncrement(METRIC_OTA_ROLLBACKS);
+    prefs.remove(OTA_NVS_STAGED_KEY);
+    Serial.println("↩️ Firmware update failed its boot checks - rolled back");
+  }
+  prefs.end();
+}
+
+void otaCheckBootHealth() {
+  // Healthy = tasks running, panel drawing and CAN driver up - all things the image
+  // controls. The network is not: a router or AP outage must not roll back a good
+  // release, so WiFi is only reported. Needs a bootloader built with rollback
+  // support; without one the image is trusted on first boot
+  if (bootStageMs[BOOT_STAGE_TASKS] != 0 && bootStageMs[BOOT_STAGE_FIRST_FRAME] != 0 &&
+      bootStageMs[BOOT_STAGE_CAN] != 0 && canController.installed) {
+    esp_ota_mark_app_valid_cancel_rollback();
+    otaPendingVerify = false;
+    metricIncrement(METRIC_OTA_UPDATES);
+    Serial.printf("✅ New firmware passed its boot checks after %lu ms%s\n", millis(),
+                  bootStageMs[BOOT_STAGE_WIFI] != 0 ? "" : " (WiFi not up yet - not a rollback condition)");
+    return;
+  }
+  
+  if (millis() > OTA_HEALTH_TIMEOUT_MS) {
+    Serial.println("❌ New firmware failed its boot checks - rolling back");
+    Serial.flush();
+    esp_ota_mark_app_invalid_rollback_and_reboot();
+    otaPendingVerify = false;  // Only reached when the bootloader can't roll back
+  }
+}
+
+bool otaCheckForUpdate() {
+  TRACE_SCOPE("http:ota");
+  if (WiFi.status() != WL_CONNECTED) return false;
+  if (sizeof(OTA_SIGNING_PUBLIC_KEY) <= 1) return false;  // Built without the release key - nothing would verify
+  
+  // The server knows releases by their image digest, the same value esptool appends
+  static char runningDigest[65] = "";
+  const esp_partition_t* running = esp_ota_get_running_partition();
+  if (runningDigest[0] == '\0') {
+    uint8_t digest[32];
+    if (esp_partition_get_sha256(running, digest) != ESP_OK) return false;
+    for (int i = 0; i < 32; i++) sprintf(runningDigest + i * 2, "%02x", digest[i]);
+  }
+  
+  char url[256];
+  snprintf(url, sizeof(url), "%s/api/obd2/kiosk/%s/firmware?base=%s", API_BASE_URL, KIOSK_ID, runningDigest);
+  HTTPClient http;
+  http.setTimeout(OTA_STREAM_TIMEOUT_MS);
+  http.begin(url);
+  
+  unsigned long applyStart = millis();
+  int httpCode = http.GET();
+  int patchSize = http.getSize();
+  metricIncrement(METRIC_HTTP_REQUESTS);
+  if (httpCode == 204 || httpCode == 304 || httpCode == 404) {  // Already on the release
+    http.end();
+    return false;
+  }
+  if (httpCode != 200) {
+    metricIncrement(METRIC_HTTP_FAILURES);
+    Serial.printf("❌ Firmware check failed: HTTP %d\n", httpCode);
+    http.end();
+    return false;
+  }
+  
+  OtaDeltaHeader header;
+  if (!otaReadExact(http.getStreamPtr(), (uint8_t*)&header, sizeof(header)) ||
+      header.magic != OTA_DELTA_MAGIC || header.version != OTA_DELTA_VERSION) {
+    Serial.println("❌ Firmware patch header invalid");
+    http.end();
+    return false;
+  }
+  if (!otaVerifySignature(header)) {
+    Serial.println("❌ Firmware patch is not signed by the release key - ignored");
+    http.end();
+    return false;
+  }
+  
+  const esp_partition_t* target = esp_ota_get_next_update_partition(NULL);
+  if (target == NULL || header.targetSize > target->size || header.baseSize > running->size) {
+    Serial.println("❌ Firmware patch does not fit the app partitions");
+    http.end();
+    return false;
+  }
+  if (otaHasRejected && memcmp(header.targetSha256, otaRejectedSha, sizeof(otaRejectedSha)) == 0) {
+    Serial.println("⚠️ Firmware patch targets the image we rolled back from - skipped");
+    http.end();
+    return false;
+  }
+  
+  // A patch against other bytes would build garbage - check before erasing anything
+  uint8_t sha[32];
+  if (!otaHashPartition(running, header.baseSize, sha) || memcmp(sha, header.baseSha256, sizeof(sha)) != 0) {
+    Serial.println("❌ Firmware patch was built against a different base image");
+    http.end();
+    return false;
+  }
+  
+  Serial.printf("⬇️ Firmware patch %d bytes -> %u byte image into %s\n",
+                patchSize, header.targetSize, target->label);
+  
+  OtaFlashIo io = {};
+  io.base = running;
+  if (esp_ota_begin(target, header.targetSize, &io.handle) != ESP_OK) {
+    Serial.println("❌ esp_ota_begin failed");
+    http.end();
+    return false;
+  }
+  
+  bool applied = otaApplyDelta(http, header, &io);
+  http.end();
+  if (!applied) {
+    esp_ota_abort(io.handle);
+    return false;
+  }
+  
+  esp_err_t err = esp_ota_end(io.handle);  // Validates the image structure and its appended digest
+  if (err == ESP_OK) err = esp_ota_set_boot_partition(target);
+  if (err != ESP_OK) {
+    Serial.printf("❌ Firmware image rejected: %s\n", esp_err_to_name(err));
+    return false;
+  }
+  
+  Preferences prefs;
+  if (prefs.begin(OTA_NVS_NAMESPACE, false)) {
+    prefs.putBytes(OTA_NVS_STAGED_KEY, header.targetSha256, sizeof(header.targetSha256));
+    prefs.end();
+  }
+  
+  unsigned long applyMs = millis() - applyStart;
+  metricRecord(METRIC_OTA_APPLY_MS, applyMs);
+  Serial.printf("✅ Firmware staged in %s: %d byte patch for %u byte image (%d%%), %lu ms\n",
+                target->label, patchSize, header.targetSize,
+                header.targetSize > 0 ? (int)((int64_t)patchSize * 100 / header.targetSize) : 0, applyMs);
+  return true;
+}
+
+bool otaApplyDelta(HTTPClient& http, const OtaDeltaHeader& header, OtaFlashIo* io) {
+  // Bounded RAM whatever the image size: the inflate window plus three small
+  // buffers, in PSRAM when the module has it
+  uint32_t caps = psramFound() ? MALLOC_CAP_SPIRAM : (MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  tinfl_decompressor* inflator = (tinfl_decompressor*)heap_caps_malloc(sizeof(tinfl_decompressor), caps);
+  uint8_t* window = (uint8_t*)heap_caps_malloc(TINFL_LZ_DICT_SIZE, caps);
+  uint8_t* input = (uint8_t*)heap_caps_malloc(OTA_INPUT_CHUNK, caps);
+  uint8_t* baseBuffer = (uint8_t*)heap_caps_malloc(OTA_BASE_CHUNK, caps);
+  uint8_t* output = (uint8_t*)heap_caps_malloc(OTA_OUTPUT_CHUNK, caps);
+  
+  bool ok = inflator != NULL && window != NULL && input != NULL && baseBuffer != NULL && output != NULL;
+  if (!ok) Serial.println("❌ Not enough memory for the firmware patch");
+  
+  OtaDeltaApplier applier;
+  otaDeltaInit(&applier, header.baseSize, header.targetSize, baseBuffer, output);
+  mbedtls_sha256_init(&io->sha);
+  mbedtls_sha256_starts_ret(&io->sha, 0);
+  
+  WiFiClient* stream = http.getStreamPtr();
+  int patchSize = http.getSize();  // -1 when the server streams without a length
+  size_t patchRead = sizeof(OtaDeltaHeader);
+  size_t inputLength = 0;
+  size_t inputPos = 0;
+  size_t windowPos = 0;
+  tinfl_status status = TINFL_STATUS_NEEDS_MORE_INPUT;
+  unsigned long lastData = millis();
+  if (ok) tinfl_init(inflator);
+  
+  while (ok) {
+    if (inputPos == inputLength && status == TINFL_STATUS_NEEDS_MORE_INPUT) {
+      int available = stream->available();
+      if (available <= 0) {
+        if (millis() - lastData > OTA_STREAM_TIMEOUT_MS || (!stream->connected() && available == 0)) {
+          Serial.println("❌ Firmware download stalled");
+          ok = false;
+          break;
+        }
+        delay(10);
+        continue;
+      }
+      inputLength = stream->readBytes(input, min((size_t)available, OTA_INPUT_CHUNK));
+      inputPos = 0;
+      patchRead += inputLength;
+      lastData = millis();
+    }
+    
+    bool moreInput = patchSize < 0 || patchRead < (size_t)patchSize;
+    size_t inBytes = inputLength - inputPos;
+    size_t outBytes = TINFL_LZ_DICT_SIZE - windowPos;
+    status = tinfl_decompress(inflator, input + inputPos, &inBytes, window, window + windowPos, &outBytes,
+                              TINFL_FLAG_PARSE_ZLIB_HEADER | (moreInput ? TINFL_FLAG_HAS_MORE_INPUT : 0));
+    inputPos += inBytes;
+    if (outBytes > 0 && !otaDeltaConsume(&applier, *io, window + windowPos, outBytes)) {
+      Serial.println("❌ Firmware patch is corrupt");
+      ok = false;
+      break;
+    }
+    windowPos = (windowPos + outBytes) & (TINFL_LZ_DICT_SIZE - 1);
+    
+    if (status == TINFL_STATUS_DONE) break;
+    if (status < 0) {
+      Serial.printf("❌ Firmware patch failed to inflate (%d)\n", status);
+      ok = false;
+    }
+  }
+  
+  if (ok) ok = otaDeltaFlush(&applier, *io);
+  if (ok && !otaDeltaComplete(applier)) {
+    Serial.printf("❌ Firmware patch ended early: %u of %u bytes\n", applier.written, applier.targetSize);
+    ok = false;
+  }
+  
+  uint8_t sha[32];
+  mbedtls_sha256_finish_ret(&io->sha, sha);
+  mbedtls_sha256_free(&io->sha);
+  if (ok && memcmp(sha, header.targetSha256, sizeof(sha)) != 0) {
+    Serial.println("❌ Rebuilt firmware hash mismatch");
+    ok = false;
+  }
+  
+  heap_caps_free(inflator);
+  heap_caps_free(window);
+  heap_caps_free(input);
+  heap_caps_free(baseBuffer);
+  heap_caps_free(output);
+  return ok;
+}
+
+bool otaReadExact(WiFiClient* stream, uint8_t* buffer, size_t length) {
+  unsigned long start = millis();
+  size_t got = 0;
+  while (got < length) {
+    if (stream->available() > 0) {
+      got += stream->readBytes(buffer + got, length - got);
+    } else if (millis() - start > OTA_STREAM_TIMEOUT_MS || !stream->connected()) {
+      return false;
+    } else {
+      delay(10);
+    }
+  }
+  return true;
+}
+
+bool otaHashPartition(const esp_partition_t* partition, uint32_t length, uint8_t* sha) {
+  uint8_t buffer[512];
+  mbedtls_sha256_context context;
+  mbedtls_sha256_init(&context);
+  mbedtls_sha256_starts_ret(&context, 0);
+  bool ok = true;
+  for (uint32_t offset = 0; offset < length && ok; offset += sizeof(buffer)) {
+    size_t chunk = min((size_t)(length - offset), sizeof(buffer));
+    ok = esp_partition_read(partition, offset, buffer, chunk) == ESP_OK;
+    if (ok) mbedtls_sha256_update_ret(&context, buffer, chunk);
+  }
+  mbedtls_sha256_finish_ret(&context, sha);
+  mbedtls_sha256_free(&context);
+  return ok;
+}
+
+bool otaVerifySignature(const OtaDeltaHeader& header) {
+  if (header.signatureLength == 0 || header.signatureLength > sizeof(header.signature)) return false;
+  
+  uint8_t digest[32];
+  mbedtls_sha256_ret((const uint8_t*)&header, offsetof(OtaDeltaHeader, signatureLength), digest, 0);
+  
+  mbedtls_pk_context key;
+  mbedtls_pk_init(&key);
+  bool ok = mbedtls_pk_parse_public_key(&key, (const uint8_t*)OTA_SIGNING_PUBLIC_KEY,
+                                        sizeof(OTA_SIGNING_PUBLIC_KEY)) == 0 &&  // PEM length counts the NUL
+            mbedtls_pk_can_do(&key, MBEDTLS_PK_ECKEY) &&
+            mbedtls_pk_verify(&key, MBEDTLS_MD_SHA256, digest, sizeof(digest),
+                              header.signature, header.signatureLength) == 0;
+  mbedtls_pk_free(&key);
+  return ok;
+}
+
+void otaPoll() {
+  // UI task. Firmware work only happens on the ready screen with no session handed
+  // out - a QR code on screen may be a customer who is paying right now. Once an
+  // update is due no new sessions are created, and DISPLAY_QR gives its session up
+  // on the next definite "not paid" (UI_EVENT_PAYMENT_STATUS)
+  if (!otaHoldSessions) {
+    bool due = otaRebootPending ||
+               (!otaInFlight && !otaPendingVerify && millis() - lastOtaCheck > OTA_CHECK_INTERVAL_MS);
+    if (!due || millis() - lastActivityTime < OTA_IDLE_MS) return;
+    if (currentState != READY_SCREEN && currentState != DISPLAY_QR) return;
+    otaHoldSessions = true;
+    Serial.println("⏸️ Holding new sessions for a firmware update");
+  }
+  
+  // Re-checked right before acting: no session, no payment answer or other network
+  // job still on its way, no scan
+  if (currentState != READY_SCREEN || transactionId.length() > 0 || scanPhase != SCAN_PHASE_IDLE ||
+      sessionRequestInFlight || paymentCheckInFlight || netJobsOutstanding.load() > 0) {
+    return;
+  }
+  if (otaRebootPending) {
+    otaReboot();
+  } else if (!otaInFlight) {
+    // The download holds the network task - fine, nobody is waiting on it
+    otaInFlight = postNetRequest(NET_CHECK_OTA);
+    lastOtaCheck = millis();
+  }
+}
+
+void otaReboot() {
+  // Counters since the last flush are lost, as with any reboot
+  Serial.println("🔄 Rebooting into new firmware...");
+  Serial.flush();
+  ESP.restart();
+}
+
+// ========== TASK ARCHITECTURE ==========
+void createTaskQueues() {
+  // Before WiFi starts - its event handlers post to uiQueue, and anything they
+  // send before the UI task exists simply waits in the queue
+  uiQueue   = xQueueCreate(UI_QUEUE_LENGTH, sizeof(UiEvent));
+  netQueue  = xQueueCreate(NET_QUEUE_LENGTH, sizeof(NetRequest));
+  scanQueue = xQueueCreate(SCAN_QUEUE_LENGTH, sizeof(ScanRequest));
+}
+
+void startTasks() {
+  taskStats[TASK_SCAN].name = "scan";
+  taskStats[TASK_SCAN].queue = scanQueue;
+  taskStats[TASK_SCAN].queueLength = SCAN_QUEUE_LENGTH;
+  taskStats[TASK_UI].name = "ui";
+  taskStats[TASK_UI].queue = uiQueue;
+  taskStats[TASK_UI].queueLength = UI_QUEUE_LENGTH;
+  taskStats[TASK_NET].name = "net";
+  taskStats[TASK_NET].queue = netQueue;
+  taskStats[TASK_NET].queueLength = NET_QUEUE_LENGTH;
+  
+  xTaskCreatePinnedToCore(scanTask, "scan", SCAN_TASK_STACK, NULL, SCAN_TASK_PRIORITY, &taskStats[TASK_SCAN].handle, SCAN_TASK_CORE);
+  xTaskCreatePinnedToCore(networkTask, "net", NET_TASK_STACK, NULL, NET_TASK_PRIORITY, &taskStats[TASK_NET].handle, NET_TASK_CORE);
+  xTaskCreatePinnedToCore(uiTask, "ui", UI_TASK_STACK, NULL, UI_TASK_PRIORITY, &taskStats[TASK_UI].handle, UI_TASK_CORE);
+  
+  initializeEventSources();
+  if (sessionStartTime > 0) startSessionClock();
+  enterState(currentState);  // Arm timers for the boot state
+  UiEvent firstFrame = {};
+  firstFrame.type = UI_EVENT_TICK;
+  postUiEvent(firstFrame, portMAX_DELAY);  // Draw the boot screen
+  Serial.printf("🧵 Tasks started: scan on core %d, ui + net on core %d\n", SCAN_TASK_CORE, UI_TASK_CORE);
+}
+
+void scanTask(void* param) {
+  ScanRequest request;
+  for (;;) {
+    if (xQueueReceive(scanQueue, &request, portMAX_DELAY) != pdTRUE) continue;
+    uint32_t busyStart = micros();
+    
+    if (request.replay) {
+      runReplaySuite();
+      continue;
+    }
+    
+    performDiagnosticScan();
+    
+    UiEvent event = {};
+    event.type = UI_EVENT_SCAN_DONE;
+    event.results = request.session;
+    postUiEvent(event, portMAX_DELAY);  // Must not be dropped - it returns the session
+    taskStats[TASK_SCAN].busyUs += micros() - busyStart;
+  }
+}
+
+void networkTask(void* param) {
+  NetRequest request;
+  for (;;) {
+    if (xQueueReceive(netQueue, &request, portMAX_DELAY) != pdTRUE) continue;
+    uint32_t busyStart = micros();
     
-    delay(100); // Brief pause between requests
+    UiEvent event = {};
+    switch (request.type) {
+      case NET_CREATE_SESSION: {
+        String sessionId = createNewSession();
+        event.type = UI_EVENT_SESSION_CREATED;
+        event.value = request.offlineFallback;
+        strncpy(event.text, sessionId.c_str(), sizeof(event.text) - 1);
+        postUiEvent(event, portMAX_DELAY);
+        break;
+      }
+      case NET_CHECK_PAYMENT: {
+        bool answered;
+        event.type = UI_EVENT_PAYMENT_STATUS;
+        event.value = checkPaymentStatus(request.transactionId, &answered);
+        event.value2 = answered;  // A definite "not paid", not just a failed poll
+        strncpy(event.text, request.transactionId, sizeof(event.text) - 1);
+        postUiEvent(event, portMAX_DELAY);
+        break;
+      }
+      case NET_SUBMIT_RESULTS:
+        // Submit diagnostic results to database for AI analysis and email
+        event.type = UI_EVENT_RESULTS_SUBMITTED;
+        event.value = submitDiagnosticResults(request.transactionId);
+        postUiEvent(event, portMAX_DELAY);
+        break;
+      case NET_FLUSH_METRICS:
+        flushMetrics();
+        break;
+      case NET_EXPORT_TRACE:
+#if TRACE_ENABLED
+        if (TRACE_SERIAL_EXPORT) traceExportChrome(Serial);
+        if (TRACE_UPLOAD) uploadTrace();
+#endif
+        break;
+      case NET_FETCH_TIMING:
+        if (fetchTimingProfile()) {
+          event.type = UI_EVENT_TIMING_STAGED;
+          postUiEvent(event, portMAX_DELAY);
+        }
+        break;
+      case NET_CHECK_OTA:
+        event.type = UI_EVENT_OTA_DONE;
+        event.value = otaCheckForUpdate();
+        postUiEvent(event, portMAX_DELAY);
+        break;
+    }
+    netJobsOutstanding--;
+    taskStats[TASK_NET].busyUs += micros() - busyStart;
   }
-  
-  Serial.printf("🎯 Found %d active OBD2 ECUs\n", activeECUs.size());
 }
 
-void probeOBD2ECUsWithTimeout(uint32_t timeout_ms) {
-  Serial.println("🔍 Actively probing for OBD2 ECUs with timeout...");
-  unsigned long startTime = millis();
-  
-  // Send standard OBD2 query to detect active ECUs
-  for (int i = 0; i < NUM_ECUS; i++) {
-    // Check timeout
-    if (millis() - startTime > timeout_ms) {
-      Serial.printf("⏰ ECU probing timeout after %d ECUs\n", i);
-      break;
+void uiTask(void* param) {
+  unsigned long lastStatsReport = millis();
+  for (;;) {
+    // Sleep until something happens - buttons, timers and workers all post here.
+    // Between customers, light-sleep the whole chip instead of just blocking
+    UiEvent event;
+    if (xQueueReceive(uiQueue, &event, 0) != pdTRUE) {
+      unsigned long sleepMs;
+      if (canEnterIdleSleep(&sleepMs)) {
+        enterIdleSleep(sleepMs);
+        continue;  // Wake-up posts its own events
+      }
+      if (xQueueReceive(uiQueue, &event, portMAX_DELAY) != pdTRUE) continue;
     }
+    uint32_t busyStart = micros();
+    unsigned long loopStart = millis();
+    metricIncrement(METRIC_UI_WAKEUPS);
     
-    uint16_t ecuAddr = OBD2_ADDRESSES[i];
+    handleUiEvent(event);
     
-    Serial.printf("📡 Probing ECU 0x%03X (%d/%d)...\n", ecuAddr, i + 1, NUM_ECUS);
+    // Run the state machine until it settles so a transition draws its new screen at once
+    KioskState previousState;
+    do {
+      previousState = currentState;
+      updateKioskState();
+    } while (currentState != previousState);
+    if (bootStageMs[BOOT_STAGE_FIRST_FRAME] == 0) markBootStage(BOOT_STAGE_FIRST_FRAME);
+    if (otaPendingVerify) otaCheckBootHealth();
     
-    // Update progress on display
-    if (i % 4 == 0) {
-      int progress = 50 + (i * 25 / NUM_ECUS); // 50-75% range
-      updateScanProgress("Checking ECU " + String(i+1) + "/" + String(NUM_ECUS), progress);
+    metricRecord(METRIC_LOOP_LATENCY_MS, millis() - loopStart);
+    if (pendingWakeUs != 0 && !wifiRejoinPending.load()) {
+      metricRecord(METRIC_WAKE_LATENCY_MS, (esp_timer_get_time() - pendingWakeUs) / 1000);
+      pendingWakeUs = 0;
     }
     
-    // Send Mode 01 PID 00 (Supported PIDs) request
-    twai_message_t msg;
-    msg.identifier = ecuAddr;
-    msg.flags = TWAI_MSG_FLAG_NONE;
-    msg.data_length_code = 8;
-    msg.data[0] = 0x02;  // Length
-    msg.data[1] = 0x01;  // Mode 01 (Show current data)
-    msg.data[2] = 0x00;  // PID 00 (Supported PIDs 01-20)
-    msg.data[3] = 0x00;
-    msg.data[4] = 0x00;
-    msg.data[5] = 0x00;
-    msg.data[6] = 0x00;
-    msg.data[7] = 0x00;
-    
-    if (twai_transmit(&msg, pdMS_TO_TICKS(100)) == ESP_OK) {
-      // Wait for response with shorter timeout per ECU
-      twai_message_t response;
-      unsigned long ecuStart = millis();
-      while (millis() - ecuStart < 800) { // 800ms per ECU max
-        if (twai_receive(&response, pdMS_TO_TICKS(50)) == ESP_OK) {
-          // Check if this is a response to our query
-          if (response.identifier == (ecuAddr + 8) || 
-              (response.identifier >= 0x7E8 && response.identifier <= 0x7EF)) {
-            
-            activeECUs.push_back(response.identifier);
-            Serial.printf("  ✅ Active ECU found: 0x%03X responded from 0x%03X\n", 
-                         ecuAddr, response.identifier);
-            
-            // Log response data
-            Serial.printf("     Response: ");
-            for (int j = 0; j < response.data_length_code; j++) {
-              Serial.printf("%02X ", response.data[j]);
-            }
-            Serial.println();
-            break;
-          }
-        }
-      }
+    // Flush telemetry only while idle between customers so it never delays a scan
+    if ((currentState == DISPLAY_QR || currentState == READY_SCREEN) &&
+        millis() - lastMetricsFlush > METRICS_FLUSH_INTERVAL_MS) {
+      postNetRequest(NET_FLUSH_METRICS);
+      lastMetricsFlush = millis();
     }
     
-    delay(50); // Brief pause between requests
+    otaPoll();
+    
+    taskStats[TASK_UI].busyUs += micros() - busyStart;
+    if (millis() - lastStatsReport > TASK_STATS_INTERVAL_MS) {
+      reportTaskStats();
+      lastStatsReport = millis();
+    }
   }
-  
-  Serial.printf("🎯 Found %d active OBD2 ECUs\n", activeECUs.size());
-}
-
-void updateScanProgress(String message, int percentage) {
-  // Update the scanning display with progress
-  tft.fillRect(0, 180, SCREEN_WIDTH, 40, TFT_BLUE);
-  tft.setTextColor(TFT_WHITE);
-  tft.setTextSize(1);
-  
-  // Progress message
-  tft.setCursor(20, 185);
-  tft.println(message);
-  
-  // Progress bar
-  int barWidth = SCREEN_WIDTH - 40;
-  int barHeight = 8;
-  int barX = 20;
-  int barY = 200;
-  
-  // Progress bar background
-  tft.fillRect(barX, barY, barWidth, barHeight, TFT_DARKGREY);
-  
-  // Progress bar fill
-  int fillWidth = (barWidth * percentage) / 100;
-  tft.fillRect(barX, barY, fillWidth, barHeight, TFT_WHITE);
-  
-  // Percentage text
-  tft.setCursor(barX + barWidth + 5, barY);
-  tft.printf("%d%%", percentage);
 }
 
-void scanAllDTCs() {
-  Serial.println("🚨 COMPREHENSIVE DTC SCAN - Multiple passes for maximum detection");
-  Serial.printf("   Active ECUs found during probe: %d\n", activeECUs.size());
-  Serial.println("   Performing 2-pass scan of all 16 standard OBD2 addresses...");
-  
-  unsigned long scanStart = millis();
-  int initialDTCCount = detectedCodes.size();
-  
-  // Perform 2 passes to catch intermittent codes
-  for (int pass = 1; pass <= 2; pass++) {
-    Serial.printf("\n🔄 DTC Scan Pass %d/2:\n", pass);
-    
-    // Scan ALL standard OBD2 addresses for DTCs, not just activeECUs
-    // This ensures we don't miss codes like P0354 from ECUs that didn't respond to probes
-    for (int i = 0; i < NUM_ECUS; i++) {
-    uint16_t requestAddr = OBD2_ADDRESSES[i];
-    uint16_t responseAddr = requestAddr + 8; // Standard OBD2 response offset
-    
-    Serial.printf("🔍 Scanning ECU 0x%03X → 0x%03X for DTCs...\n", requestAddr, responseAddr);
-    
-    // Try both Mode 03 (stored DTCs) and Mode 07 (pending DTCs)
-    uint8_t modes[] = {0x03, 0x07};
-    const char* modeNames[] = {"stored", "pending"};
-    
-    for (int m = 0; m < 2; m++) {
-      Serial.printf("    Trying Mode %02X (%s DTCs)...\n", modes[m], modeNames[m]);
+void handleUiEvent(const UiEvent& event) {
+  switch (event.type) {
+    case UI_EVENT_SCAN_PROGRESS:
+      if (currentState == SCANNING) drawScanProgress(event.text, event.value);
+      break;
       
-      twai_message_t msg;
-      msg.identifier = requestAddr;
-      msg.flags = TWAI_MSG_FLAG_NONE;
-      msg.data_length_code = 8;
-      msg.data[0] = 0x01;  // Length
-      msg.data[1] = modes[m];  // Mode 03 or 07
-      msg.data[2] = 0x00;
-      msg.data[3] = 0x00;
-      msg.data[4] = 0x00;
-      msg.data[5] = 0x00;
-      msg.data[6] = 0x00;
-      msg.data[7] = 0x00;
+    case UI_EVENT_SCAN_TRAFFIC:
+      if (currentState == SCANNING) drawTrafficCounter(event.value, event.value2);
+      break;
       
-      if (twai_transmit(&msg, pdMS_TO_TICKS(100)) == ESP_OK) {
-        // Wait for DTC response
-        unsigned long start = millis();
-        bool foundResponse = false;
-        
-        while (millis() - start < 2000 && !foundResponse) { // Longer timeout for DTC responses
-          twai_message_t response;
-          if (twai_receive(&response, pdMS_TO_TICKS(50)) == ESP_OK) {
-            if (response.identifier == responseAddr) {
-              Serial.printf("    📋 Mode %02X Response from 0x%03X: ", modes[m], responseAddr);
-              for (int i = 0; i < response.data_length_code; i++) {
-                Serial.printf("%02X ", response.data[i]);
-              }
-              Serial.println();
-              
-              // Check if this is a positive response (not just "no DTCs")
-              if (response.data_length_code > 2 && !(response.data_length_code == 3 && response.data[2] == 0x00)) {
-                parseAndStoreDTC(response.data, response.data_length_code, responseAddr);
-              } else if (response.data_length_code == 3 && response.data[2] == 0x00) {
-                Serial.printf("    ✅ No %s DTCs in this ECU\n", modeNames[m]);
-              }
-              foundResponse = true;
-            }
-          }
-        }
-        
-        if (!foundResponse) {
-          Serial.printf("    ⚠️ No response to Mode %02X from ECU 0x%03X\n", modes[m], requestAddr);
-        }
+    case UI_EVENT_SCAN_DONE:
+      metricRecord(METRIC_SCAN_DURATION_MS, millis() - scanDispatchTime);
+      if (event.results->vehicleDetected) metricIncrement(METRIC_SCANS_WITH_VEHICLE);
+      
+      // The session is read-only from here until the upload reports back
+      Serial.println("📤 Submitting diagnostic results to server...");
+      scanPhase = SCAN_PHASE_UPLOADING;
+      if (!postNetRequest(NET_SUBMIT_RESULTS)) {
+        scanPhase = SCAN_PHASE_IDLE;
+        enterState(DISPLAY_RESULTS);
+      }
+      break;
+      
+    case UI_EVENT_RESULTS_SUBMITTED:
+      if (event.value) {
+        Serial.println("✅ Diagnostic results submitted successfully");
       } else {
-        Serial.printf("    ❌ Failed to send Mode %02X request to ECU 0x%03X\n", modes[m], requestAddr);
+        Serial.println("❌ Failed to submit diagnostic results");
       }
+      scanPhase = SCAN_PHASE_IDLE;
+      enterState(DISPLAY_RESULTS);
+      break;
       
-      delay(50); // Small delay between mode requests
-    }
+    case UI_EVENT_SESSION_CREATED:
+      sessionRequestInFlight = false;
+      if (currentState != READY_SCREEN) break;  // Customer moved on while we waited
+      if (event.text[0] != '\0') {
+        transactionId = event.text;
+        markBootStage(BOOT_STAGE_SESSION);
+        Serial.println("✅ Session created successfully: " + transactionId);
+        startSessionClock();
+        lastPaymentCheck = millis(); // Initialize payment polling
+        enterState(DISPLAY_QR);
+      } else if (event.value) {
+        Serial.println("❌ Session creation failed, using offline test mode");
+        transactionId = "OFFLINE_" + String(millis());
+        enterState(READY_TO_SCAN);  // Skip QR/payment, go directly to scan
+      } else {
+        Serial.println("❌ Failed to create new session, showing ready screen");
+      }
+      break;
+      
+    case UI_EVENT_BUTTON:
+      lastActivityTime = millis();
+      metricRecord(METRIC_INPUT_LATENCY_MS, (micros() - event.timestampUs) / 1000);
+      handleButtonPress();
+      break;
       
-      delay(100);
+    case UI_EVENT_STATE_TIMEOUT:
+      // A timer armed for a state we have since left is stale
+      if ((uint32_t)event.value == stateGeneration) stateTimeoutPending = true;
+      break;
       
-      // Check for timeout
-      if (millis() - scanStart > DTC_SCAN_TIMEOUT_MS) {
-        Serial.println("⏰ DTC scan timeout reached, stopping...");
+    case UI_EVENT_SESSION_TIMEOUT:
+      handleSessionTimeout();
+      break;
+      
+    case UI_EVENT_TICK:
+      break;
+      
+    case UI_EVENT_WIFI_CONNECTED:
+      if (currentState == READY_SCREEN) forceRedraw = true;  // WiFi status line
+      if (transactionId.length() == 0 && !sessionRequestInFlight && !otaHoldSessions) {
+        Serial.println("🔗 WiFi up - creating session...");
+        postNetRequest(NET_CREATE_SESSION);
+      }
+      postNetRequest(NET_FETCH_TIMING);
+      break;
+      
+    case UI_EVENT_OTA_DONE:
+      otaInFlight = false;
+      if (event.value) {
+        otaRebootPending = true;  // otaPoll() switches as soon as the kiosk is quiet
         break;
       }
-    }
-    
-    // Brief pause between passes
-    if (pass == 1) {
-      delay(500);
-      Serial.printf("✓ Pass %d complete, found %d new DTCs\n", pass, detectedCodes.size() - initialDTCCount);
-    }
+      if (otaHoldSessions) {
+        otaHoldSessions = false;  // Nothing to install - back to serving customers
+        if (currentState == READY_SCREEN && transactionId.length() == 0 && !sessionRequestInFlight) {
+          postNetRequest(NET_CREATE_SESSION);
+        }
+      }
+      break;
+      
+    case UI_EVENT_TIMING_STAGED:
+      // Between customers the new profile can go live now; otherwise resetToReady() applies it
+      if (currentState == READY_SCREEN || currentState == DISPLAY_QR) applyPendingTiming();
+      break;
+      
+    case UI_EVENT_PAYMENT_STATUS:
+      paymentCheckInFlight = false;
+      if (otaHoldSessions && !event.value && event.value2 && currentState == DISPLAY_QR &&
+          transactionId == event.text) {
+        // The server has just said "not paid" for the code on screen - take it
+        // down so the firmware work cannot strand a customer mid-payment
+        Serial.println("⏸️ Retiring the idle session for a firmware update");
+        transactionId = "";
+        sessionStartTime = 0;
+        esp_timer_stop(sessionTimer);
+        enterState(READY_SCREEN);
+        break;
+      }
+      // Ignore answers for a session that has since been replaced
+      if (!event.value || transactionId != event.text) break;
+      if (currentState == DISPLAY_QR || currentState == WAITING_PAYMENT) {
+        Serial.println("✅ Payment confirmed! Preparing for vehicle scan...");
+        startSessionClock();
+        enterState(PREPARE_VEHICLE);  // Give user time to prepare vehicle
+      }
+      break;
+  }
+}
+
+bool postUiEvent(const UiEvent& event, TickType_t wait) {
+  if (xQueueSend(uiQueue, &event, wait) != pdTRUE) return false;  // Progress updates may be dropped
+  noteQueueDepth(TASK_UI);
+  return true;
+}
+
+bool postNetRequest(NetRequestType type, bool offlineFallback) {
+  NetRequest request = {};
+  request.type = type;
+  request.offlineFallback = offlineFallback;
+  strncpy(request.transactionId, transactionId.c_str(), sizeof(request.transactionId) - 1);
+  
+  // Counted before the send so there is no instant where the job is neither queued nor busy
+  netJobsOutstanding++;
+  if (xQueueSend(netQueue, &request, 0) != pdTRUE) {
+    netJobsOutstanding--;
+    Serial.printf("⚠️ Network queue full, dropping request %d\n", type);
+    return false;
+  }
+  if (type == NET_CREATE_SESSION) sessionRequestInFlight = true;
+  noteQueueDepth(TASK_NET);
+  return true;
+}
+
+void noteQueueDepth(TaskId task) {
+  uint32_t depth = uxQueueMessagesWaiting(taskStats[task].queue);
+  uint32_t highWater = taskStats[task].queueHighWater.load(std::memory_order_relaxed);
+  while (depth > highWater &&
+         !taskStats[task].queueHighWater.compare_exchange_weak(highWater, depth, std::memory_order_relaxed)) {
+  }
+}
+
+void reportTaskStats() {
+  // Show a partial boot timeline if some stage (usually WiFi) never completed
+  if (!bootReportPrinted) printBootReport();
+  
+  // Busy share over the last interval, per task, plus worst queue backlog seen
+  static uint32_t lastReportUs = 0;
+  static uint32_t lastWakeups = 0;
+  uint32_t now = micros();
+  uint32_t elapsed = now - lastReportUs;
+  lastReportUs = now;
+  if (elapsed == 0) return;
+  
+  // UI wake-ups per second stand in for idle power - every wake pulls the CPU out of idle
+  uint32_t wakeups = metricCounters[METRIC_UI_WAKEUPS].load(std::memory_order_relaxed);
+  Serial.printf("🧵 ui   %.2f wakeups/s\n", (wakeups - lastWakeups) * 1000000.0f / elapsed);
+  lastWakeups = wakeups;
+  
+  // Awake share of the interval - the idle-power duty cycle
+  static uint64_t lastSleptUs = 0;
+  uint32_t sleptUs = (uint32_t)(idleSleptUs - lastSleptUs);
+  lastSleptUs = idleSleptUs;
+  Serial.printf("💤 light sleep %.1f%% of interval, duty cycle %.1f%% awake\n",
+                sleptUs * 100.0f / elapsed, 100.0f - sleptUs * 100.0f / elapsed);
+  
+  for (int i = 0; i < NUM_TASKS; i++) {
+    uint32_t busy = taskStats[i].busyUs.exchange(0, std::memory_order_relaxed);
+    uint32_t highWater = taskStats[i].queueHighWater.exchange(0, std::memory_order_relaxed);
+    Serial.printf("🧵 %-4s %5.1f%% busy, queue %u/%u now, high-water %u\n", taskStats[i].name,
+                  busy * 100.0f / elapsed, (unsigned)uxQueueMessagesWaiting(taskStats[i].queue),
+                  (unsigned)taskStats[i].queueLength, (unsigned)highWater);
   }
+}
+
+void initializeEventSources() {
+  esp_timer_create_args_t timerArgs = {};
+  timerArgs.callback = onStateTimer;
+  timerArgs.name = "state";
+  esp_timer_create(&timerArgs, &stateTimer);
+  timerArgs.callback = onSessionTimer;
+  timerArgs.name = "session";
+  esp_timer_create(&timerArgs, &sessionTimer);
+  timerArgs.callback = onUiTick;
+  timerArgs.name = "uiTick";
+  esp_timer_create(&timerArgs, &uiTickTimer);
+  timerArgs.callback = onButtonDebounced;
+  timerArgs.name = "debounce";
+  esp_timer_create(&timerArgs, &debounceTimer);
+  
+  // Both the scan button and the trigger start a scan - falling edge = press (pull-ups)
+  attachInterrupt(digitalPinToInterrupt(SCAN_BUTTON), onButtonEdge, FALLING);
+  attachInterrupt(digitalPinToInterrupt(SW_TRIG), onButtonEdge, FALLING);
+}
+
+void enterState(KioskState next) {
+  // Each state is a span on the timeline - the boot call has no span open to end
+  static bool stateSpanOpen = false;
+  if (stateSpanOpen) TRACE_END(KIOSK_STATE_NAMES[currentState]);
+  stateSpanOpen = true;
+  TRACE_BEGIN(KIOSK_STATE_NAMES[next]);
+  currentState = next;
+  stateStartTime = millis();
+  lastActivityTime = millis();
   
-  // Final summary
-  int totalDTCs = detectedCodes.size();
-  int newDTCs = totalDTCs - initialDTCCount;
-  unsigned long scanDuration = millis() - scanStart;
+  // Full-power WiFi only while a customer is being served
+  setWiFiPowerSave(next == DISPLAY_QR || next == READY_SCREEN);
+  stateGeneration++;
+  stateTimeoutPending = false;
   
-  Serial.printf("\n🏁 COMPREHENSIVE DTC SCAN COMPLETE:\n");
-  Serial.printf("   Duration: %.1f seconds\n", scanDuration / 1000.0);
-  Serial.printf("   Total DTCs found: %d\n", totalDTCs);
-  Serial.printf("   New DTCs this scan: %d\n", newDTCs);
+  esp_timer_stop(stateTimer);
+  unsigned long timeoutMs = stateTimeoutMs(next);
+  if (timeoutMs > 0) esp_timer_start_once(stateTimer, timeoutMs * 1000ULL);
   
-  if (totalDTCs > 0) {
-    Serial.println("   Detected fault codes:");
-    for (const auto& code : detectedCodes) {
-      Serial.printf("   🚨 %s - %s\n", code.code.c_str(), code.system.c_str());
+  // Countdown and polling screens need a once-a-second wake, everything else sleeps
+  esp_timer_stop(uiTickTimer);
+  if (stateNeedsTick(next)) esp_timer_start_periodic(uiTickTimer, UI_TICK_MS * 1000ULL);
+}
+
+unsigned long stateTimeoutMs(KioskState state) {
+  switch (state) {
+    case PREPARE_VEHICLE: return timing.prepareVehicleMs;
+    case DISPLAY_RESULTS:
+      return (!session.vehicleDetected && scanRetryCount < 2) ? NO_VEHICLE_DISPLAY_MS : RESULTS_DISPLAY_MS;
+    case SCAN_COMPLETE:   return SCAN_COMPLETE_MS;
+    case ERROR_STATE:     return ERROR_RECOVERY_MS;
+    default:              return 0;
+  }
+}
+
+bool stateNeedsTick(KioskState state) {
+  switch (state) {
+    case READY_SCREEN:     // Session creation retry
+    case DISPLAY_QR:       // Payment poll + status line
+    case WAITING_PAYMENT:  // Payment poll + elapsed time
+    case PREPARE_VEHICLE:  // Countdown
+    case DISPLAY_RESULTS:  // "No vehicle" countdown
+    case SCAN_COMPLETE:    // Countdown
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool consumeStateTimeout() {
+  if (!stateTimeoutPending) return false;
+  stateTimeoutPending = false;
+  return true;
+}
+
+void startSessionClock() {
+  sessionStartTime = millis();
+  esp_timer_stop(sessionTimer);
+  esp_timer_start_once(sessionTimer, SESSION_TIMEOUT_MS * 1000ULL);
+}
+
+void IRAM_ATTR onButtonEdge() {
+  // Restart the debounce window on every edge - only a level that holds gets through
+  buttonEdgeUs = (uint32_t)esp_timer_get_time();
+  esp_timer_stop(debounceTimer);
+  esp_timer_start_once(debounceTimer, BUTTON_DEBOUNCE_MS * 1000ULL);
+}
+
+void onButtonDebounced(void* arg) {
+  if (digitalRead(SCAN_BUTTON) != LOW && digitalRead(SW_TRIG) != LOW) return;  // Bounce or release
+  
+  UiEvent event = {};
+  event.type = UI_EVENT_BUTTON;
+  event.timestampUs = buttonEdgeUs;
+  postUiEvent(event, 0);
+}
+
+void onStateTimer(void* arg) {
+  UiEvent event = {};
+  event.type = UI_EVENT_STATE_TIMEOUT;
+  event.value = stateGeneration;
+  postUiEvent(event, 0);
+}
+
+void onSessionTimer(void* arg) {
+  UiEvent event = {};
+  event.type = UI_EVENT_SESSION_TIMEOUT;
+  postUiEvent(event, 0);
+}
+
+void onUiTick(void* arg) {
+  // Skip the tick if the UI is already behind - it will recheck millis() anyway
+  if (uxQueueMessagesWaiting(uiQueue) > 0) return;
+  UiEvent event = {};
+  event.type = UI_EVENT_TICK;
+  postUiEvent(event, 0);
+}
+
+// ========== TRACING ==========
+#if TRACE_ENABLED
+void traceRecord(const char* name, char phase) {
+  // One relaxed fetch_add claims a slot - safe from any task, no lock
+  uint32_t slot = traceHead.fetch_add(1, std::memory_order_relaxed);
+  TraceEvent& event = traceBuffer[slot % TRACE_BUFFER_EVENTS];
+  event.name = name;
+  event.timestampUs = (uint32_t)esp_timer_get_time();
+  event.phase = phase;
+  event.tid = (uint32_t)(uintptr_t)xTaskGetCurrentTaskHandle();
+}
+
+void traceExportChrome(Print& out) {
+  // Trace-event format: one complete JSON object, tid = task handle so the UI and
+  // network tasks get their own rows even though both run on core 0
+  uint32_t head = traceHead.load(std::memory_order_relaxed);
+  uint32_t first = head > TRACE_BUFFER_EVENTS ? head - TRACE_BUFFER_EVENTS : 0;
+  
+  // snprintf into a stack line - Print::printf mallocs for anything over 64 bytes
+  char line[128];
+  out.print("{\"traceEvents\":[");
+  for (int task = 0; task < NUM_TASKS; task++) {
+    int length = snprintf(line, sizeof(line), "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}},",
+                          (unsigned)(uintptr_t)taskStats[task].handle, taskStats[task].name);
+    out.write((const uint8_t*)line, min(length, (int)sizeof(line) - 1));
+  }
+  for (uint32_t i = first; i < head; i++) {
+    const TraceEvent& event = traceBuffer[i % TRACE_BUFFER_EVENTS];
+    int length = snprintf(line, sizeof(line), "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%u,\"pid\":1,\"tid\":%u%s}",
+                          i == first ? "" : ",", event.name, event.phase, event.timestampUs, event.tid,
+                          event.phase == 'i' ? ",\"s\":\"t\"" : "");
+    out.write((const uint8_t*)line, min(length, (int)sizeof(line) - 1));
+  }
+  out.printf("],\"displayTimeUnit\":\"ms\",\"otherData\":{\"kiosk\":\"%s\",\"dropped\":%u}}\n",
+             KIOSK_ID, head > TRACE_BUFFER_EVENTS ? head - TRACE_BUFFER_EVENTS : 0);
+}
+
+bool uploadTrace() {
+  if (WiFi.status() != WL_CONNECTED) return false;
+  
+  char path[96];
+  snprintf(path, sizeof(path), "/api/obd2/kiosk/%s/trace", KIOSK_ID);
+  WiFiClientSecure client;
+  if (!beginChunkedPost(client, path, "application/json")) return false;
+  
+  static ChunkedBodyWriter writer;
+  chunkedInit(&writer, &client);
+  traceExportChrome(writer);
+  chunkedFinish(&writer);
+  
+  int httpCode = writer.failed ? -1 : readHttpStatus(client, RESULTS_HTTP_TIMEOUT_MS);
+  client.stop();
+  metricIncrement(METRIC_HTTP_REQUESTS);
+  if (httpCode != 200 && httpCode != 201 && httpCode != 204) {
+    metricIncrement(METRIC_HTTP_FAILURES);
+    Serial.printf("❌ Trace upload failed: HTTP %d\n", httpCode);
+    return false;
+  }
+  Serial.printf("🧭 Trace uploaded (%u bytes)\n", (unsigned)writer.totalBytes);
+  return true;
+}
+#endif
+
+// ========== BOOT TIMELINE ==========
+void markBootStage(BootStage stage) {
+  uint32_t expected = 0;
+  bootStageMs[stage].compare_exchange_strong(expected, millis() > 0 ? millis() : 1);
+  
+  for (int i = 0; i < NUM_BOOT_STAGES; i++) {
+    if (bootStageMs[i] == 0) return;
+  }
+  if (!bootReportPrinted.exchange(true)) printBootReport();
+}
+
+void printBootReport() {
+  bootReportPrinted = true;
+  Serial.println("🚀 Boot timeline (ms since reset):");
+  for (int i = 0; i < NUM_BOOT_STAGES; i++) {
+    uint32_t stamp = bootStageMs[i];
+    if (stamp == 0) {
+      Serial.printf("   %-10s  -\n", BOOT_STAGE_NAMES[i]);
+    } else {
+      Serial.printf("   %-10s %6u\n", BOOT_STAGE_NAMES[i], stamp);
     }
-  } else {
-    Serial.println("   ✅ No diagnostic trouble codes detected");
   }
+  
+  uint32_t firstFrame = bootStageMs[BOOT_STAGE_FIRST_FRAME];
+  Serial.printf("   First interactive frame %s %lu ms target\n",
+                firstFrame != 0 && firstFrame <= BOOT_FIRST_FRAME_TARGET_MS ? "✅ within" : "⚠️ over",
+                BOOT_FIRST_FRAME_TARGET_MS);
+}
+
+// ========== IDLE POWER MODE ==========
+bool canEnterIdleSleep(unsigned long* sleepMs) {
+  // DISPLAY_QR keeps the association for its payment polls and idles on modem sleep;
+  // READY_SCREEN has nothing that needs the radio until the next session retry
+  IdleInputs inputs;
+  inputs.readyScreen = (currentState == READY_SCREEN);
+  inputs.busy = scanPhase != SCAN_PHASE_IDLE || sessionRequestInFlight || paymentCheckInFlight || otaInFlight ||
+                netJobsOutstanding.load() > 0;  // Metrics/trace/timing posts hold a TLS session open
+  inputs.rejoinPending = wifiRejoinPending.load();
+  inputs.sinceActivityMs = millis() - lastActivityTime;
+  inputs.sinceRejoinMs = millis() - wifiRejoinStartMs;
+  
+  *sleepMs = idleSleepMs(inputs);
+  return *sleepMs > 0;
+}
+
+void enterIdleSleep(unsigned long sleepMs) {
+  // Wake on any presence input changing level - arming on the opposite of the
+  // current level means a docked (held-low) kiosk doesn't wake straight back up
+  for (int i = 0; i < NUM_IDLE_WAKE_PINS; i++) {
+    gpio_num_t pin = (gpio_num_t)IDLE_WAKE_PINS[i];
+    gpio_wakeup_enable(pin, digitalRead(IDLE_WAKE_PINS[i]) ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+  }
+  esp_sleep_enable_gpio_wakeup();
+  esp_sleep_enable_timer_wakeup(sleepMs * 1000ULL);
+  esp_timer_stop(uiTickTimer);  // The timer wake-up replaces the tick while asleep
+  
+  // The association would not survive the sleep - leave cleanly, remembering the AP for a fast rejoin
+  bool associated = (WiFi.status() == WL_CONNECTED);
+  int32_t channel = associated ? WiFi.channel() : 0;
+  uint8_t bssid[6];
+  if (associated) memcpy(bssid, WiFi.BSSID(), sizeof(bssid));
+  WiFi.disconnect(true);
+  Serial.flush();
+  
+  // The TFT controller keeps its frame buffer and the backlight pin holds its
+  // level, so the ready screen stays up the whole time
+  int64_t sleepStart = esp_timer_get_time();
+  esp_light_sleep_start();
+  int64_t wakeTime = esp_timer_get_time();
+  
+  // gpio_wakeup_enable() replaced the button edge interrupts with level ones
+  for (int i = 0; i < NUM_IDLE_WAKE_PINS; i++) {
+    gpio_wakeup_disable((gpio_num_t)IDLE_WAKE_PINS[i]);
+  }
+  gpio_set_intr_type((gpio_num_t)SW_TRIG, GPIO_INTR_NEGEDGE);
+  gpio_set_intr_type((gpio_num_t)SCAN_BUTTON, GPIO_INTR_NEGEDGE);
+  esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_TIMER);
+  
+  // Rejoin in the background - wakeMs is recorded once onWiFiGotIP() says we're back
+  wifiRejoinPending = true;
+  wifiRejoinStartMs = millis();
+  WiFi.begin(WIFI_SSID, WIFI_PASSWORD, channel, associated ? bssid : NULL);
+  WiFi.setSleep(wifiPowerSave ? WIFI_PS_MAX_MODEM : WIFI_PS_MIN_MODEM);
+  
+  idleSleptUs += wakeTime - sleepStart;
+  pendingWakeUs = wakeTime;
+  metricIncrement(METRIC_IDLE_SLEEPS);
+  if (stateNeedsTick(currentState)) esp_timer_start_periodic(uiTickTimer, UI_TICK_MS * 1000ULL);
+  
+  UiEvent event = {};
+  if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_GPIO) {
+    // Someone is at the kiosk - stay awake for a while
+    lastActivityTime = millis();
+    if (digitalRead(SW_TRIG) == LOW || digitalRead(SCAN_BUTTON) == LOW) {
+      event.type = UI_EVENT_BUTTON;
+      event.timestampUs = (uint32_t)wakeTime;
+      postUiEvent(event, 0);
+      return;
+    }
+    Serial.println("👋 Woke on dock/IR input");
+  }
+  event.type = UI_EVENT_TICK;
+  postUiEvent(event, 0);
+}
+
+void setWiFiPowerSave(bool enabled) {
+  // Max modem sleep skips DTIM beacons - fine for a 3 s payment poll, too slow mid-upload
+  if (enabled == wifiPowerSave) return;
+  wifiPowerSave = enabled;
+  WiFi.setSleep(enabled ? WIFI_PS_MAX_MODEM : WIFI_PS_MIN_MODEM);
 }
 
 // ========== UTILITY FUNCTIONS ==========
+void resetScanSession() {
+  // Reset the arena in place - nothing is freed because nothing was allocated
+  session.codes.clear();
+  memset(session.codeSlots, 0, sizeof(session.codeSlots));
+  session.ecus.count = 0;
+  memset(session.ecus.slots, 0, sizeof(session.ecus.slots));
+  session.freezeFrameCount = 0;
+  clearReadiness(&session.readiness);
+  session.vehicleDetected = false; // Reset vehicle detection flag
+  session.extendedDTCTimeMs = 0;
+  session.scanDurationMs = 0;
+  session.bus = {};
+  session.link = SCAN_LINK_TWAI;
+  session.vin[0] = '\0';
+  session.vehicleInfoCount = 0;
+  session.vehicleInfoCached = false;
+  session.vehicleInfoTimeMs = 0;
+}
+
+uint8_t heapFragmentationPercent() {
+  // Share of free internal heap that is NOT usable as one block - TLS needs large blocks
+  size_t freeBytes = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+  size_t largestBlock = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL);
+  if (freeBytes == 0) return 100;
+  return 100 - (largestBlock * 100 / freeBytes);
+}
+
+void logHeapStats() {
+  Serial.printf("🧠 Heap: %u free, %u largest block, %u low-water, %u%% fragmented\n",
+                (unsigned)heap_caps_get_free_size(MALLOC_CAP_INTERNAL),
+                (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL),
+                (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL),
+                heapFragmentationPercent());
+}
+
 void resetDisplayFlags() {
   // Force all display functions to redraw by setting the global flag
   forceRedraw = true;
 }
 
 void resetToReady() {
+  if (otaRebootPending) otaHoldSessions = true;  // Between customers - otaPoll() reboots once nothing is in flight
+  
   // Clear all session data
   transactionId = "";
   sessionStartTime = 0;
-  detectedCodes.clear();
-  activeECUs.clear();
-  vehicleDetected = false; // Reset vehicle detection flag
+  esp_timer_stop(sessionTimer);
+  resetScanSession();
   scanRetryCount = 0; // Reset retry counter for new session
+  logHeapStats();
+  applyPendingTiming();  // Session boundary - the only place a new timing profile goes live
   
   // Reset display flags
   for (int i = 0; i < 10; i++) {
@@ -2320,19 +7181,16 @@ void resetToReady() {
   // Force all display functions to redraw
   forceRedraw = true;
   
-  // Create new session and return to QR code for next customer
+  // Create new session and return to QR code for next customer - the ready
+  // screen shows until UI_EVENT_SESSION_CREATED arrives
   Serial.println("🔄 Creating new session for next customer...");
-  transactionId = createNewSession();
-  
-  if (transactionId.length() > 0) {
-    currentState = DISPLAY_QR;
-    lastPaymentCheck = millis(); // Initialize payment polling for new session
-    Serial.println("✓ New session created: " + transactionId);
-  } else {
-    Serial.println("❌ Failed to create new session, showing ready screen");
-    currentState = READY_SCREEN;
-  }
-  
-  stateStartTime = millis();
+  enterState(READY_SCREEN);
+  if (!sessionRequestInFlight && !otaHoldSessions) postNetRequest(NET_CREATE_SESSION);
+  postNetRequest(NET_FETCH_TIMING);
+#if TRACE_ENABLED
+  // Behind the next customer's session - the export is slow and optional
+  if (TRACE_SERIAL_EXPORT || TRACE_UPLOAD) postNetRequest(NET_EXPORT_TRACE);
+#endif
+
   Serial.println("🔄 Reset complete - ready for next customer");
 }
\ No newline at end of file
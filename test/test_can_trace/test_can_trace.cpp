@@ -0,0 +1,215 @@
+/*
+ * CAN trace codec tests and per-frame recording benchmark - run on the host
+ * with: pio test -e native
+ */
+#include <unity.h>
+#include <chrono>
+#include <stdio.h>
+#include "can_trace.h"
+
+struct VarintCase {
+  uint32_t value;
+  int length;
+};
+
+static const VarintCase VARINT_CASES[] = {
+  {0, 1}, {1, 1}, {127, 1}, {128, 2}, {0x7DF, 2}, {16383, 2}, {16384, 3},
+  {0x0FFFFFFF, 4}, {0x18DAF110, 5}, {0x10000000, 5}, {0xFFFFFFFF, 5}
+};
+
+void test_varint_round_trip() {
+  for (const VarintCase& test : VARINT_CASES) {
+    uint8_t buffer[8];
+    uint8_t* end = canTracePutVarint(buffer, test.value);
+    TEST_ASSERT_EQUAL(test.length, end - buffer);
+    
+    const uint8_t* in = buffer;
+    TEST_ASSERT_EQUAL_HEX32(test.value, canTraceGetVarint(&in, end));
+    TEST_ASSERT_TRUE(in == end);
+  }
+}
+
+void test_varint_known_bytes() {
+  // 0x7E8 = 0b1111_1101000 -> E8 0F
+  const uint8_t expected[] = {0xE8, 0x0F};
+  uint8_t buffer[8];
+  TEST_ASSERT_EQUAL(2, canTracePutVarint(buffer, 0x7E8) - buffer);
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, buffer, 2);
+}
+
+void test_varint_never_reads_past_end() {
+  // Continuation bit set on the last available byte
+  const uint8_t truncated[] = {0xFF, 0xFF};
+  const uint8_t* in = truncated;
+  canTraceGetVarint(&in, truncated + sizeof(truncated));
+  TEST_ASSERT_TRUE(in == truncated + sizeof(truncated));
+  
+  // Six continuation bytes - stops after five
+  const uint8_t overlong[] = {0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x01};
+  in = overlong;
+  canTraceGetVarint(&in, overlong + sizeof(overlong));
+  TEST_ASSERT_EQUAL(5, in - overlong);
+}
+
+void test_frame_encoding_bytes() {
+  // Request 7DF 02 01 00, then the 7E8 reply 2 ms later
+  CanTraceBlock block;
+  CanTraceChain chain;
+  canTraceStartBlock(&block, &chain, 1000);
+  const uint8_t request[8] = {0x02, 0x01, 0x00, 0, 0, 0, 0, 0};
+  const uint8_t reply[8] = {0x06, 0x41, 0x00, 0xBE, 0x3E, 0xB8, 0x11, 0x00};
+  canTraceEncodeFrame(&block, &chain, 1000, 0x7DF, true, false, false, 8, request);
+  canTraceEncodeFrame(&block, &chain, 3000, 0x7E8, false, false, false, 8, reply);
+  
+  const uint8_t expected[] = {
+    0x18, 0x00, 0xDF, 0x0F, 0x02, 0x01, 0x00, 0, 0, 0, 0, 0,
+    0x08, 0xD0, 0x0F, 0xE8, 0x0F, 0x06, 0x41, 0x00, 0xBE, 0x3E, 0xB8, 0x11, 0x00
+  };
+  TEST_ASSERT_EQUAL(sizeof(expected), block.length);
+  TEST_ASSERT_EQUAL(2, block.records);
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, block.data, sizeof(expected));
+}
+
+void test_round_trip_with_same_id_and_markers() {
+  CanTraceBlock block;
+  CanTraceChain chain;
+  canTraceStartBlock(&block, &chain, 500000);
+  const uint8_t payload[8] = {0x03, 0x43, 0x01, 0x03, 0x01, 0x00, 0x00, 0x00};
+  
+  canTraceEncodeMarker(&block, &chain, 500000, CAN_TRACE_BAUD_MARKER | 1);
+  canTraceEncodeFrame(&block, &chain, 500100, 0x7DF, true, false, false, 8, payload);
+  canTraceEncodeFrame(&block, &chain, 500200, 0x7E8, false, false, false, 8, payload);
+  canTraceEncodeFrame(&block, &chain, 500300, 0x7DF, true, false, false, 8, payload);   // SAME_ID, TX
+  canTraceEncodeFrame(&block, &chain, 500400, 0x7E8, false, false, false, 3, payload);  // SAME_ID, RX
+  canTraceEncodeFrame(&block, &chain, 520400, 0x18DAF110, false, true, false, 8, payload);
+  canTraceEncodeFrame(&block, &chain, 520401, 0x7E0, true, false, true, 8, payload);    // RTR - no payload
+  canTraceEncodeMarker(&block, &chain, 600000, CAN_TRACE_ANOMALY_TIMEOUT);
+  TEST_ASSERT_EQUAL(8, block.records);
+  
+  CanTraceReader reader;
+  CanTraceRecord record;
+  canTraceReaderInit(&reader, block, 0);
+  
+  TEST_ASSERT_TRUE(canTraceReadRecord(&reader, &record));
+  TEST_ASSERT_EQUAL(CAN_TRACE_MARKER, record.flags);
+  TEST_ASSERT_EQUAL_HEX8(CAN_TRACE_BAUD_MARKER | 1, record.code);
+  TEST_ASSERT_EQUAL(0, record.timeUs);
+  
+  const uint32_t ids[] = {0x7DF, 0x7E8, 0x7DF, 0x7E8, 0x18DAF110, 0x7E0};
+  const uint32_t times[] = {100, 200, 300, 400, 20400, 20401};
+  const uint8_t flags[] = {CAN_TRACE_TX, 0, CAN_TRACE_TX, 0, CAN_TRACE_EXTENDED, CAN_TRACE_TX | CAN_TRACE_RTR};
+  const uint8_t dlcs[] = {8, 8, 8, 3, 8, 8};
+  for (int i = 0; i < 6; i++) {
+    TEST_ASSERT_TRUE(canTraceReadRecord(&reader, &record));
+    TEST_ASSERT_EQUAL_HEX32(ids[i], record.identifier);
+    TEST_ASSERT_EQUAL(times[i], record.timeUs);
+    TEST_ASSERT_EQUAL_HEX8(flags[i], record.flags);
+    TEST_ASSERT_EQUAL(dlcs[i], record.dlc);
+    if (!(flags[i] & CAN_TRACE_RTR)) TEST_ASSERT_EQUAL_HEX8_ARRAY(payload, record.data, dlcs[i]);
+  }
+  
+  TEST_ASSERT_TRUE(canTraceReadRecord(&reader, &record));
+  TEST_ASSERT_EQUAL(CAN_TRACE_MARKER, record.flags);
+  TEST_ASSERT_EQUAL_HEX8(CAN_TRACE_ANOMALY_TIMEOUT, record.code);
+  TEST_ASSERT_EQUAL(100000, record.timeUs);
+  TEST_ASSERT_FALSE(canTraceReadRecord(&reader, &record));
+}
+
+void test_malformed_records_stop_decoding() {
+  CanTraceBlock block;
+  CanTraceReader reader;
+  CanTraceRecord record;
+  
+  // DLC nibble 9 is not a CAN 2.0 frame
+  const uint8_t badDlc[] = {0x09, 0x00, 0xE8, 0x0F, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+  memcpy(block.data, badDlc, sizeof(badDlc));
+  block.length = sizeof(badDlc);
+  canTraceReaderInit(&reader, block, 0);
+  TEST_ASSERT_FALSE(canTraceReadRecord(&reader, &record));
+  
+  // Payload runs past the end of the block
+  const uint8_t shortPayload[] = {0x08, 0x00, 0xE8, 0x0F, 0x06, 0x41};
+  memcpy(block.data, shortPayload, sizeof(shortPayload));
+  block.length = sizeof(shortPayload);
+  canTraceReaderInit(&reader, block, 0);
+  TEST_ASSERT_FALSE(canTraceReadRecord(&reader, &record));
+  
+  // SAME_ID with nothing before it in this direction
+  const uint8_t orphanSameId[] = {0x80 | 0x02, 0x00, 0x41, 0x00};
+  memcpy(block.data, orphanSameId, sizeof(orphanSameId));
+  block.length = sizeof(orphanSameId);
+  canTraceReaderInit(&reader, block, 0);
+  TEST_ASSERT_FALSE(canTraceReadRecord(&reader, &record));
+  
+  // Marker with its code byte missing
+  const uint8_t markerNoCode[] = {CAN_TRACE_MARKER, 0x05};
+  memcpy(block.data, markerNoCode, sizeof(markerNoCode));
+  block.length = sizeof(markerNoCode);
+  canTraceReaderInit(&reader, block, 0);
+  TEST_ASSERT_FALSE(canTraceReadRecord(&reader, &record));
+  
+  // A corrupt length field is clamped to the block, not trusted
+  block.length = 0xFFFF;
+  canTraceReaderInit(&reader, block, 0);
+  TEST_ASSERT_TRUE(reader.end == block.data + sizeof(block.data));
+}
+
+void test_block_room_leaves_space_for_largest_record() {
+  CanTraceBlock block;
+  CanTraceChain chain;
+  canTraceStartBlock(&block, &chain, 0);
+  const uint8_t payload[8] = {};
+  uint32_t id = 0x10000000;  // Never SAME_ID - 5-byte ID varint
+  uint32_t nowUs = 0;
+  while (canTraceBlockHasRoom(block)) {
+    nowUs += 0x10000000;  // 5-byte delta varint
+    canTraceEncodeFrame(&block, &chain, nowUs, id++, false, true, false, 8, payload);
+  }
+  TEST_ASSERT_LESS_OR_EQUAL(sizeof(block.data), block.length);
+}
+
+void test_benchmark_record_cost() {
+  // Scan-like traffic: 7DF request, one or two ECU replies, flow control and
+  // consecutive frames, 0.5-20 ms apart. Blocks restart when full like the ring
+  static CanTraceBlock block;
+  CanTraceChain chain;
+  canTraceStartBlock(&block, &chain, 0);
+  const uint32_t ids[] = {0x7DF, 0x7E8, 0x7E9, 0x7E0, 0x7E8, 0x7E8};
+  const uint8_t payload[8] = {0x10, 0x14, 0x49, 0x02, 0x01, 0x31, 0x48, 0x47};
+  const int frames = 2000000;
+  
+  uint32_t nowUs = 0;
+  size_t bytes = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < frames; i++) {
+    if (!canTraceBlockHasRoom(block)) {
+      bytes += block.length;
+      canTraceStartBlock(&block, &chain, nowUs);
+    }
+    nowUs += 500 + (i % 7) * 2900;
+    uint32_t id = ids[i % 6];
+    canTraceEncodeFrame(&block, &chain, nowUs, id, id < 0x7E8, false, false, 8, payload);
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  bytes += block.length;
+  double nsPerFrame = std::chrono::duration<double, std::nano>(elapsed).count() / frames;
+  
+  char report[96];
+  snprintf(report, sizeof(report), "trace record: %.1f ns/frame on the host, %.2f B/frame",
+           nsPerFrame, (double)bytes / frames);
+  TEST_MESSAGE(report);
+  TEST_ASSERT_LESS_THAN(14, (int)(bytes / frames));  // 1 + 2 + 0-2 + 8 per frame
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_varint_round_trip);
+  RUN_TEST(test_varint_known_bytes);
+  RUN_TEST(test_varint_never_reads_past_end);
+  RUN_TEST(test_frame_encoding_bytes);
+  RUN_TEST(test_round_trip_with_same_id_and_markers);
+  RUN_TEST(test_malformed_records_stop_decoding);
+  RUN_TEST(test_block_room_leaves_space_for_largest_record);
+  RUN_TEST(test_benchmark_record_cost);
+  return UNITY_END();
+}
@@ -0,0 +1,252 @@
+/*
+ * Byte-exact tests and a size/time benchmark for the CBOR encoder - run on the
+ * host with: pio test -e native
+ */
+#include <unity.h>
+#include <chrono>
+#include <stdio.h>
+#include "cbor.h"
+
+struct HeadCase {
+  uint32_t value;
+  uint8_t encoded[5];
+  size_t length;
+};
+
+// RFC 8949 appendix A vectors for unsigned ints, one per head size
+static const HeadCase UINT_CASES[] = {
+  {0,          {0x00},                         1},
+  {23,         {0x17},                         1},
+  {24,         {0x18, 0x18},                   2},
+  {255,        {0x18, 0xFF},                   2},
+  {256,        {0x19, 0x01, 0x00},             3},
+  {65535,      {0x19, 0xFF, 0xFF},             3},
+  {65536,      {0x1A, 0x00, 0x01, 0x00, 0x00}, 5},
+  {1000000,    {0x1A, 0x00, 0x0F, 0x42, 0x40}, 5},
+  {0xFFFFFFFF, {0x1A, 0xFF, 0xFF, 0xFF, 0xFF}, 5}
+};
+
+void test_uint_head_sizes() {
+  for (const HeadCase& test : UINT_CASES) {
+    uint8_t buffer[8];
+    CborWriter writer;
+    cborInit(&writer, buffer, sizeof(buffer));
+    cborWriteUInt(&writer, test.value);
+    TEST_ASSERT_FALSE(writer.overflow);
+    TEST_ASSERT_EQUAL(test.length, writer.length);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(test.encoded, buffer, test.length);
+  }
+}
+
+void test_major_types_in_head() {
+  // Array of 24, map of 256, bytes of 3 - the major type lands in the top three bits
+  const uint8_t expected[] = {0x98, 0x18, 0xB9, 0x01, 0x00, 0x43, 0x01, 0x02, 0x03};
+  const uint8_t bytes[] = {0x01, 0x02, 0x03};
+  uint8_t buffer[16];
+  CborWriter writer;
+  cborInit(&writer, buffer, sizeof(buffer));
+  cborBeginArray(&writer, 24);
+  cborBeginMap(&writer, 256);
+  cborWriteBytes(&writer, bytes, sizeof(bytes));
+  TEST_ASSERT_EQUAL(sizeof(expected), writer.length);
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, buffer, sizeof(expected));
+}
+
+void test_text_and_bools() {
+  // {"v": 2, "detected": true, "vin": ""}
+  const uint8_t expected[] = {0xA3, 0x61, 'v', 0x02,
+                              0x68, 'd', 'e', 't', 'e', 'c', 't', 'e', 'd', 0xF5,
+                              0x63, 'v', 'i', 'n', 0x60};
+  uint8_t buffer[32];
+  CborWriter writer;
+  cborInit(&writer, buffer, sizeof(buffer));
+  cborBeginMap(&writer, 3);
+  cborWriteText(&writer, "v");
+  cborWriteUInt(&writer, 2);
+  cborWriteText(&writer, "detected");
+  cborWriteBool(&writer, true);
+  cborWriteText(&writer, "vin");
+  cborWriteText(&writer, "");
+  TEST_ASSERT_FALSE(writer.overflow);
+  TEST_ASSERT_EQUAL(sizeof(expected), writer.length);
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, buffer, sizeof(expected));
+}
+
+void test_long_text_uses_one_byte_length() {
+  const char* text = "Catalyst System Efficiency Below Threshold";  // 42 chars
+  uint8_t buffer[64];
+  CborWriter writer;
+  cborInit(&writer, buffer, sizeof(buffer));
+  cborWriteText(&writer, text);
+  TEST_ASSERT_EQUAL_HEX8(0x78, buffer[0]);
+  TEST_ASSERT_EQUAL_HEX8(42, buffer[1]);
+  TEST_ASSERT_EQUAL(44, writer.length);
+}
+
+void test_overflow_never_writes_past_buffer() {
+  // Guard bytes after the capacity must survive every kind of write
+  uint8_t buffer[8];
+  memset(buffer, 0xEE, sizeof(buffer));
+  CborWriter writer;
+  cborInit(&writer, buffer, 4);
+  cborWriteUInt(&writer, 1000000);  // 5-byte head into 4
+  TEST_ASSERT_TRUE(writer.overflow);
+  TEST_ASSERT_EQUAL(0, writer.length);
+  
+  cborInit(&writer, buffer, 4);
+  cborWriteText(&writer, "misfire");  // Head fits, text doesn't
+  TEST_ASSERT_TRUE(writer.overflow);
+  TEST_ASSERT_LESS_OR_EQUAL(4, writer.length);
+  
+  cborInit(&writer, buffer, 4);
+  const uint8_t bytes[] = {1, 2, 3, 4};
+  cborWriteBytes(&writer, bytes, sizeof(bytes));
+  TEST_ASSERT_TRUE(writer.overflow);
+  
+  for (int i = 4; i < 8; i++) {
+    TEST_ASSERT_EQUAL_HEX8(0xEE, buffer[i]);
+  }
+}
+
+void test_overflow_is_sticky() {
+  // After a dropped item nothing smaller may follow it into the buffer
+  uint8_t buffer[4];
+  CborWriter writer;
+  cborInit(&writer, buffer, sizeof(buffer));
+  cborWriteUInt(&writer, 1);
+  cborWriteText(&writer, "freeze");
+  size_t lengthAtOverflow = writer.length;
+  cborWriteBool(&writer, false);
+  cborWriteUInt(&writer, 2);
+  TEST_ASSERT_TRUE(writer.overflow);
+  TEST_ASSERT_EQUAL(lengthAtOverflow, writer.length);
+}
+
+// A busy session in encodeResultsCbor's layout: 12 DTCs, 8 ECUs, 4 Mode 09
+// records, 2 freeze frames, readiness, timings and bus health
+static size_t encodeRealisticResults(uint8_t* buffer, size_t capacity) {
+  CborWriter writer;
+  cborInit(&writer, buffer, capacity);
+  cborBeginMap(&writer, 12);
+  cborWriteText(&writer, "v");
+  cborWriteUInt(&writer, 1);
+  cborWriteText(&writer, "detected");
+  cborWriteBool(&writer, true);
+  cborWriteText(&writer, "link");
+  cborWriteUInt(&writer, 0);
+  
+  cborWriteText(&writer, "dtcs");
+  cborBeginArray(&writer, 12);
+  for (int i = 0; i < 12; i++) {
+    cborBeginArray(&writer, 6);
+    cborWriteUInt(&writer, 0x0300 + i);
+    cborWriteUInt(&writer, 0x7E8 + (i % 3));
+    cborWriteUInt(&writer, i % 2);
+    cborWriteUInt(&writer, 0x2F);
+    cborWriteUInt(&writer, 0);
+    cborWriteUInt(&writer, 1);
+  }
+  
+  cborWriteText(&writer, "ecus");
+  cborBeginArray(&writer, 8);
+  for (int i = 0; i < 8; i++) {
+    cborBeginArray(&writer, 8);
+    cborWriteUInt(&writer, 0x7E8 + i);
+    cborWriteUInt(&writer, 0x7E0 + i);
+    cborWriteUInt(&writer, 14);
+    cborWriteUInt(&writer, 8);
+    cborWriteUInt(&writer, 21);
+    cborWriteUInt(&writer, 310);
+    cborWriteUInt(&writer, 1);
+    cborWriteUInt(&writer, 0x1F);
+  }
+  
+  cborWriteText(&writer, "vin");
+  cborWriteText(&writer, "1HGCM82633A004352");
+  cborWriteText(&writer, "vinfo");
+  cborBeginArray(&writer, 4);
+  for (int i = 0; i < 4; i++) {
+    cborBeginArray(&writer, 4);
+    cborWriteUInt(&writer, 0x7E8 + i);
+    cborWriteText(&writer, "ECM-EngineControl");
+    cborBeginArray(&writer, 2);
+    cborWriteText(&writer, "37805-5A2-A530");
+    cborWriteText(&writer, "37805-5A2-A540");
+    cborBeginArray(&writer, 2);
+    cborWriteUInt(&writer, 0x1791BC82);
+    cborWriteUInt(&writer, 0x16E062BE);
+  }
+  
+  cborWriteText(&writer, "freeze");
+  cborBeginArray(&writer, 2);
+  const uint8_t pidBytes[] = {0x02, 0x03, 0x00, 0x04, 0x5A, 0x05, 0x7B, 0x0C, 0x1A, 0xF8, 0x0D, 0x00, 0x11, 0x26};
+  for (int i = 0; i < 2; i++) {
+    cborBeginArray(&writer, 4);
+    cborWriteUInt(&writer, 0x0301 + i);
+    cborWriteUInt(&writer, 0x7E8);
+    cborWriteUInt(&writer, i);
+    cborWriteBytes(&writer, pidBytes, sizeof(pidBytes));
+  }
+  
+  cborWriteText(&writer, "ready");
+  cborBeginArray(&writer, 6);
+  cborWriteUInt(&writer, 0x1F7);
+  cborWriteUInt(&writer, 0x1B7);
+  cborWriteUInt(&writer, 0x107);
+  cborWriteUInt(&writer, 0x003);
+  cborWriteUInt(&writer, 0x05);
+  cborWriteUInt(&writer, 12);
+  
+  cborWriteText(&writer, "t");
+  cborBeginArray(&writer, 5);
+  cborWriteUInt(&writer, 18250);
+  cborWriteUInt(&writer, 2410);
+  cborWriteUInt(&writer, 640);
+  cborWriteUInt(&writer, 86400000);
+  cborWriteUInt(&writer, 930);
+  
+  cborWriteText(&writer, "bus");
+  cborBeginArray(&writer, 9);
+  const uint32_t bus[] = {12, 31, 0, 2, 0, 0, 0, 0, 3};
+  for (uint32_t value : bus) {
+    cborWriteUInt(&writer, value);
+  }
+  
+  cborWriteText(&writer, "timing");
+  cborBeginArray(&writer, 2);
+  cborWriteUInt(&writer, 7);
+  cborWriteText(&writer, "fast-idle");
+  return writer.overflow ? 0 : writer.length;
+}
+
+void test_benchmark_realistic_results() {
+  // Same 3 KB buffer submitResultsCbor() encodes into
+  static uint8_t buffer[3072];
+  const int iterations = 20000;
+  size_t length = 0;
+  
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    length = encodeRealisticResults(buffer, sizeof(buffer));
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  double perEncodeUs = std::chrono::duration<double, std::micro>(elapsed).count() / iterations;
+  
+  char report[96];
+  snprintf(report, sizeof(report), "results blob: %d bytes, %.2f us per encode on the host", (int)length, perEncodeUs);
+  TEST_MESSAGE(report);
+  TEST_ASSERT_GREATER_THAN(0, (int)length);
+  TEST_ASSERT_LESS_THAN(1024, (int)length);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_uint_head_sizes);
+  RUN_TEST(test_major_types_in_head);
+  RUN_TEST(test_text_and_bools);
+  RUN_TEST(test_long_text_uses_one_byte_length);
+  RUN_TEST(test_overflow_never_writes_past_buffer);
+  RUN_TEST(test_overflow_is_sticky);
+  RUN_TEST(test_benchmark_realistic_results);
+  return UNITY_END();
+}
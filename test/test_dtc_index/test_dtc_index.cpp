@@ -0,0 +1,172 @@
+/*
+ * Session DTC dedup index tests and insert/lookup benchmark - run on the host
+ * with: pio test -e native
+ */
+#include <unity.h>
+#include <chrono>
+#include <stdio.h>
+#include "dtc_index.h"
+
+static DtcList codes;
+static uint8_t slots[DTC_INDEX_SLOTS];
+
+static void resetIndex() {
+  codes.clear();
+  memset(slots, 0, sizeof(slots));
+}
+
+static FaultCode makeCode(uint16_t rawCode, uint16_t ecuId, uint8_t mode, uint8_t failureType = 0,
+                          uint8_t status = 0) {
+  FaultCode fault;
+  memset(&fault, 0, sizeof(fault));
+  snprintf(fault.code, sizeof(fault.code), "P%04X", rawCode & 0x3FFF);
+  fault.rawCode = rawCode;
+  fault.ecuId = ecuId;
+  fault.mode = mode;
+  fault.failureType = failureType;
+  fault.status = status;
+  return fault;
+}
+
+static int usedSlots() {
+  int used = 0;
+  for (int i = 0; i < DTC_INDEX_SLOTS; i++) {
+    if (slots[i] != 0) used++;
+  }
+  return used;
+}
+
+void test_repeat_report_merges_into_first_entry() {
+  resetIndex();
+  FaultCode* first = dtcIndexAdd(&codes, slots, makeCode(0x0420, 0x7E8, 0x03));
+  TEST_ASSERT_NOT_NULL(first);
+  TEST_ASSERT_EQUAL(1, first->passes);
+  
+  FaultCode* again = dtcIndexAdd(&codes, slots, makeCode(0x0420, 0x7E8, 0x03));
+  FaultCode* third = dtcIndexAdd(&codes, slots, makeCode(0x0420, 0x7E8, 0x03));
+  TEST_ASSERT_TRUE(again == first);
+  TEST_ASSERT_TRUE(third == first);
+  TEST_ASSERT_EQUAL(3, first->passes);
+  TEST_ASSERT_EQUAL(1, codes.size());
+  TEST_ASSERT_EQUAL(1, usedSlots());
+}
+
+void test_merge_ors_uds_status() {
+  resetIndex();
+  dtcIndexAdd(&codes, slots, makeCode(0x0420, 0x7E8, UDS_DTC_MODE, 0x1C, 0x08));
+  FaultCode* merged = dtcIndexAdd(&codes, slots, makeCode(0x0420, 0x7E8, UDS_DTC_MODE, 0x1C, 0x04));
+  TEST_ASSERT_EQUAL_HEX8(0x0C, merged->status);
+  TEST_ASSERT_EQUAL(2, merged->passes);
+}
+
+void test_key_fields_keep_codes_apart() {
+  resetIndex();
+  // Same DTC from another ECU, another mode or with another failure type is a different fault
+  dtcIndexAdd(&codes, slots, makeCode(0x0420, 0x7E8, 0x03));
+  dtcIndexAdd(&codes, slots, makeCode(0x0420, 0x7E9, 0x03));
+  dtcIndexAdd(&codes, slots, makeCode(0x0420, 0x7E8, 0x07));
+  dtcIndexAdd(&codes, slots, makeCode(0x0420, 0x7E8, UDS_DTC_MODE, 0x00));
+  dtcIndexAdd(&codes, slots, makeCode(0x0420, 0x7E8, UDS_DTC_MODE, 0x1C));
+  TEST_ASSERT_EQUAL(5, codes.size());
+  for (const FaultCode& code : codes) {
+    TEST_ASSERT_EQUAL(1, code.passes);
+  }
+}
+
+void test_full_list_returns_null() {
+  resetIndex();
+  for (int i = 0; i < MAX_SESSION_DTCS; i++) {
+    TEST_ASSERT_NOT_NULL(dtcIndexAdd(&codes, slots, makeCode(0x0100 + i, 0x7E8, 0x03)));
+  }
+  TEST_ASSERT_TRUE(codes.full());
+  TEST_ASSERT_NULL(dtcIndexAdd(&codes, slots, makeCode(0x0300, 0x7E8, 0x03)));
+  TEST_ASSERT_EQUAL(MAX_SESSION_DTCS, codes.size());
+  TEST_ASSERT_EQUAL(MAX_SESSION_DTCS, usedSlots());
+  
+  // A code already in the list still merges when there is no room for new ones
+  FaultCode* merged = dtcIndexAdd(&codes, slots, makeCode(0x0100, 0x7E8, 0x03));
+  TEST_ASSERT_NOT_NULL(merged);
+  TEST_ASSERT_EQUAL(2, merged->passes);
+}
+
+void test_collisions_probe_to_next_slot() {
+  resetIndex();
+  // Find codes that share a home slot, so the later ones have to probe past it
+  FaultCode colliding[3];
+  int found = 0;
+  uint32_t home = dtcKeyHash(makeCode(0x0100, 0x7E8, 0x03)) & (DTC_INDEX_SLOTS - 1);
+  for (uint16_t raw = 0x0100; raw < 0x4000 && found < 3; raw++) {
+    FaultCode fault = makeCode(raw, 0x7E8, 0x03);
+    if ((dtcKeyHash(fault) & (DTC_INDEX_SLOTS - 1)) == home) colliding[found++] = fault;
+  }
+  TEST_ASSERT_EQUAL(3, found);
+  
+  for (int i = 0; i < 3; i++) {
+    TEST_ASSERT_NOT_NULL(dtcIndexAdd(&codes, slots, colliding[i]));
+  }
+  for (int i = 0; i < 3; i++) {
+    TEST_ASSERT_EQUAL(i + 1, slots[(home + i) & (DTC_INDEX_SLOTS - 1)]);
+  }
+  
+  // Each still resolves to its own entry through the probe chain
+  for (int i = 2; i >= 0; i--) {
+    FaultCode* merged = dtcIndexAdd(&codes, slots, colliding[i]);
+    TEST_ASSERT_EQUAL_HEX16(colliding[i].rawCode, merged->rawCode);
+    TEST_ASSERT_EQUAL(2, merged->passes);
+  }
+  TEST_ASSERT_EQUAL(3, codes.size());
+}
+
+void test_list_keeps_insertion_order() {
+  resetIndex();
+  const uint16_t order[] = {0x0420, 0x0171, 0x0300, 0x0442, 0x0128};
+  for (uint16_t raw : order) {
+    dtcIndexAdd(&codes, slots, makeCode(raw, 0x7E8, 0x03));
+  }
+  dtcIndexAdd(&codes, slots, makeCode(0x0300, 0x7E8, 0x03));  // Merges - must not move it
+  
+  TEST_ASSERT_EQUAL(5, codes.size());
+  for (int i = 0; i < 5; i++) {
+    TEST_ASSERT_EQUAL_HEX16(order[i], codes[i].rawCode);
+  }
+}
+
+void test_benchmark_insert_and_lookup() {
+  // A full session (64 codes over 8 ECUs) inserted, then every code reported again
+  const int rounds = 20000;
+  FaultCode session[MAX_SESSION_DTCS];
+  for (int i = 0; i < MAX_SESSION_DTCS; i++) {
+    session[i] = makeCode(0x0100 + i * 7, 0x7E8 + (i & 7), 0x03);
+  }
+  
+  uint32_t merged = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int round = 0; round < rounds; round++) {
+    resetIndex();
+    for (int pass = 0; pass < 2; pass++) {
+      for (int i = 0; i < MAX_SESSION_DTCS; i++) {
+        FaultCode* stored = dtcIndexAdd(&codes, slots, session[i]);
+        if (stored->passes > 1) merged++;
+      }
+    }
+  }
+  double elapsedNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  TEST_ASSERT_EQUAL_UINT32((uint32_t)rounds * MAX_SESSION_DTCS, merged);
+  
+  char report[96];
+  snprintf(report, sizeof(report), "%.1f ns per insert/lookup, %d codes, %d-slot index",
+           elapsedNs / (rounds * 2.0 * MAX_SESSION_DTCS), MAX_SESSION_DTCS, DTC_INDEX_SLOTS);
+  TEST_MESSAGE(report);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_repeat_report_merges_into_first_entry);
+  RUN_TEST(test_merge_ors_uds_status);
+  RUN_TEST(test_key_fields_keep_codes_apart);
+  RUN_TEST(test_full_list_returns_null);
+  RUN_TEST(test_collisions_probe_to_next_slot);
+  RUN_TEST(test_list_keeps_insertion_order);
+  RUN_TEST(test_benchmark_insert_and_lookup);
+  return UNITY_END();
+}
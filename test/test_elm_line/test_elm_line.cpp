@@ -0,0 +1,88 @@
+/*
+ * Table tests for elmParseLine() - run on the host with: pio test -e native
+ */
+#include <unity.h>
+#include "elm_line.h"
+
+// Same field names as twai_message_t
+struct HostFrame {
+  uint32_t identifier;
+  uint32_t extd;
+  uint8_t data_length_code;
+  uint8_t data[8];
+};
+
+struct LineCase {
+  const char* line;
+  bool accepted;
+  uint32_t identifier;
+  bool extended;
+  uint8_t dlc;
+  uint8_t data[8];
+};
+
+static const LineCase LINE_CASES[] = {
+  // 11-bit IDs - odd digit count
+  {"7E8064100BE3FA813", true, 0x7E8, false, 7, {0x06, 0x41, 0x00, 0xBE, 0x3F, 0xA8, 0x13}},
+  {"7E91043060101031502", true, 0x7E9, false, 8, {0x10, 0x43, 0x06, 0x01, 0x01, 0x03, 0x15, 0x02}},
+  {"7E803", true, 0x7E8, false, 1, {0x03}},
+  {"7e8024300", true, 0x7E8, false, 3, {0x02, 0x43, 0x00}},
+  // 29-bit IDs - even digit count
+  {"18DAF110064100BE3FA813", true, 0x18DAF110, true, 7, {0x06, 0x41, 0x00, 0xBE, 0x3F, 0xA8, 0x13}},
+  {"18DAF1182143000000000000", true, 0x18DAF118, true, 8, {0x21, 0x43, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}},
+  {"18DAF11030", true, 0x18DAF110, true, 1, {0x30}},
+  // Status text never parses
+  {"NO DATA", false},
+  {"SEARCHING...", false},
+  {"CAN ERROR", false},
+  {"BUFFER FULL", false},
+  {"UNABLE TO CONNECT", false},
+  {"STOPPED", false},
+  {"OK", false},
+  {"?", false},
+  {"", false},
+  // Spaces or headers off are not what the backend configured
+  {"7E8 06 41 00 BE 3F A8 13", false},
+  {"4100BE3FA813", false},                                  // Would be a 32-bit ID
+  {"43010420000000", false},
+  {"8E8064100BE3FA813", false},                             // Would be a 12-bit ID
+  // Lengths with no whole frame in them
+  {"7E8", false},
+  {"7E80", false},
+  {"18DAF110", false},
+  {"18DAF1100", true, 0x18D, false, 3, {0xAF, 0x11, 0x00}},  // Odd, so read as 11-bit - a 29-bit line is never odd
+  {"7E8064100BE3FA8130000", false},                         // 9 data bytes
+  {"18DAF110064100BE3FA8130000", false},
+};
+
+void test_line_table() {
+  for (const LineCase& c : LINE_CASES) {
+    HostFrame frame;
+    memset(&frame, 0xAA, sizeof(frame));
+    bool accepted = elmParseLine(c.line, strlen(c.line), &frame);
+    TEST_ASSERT_EQUAL_MESSAGE(c.accepted, accepted, c.line);
+    if (!c.accepted) continue;
+    
+    TEST_ASSERT_EQUAL_HEX32_MESSAGE(c.identifier, frame.identifier, c.line);
+    TEST_ASSERT_EQUAL_MESSAGE(c.extended ? 1 : 0, frame.extd, c.line);
+    TEST_ASSERT_EQUAL_MESSAGE(c.dlc, frame.data_length_code, c.line);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY_MESSAGE(c.data, frame.data, 8, c.line);  // Unused bytes cleared
+  }
+}
+
+void test_length_bounds_the_read() {
+  // The backend passes its line length - digits past it are never read
+  const char* line = "7E8064100BE3FA813FFFF";
+  HostFrame frame;
+  TEST_ASSERT_TRUE(elmParseLine(line, 17, &frame));
+  TEST_ASSERT_EQUAL(7, frame.data_length_code);
+  TEST_ASSERT_EQUAL_HEX8(0x13, frame.data[6]);
+  TEST_ASSERT_EQUAL_HEX8(0x00, frame.data[7]);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_line_table);
+  RUN_TEST(test_length_bounds_the_read);
+  return UNITY_END();
+}
@@ -0,0 +1,141 @@
+/*
+ * Idle power policy tests and a virtual-time model of duty cycle and wake
+ * latency - run on the host with: pio test -e native
+ */
+#include <unity.h>
+#include <stdio.h>
+#include "idle_power.h"
+
+// Modelled costs on the ESP32-S3. Light-sleep exit and the first UI event are
+// a few ms; the panel keeps its frame buffer so nothing is redrawn. Rejoining a
+// known AP by channel and BSSID is dominated by the handshake and DHCP
+const unsigned long MODEL_SLEEP_EXIT_MS      = 2;
+const unsigned long MODEL_SCREEN_SETTLE_MS   = 15;
+const unsigned long MODEL_REJOIN_MS          = 1800;
+const unsigned long MODEL_RETRY_WORK_MS      = 400;   // Session retry POST after a rejoin
+const unsigned long WAKE_TO_SCREEN_TARGET_MS = 100;
+
+static IdleInputs idleReadyScreen() {
+  IdleInputs inputs = {};
+  inputs.readyScreen = true;
+  inputs.sinceActivityMs = IDLE_SLEEP_AFTER_MS;
+  return inputs;
+}
+
+void test_sleeps_only_on_idle_ready_screen() {
+  IdleInputs inputs = idleReadyScreen();
+  TEST_ASSERT_EQUAL(IDLE_MAX_SLEEP_MS, idleSleepMs(inputs));
+  
+  inputs.readyScreen = false;  // DISPLAY_QR and every customer-facing state
+  TEST_ASSERT_EQUAL(0, idleSleepMs(inputs));
+  
+  inputs = idleReadyScreen();
+  inputs.busy = true;
+  TEST_ASSERT_EQUAL(0, idleSleepMs(inputs));
+  
+  inputs = idleReadyScreen();
+  inputs.sinceActivityMs = IDLE_SLEEP_AFTER_MS - 1;
+  TEST_ASSERT_EQUAL(0, idleSleepMs(inputs));
+}
+
+void test_waits_for_rejoin_until_timeout() {
+  IdleInputs inputs = idleReadyScreen();
+  inputs.rejoinPending = true;
+  inputs.sinceRejoinMs = MODEL_REJOIN_MS;
+  TEST_ASSERT_EQUAL(0, idleSleepMs(inputs));
+  
+  // AP gone - don't keep the chip awake forever waiting for it
+  inputs.sinceRejoinMs = IDLE_REJOIN_TIMEOUT_MS;
+  TEST_ASSERT_EQUAL(IDLE_MAX_SLEEP_MS, idleSleepMs(inputs));
+}
+
+void test_sleep_never_outlasts_retry_cadence() {
+  // READY_SCREEN retries session creation every 10 s - a sleep must not skip one
+  TEST_ASSERT_LESS_OR_EQUAL(10000, IDLE_MAX_SLEEP_MS);
+}
+
+struct IdleModelResult {
+  unsigned long sleptMs;
+  unsigned long awakeMs;
+  int sleeps;
+};
+
+// One hour on an idle READY_SCREEN in 1 ms virtual steps, driving the real policy
+static IdleModelResult modelIdleHour(unsigned long rejoinMs) {
+  IdleModelResult result = {};
+  const unsigned long hourMs = 3600UL * 1000;
+  unsigned long now = 0;
+  unsigned long lastActivity = 0;
+  unsigned long rejoinStart = 0;
+  bool rejoinPending = false;
+  unsigned long busyUntil = 0;
+  
+  while (now < hourMs) {
+    if (rejoinPending && now - rejoinStart >= rejoinMs) {
+      rejoinPending = false;
+      busyUntil = now + MODEL_RETRY_WORK_MS;  // Got IP - the session retry runs
+    }
+    
+    IdleInputs inputs = {};
+    inputs.readyScreen = true;
+    inputs.busy = now < busyUntil;
+    inputs.rejoinPending = rejoinPending;
+    inputs.sinceActivityMs = now - lastActivity;
+    inputs.sinceRejoinMs = now - rejoinStart;
+    
+    unsigned long sleepMs = idleSleepMs(inputs);
+    if (sleepMs > 0) {
+      result.sleptMs += sleepMs;
+      result.sleeps++;
+      now += sleepMs;
+      result.awakeMs += MODEL_SLEEP_EXIT_MS;
+      now += MODEL_SLEEP_EXIT_MS;
+      rejoinPending = true;
+      rejoinStart = now;
+      continue;
+    }
+    result.awakeMs++;
+    now++;
+  }
+  return result;
+}
+
+void test_model_duty_cycle() {
+  IdleModelResult result = modelIdleHour(MODEL_REJOIN_MS);
+  float awakePercent = result.awakeMs * 100.0f / (result.awakeMs + result.sleptMs);
+  
+  char report[96];
+  snprintf(report, sizeof(report), "idle hour: %d sleeps, %.1f%% awake (rejoin %lums)",
+           result.sleeps, awakePercent, MODEL_REJOIN_MS);
+  TEST_MESSAGE(report);
+  TEST_ASSERT_GREATER_THAN(250, result.sleeps);
+  TEST_ASSERT_LESS_THAN(25, (int)awakePercent);
+}
+
+void test_model_duty_cycle_with_ap_down() {
+  // Rejoin never completes - the timeout still lets the chip sleep most of the time
+  IdleModelResult result = modelIdleHour(IDLE_REJOIN_TIMEOUT_MS * 10);
+  float awakePercent = result.awakeMs * 100.0f / (result.awakeMs + result.sleptMs);
+  TEST_ASSERT_GREATER_THAN(100, result.sleeps);
+  TEST_ASSERT_LESS_THAN(65, (int)awakePercent);
+}
+
+void test_model_wake_latency() {
+  // A button wake reaches a settled screen without waiting for WiFi; the wakeMs
+  // histogram also counts the rejoin, so it lands in the 2500 ms bucket
+  unsigned long wakeToScreenMs = MODEL_SLEEP_EXIT_MS + MODEL_SCREEN_SETTLE_MS;
+  unsigned long wakeMs = wakeToScreenMs + MODEL_REJOIN_MS;
+  TEST_ASSERT_LESS_THAN(WAKE_TO_SCREEN_TARGET_MS, wakeToScreenMs);
+  TEST_ASSERT_LESS_OR_EQUAL(2500, wakeMs);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_sleeps_only_on_idle_ready_screen);
+  RUN_TEST(test_waits_for_rejoin_until_timeout);
+  RUN_TEST(test_sleep_never_outlasts_retry_cadence);
+  RUN_TEST(test_model_duty_cycle);
+  RUN_TEST(test_model_duty_cycle_with_ap_down);
+  RUN_TEST(test_model_wake_latency);
+  return UNITY_END();
+}
@@ -0,0 +1,139 @@
+/*
+ * ISO-TP reassembly tests for isoTpAccept() - run on the host with: pio test -e native
+ */
+#include <unity.h>
+#include "isotp.h"
+
+// Feed a simulated ECU's frames in order; returns the last result
+static IsoTpResult feedFrames(IsoTpReceiver* rx, const uint8_t frames[][8], int count) {
+  IsoTpResult result = ISOTP_IGNORED;
+  for (int i = 0; i < count; i++) {
+    result = isoTpAccept(rx, frames[i], 8);
+  }
+  return result;
+}
+
+void test_single_frame() {
+  const uint8_t frame[8] = {0x03, 0x59, 0x02, 0xFF, 0xAA, 0xAA, 0xAA, 0xAA};
+  IsoTpReceiver rx;
+  isoTpReset(&rx, 0x7E0, false);
+  TEST_ASSERT_EQUAL(ISOTP_COMPLETE, isoTpAccept(&rx, frame, 8));
+  TEST_ASSERT_TRUE(rx.complete);
+  TEST_ASSERT_EQUAL(3, rx.receivedLength);
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(&frame[1], rx.buffer, 3);
+}
+
+void test_single_frame_length_beyond_dlc_ignored() {
+  const uint8_t frame[4] = {0x05, 0x41, 0x00, 0xBE};
+  IsoTpReceiver rx;
+  isoTpReset(&rx, 0x7E0, false);
+  TEST_ASSERT_EQUAL(ISOTP_IGNORED, isoTpAccept(&rx, frame, sizeof(frame)));
+  TEST_ASSERT_FALSE(rx.complete);
+}
+
+void test_multi_frame_uds_report() {
+  // 59 02 FF + three DTC records = 15 bytes: first frame plus two consecutive frames
+  const uint8_t frames[][8] = {
+    {0x10, 0x0F, 0x59, 0x02, 0xFF, 0xC1, 0x00, 0x00},
+    {0x21, 0x08, 0xC4, 0x15, 0x01, 0x09, 0x81, 0x23},
+    {0x22, 0x00, 0x0C, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA}
+  };
+  const uint8_t expected[] = {0x59, 0x02, 0xFF, 0xC1, 0x00, 0x00, 0x08, 0xC4,
+                              0x15, 0x01, 0x09, 0x81, 0x23, 0x00, 0x0C};
+  IsoTpReceiver rx;
+  isoTpReset(&rx, 0x760, false);
+  TEST_ASSERT_EQUAL(ISOTP_SEND_FLOW, isoTpAccept(&rx, frames[0], 8));
+  TEST_ASSERT_EQUAL(ISOTP_IN_PROGRESS, isoTpAccept(&rx, frames[1], 8));
+  TEST_ASSERT_EQUAL(ISOTP_COMPLETE, isoTpAccept(&rx, frames[2], 8));
+  TEST_ASSERT_EQUAL(sizeof(expected), rx.receivedLength);
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, rx.buffer, sizeof(expected));
+  
+  // Complete receivers ignore anything else until reset
+  TEST_ASSERT_EQUAL(ISOTP_IGNORED, isoTpAccept(&rx, frames[1], 8));
+}
+
+void test_sequence_number_wraps() {
+  // 6 + 17 * 7 = 125 bytes - sequence numbers run 1..15, 0, 1
+  IsoTpReceiver rx;
+  isoTpReset(&rx, 0x7E0, false);
+  const uint8_t first[8] = {0x10, 125, 0, 1, 2, 3, 4, 5};
+  TEST_ASSERT_EQUAL(ISOTP_SEND_FLOW, isoTpAccept(&rx, first, 8));
+  
+  uint8_t value = 6;
+  IsoTpResult result = ISOTP_IGNORED;
+  for (int n = 1; n <= 17; n++) {
+    uint8_t frame[8] = {(uint8_t)(0x20 | (n & 0x0F))};
+    for (int j = 1; j < 8; j++) frame[j] = value++;
+    result = isoTpAccept(&rx, frame, 8);
+  }
+  TEST_ASSERT_EQUAL(ISOTP_COMPLETE, result);
+  TEST_ASSERT_EQUAL(125, rx.receivedLength);
+  for (int i = 0; i < 125; i++) {
+    TEST_ASSERT_EQUAL(i, rx.buffer[i]);
+  }
+}
+
+void test_sequence_error_drops_transfer() {
+  const uint8_t frames[][8] = {
+    {0x10, 0x14, 0x49, 0x02, 0x01, 0x31, 0x48, 0x47},
+    {0x22, 0x43, 0x4D, 0x38, 0x32, 0x36, 0x33, 0x33}  // Skipped 0x21
+  };
+  IsoTpReceiver rx;
+  isoTpReset(&rx, 0x7E0, false);
+  TEST_ASSERT_EQUAL(ISOTP_SEQUENCE_ERROR, feedFrames(&rx, frames, 2));
+  TEST_ASSERT_FALSE(rx.complete);
+  TEST_ASSERT_EQUAL(0, rx.expectedLength);
+  TEST_ASSERT_EQUAL(0x7E0, rx.flowControlId);
+  
+  // A consecutive frame with no first frame is ignored rather than appended
+  TEST_ASSERT_EQUAL(ISOTP_IGNORED, isoTpAccept(&rx, frames[1], 8));
+}
+
+void test_undersized_first_frame_ignored() {
+  const uint8_t frame[8] = {0x10, 0x05, 0x41, 0x00, 0xBE, 0x3E, 0xB8, 0x11};
+  IsoTpReceiver rx;
+  isoTpReset(&rx, 0x7E0, false);
+  TEST_ASSERT_EQUAL(ISOTP_IGNORED, isoTpAccept(&rx, frame, 8));
+  TEST_ASSERT_EQUAL(0, rx.expectedLength);
+}
+
+void test_oversized_transfer_truncated_to_buffer() {
+  // 300 bytes announced: every frame is consumed, the buffer keeps the first 256
+  IsoTpReceiver rx;
+  isoTpReset(&rx, 0x7E0, false);
+  const uint8_t first[8] = {0x11, 0x2C, 0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5};
+  TEST_ASSERT_EQUAL(ISOTP_SEND_FLOW, isoTpAccept(&rx, first, 8));
+  
+  IsoTpResult result = ISOTP_IGNORED;
+  for (int n = 1; result != ISOTP_COMPLETE && n < 60; n++) {
+    const uint8_t frame[8] = {(uint8_t)(0x20 | (n & 0x0F)), 1, 2, 3, 4, 5, 6, 7};
+    result = isoTpAccept(&rx, frame, 8);
+  }
+  TEST_ASSERT_EQUAL(ISOTP_COMPLETE, result);
+  TEST_ASSERT_EQUAL(ISOTP_MAX_PAYLOAD, rx.receivedLength);
+}
+
+void test_response_pending() {
+  const uint8_t pending[8] = {0x03, 0x7F, 0x19, 0x78, 0, 0, 0, 0};
+  const uint8_t rejected[8] = {0x03, 0x7F, 0x19, 0x31, 0, 0, 0, 0};
+  IsoTpReceiver rx;
+  isoTpReset(&rx, 0x760, false);
+  isoTpAccept(&rx, pending, 8);
+  TEST_ASSERT_TRUE(isoTpResponsePending(rx));
+  isoTpReset(&rx, 0x760, false);
+  isoTpAccept(&rx, rejected, 8);
+  TEST_ASSERT_FALSE(isoTpResponsePending(rx));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_single_frame);
+  RUN_TEST(test_single_frame_length_beyond_dlc_ignored);
+  RUN_TEST(test_multi_frame_uds_report);
+  RUN_TEST(test_sequence_number_wraps);
+  RUN_TEST(test_sequence_error_drops_transfer);
+  RUN_TEST(test_undersized_first_frame_ignored);
+  RUN_TEST(test_oversized_transfer_truncated_to_buffer);
+  RUN_TEST(test_response_pending);
+  return UNITY_END();
+}
@@ -0,0 +1,111 @@
+/*
+ * Table tests for klineExpectedLength()/klineDecode() - run on the host with:
+ * pio test -e native
+ */
+#include <unity.h>
+#include "kline.h"
+
+struct FrameCase {
+  const char* label;
+  bool kwp;
+  uint8_t raw[16];           // Checksum included - see withChecksum()
+  int length;
+  bool fixChecksum;          // Fill in the last byte so only the framing is under test
+  int expectedLength;        // klineExpectedLength() once every byte is in
+  bool accepted;
+  uint8_t source;
+  int dataLength;
+  uint8_t data[8];
+};
+
+static const FrameCase FRAME_CASES[] = {
+  // ISO 9141-2: 48 6B <ecu> <data> <checksum>, no length anywhere
+  {"ISO 9141 Mode 01 PID 01", false, {0x48, 0x6B, 0x10, 0x41, 0x01, 0x81, 0x07, 0x65, 0x04}, 10, true,
+   0, true, 0x10, 6, {0x41, 0x01, 0x81, 0x07, 0x65, 0x04}},
+  {"ISO 9141 Mode 03 two DTCs", false, {0x48, 0x6B, 0x10, 0x43, 0x01, 0x33, 0x04, 0x20, 0x00, 0x00}, 11, true,
+   0, true, 0x10, 7, {0x43, 0x01, 0x33, 0x04, 0x20, 0x00, 0x00}},
+  {"ISO 9141 header only", false, {0x48, 0x6B, 0x10}, 4, true, 0, false},
+  // KWP2000 with addresses, length in the format byte
+  {"KWP format-byte length", true, {0x86, 0xF1, 0x11, 0x41, 0x01, 0x81, 0x07, 0x65, 0x04}, 10, true,
+   10, true, 0x11, 6, {0x41, 0x01, 0x81, 0x07, 0x65, 0x04}},
+  {"KWP response pending", true, {0x83, 0xF1, 0x11, 0x7F, 0x03, 0x78}, 7, true,
+   7, true, 0x11, 3, {0x7F, 0x03, 0x78}},
+  // KWP2000 with a separate length byte (format length 0)
+  {"KWP length byte", true, {0x80, 0xF1, 0x11, 0x03, 0x47, 0x01, 0x33}, 8, true,
+   8, true, 0x11, 3, {0x47, 0x01, 0x33}},
+  // KWP2000 without addresses (address mode 0)
+  {"KWP no address, format length", true, {0x02, 0x43, 0x00}, 4, true, 4, true, 0, 2, {0x43, 0x00}},
+  {"KWP no address, length byte", true, {0x00, 0x02, 0x43, 0x00}, 5, true, 5, true, 0, 2, {0x43, 0x00}},
+  // KWP lengths that do not match the message - a dropped or an extra byte
+  {"KWP one byte short", true, {0x86, 0xF1, 0x11, 0x41, 0x01, 0x81, 0x07, 0x65}, 9, true, 10, false},
+  {"KWP length byte, one byte long", true, {0x80, 0xF1, 0x11, 0x02, 0x47, 0x01, 0x33}, 8, true, 7, false},
+  // Bad checksums
+  {"ISO 9141 bad checksum", false, {0x48, 0x6B, 0x10, 0x41, 0x00, 0xBE, 0x3F, 0xA8, 0x13, 0x00}, 10, false,
+   0, false},
+  {"KWP bad checksum", true, {0x83, 0xF1, 0x11, 0x43, 0x00, 0x00, 0x00}, 7, false, 7, false},
+  {"Too short for a checksum", false, {0x48, 0x48}, 2, false, 0, false},
+};
+
+void test_frame_table() {
+  for (const FrameCase& c : FRAME_CASES) {
+    uint8_t raw[16];
+    memcpy(raw, c.raw, sizeof(raw));
+    if (c.fixChecksum) {
+      uint8_t checksum = 0;
+      for (int j = 0; j < c.length - 1; j++) {
+        checksum += raw[j];
+      }
+      raw[c.length - 1] = checksum;
+    }
+    
+    TEST_ASSERT_EQUAL_MESSAGE(c.expectedLength, klineExpectedLength(raw, c.length, c.kwp), c.label);
+    KLineMessage message;
+    TEST_ASSERT_EQUAL_MESSAGE(c.accepted, klineDecode(raw, c.length, c.kwp, &message), c.label);
+    if (!c.accepted) continue;
+    
+    TEST_ASSERT_EQUAL_HEX8_MESSAGE(c.source, message.source, c.label);
+    TEST_ASSERT_EQUAL_MESSAGE(c.dataLength, message.length, c.label);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY_MESSAGE(c.data, message.data, c.dataLength, c.label);
+  }
+}
+
+void test_expected_length_while_receiving() {
+  // klineReceive() asks after every byte - 0 until the format (and length) byte say more
+  const uint8_t formatLength[] = {0x86, 0xF1, 0x11};
+  TEST_ASSERT_EQUAL(10, klineExpectedLength(formatLength, 1, true));
+  
+  const uint8_t lengthByte[] = {0x80, 0xF1, 0x11, 0x03};
+  for (int length = 1; length <= 3; length++) {
+    TEST_ASSERT_EQUAL(0, klineExpectedLength(lengthByte, length, true));
+  }
+  TEST_ASSERT_EQUAL(8, klineExpectedLength(lengthByte, 4, true));
+  
+  const uint8_t noAddress[] = {0x00, 0x05};
+  TEST_ASSERT_EQUAL(0, klineExpectedLength(noAddress, 1, true));
+  TEST_ASSERT_EQUAL(8, klineExpectedLength(noAddress, 2, true));
+  
+  // ISO 9141-2 never knows - P1 silence ends the message
+  const uint8_t iso[] = {0x48, 0x6B, 0x10, 0x41};
+  TEST_ASSERT_EQUAL(0, klineExpectedLength(iso, 4, false));
+}
+
+void test_kwp_flag_selects_framing() {
+  // The same bytes read as ISO 9141-2 keep a 3-byte header whatever the first byte says
+  uint8_t raw[] = {0x48, 0x6B, 0x10, 0x43, 0x00, 0x00};
+  raw[5] = (uint8_t)(0x48 + 0x6B + 0x10 + 0x43);
+  KLineMessage message;
+  TEST_ASSERT_TRUE(klineDecode(raw, sizeof(raw), false, &message));
+  TEST_ASSERT_EQUAL(2, message.length);
+  TEST_ASSERT_EQUAL_HEX8(0x43, message.data[0]);
+  
+  // As KWP the format byte declares 8 data bytes that never came
+  TEST_ASSERT_FALSE(klineDecode(raw, sizeof(raw), true, &message));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_frame_table);
+  RUN_TEST(test_expected_length_while_receiving);
+  RUN_TEST(test_kwp_flag_selects_framing);
+  return UNITY_END();
+}
@@ -0,0 +1,303 @@
+/*
+ * Delta OTA record applier tests and patch size/apply time benchmark - run on
+ * the host with: pio test -e native
+ */
+#include <unity.h>
+#include <chrono>
+#include <stdio.h>
+#include <vector>
+#include <zlib.h>
+#include "ota_delta.h"
+
+typedef std::vector<uint8_t> Bytes;
+
+// Base image in memory, rebuilt image collected - stands in for the two app slots
+struct MemoryIo {
+  const Bytes* base;
+  Bytes out;
+  int failWriteAt;  // Fail the Nth write, -1 = never
+  
+  bool readBase(uint32_t offset, uint8_t* buffer, size_t length) {
+    TEST_ASSERT_TRUE(offset + length <= base->size());  // The applier must bound this itself
+    memcpy(buffer, base->data() + offset, length);
+    return true;
+  }
+  bool write(const uint8_t* data, size_t length) {
+    if (failWriteAt-- == 0) return false;
+    out.insert(out.end(), data, data + length);
+    return true;
+  }
+};
+
+static uint8_t baseBuffer[OTA_BASE_CHUNK];
+static uint8_t outputBuffer[OTA_OUTPUT_CHUNK];
+
+static void putControl(Bytes* patch, uint32_t diffLength, uint32_t extraLength, int32_t seek) {
+  uint8_t control[OTA_DELTA_CONTROL_SIZE];
+  memcpy(control, &diffLength, 4);
+  memcpy(control + 4, &extraLength, 4);
+  memcpy(control + 8, &seek, 4);
+  patch->insert(patch->end(), control, control + sizeof(control));
+}
+
+// One record: target[from..] = base[basePos..] + diff over diffLength bytes, then extra
+static void putRecord(Bytes* patch, const Bytes& base, uint32_t basePos, const Bytes& target, uint32_t targetPos,
+                      uint32_t diffLength, uint32_t extraLength, int32_t seek) {
+  putControl(patch, diffLength, extraLength, seek);
+  for (uint32_t i = 0; i < diffLength; i++) {
+    patch->push_back((uint8_t)(target[targetPos + i] - base[basePos + i]));
+  }
+  patch->insert(patch->end(), target.begin() + targetPos + diffLength,
+                target.begin() + targetPos + diffLength + extraLength);
+}
+
+static bool apply(const Bytes& base, const Bytes& patch, uint32_t targetSize, MemoryIo* io,
+                  OtaDeltaApplier* applier, size_t pieceSize) {
+  io->base = &base;
+  io->out.clear();
+  io->failWriteAt = -1;
+  otaDeltaInit(applier, base.size(), targetSize, baseBuffer, outputBuffer);
+  for (size_t pos = 0; pos < patch.size(); pos += pieceSize) {
+    size_t length = patch.size() - pos < pieceSize ? patch.size() - pos : pieceSize;
+    if (!otaDeltaConsume(applier, *io, patch.data() + pos, length)) return false;
+  }
+  return otaDeltaFlush(applier, *io) && otaDeltaComplete(*applier);
+}
+
+static Bytes pseudoImage(size_t size, uint32_t seed) {
+  // Firmware-like: opcode-ish bytes with repeats, not pure noise
+  Bytes image(size);
+  for (size_t i = 0; i < size; i++) {
+    seed = seed * 1103515245 + 12345;
+    image[i] = (seed >> 16) & ((i & 0x40) ? 0xFF : 0x3F);
+  }
+  return image;
+}
+
+void test_records_rebuild_target_in_any_piece_size() {
+  // Target = base[0..100) patched, 20 new bytes, base[150..250) (seek +50),
+  // then base[40..60) again (seek back to 40)
+  Bytes base = pseudoImage(300, 1);
+  Bytes target;
+  for (int i = 0; i < 100; i++) target.push_back(base[i] + (i % 10 == 0 ? 3 : 0));
+  for (int i = 0; i < 20; i++) target.push_back(0xA0 + i);
+  for (int i = 150; i < 250; i++) target.push_back(base[i]);
+  for (int i = 40; i < 60; i++) target.push_back(base[i] ^ 0x01);
+  
+  Bytes patch;
+  putRecord(&patch, base, 0, target, 0, 100, 20, 50);
+  putRecord(&patch, base, 150, target, 120, 100, 0, -210);
+  putRecord(&patch, base, 40, target, 220, 20, 0, 0);
+  
+  for (size_t pieceSize : {(size_t)1, (size_t)5, (size_t)12, (size_t)13, (size_t)4096}) {
+    MemoryIo io;
+    OtaDeltaApplier applier;
+    TEST_ASSERT_TRUE(apply(base, patch, target.size(), &io, &applier, pieceSize));
+    TEST_ASSERT_EQUAL(target.size(), io.out.size());
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(target.data(), io.out.data(), target.size());
+  }
+}
+
+void test_empty_runs_only_move_the_base_cursor() {
+  Bytes base = pseudoImage(64, 2);
+  Bytes target(base.begin() + 32, base.end());
+  Bytes patch;
+  putControl(&patch, 0, 0, 16);
+  putControl(&patch, 0, 0, 16);
+  putRecord(&patch, base, 32, target, 0, 32, 0, 0);
+  
+  MemoryIo io;
+  OtaDeltaApplier applier;
+  TEST_ASSERT_TRUE(apply(base, patch, target.size(), &io, &applier, 7));
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(target.data(), io.out.data(), target.size());
+}
+
+void test_control_record_past_target_size_is_rejected() {
+  Bytes base = pseudoImage(100, 3);
+  MemoryIo io;
+  OtaDeltaApplier applier;
+  
+  Bytes tooLong;
+  putControl(&tooLong, 60, 41, 0);  // 101 bytes into a 100-byte target
+  TEST_ASSERT_FALSE(apply(base, tooLong, 100, &io, &applier, 12));
+  TEST_ASSERT_EQUAL(0, io.out.size());
+  
+  // diffLen + extraLen wrapping 32 bits must not slip under the check
+  Bytes wraps;
+  putControl(&wraps, 0xFFFFFFF0, 0x20, 0);
+  TEST_ASSERT_FALSE(apply(base, wraps, 100, &io, &applier, 12));
+  
+  // Second record overruns what the first already built
+  Bytes second;
+  putControl(&second, 0, 80, 0);
+  second.insert(second.end(), 80, 0x11);
+  putControl(&second, 0, 21, 0);
+  TEST_ASSERT_FALSE(apply(base, second, 100, &io, &applier, 12));
+}
+
+void test_diff_run_past_base_end_is_rejected() {
+  Bytes base = pseudoImage(100, 4);
+  Bytes patch;
+  putControl(&patch, 30, 0, 0);
+  patch.insert(patch.end(), 30, 0);
+  
+  // Seek to 80 first - 30 diff bytes from there would read base[100..110)
+  Bytes seekThenDiff;
+  putControl(&seekThenDiff, 0, 0, 80);
+  seekThenDiff.insert(seekThenDiff.end(), patch.begin(), patch.end());
+  MemoryIo io;
+  OtaDeltaApplier applier;
+  TEST_ASSERT_FALSE(apply(base, seekThenDiff, 200, &io, &applier, 64));
+}
+
+void test_seek_bounds() {
+  Bytes base = pseudoImage(100, 5);
+  MemoryIo io;
+  OtaDeltaApplier applier;
+  
+  Bytes beforeStart;
+  putControl(&beforeStart, 10, 0, -11);  // Cursor at 10 after the diff run
+  beforeStart.insert(beforeStart.end(), 10, 0);
+  TEST_ASSERT_FALSE(apply(base, beforeStart, 10, &io, &applier, 64));
+  
+  Bytes pastEnd;
+  putControl(&pastEnd, 0, 0, 101);
+  TEST_ASSERT_FALSE(apply(base, pastEnd, 0, &io, &applier, 64));
+  
+  Bytes hugeSeek;
+  putControl(&hugeSeek, 0, 0, INT32_MIN);
+  TEST_ASSERT_FALSE(apply(base, hugeSeek, 0, &io, &applier, 64));
+  
+  // Exactly to the start and exactly to the end are both fine
+  Bytes edges;
+  putControl(&edges, 10, 0, -10);
+  edges.insert(edges.end(), 10, 0);
+  putControl(&edges, 0, 0, 100);
+  TEST_ASSERT_TRUE(apply(base, edges, 10, &io, &applier, 64));
+  TEST_ASSERT_EQUAL(100, applier.basePos);
+}
+
+void test_truncated_patch_is_not_complete() {
+  Bytes base = pseudoImage(100, 6);
+  Bytes target(base.begin(), base.begin() + 50);
+  Bytes patch;
+  putRecord(&patch, base, 0, target, 0, 50, 0, 0);
+  MemoryIo io;
+  OtaDeltaApplier applier;
+  
+  // Inside the diff run
+  Bytes midRun(patch.begin(), patch.end() - 5);
+  TEST_ASSERT_FALSE(apply(base, midRun, 50, &io, &applier, 16));
+  
+  // Inside a control record: trailing bytes after a finished image
+  Bytes trailing = patch;
+  trailing.insert(trailing.end(), 5, 0);
+  TEST_ASSERT_FALSE(apply(base, trailing, 50, &io, &applier, 16));
+  
+  // Complete patch, smaller target declared than the records build
+  TEST_ASSERT_FALSE(apply(base, patch, 40, &io, &applier, 16));
+  TEST_ASSERT_TRUE(apply(base, patch, 50, &io, &applier, 16));
+}
+
+void test_write_failure_stops_the_apply() {
+  Bytes base = pseudoImage(3 * OTA_OUTPUT_CHUNK, 7);
+  Bytes patch;
+  putRecord(&patch, base, 0, base, 0, base.size(), 0, 0);
+  
+  MemoryIo io;
+  io.base = &base;
+  io.failWriteAt = 1;  // Second sector
+  OtaDeltaApplier applier;
+  otaDeltaInit(&applier, base.size(), base.size(), baseBuffer, outputBuffer);
+  TEST_ASSERT_FALSE(otaDeltaConsume(&applier, io, patch.data(), patch.size()));
+  TEST_ASSERT_EQUAL(OTA_OUTPUT_CHUNK, applier.written);
+}
+
+void test_header_layout_matches_signing_doc() {
+  // OTA_RELEASE_SIGNING.md signs the first 80 bytes and pads signature[] to 72
+  TEST_ASSERT_EQUAL(80, offsetof(OtaDeltaHeader, signatureLength));
+  TEST_ASSERT_EQUAL(81 + 72, sizeof(OtaDeltaHeader));
+}
+
+void test_benchmark_patch_size_and_apply_time() {
+  // A 1.2 MB release where ~0.5% of words moved by a relocation and 12 KB of new
+  // code was inserted at 40% - the shape of a typical point release
+  const size_t imageSize = 1200 * 1024;
+  const size_t insertAt = imageSize * 2 / 5;
+  const size_t inserted = 12 * 1024;
+  Bytes base = pseudoImage(imageSize, 8);
+  Bytes newCode = pseudoImage(inserted, 9);
+  
+  Bytes target(base.begin(), base.begin() + insertAt);
+  target.insert(target.end(), newCode.begin(), newCode.end());
+  target.insert(target.end(), base.begin() + insertAt, base.end());
+  for (size_t i = insertAt + inserted; i + 4 <= target.size(); i += 800) {
+    target[i] += 0x30;  // Relocated call targets after the insertion
+  }
+  
+  Bytes records;
+  putRecord(&records, base, 0, target, 0, insertAt, inserted, 0);
+  putRecord(&records, base, insertAt, target, insertAt + inserted, imageSize - insertAt, 0, 0);
+  
+  uLongf compressedSize = compressBound(records.size());
+  Bytes compressed(compressedSize);
+  TEST_ASSERT_EQUAL(Z_OK, compress2(compressed.data(), &compressedSize, records.data(), records.size(), 9));
+  compressed.resize(compressedSize);
+  size_t patchSize = sizeof(OtaDeltaHeader) + compressed.size();
+  
+  // Apply the way otaApplyDelta does: inflate 1 KB of input at a time into a window
+  const int runs = 5;
+  MemoryIo io;
+  io.base = &base;
+  OtaDeltaApplier applier;
+  auto start = std::chrono::steady_clock::now();
+  for (int run = 0; run < runs; run++) {
+    io.out.clear();
+    io.failWriteAt = -1;
+    otaDeltaInit(&applier, base.size(), target.size(), baseBuffer, outputBuffer);
+    z_stream stream = {};
+    TEST_ASSERT_EQUAL(Z_OK, inflateInit(&stream));
+    static uint8_t window[32768];
+    int status = Z_OK;
+    for (size_t inPos = 0; status != Z_STREAM_END;) {
+      size_t chunk = compressed.size() - inPos < 1024 ? compressed.size() - inPos : 1024;
+      stream.next_in = compressed.data() + inPos;
+      stream.avail_in = chunk;
+      do {
+        stream.next_out = window;
+        stream.avail_out = sizeof(window);
+        status = inflate(&stream, Z_NO_FLUSH);
+        TEST_ASSERT_TRUE(status == Z_OK || status == Z_STREAM_END || status == Z_BUF_ERROR);
+        TEST_ASSERT_TRUE(otaDeltaConsume(&applier, io, window, sizeof(window) - stream.avail_out));
+      } while (stream.avail_out == 0);
+      inPos += chunk;
+    }
+    inflateEnd(&stream);
+    TEST_ASSERT_TRUE(otaDeltaFlush(&applier, io));
+    TEST_ASSERT_TRUE(otaDeltaComplete(applier));
+  }
+  double applyMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / runs;
+  TEST_ASSERT_TRUE(io.out == target);
+  
+  char report[160];
+  snprintf(report, sizeof(report),
+           "delta OTA: %u byte image from a %u byte patch (%.1f%%), applied in %.1f ms on the host (%.0f MB/s)",
+           (unsigned)target.size(), (unsigned)patchSize, patchSize * 100.0 / target.size(), applyMs,
+           target.size() / 1048576.0 / (applyMs / 1000.0));
+  TEST_MESSAGE(report);
+  TEST_ASSERT_LESS_THAN(target.size() / 10, patchSize);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_records_rebuild_target_in_any_piece_size);
+  RUN_TEST(test_empty_runs_only_move_the_base_cursor);
+  RUN_TEST(test_control_record_past_target_size_is_rejected);
+  RUN_TEST(test_diff_run_past_base_end_is_rejected);
+  RUN_TEST(test_seek_bounds);
+  RUN_TEST(test_truncated_patch_is_not_complete);
+  RUN_TEST(test_write_failure_stops_the_apply);
+  RUN_TEST(test_header_layout_matches_signing_doc);
+  RUN_TEST(test_benchmark_patch_size_and_apply_time);
+  return UNITY_END();
+}
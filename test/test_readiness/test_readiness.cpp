@@ -0,0 +1,149 @@
+/*
+ * Table tests for decodeReadiness() - run on the host with: pio test -e native
+ */
+#include <unity.h>
+#include "readiness.h"
+
+// Report bit index for a monitor name and ignition type
+static int monitorIndex(const char* name, MonitorIgnition ignition) {
+  for (int i = 0; i < NUM_READINESS_MONITORS; i++) {
+    if (strcmp(READINESS_MONITORS[i].name, name) == 0 &&
+        (READINESS_MONITORS[i].ignition == ignition || READINESS_MONITORS[i].ignition == MONITOR_ANY_IGNITION)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static uint32_t monitorBit(const char* name, MonitorIgnition ignition) {
+  int index = monitorIndex(name, ignition);
+  TEST_ASSERT_TRUE_MESSAGE(index >= 0, name);
+  return 1UL << index;
+}
+
+struct DecodeCase {
+  const char* label;
+  uint8_t payload[6];
+  bool accepted;
+  bool compression;
+  uint8_t milOn;
+  uint8_t dtcCount;
+  const char* supported[8];      // Monitor names, NULL-terminated
+  const char* incomplete[8];
+};
+
+static const DecodeCase PID01_CASES[] = {
+  {"spark, all complete, MIL on with 3 DTCs", {0x41, 0x01, 0x83, 0x07, 0x65, 0x00}, true, false, 1, 3,
+   {"Misfire", "Fuel System", "Components", "Catalyst", "EVAP System", "O2 Sensor", "O2 Sensor Heater", NULL},
+   {NULL}},
+  {"spark, EVAP and misfire incomplete", {0x41, 0x01, 0x00, 0x17, 0x65, 0x04}, true, false, 0, 0,
+   {"Misfire", "Fuel System", "Components", "Catalyst", "EVAP System", "O2 Sensor", "O2 Sensor Heater", NULL},
+   {"Misfire", "EVAP System", NULL}},
+  {"compression, NOx and misfire incomplete", {0x41, 0x01, 0x01, 0x1B, 0xEB, 0x02}, true, true, 0, 1,
+   {"Misfire", "Fuel System", "NMHC Catalyst", "NOx/SCR", "Boost Pressure", "Exhaust Gas Sensor", "PM Filter", "EGR/VVT"},
+   {"Misfire", "NOx/SCR", NULL}},
+  {"incomplete bits without support are ignored", {0x41, 0x01, 0x00, 0x70, 0x00, 0xFF}, true, false, 0, 0,
+   {NULL},
+   {NULL}},
+  {"every supported monitor incomplete", {0x41, 0x01, 0x00, 0x77, 0x0F, 0xFF}, true, false, 0, 0,
+   {"Misfire", "Fuel System", "Components", "Catalyst", "Heated Catalyst", "EVAP System", "Secondary Air", NULL},
+   {"Misfire", "Fuel System", "Components", "Catalyst", "Heated Catalyst", "EVAP System", "Secondary Air", NULL}},
+  {"wrong service", {0x42, 0x01, 0x00, 0x07, 0x00, 0x00}, false, false, 0, 0, {NULL}, {NULL}},
+  {"wrong PID", {0x41, 0x02, 0x00, 0x07, 0x00, 0x00}, false, false, 0, 0, {NULL}, {NULL}},
+  {"reserved byte B bit 7 set", {0x41, 0x01, 0x00, 0x8F, 0x00, 0x00}, false, false, 0, 0, {NULL}, {NULL}}
+};
+
+static uint32_t maskOf(const char* const* names, MonitorIgnition ignition) {
+  uint32_t mask = 0;
+  for (int i = 0; i < 8 && names[i] != NULL; i++) {
+    mask |= monitorBit(names[i], ignition);
+  }
+  return mask;
+}
+
+void test_pid01_table() {
+  for (const DecodeCase& test : PID01_CASES) {
+    ReadinessReport report;
+    clearReadiness(&report);
+    bool accepted = decodeReadiness(test.payload, sizeof(test.payload), &report);
+    TEST_ASSERT_EQUAL_MESSAGE(test.accepted, accepted, test.label);
+    if (!accepted) {
+      TEST_ASSERT_FALSE_MESSAGE(report.hasStatus, test.label);
+      continue;
+    }
+    
+    MonitorIgnition ignition = test.compression ? MONITOR_COMPRESSION : MONITOR_SPARK;
+    uint32_t supported = maskOf(test.supported, ignition);
+    uint32_t incomplete = maskOf(test.incomplete, ignition);
+    TEST_ASSERT_TRUE_MESSAGE(report.hasStatus, test.label);
+    TEST_ASSERT_EQUAL_MESSAGE(test.compression, (bool)report.compressionIgnition, test.label);
+    TEST_ASSERT_EQUAL_MESSAGE(test.milOn, report.milOn, test.label);
+    TEST_ASSERT_EQUAL_MESSAGE(test.dtcCount, report.dtcCount, test.label);
+    TEST_ASSERT_EQUAL_HEX32_MESSAGE(supported, report.supported, test.label);
+    TEST_ASSERT_EQUAL_HEX32_MESSAGE(supported & ~incomplete, report.complete, test.label);
+    TEST_ASSERT_EQUAL_MESSAGE(__builtin_popcount(incomplete), countIncompleteMonitors(report), test.label);
+  }
+}
+
+void test_spark_bits_ignored_on_compression() {
+  // C/D bits 2 and 4 are spark-only (EVAP, A/C) - reserved on a diesel
+  const uint8_t payload[] = {0x41, 0x01, 0x00, 0x08, 0x14, 0x14};
+  ReadinessReport report;
+  clearReadiness(&report);
+  TEST_ASSERT_TRUE(decodeReadiness(payload, sizeof(payload), &report));
+  TEST_ASSERT_EQUAL_HEX32(0, report.supported);
+}
+
+void test_short_payload_rejected() {
+  const uint8_t payload[] = {0x41, 0x01, 0x00, 0x07, 0x00};
+  ReadinessReport report;
+  clearReadiness(&report);
+  TEST_ASSERT_FALSE(decodeReadiness(payload, sizeof(payload), &report));
+  TEST_ASSERT_FALSE(report.hasStatus);
+}
+
+void test_pid41_fills_cycle_fields_only() {
+  const uint8_t pid01[] = {0x41, 0x01, 0x82, 0x07, 0x65, 0x04};
+  const uint8_t pid41[] = {0x41, 0x41, 0x00, 0x13, 0x21, 0x01};
+  ReadinessReport report;
+  clearReadiness(&report);
+  TEST_ASSERT_TRUE(decodeReadiness(pid01, sizeof(pid01), &report));
+  TEST_ASSERT_TRUE(decodeReadiness(pid41, sizeof(pid41), &report));
+  
+  TEST_ASSERT_TRUE(report.hasCycleStatus);
+  TEST_ASSERT_EQUAL(2, report.dtcCount);  // PID 01 fields untouched
+  TEST_ASSERT_EQUAL_HEX32(monitorBit("Misfire", MONITOR_SPARK) | monitorBit("Fuel System", MONITOR_SPARK) |
+                          monitorBit("Catalyst", MONITOR_SPARK) | monitorBit("O2 Sensor", MONITOR_SPARK),
+                          report.cycleEnabled);
+  TEST_ASSERT_EQUAL_HEX32(monitorBit("Fuel System", MONITOR_SPARK) | monitorBit("O2 Sensor", MONITOR_SPARK),
+                          report.cycleComplete);
+}
+
+void test_pid41_reserved_byte_a_rejected() {
+  const uint8_t pid41[] = {0x41, 0x41, 0x80, 0x07, 0x00, 0x00};
+  ReadinessReport report;
+  clearReadiness(&report);
+  TEST_ASSERT_FALSE(decodeReadiness(pid41, sizeof(pid41), &report));
+  TEST_ASSERT_FALSE(report.hasCycleStatus);
+}
+
+void test_pid41_ignition_mismatch_rejected() {
+  const uint8_t pid01[] = {0x41, 0x01, 0x00, 0x07, 0x65, 0x00};  // Spark
+  const uint8_t pid41[] = {0x41, 0x41, 0x00, 0x0B, 0x03, 0x00};  // Compression layout
+  ReadinessReport report;
+  clearReadiness(&report);
+  TEST_ASSERT_TRUE(decodeReadiness(pid01, sizeof(pid01), &report));
+  TEST_ASSERT_FALSE(decodeReadiness(pid41, sizeof(pid41), &report));
+  TEST_ASSERT_FALSE(report.hasCycleStatus);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_pid01_table);
+  RUN_TEST(test_spark_bits_ignored_on_compression);
+  RUN_TEST(test_short_payload_rejected);
+  RUN_TEST(test_pid41_fills_cycle_fields_only);
+  RUN_TEST(test_pid41_reserved_byte_a_rejected);
+  RUN_TEST(test_pid41_ignition_mismatch_rejected);
+  return UNITY_END();
+}
@@ -0,0 +1,379 @@
+/*
+ * Trace replay regression runner and engine tests - run on the host with:
+ * pio test -e native
+ *
+ * Every trace in data/replay/ (the corpus uploadfs puts on the kiosk) is played
+ * through a minimal OBD scan - bit-rate probe, Mode 03/07/0A with ISO-TP flow
+ * control - and the decoded codes and virtual scan time are diffed against the
+ * results block the recording firmware wrote, like runReplaySuite() on the device
+ */
+#include <unity.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "replay.h"
+#include "isotp.h"
+
+static ReplayFrame frames[4096];
+static CanTraceBlock loadBlock;
+static ReplayEngine engine;
+
+const uint64_t COLLECT_WINDOW_US = 100000;  // Per-receive wait, like the live DTC window
+const uint32_t TIMING_REGRESSION_PERCENT = 10;
+
+struct FileSource {
+  FILE* file;
+  size_t read(uint8_t* buffer, size_t size) { return fread(buffer, 1, size, file); }
+};
+
+struct MemorySource {
+  const uint8_t* data;
+  size_t size;
+  size_t offset;
+  size_t read(uint8_t* buffer, size_t count) {
+    if (count > size - offset) count = size - offset;
+    memcpy(buffer, data + offset, count);
+    offset += count;
+    return count;
+  }
+};
+
+// Builds a one-block trace file in memory with the firmware's encoder
+struct TraceBuilder {
+  std::vector<uint8_t> bytes;
+  CanTraceBlock block;
+  CanTraceChain chain;
+  CanTraceFileHeader header;
+  CanTraceResults results;
+  
+  TraceBuilder() {
+    memset(&header, 0, sizeof(header));
+    memset(&results, 0, sizeof(results));
+    memcpy(header.magic, CAN_TRACE_MAGIC, 4);
+    header.version = CAN_TRACE_FORMAT_VERSION;
+    canTraceStartBlock(&block, &chain, 1000);
+  }
+  void frame(uint32_t timeUs, uint32_t identifier, bool transmitted, const uint8_t* data) {
+    canTraceEncodeFrame(&block, &chain, 1000 + timeUs, identifier, transmitted, false, false, 8, data);
+  }
+  void marker(uint32_t timeUs, uint8_t code) {
+    canTraceEncodeMarker(&block, &chain, 1000 + timeUs, code);
+  }
+  MemorySource source() {
+    bytes.clear();
+    const uint8_t* parts[] = {(const uint8_t*)&header, (const uint8_t*)&results, (const uint8_t*)&block};
+    size_t sizes[] = {sizeof(header), sizeof(results), offsetof(CanTraceBlock, data) + block.length};
+    for (int i = 0; i < 3; i++) bytes.insert(bytes.end(), parts[i], parts[i] + sizes[i]);
+    return {bytes.data(), bytes.size(), 0};
+  }
+};
+
+static void engineInit() {
+  memset(&engine, 0, sizeof(engine));
+  engine.frames = frames;
+  engine.frameCapacity = sizeof(frames) / sizeof(frames[0]);
+  engine.block = &loadBlock;
+}
+
+static std::string corpusDir() {
+  // This file lives in test/test_replay/ - the corpus is data/replay/ at the project root
+  std::string path = __FILE__;
+  size_t cut = path.rfind("test/test_replay/");
+  return (cut == std::string::npos ? std::string() : path.substr(0, cut)) + "data/replay/";
+}
+
+static bool loadCorpusTrace(const std::string& path, CanTraceResults* expected) {
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == NULL) return false;
+  FileSource source = {file};
+  engineInit();
+  bool loaded = replayLoad(&engine, source, expected);
+  fclose(file);
+  return loaded;
+}
+
+// ---- Minimal OBD scan driven through the engine ----
+
+struct ScanCode {
+  uint16_t rawCode;
+  uint16_t ecuId;
+  uint8_t flags;
+};
+
+struct ScanResult {
+  bool detected;
+  std::vector<uint32_t> ecus;
+  std::vector<ScanCode> codes;
+};
+
+static void sendRequest(uint32_t identifier, const uint8_t* data) {
+  replayMatchRequest(&engine, identifier, false, data, 8);
+}
+
+static bool probe(ScanResult* result) {
+  const uint8_t request[8] = {0x02, 0x01, 0x00};
+  sendRequest(0x7DF, request);
+  for (const ReplayFrame* frame; (frame = replayNextFrame(&engine, COLLECT_WINDOW_US)) != NULL;) {
+    if (frame->identifier < 0x7E8 || frame->identifier > 0x7EF || frame->data[1] != 0x41) continue;
+    result->ecus.push_back(frame->identifier);
+  }
+  return !result->ecus.empty();
+}
+
+static void readCodes(uint8_t mode, uint8_t flags, ScanResult* result) {
+  static IsoTpReceiver receivers[8];
+  for (int i = 0; i < 8; i++) isoTpReset(&receivers[i], 0x7E0 + i, false);
+  
+  const uint8_t request[8] = {0x01, mode};
+  sendRequest(0x7DF, request);
+  for (const ReplayFrame* frame; (frame = replayNextFrame(&engine, COLLECT_WINDOW_US)) != NULL;) {
+    if (frame->identifier < 0x7E8 || frame->identifier > 0x7EF) continue;
+    IsoTpReceiver* rx = &receivers[frame->identifier - 0x7E8];
+    IsoTpResult state = isoTpAccept(rx, frame->data, frame->dlc);
+    if (state == ISOTP_SEND_FLOW) {
+      const uint8_t flowControl[8] = {0x30, 0x00, 0x00};
+      sendRequest(rx->flowControlId, flowControl);
+    }
+    if (state != ISOTP_COMPLETE || rx->buffer[0] != 0x40 + mode) continue;
+    
+    for (int j = 2; j + 1 < rx->receivedLength && (j - 2) / 2 < rx->buffer[1]; j += 2) {
+      uint16_t rawCode = (rx->buffer[j] << 8) | rx->buffer[j + 1];
+      if (rawCode != 0) result->codes.push_back({rawCode, (uint16_t)frame->identifier, flags});
+    }
+  }
+}
+
+static ScanResult runScan() {
+  // Same bit-rate order as the live autobaud: 500k, 250k, 1M, 125k
+  ScanResult result = {};
+  replayReset(&engine);
+  for (uint8_t baudIndex : {1, 2, 0, 3}) {
+    replaySelectBaud(&engine, baudIndex);
+    if (probe(&result)) break;
+  }
+  result.detected = !result.ecus.empty();
+  if (!result.detected) return result;
+  
+  readCodes(0x03, 0x00, &result);
+  readCodes(0x07, 0x01, &result);
+  readCodes(0x0A, 0x02, &result);
+  return result;
+}
+
+static bool sameCodes(const CanTraceResults& expected, const ScanResult& result, std::string* diff) {
+  bool match = (int)result.codes.size() == expected.dtcCount;
+  for (int i = 0; i < expected.dtcCount; i++) {
+    const CanTraceResultCode& want = expected.codes[i];
+    bool found = false;
+    for (const ScanCode& code : result.codes) {
+      found |= code.rawCode == want.rawCode && code.ecuId == want.ecuId && code.flags == want.flags;
+    }
+    if (!found) {
+      char line[64];
+      snprintf(line, sizeof(line), " -%04X@%03X/%u", want.rawCode, want.ecuId, want.flags);
+      *diff += line;
+      match = false;
+    }
+  }
+  return match;
+}
+
+// ---- Tests ----
+
+void test_corpus_replays_to_recorded_results() {
+  std::string dirPath = corpusDir();
+  DIR* dir = opendir(dirPath.c_str());
+  TEST_ASSERT_NOT_NULL_MESSAGE(dir, "data/replay/ not found");
+  
+  int traces = 0;
+  for (struct dirent* entry; (entry = readdir(dir)) != NULL;) {
+    std::string name = entry->d_name;
+    if (name.size() < 4 || name.compare(name.size() - 4, 4, ".bin") != 0) continue;
+    
+    CanTraceResults expected;
+    TEST_ASSERT_TRUE_MESSAGE(loadCorpusTrace(dirPath + name, &expected), name.c_str());
+    TEST_ASSERT_FALSE_MESSAGE(engine.truncated, name.c_str());
+    
+    ScanResult result = runScan();
+    uint32_t scanMs = (uint32_t)(engine.virtualUs / 1000);
+    std::string diff;
+    bool codesMatch = sameCodes(expected, result, &diff);
+    
+    char report[160];
+    snprintf(report, sizeof(report), "%s: %d ECUs, %d DTCs, scan %ums (recorded %ums), %u/%u requests matched%s",
+             name.c_str(), (int)result.ecus.size(), (int)result.codes.size(), scanMs, expected.scanMs,
+             engine.matchedRequests, engine.matchedRequests + engine.unmatchedRequests, diff.c_str());
+    TEST_MESSAGE(report);
+    
+    TEST_ASSERT_EQUAL_MESSAGE((bool)expected.detected, result.detected, name.c_str());
+    TEST_ASSERT_EQUAL_MESSAGE(expected.ecuCount, result.ecus.size(), name.c_str());
+    TEST_ASSERT_TRUE_MESSAGE(codesMatch, report);
+    TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(expected.scanMs * (100 + TIMING_REGRESSION_PERCENT) / 100, scanMs, report);
+    traces++;
+  }
+  closedir(dir);
+  TEST_ASSERT_GREATER_THAN(0, traces);
+}
+
+void test_responses_keep_recorded_offsets() {
+  CanTraceResults expected;
+  TEST_ASSERT_TRUE(loadCorpusTrace(corpusDir() + "civic_500k_stored_pending.bin", &expected));
+  replayReset(&engine);
+  replaySelectBaud(&engine, 1);
+  engine.virtualUs = 5000000;  // The scan reaches this request later than the recording did
+  
+  const uint8_t request[8] = {0x02, 0x01, 0x00};
+  TEST_ASSERT_TRUE(replayMatchRequest(&engine, 0x7DF, false, request, 8));
+  const ReplayFrame* first = replayNextFrame(&engine, COLLECT_WINDOW_US);
+  TEST_ASSERT_NOT_NULL(first);
+  TEST_ASSERT_EQUAL_HEX32(0x7E8, first->identifier);
+  TEST_ASSERT_EQUAL(5001850, engine.virtualUs);
+  const ReplayFrame* second = replayNextFrame(&engine, COLLECT_WINDOW_US);
+  TEST_ASSERT_NOT_NULL(second);
+  TEST_ASSERT_EQUAL_HEX32(0x7E9, second->identifier);
+  TEST_ASSERT_EQUAL(5002490, engine.virtualUs);
+  
+  // Nothing else until the next request - the wait passes instantly
+  TEST_ASSERT_NULL(replayNextFrame(&engine, COLLECT_WINDOW_US));
+  TEST_ASSERT_EQUAL(5102490, engine.virtualUs);
+}
+
+void test_unmatched_request_stays_silent() {
+  CanTraceResults expected;
+  TEST_ASSERT_TRUE(loadCorpusTrace(corpusDir() + "civic_500k_stored_pending.bin", &expected));
+  replayReset(&engine);
+  replaySelectBaud(&engine, 1);
+  
+  const uint8_t vinRequest[8] = {0x02, 0x09, 0x02};  // Never sent in this recording
+  TEST_ASSERT_FALSE(replayMatchRequest(&engine, 0x7DF, false, vinRequest, 8));
+  TEST_ASSERT_EQUAL(1, engine.unmatchedRequests);
+  TEST_ASSERT_NULL(replayNextFrame(&engine, COLLECT_WINDOW_US));
+  TEST_ASSERT_EQUAL(COLLECT_WINDOW_US, engine.virtualUs);
+  
+  // Physical address the recording never used
+  const uint8_t request[8] = {0x02, 0x01, 0x00};
+  TEST_ASSERT_FALSE(replayMatchRequest(&engine, 0x7E0, false, request, 8));
+}
+
+void test_repeated_requests_pair_in_recording_order() {
+  TraceBuilder trace;
+  const uint8_t request[8] = {0x02, 0x01, 0x0C};
+  const uint8_t firstReply[8] = {0x04, 0x41, 0x0C, 0x0B, 0xB8};
+  const uint8_t secondReply[8] = {0x04, 0x41, 0x0C, 0x0C, 0x80};
+  trace.marker(0, CAN_TRACE_BAUD_MARKER | 1);
+  trace.frame(100, 0x7DF, true, request);
+  trace.frame(2100, 0x7E8, false, firstReply);
+  trace.frame(50000, 0x7DF, true, request);
+  trace.frame(51000, 0x7E8, false, secondReply);
+  
+  MemorySource source = trace.source();
+  CanTraceResults expected;
+  engineInit();
+  TEST_ASSERT_TRUE(replayLoad(&engine, source, &expected));
+  replayReset(&engine);
+  replaySelectBaud(&engine, 1);
+  
+  TEST_ASSERT_TRUE(replayMatchRequest(&engine, 0x7DF, false, request, 8));
+  TEST_ASSERT_EQUAL_HEX8(0xB8, replayNextFrame(&engine, COLLECT_WINDOW_US)->data[4]);
+  TEST_ASSERT_TRUE(replayMatchRequest(&engine, 0x7DF, false, request, 8));
+  TEST_ASSERT_EQUAL_HEX8(0x80, replayNextFrame(&engine, COLLECT_WINDOW_US)->data[4]);
+  
+  // Both recorded requests are used up
+  TEST_ASSERT_FALSE(replayMatchRequest(&engine, 0x7DF, false, request, 8));
+  TEST_ASSERT_EQUAL(2, engine.matchedRequests);
+}
+
+void test_same_service_matches_when_no_identical_request() {
+  TraceBuilder trace;
+  const uint8_t recorded[8] = {0x02, 0x01, 0x00};
+  const uint8_t reply[8] = {0x06, 0x41, 0x00, 0xBE, 0x3E, 0xB8, 0x13};
+  trace.marker(0, CAN_TRACE_BAUD_MARKER | 1);
+  trace.frame(100, 0x7DF, true, recorded);
+  trace.frame(1900, 0x7E8, false, reply);
+  
+  MemorySource source = trace.source();
+  CanTraceResults expected;
+  engineInit();
+  TEST_ASSERT_TRUE(replayLoad(&engine, source, &expected));
+  replayReset(&engine);
+  replaySelectBaud(&engine, 1);
+  
+  // PID 20 instead of PID 00 - same service, so the build under test still gets an answer
+  const uint8_t changed[8] = {0x02, 0x01, 0x20};
+  TEST_ASSERT_TRUE(replayMatchRequest(&engine, 0x7DF, false, changed, 8));
+  TEST_ASSERT_NOT_NULL(replayNextFrame(&engine, COLLECT_WINDOW_US));
+  
+  // A different service does not
+  const uint8_t otherService[8] = {0x01, 0x03};
+  TEST_ASSERT_FALSE(replayMatchRequest(&engine, 0x7DF, false, otherService, 8));
+}
+
+void test_bit_rate_switch_plays_passive_traffic() {
+  CanTraceResults expected;
+  TEST_ASSERT_TRUE(loadCorpusTrace(corpusDir() + "fleet_250k_after_500k_timeout.bin", &expected));
+  replayReset(&engine);
+  
+  // At 500k the ECU never answered
+  replaySelectBaud(&engine, 1);
+  const uint8_t request[8] = {0x02, 0x01, 0x00};
+  TEST_ASSERT_TRUE(replayMatchRequest(&engine, 0x7DF, false, request, 8));
+  TEST_ASSERT_NULL(replayNextFrame(&engine, COLLECT_WINDOW_US));
+  
+  // At 250k the body frames the recording heard right after the switch come first
+  replaySelectBaud(&engine, 2);
+  const ReplayFrame* frame = replayNextFrame(&engine, COLLECT_WINDOW_US);
+  TEST_ASSERT_NOT_NULL(frame);
+  TEST_ASSERT_EQUAL_HEX32(0x1A0, frame->identifier);
+  TEST_ASSERT_EQUAL_HEX32(0x1A0, replayNextFrame(&engine, COLLECT_WINDOW_US)->identifier);
+  TEST_ASSERT_NULL(replayNextFrame(&engine, COLLECT_WINDOW_US));
+  
+  // Requests only pair with frames recorded at the current rate
+  replaySelectBaud(&engine, 3);
+  TEST_ASSERT_FALSE(replayMatchRequest(&engine, 0x7DF, false, request, 8));
+  replaySelectBaud(&engine, 2);
+  TEST_ASSERT_TRUE(replayMatchRequest(&engine, 0x7DF, false, request, 8));
+  TEST_ASSERT_EQUAL_HEX32(0x7E8, replayNextFrame(&engine, COLLECT_WINDOW_US)->identifier);
+}
+
+void test_load_rejects_foreign_files_and_flags_truncation() {
+  TraceBuilder trace;
+  const uint8_t request[8] = {0x02, 0x01, 0x00};
+  trace.frame(100, 0x7DF, true, request);
+  CanTraceResults expected;
+  
+  trace.header.version = CAN_TRACE_FORMAT_VERSION - 1;
+  MemorySource oldVersion = trace.source();
+  engineInit();
+  TEST_ASSERT_FALSE(replayLoad(&engine, oldVersion, &expected));
+  
+  trace.header.version = CAN_TRACE_FORMAT_VERSION;
+  trace.header.magic[0] = 'X';
+  MemorySource foreign = trace.source();
+  TEST_ASSERT_FALSE(replayLoad(&engine, foreign, &expected));
+  
+  trace.header.magic[0] = CAN_TRACE_MAGIC[0];
+  trace.header.anomalies = CAN_TRACE_TRUNCATED;
+  MemorySource truncated = trace.source();
+  TEST_ASSERT_TRUE(replayLoad(&engine, truncated, &expected));
+  TEST_ASSERT_TRUE(engine.truncated);
+  
+  // A block whose length runs past the file stops loading without reading garbage
+  trace.header.anomalies = 0;
+  MemorySource cut = trace.source();
+  cut.size -= 3;
+  TEST_ASSERT_FALSE(replayLoad(&engine, cut, &expected));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_corpus_replays_to_recorded_results);
+  RUN_TEST(test_responses_keep_recorded_offsets);
+  RUN_TEST(test_unmatched_request_stays_silent);
+  RUN_TEST(test_repeated_requests_pair_in_recording_order);
+  RUN_TEST(test_same_service_matches_when_no_identical_request);
+  RUN_TEST(test_bit_rate_switch_plays_passive_traffic);
+  RUN_TEST(test_load_rejects_foreign_files_and_flags_truncation);
+  return UNITY_END();
+}
@@ -0,0 +1,84 @@
+/*
+ * ReadDTCInformation 0x19/0x02 decoding tests - run on the host with: pio test -e native
+ */
+#include <unity.h>
+#include "uds.h"
+
+const uint8_t STATUS_MASK = 0x8D;  // Same mask the firmware sends
+
+void test_records_filtered_by_status_mask() {
+  // C0035 confirmed, B1015 failedThisCycle only (outside the mask), U0123 pending
+  const uint8_t payload[] = {0x59, 0x02, 0xFF,
+                             0x40, 0x35, 0x00, 0x09,
+                             0x90, 0x15, 0x01, 0x02,
+                             0xC1, 0x23, 0x00, 0x04};
+  UdsDtcRecord records[8];
+  int count = decodeUdsDtcReport(payload, sizeof(payload), STATUS_MASK, records, 8);
+  TEST_ASSERT_EQUAL(2, count);
+  TEST_ASSERT_EQUAL_HEX8(0x40, records[0].high);
+  TEST_ASSERT_EQUAL_HEX8(0x35, records[0].mid);
+  TEST_ASSERT_EQUAL_HEX8(0x09, records[0].status);
+  TEST_ASSERT_EQUAL_HEX8(0xC1, records[1].high);
+  TEST_ASSERT_EQUAL_HEX8(0x00, records[1].failureType);
+  TEST_ASSERT_TRUE(udsStatusIsPending(records[1].status));
+  TEST_ASSERT_FALSE(udsStatusIsPending(records[0].status));
+}
+
+void test_no_dtcs() {
+  const uint8_t payload[] = {0x59, 0x02, 0xFF};
+  UdsDtcRecord records[4];
+  TEST_ASSERT_EQUAL(0, decodeUdsDtcReport(payload, sizeof(payload), STATUS_MASK, records, 4));
+}
+
+void test_trailing_partial_record_dropped() {
+  const uint8_t payload[] = {0x59, 0x02, 0xFF, 0x40, 0x35, 0x00, 0x08, 0x41, 0x21};
+  UdsDtcRecord records[4];
+  TEST_ASSERT_EQUAL(1, decodeUdsDtcReport(payload, sizeof(payload), STATUS_MASK, records, 4));
+}
+
+void test_output_capacity_respected() {
+  const uint8_t payload[] = {0x59, 0x02, 0xFF,
+                             0x40, 0x35, 0x00, 0x08,
+                             0x40, 0x36, 0x00, 0x08,
+                             0x40, 0x37, 0x00, 0x08};
+  UdsDtcRecord records[3];
+  TEST_ASSERT_EQUAL(2, decodeUdsDtcReport(payload, sizeof(payload), STATUS_MASK, records, 2));
+  TEST_ASSERT_EQUAL_HEX8(0x36, records[1].mid);
+}
+
+void test_negative_response() {
+  const uint8_t payload[] = {0x7F, 0x19, 0x31};
+  UdsDtcRecord records[4];
+  TEST_ASSERT_EQUAL(UDS_REPORT_REJECTED, decodeUdsDtcReport(payload, sizeof(payload), STATUS_MASK, records, 4));
+  TEST_ASSERT_EQUAL_HEX8(0x31, udsNegativeCode(payload, sizeof(payload)));
+}
+
+void test_malformed_replies() {
+  const uint8_t wrongSubFunction[] = {0x59, 0x0A, 0xFF, 0x40, 0x35, 0x00, 0x08};
+  const uint8_t truncated[] = {0x59, 0x02};
+  const uint8_t otherService[] = {0x50, 0x03, 0x00, 0x32, 0x01, 0xF4};
+  UdsDtcRecord records[4];
+  TEST_ASSERT_EQUAL(UDS_REPORT_MALFORMED, decodeUdsDtcReport(wrongSubFunction, sizeof(wrongSubFunction), STATUS_MASK, records, 4));
+  TEST_ASSERT_EQUAL(UDS_REPORT_MALFORMED, decodeUdsDtcReport(truncated, sizeof(truncated), STATUS_MASK, records, 4));
+  TEST_ASSERT_EQUAL(UDS_REPORT_MALFORMED, decodeUdsDtcReport(otherService, sizeof(otherService), STATUS_MASK, records, 4));
+}
+
+void test_status_text() {
+  char text[96];
+  formatDTCStatus(0x89, text, sizeof(text));
+  TEST_ASSERT_EQUAL_STRING("testFailed,confirmed,MIL", text);
+  formatDTCStatus(0x00, text, sizeof(text));
+  TEST_ASSERT_EQUAL_STRING("", text);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_records_filtered_by_status_mask);
+  RUN_TEST(test_no_dtcs);
+  RUN_TEST(test_trailing_partial_record_dropped);
+  RUN_TEST(test_output_capacity_respected);
+  RUN_TEST(test_negative_response);
+  RUN_TEST(test_malformed_replies);
+  RUN_TEST(test_status_text);
+  return UNITY_END();
+}